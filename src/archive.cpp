@@ -0,0 +1,363 @@
+#include "archive.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+// number of bits of one length unit of each section kind
+static const unsigned int section_unit_bits[ARCHIVE_SECTIONS] = {
+  8,  // SECTION_TOPOLOGY
+  64, // SECTION_NODE_PERMUTATION
+  64, // SECTION_BRANCH_LENGTHS
+  64, // SECTION_EDGES_TO_CONTRACT
+  64, // SECTION_SUBTREE_DIRECTORY
+  8,  // SECTION_SUBTREES
+  1,  // SECTION_SUBTREE_PERMUTATIONS
+  64, // SECTION_CONSENSUS_BRANCHES
+  64, // SECTION_NON_CONSENSUS_BRANCHES
+  64, // SECTION_TOPOLOGY_ID
+  64, // SECTION_SPLITS
+  64, // SECTION_SPLIT_COUNTS
+  64, // SECTION_SPLIT_DICTIONARY
+  1,  // SECTION_SPLIT_BITMAP
+  64, // SECTION_SPLIT_IDS
+  64, // SECTION_DAG_NODES
+  64, // SECTION_DAG_REFERENCE
+  64, // SECTION_SPR_MOVES
+  64  // SECTION_SUBTREE_MOVES
+};
+
+size_t sectionWords(unsigned int kind, uint64_t length) {
+  assert(kind < ARCHIVE_SECTIONS);
+  return (length * section_unit_bits[kind] + 63) / 64;
+}
+
+size_t recordWords(const EncodedRecord &record) {
+  size_t words = 1;
+  for (unsigned int s = 0; s < ARCHIVE_SECTIONS; s++) {
+    if (record.sections[s].length > 0) {
+      assert(record.sections[s].words.size() == sectionWords(s, record.sections[s].length));
+      words += 1 + record.sections[s].words.size();
+    }
+  }
+  return words;
+}
+
+size_t setSection(EncodedRecord &record, unsigned int kind, EncodedSection section) {
+  assert(kind < ARCHIVE_SECTIONS);
+  record.sections[kind] = std::move(section);
+  return record.sections[kind].words.size() * sizeof(uint64_t);
+}
+
+void resetRecord(EncodedRecord &record, unsigned int kind) {
+  record.kind = kind;
+  for (unsigned int s = 0; s < ARCHIVE_SECTIONS; s++) {
+    record.sections[s].words.clear();
+    record.sections[s].length = 0;
+  }
+}
+
+RecordView viewRecord(const EncodedRecord &record) {
+  RecordView view;
+  view.kind = record.kind;
+  for (unsigned int s = 0; s < ARCHIVE_SECTIONS; s++) {
+    view.sections[s].words = record.sections[s].words.data();
+    view.sections[s].n_words = record.sections[s].words.size();
+    view.sections[s].length = record.sections[s].length;
+  }
+  return view;
+}
+
+EncodedRecord copyRecord(const RecordView &view) {
+  EncodedRecord record;
+  record.kind = view.kind;
+  for (unsigned int s = 0; s < ARCHIVE_SECTIONS; s++) {
+    record.sections[s].words.assign(view.sections[s].words, view.sections[s].words + view.sections[s].n_words);
+    record.sections[s].length = view.sections[s].length;
+  }
+  return record;
+}
+
+int ArchiveWriter::open(const std::string &filename) {
+  if (file.open(filename, 0) < 0) {
+    return -1;
+  }
+  uint64_t header[ARCHIVE_HEADER_WORDS] = {ARCHIVE_MAGIC, ARCHIVE_VERSION};
+  file.write(header, sizeof(header));
+  offset = ARCHIVE_HEADER_WORDS;
+  index.clear();
+  committed_records = 0;
+  last_trailer = 0;
+  return 0;
+}
+
+/*
+ * Whether a file starts like an archive of the current version: it is empty,
+ * holds part of the header or the header and whatever follows.
+ */
+bool startsLikeArchive(const std::string &filename) {
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  uint64_t header[ARCHIVE_HEADER_WORDS] = {ARCHIVE_MAGIC, ARCHIVE_VERSION};
+  char start[sizeof(header)];
+  ssize_t bytes = read(fd, start, sizeof(start));
+  ::close(fd);
+  return bytes >= 0 && memcmp(start, header, bytes) == 0;
+}
+
+int ArchiveWriter::openAppend(const std::string &filename) {
+  uint64_t committed_words;
+  {
+    ArchiveReader reader;
+    if (reader.open(filename) < 0) {
+      if (!startsLikeArchive(filename)) {
+        // ERROR: no archive, or one of an older version
+        return -1;
+      }
+      // cut off before its first commit: nothing to keep
+      return open(filename);
+    }
+    if (reader.words[1] != ARCHIVE_VERSION) {
+      // ERROR: an archive with the trailers of an older version
+      return -1;
+    }
+    committed_words = reader.committed_words;
+    committed_records = reader.size();
+  }
+  // drop a commit that was cut off
+  if (truncate(filename.c_str(), committed_words * sizeof(uint64_t)) != 0) {
+    return -1;
+  }
+  if (file.open(filename, committed_words * sizeof(uint64_t)) < 0) {
+    return -1;
+  }
+  offset = committed_words;
+  index.clear();
+  last_trailer = committed_words - ARCHIVE_TRAILER_WORDS;
+  return 0;
+}
+
+int64_t ArchiveWriter::append(const EncodedRecord &record) {
+  uint64_t record_offset = offset;
+  if (appendAuxiliary(record) < 0) {
+    return -1;
+  }
+  index.push_back(record_offset);
+  return (offset - record_offset) * sizeof(uint64_t);
+}
+
+int64_t ArchiveWriter::appendAuxiliary(const EncodedRecord &record) {
+  assert(file.isOpen());
+  if (file.failed) {
+    return -1;
+  }
+
+  // record header: kind, present sections, section lengths
+  uint64_t header[1 + ARCHIVE_SECTIONS] = {record.kind};
+  size_t header_words = 1;
+  for (unsigned int s = 0; s < ARCHIVE_SECTIONS; s++) {
+    if (record.sections[s].length > 0) {
+      header[0] |= 1ULL << (8 + s);
+      header[header_words++] = record.sections[s].length;
+    }
+  }
+  file.write(header, header_words * sizeof(uint64_t));
+  for (unsigned int s = 0; s < ARCHIVE_SECTIONS; s++) {
+    const EncodedSection &section = record.sections[s];
+    if (section.length > 0) {
+      assert(section.words.size() == sectionWords(s, section.length));
+      file.write(section.words.data(), section.words.size() * sizeof(uint64_t));
+    }
+  }
+
+  uint64_t record_offset = offset;
+  offset += recordWords(record);
+  return record_offset;
+}
+
+int ArchiveWriter::appendArchive(const ArchiveReader &archive) {
+  assert(file.isOpen());
+  if (file.failed) {
+    return -1;
+  }
+  // the records and auxiliary records lie between the header and the index
+  size_t body = archive.records_end - ARCHIVE_HEADER_WORDS;
+  file.write(archive.words + ARCHIVE_HEADER_WORDS, body * sizeof(uint64_t));
+  for (size_t i = 0; i < archive.size(); i++) {
+    index.push_back(archive.index[i] - ARCHIVE_HEADER_WORDS + offset);
+  }
+  offset += body;
+  return 0;
+}
+
+int ArchiveWriter::commit(bool sync) {
+  assert(file.isOpen());
+  sync = sync || sync_policy == ARCHIVE_SYNC_COMMIT;
+  // the index is written before the trailer that makes it valid; on the way
+  // to the disk the trailer must not overtake the records and the index, or
+  // a power loss could leave it behind pointing at garbage
+  file.write(index.data(), index.size() * sizeof(uint64_t));
+  if (sync && file.flush(true) < 0) {
+    return -1;
+  }
+  uint64_t trailer[ARCHIVE_TRAILER_WORDS] = {offset, size(), last_trailer, ARCHIVE_MAGIC};
+  file.write(trailer, sizeof(trailer));
+  if (file.flush(sync) < 0) {
+    return -1;
+  }
+  last_trailer = offset + index.size();
+  offset = last_trailer + ARCHIVE_TRAILER_WORDS;
+  committed_records = size();
+  index.clear();
+  return 0;
+}
+
+int ArchiveWriter::close() {
+  bool sync = sync_policy == ARCHIVE_SYNC_CLOSE;
+  // nothing to commit if the last commit holds all records
+  if ((!index.empty() || last_trailer == 0) && commit(sync) < 0) {
+    file.close(false);
+    return -1;
+  }
+  return file.close(sync);
+}
+
+ArchiveReader::~ArchiveReader() {
+  close();
+}
+
+int ArchiveReader::open(const std::string &filename) {
+  close();
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+  struct stat st;
+  // a commit that was cut off may end within a word; whole words are mapped
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < (ARCHIVE_HEADER_WORDS + 3) * sizeof(uint64_t)) {
+    ::close(fd);
+    return -1;
+  }
+  void * mapping = mmap(NULL, st.st_size - st.st_size % sizeof(uint64_t), PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping stays valid after closing the file descriptor
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return -1;
+  }
+  words = (const uint64_t *) mapping;
+  n_words = st.st_size / sizeof(uint64_t);
+
+  if (words[0] != ARCHIVE_MAGIC || words[1] != ARCHIVE_VERSION) {
+    close();
+    return -1;
+  }
+
+  // the last complete trailer: normally at the end, otherwise the last one
+  // before the end of a commit that was cut off
+  uint64_t last = 0;
+  for (uint64_t t = n_words - ARCHIVE_TRAILER_WORDS; n_words >= ARCHIVE_HEADER_WORDS + ARCHIVE_TRAILER_WORDS
+        && t >= ARCHIVE_HEADER_WORDS && last == 0; t--) {
+    if (words[t + 3] == ARCHIVE_MAGIC && validTrailer(t)) {
+      last = t;
+    }
+  }
+  if (last == 0) {
+    close();
+    return -1;
+  }
+  const uint64_t * trailer = words + last;
+  record_count = trailer[1];
+  records_end = trailer[0];
+  committed_words = last + ARCHIVE_TRAILER_WORDS;
+  if (trailer[2] == 0) {
+    index = words + trailer[0];
+    return 0;
+  }
+
+  // join the indexes of all commits
+  joined_index.resize(record_count);
+  for (uint64_t t = last; t != 0; t = words[t + 2]) {
+    if (!validTrailer(t)) {
+      close();
+      return -1;
+    }
+    uint64_t previous_count = words[t + 2] == 0 ? 0 : words[words[t + 2] + 1];
+    std::copy(words + words[t], words + t, joined_index.begin() + previous_count);
+  }
+  index = joined_index.data();
+  return 0;
+}
+
+bool ArchiveReader::validTrailer(uint64_t t) const {
+  // the index of the commit lies right before its trailer, the previous
+  // trailer before the index
+  const uint64_t * trailer = words + t;
+  if (trailer[0] < ARCHIVE_HEADER_WORDS || trailer[0] > t) {
+    return false;
+  }
+  uint64_t previous_count = 0;
+  if (trailer[2] != 0) {
+    if (trailer[2] < ARCHIVE_HEADER_WORDS || trailer[2] + ARCHIVE_TRAILER_WORDS > trailer[0]
+          || words[trailer[2] + 3] != ARCHIVE_MAGIC) {
+      return false;
+    }
+    previous_count = words[trailer[2] + 1];
+  }
+  return previous_count <= trailer[1] && trailer[0] + (trailer[1] - previous_count) == t;
+}
+
+void ArchiveReader::close() {
+  if (words != NULL) {
+    munmap((void *) words, n_words * sizeof(uint64_t));
+  }
+  words = NULL;
+  n_words = 0;
+  index = NULL;
+  record_count = 0;
+  records_end = 0;
+  committed_words = 0;
+  joined_index.clear();
+}
+
+RecordView ArchiveReader::recordAt(uint64_t offset) const {
+  assert(offset >= ARCHIVE_HEADER_WORDS && offset < records_end);
+  const uint64_t * record = words + offset;
+
+  RecordView view;
+  view.kind = record[0] & 0xFF;
+  uint64_t present = record[0] >> 8;
+  const uint64_t * lengths = record + 1;
+  const uint64_t * data = lengths + __builtin_popcountll(present);
+  for (unsigned int s = 0; s < ARCHIVE_SECTIONS; s++) {
+    if (present & (1ULL << s)) {
+      view.sections[s].length = *lengths;
+      view.sections[s].n_words = sectionWords(s, *lengths);
+      view.sections[s].words = data;
+      data += view.sections[s].n_words;
+      lengths++;
+    }
+  }
+  assert(data <= words + n_words);
+  return view;
+}
+
+void ArchiveReader::prefetch(size_t first, size_t last) const {
+  if (first >= last || first >= record_count) {
+    return;
+  }
+  // the records end where the index starts
+  uint64_t begin = index[first] * sizeof(uint64_t);
+  uint64_t end = (last < record_count ? index[last] : records_end) * sizeof(uint64_t);
+
+  // madvise needs a page aligned start
+  uint64_t page = sysconf(_SC_PAGESIZE);
+  begin -= begin % page;
+  madvise((void *) ((const char *) words + begin), end - begin, MADV_WILLNEED);
+}
@@ -0,0 +1,407 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "async_writer.h"
+
+/**
+ * Archive of compressed trees. Each tree is stored as a record that consists of
+ * the encoded data structures (sections) of its compression.
+ *
+ * The reader maps the archive into memory; the sections of a record are
+ * handed out as views into the mapping, so opening an archive only reads its
+ * index and a record is paged in when it is decoded.
+ *
+ * All offsets and sizes are given in 64 bit words, every section is 8 byte aligned.
+ *
+ * Archive layout:
+ *   header   ARCHIVE_MAGIC, ARCHIVE_VERSION
+ *   records  one after another (plus auxiliary records that are not in the index)
+ *   index    offset of each record
+ *   trailer  offset of the index, number of records, offset of the previous
+ *            trailer (0 if there is none), ARCHIVE_MAGIC
+ *
+ * An archive can be appended to: every commit writes the records appended
+ * since the last one, then an index of just these records and a trailer that
+ * points to the previous trailer. The last complete trailer describes a
+ * consistent archive, so a reader that opens a file that is being appended
+ * to (or that was left by a crash) ignores the incomplete end.
+ *
+ * Record layout:
+ *   word 0   record kind | (bit mask of the present sections << 8)
+ *   then     the length of each present section (see sectionWords)
+ *   then     the words of each present section
+ */
+
+#define ARCHIVE_MAGIC 0x3143524145455254ULL // "TREEARC1"
+// the only version that is read and written; versions 1 to 4 were
+// development formats (without the record kinds added since, and with a
+// single index and a 3 word trailer) and are not read any more
+#define ARCHIVE_VERSION 5
+#define ARCHIVE_HEADER_WORDS 2
+#define ARCHIVE_TRAILER_WORDS 4
+
+enum ArchiveRecordKind {
+    // tree stored on its own (simple compression)
+    RECORD_SIMPLE = 0,
+
+    // tree stored relative to its predecessor (rf distance compression)
+    RECORD_RF     = 1,
+
+    // tree equal to its predecessor (no sections)
+    RECORD_REPEAT = 2,
+
+    // tree with the topology of its predecessor: only the branch length diffs
+    // (SECTION_CONSENSUS_BRANCHES, as in an rf delta without contracted edges)
+    RECORD_BRANCH_LENGTHS = 3,
+
+    // tree with the topology of an earlier simple compression (the topology
+    // dictionary): its record index (SECTION_TOPOLOGY_ID) and its own branch
+    // lengths (SECTION_BRANCH_LENGTHS)
+    RECORD_TOPOLOGY = 4,
+
+    // auxiliary record: the global split dictionary of a split archive
+    // (SECTION_SPLITS, SECTION_SPLIT_COUNTS)
+    RECORD_SPLIT_DICTIONARY = 5,
+
+    // tree given by the ids of its splits in a split dictionary: the offset of
+    // the dictionary (SECTION_SPLIT_DICTIONARY), the ids (SECTION_SPLIT_BITMAP,
+    // SECTION_SPLIT_IDS) and the branch lengths (SECTION_BRANCH_LENGTHS)
+    RECORD_SPLITS = 6,
+
+    // auxiliary record: the subtree DAG of a DAG archive (SECTION_DAG_NODES)
+    RECORD_SUBTREE_DAG = 7,
+
+    // tree given by a subtree of a DAG: the offset of the DAG and the subtree
+    // (SECTION_DAG_REFERENCE) and the branch lengths in depth-first order
+    // (SECTION_BRANCH_LENGTHS)
+    RECORD_DAG_TREE = 8,
+
+    // tree given by SPR moves applied to its predecessor (SECTION_SPR_MOVES)
+    // and its branch lengths as diffs to the branches of the predecessor with
+    // the same split (SECTION_CONSENSUS_BRANCHES)
+    RECORD_SPR = 9,
+
+    ARCHIVE_RECORD_KINDS = 10
+};
+
+enum ArchiveSectionKind {
+    // simple compression
+    SECTION_TOPOLOGY                = 0, // topology codec, length in bytes
+    SECTION_NODE_PERMUTATION        = 1, // integer codec, length in words
+    SECTION_BRANCH_LENGTHS          = 2, // integer codec, length in words
+
+    // rf distance compression
+    SECTION_EDGES_TO_CONTRACT       = 3, // integer codec, length in words
+    SECTION_SUBTREE_DIRECTORY       = 4, // integer codec, length in words
+    SECTION_SUBTREES                = 5, // topology codec, length in bytes
+    SECTION_SUBTREE_PERMUTATIONS    = 6, // permutation codec, length in bits
+    SECTION_CONSENSUS_BRANCHES      = 7, // integer codec, length in words
+    SECTION_NON_CONSENSUS_BRANCHES  = 8, // integer codec, length in words
+
+    // topology reference
+    SECTION_TOPOLOGY_ID             = 9, // integer codec, length in words
+
+    // split dictionary
+    SECTION_SPLITS                  = 10, // bit sets, length in words
+    SECTION_SPLIT_COUNTS            = 11, // integer codec, length in words
+
+    // split record
+    SECTION_SPLIT_DICTIONARY        = 12, // integer codec, length in words
+    SECTION_SPLIT_BITMAP            = 13, // bit set, length in bits
+    SECTION_SPLIT_IDS               = 14, // integer codec, length in words
+
+    // subtree DAG
+    SECTION_DAG_NODES               = 15, // integer codec, length in words
+    SECTION_DAG_REFERENCE           = 16, // integer codec, length in words
+
+    // spr moves
+    SECTION_SPR_MOVES               = 17, // integer codec, length in words
+
+    // rf subtrees stored as SPR moves on the predecessor's resolution of their
+    // node of the consensus tree
+    SECTION_SUBTREE_MOVES           = 18, // integer codec, length in words
+
+    ARCHIVE_SECTIONS                = 19
+};
+
+/**
+ * An encoded data structure.
+ */
+struct EncodedSection {
+  std::vector<uint64_t> words;
+  uint64_t length = 0;
+};
+
+/**
+ * A compressed tree, ready to be appended to an archive.
+ */
+struct EncodedRecord {
+  unsigned int kind = RECORD_SIMPLE;
+  EncodedSection sections[ARCHIVE_SECTIONS];
+};
+
+/**
+ * View of a section inside an archive (or inside an EncodedRecord).
+ */
+struct SectionView {
+  const uint64_t * words = NULL;
+  size_t n_words = 0;
+  uint64_t length = 0;
+};
+
+/**
+ * View of a record.
+ */
+struct RecordView {
+  unsigned int kind = RECORD_SIMPLE;
+  SectionView sections[ARCHIVE_SECTIONS];
+};
+
+/**
+ * Returns the number of words of a section.
+ * @param  kind   section kind
+ * @param  length length of the section in the unit of its kind
+ * @return        number of words
+ */
+size_t sectionWords(unsigned int kind, uint64_t length);
+
+/**
+ * Returns the number of words a record takes in an archive.
+ * @param  record the record
+ * @return        number of words
+ */
+size_t recordWords(const EncodedRecord &record);
+
+/**
+ * Sets a section of a record.
+ * @param  record  the record
+ * @param  kind    section kind
+ * @param  section encoded section
+ * @return         size of the section in bytes
+ */
+size_t setSection(EncodedRecord &record, unsigned int kind, EncodedSection section);
+
+/**
+ * Empties a record for the next tree. The sections keep their memory, such
+ * that a record that is reused does not allocate once it is large enough.
+ * @param record the record
+ * @param kind   record kind
+ */
+void resetRecord(EncodedRecord &record, unsigned int kind);
+
+/**
+ * Returns a view of an encoded record (without copying it).
+ * @param  record the record
+ * @return        view of the record
+ */
+RecordView viewRecord(const EncodedRecord &record);
+
+/**
+ * Copies a record (e.g. from one archive into another).
+ * @param  view view of the record
+ * @return      the record
+ */
+EncodedRecord copyRecord(const RecordView &view);
+
+/**
+ * Returns whether a record can be decoded without its predecessor.
+ * @param  kind record kind
+ * @return      true for simple compressions, topology references, split
+ *              records and DAG trees
+ */
+inline bool isKeyframe(unsigned int kind) {
+  return kind == RECORD_SIMPLE || kind == RECORD_TOPOLOGY || kind == RECORD_SPLITS || kind == RECORD_DAG_TREE;
+}
+
+enum ArchiveSyncPolicy {
+    // leave it to the system when the archive reaches the disk
+    ARCHIVE_SYNC_NONE   = 0,
+
+    // write the archive through to the disk (fsync) when it is closed
+    ARCHIVE_SYNC_CLOSE  = 1,
+
+    // write the archive through to the disk at every commit
+    ARCHIVE_SYNC_COMMIT = 2
+};
+
+struct ArchiveReader;
+
+/**
+ * Appends records to a new archive file or to an existing one. The records
+ * are serialised into the buffers of an AsyncWriter, so appending a record
+ * does not wait for the file unless the writer falls behind; a commit waits
+ * until the archive is written.
+ */
+struct ArchiveWriter {
+  AsyncWriter file;
+  uint64_t offset = 0;
+
+  // when the archive is written through to the disk (ArchiveSyncPolicy)
+  unsigned int sync_policy = ARCHIVE_SYNC_NONE;
+
+  // offsets of the records appended since the last commit, the number of
+  // committed records and the offset of the last trailer
+  std::vector<uint64_t> index;
+  uint64_t committed_records = 0;
+  uint64_t last_trailer = 0;
+
+  /**
+   * Creates the archive file.
+   * @param  filename archive file
+   * @return          value < 0 in case of an error
+   */
+  int open(const std::string &filename);
+
+  /**
+   * Opens an archive to append records to it. Whatever follows the last
+   * complete trailer (the end of a commit that was cut off) is dropped; an
+   * archive without a complete commit (e.g. empty, or just its header) is
+   * started anew.
+   * @param  filename archive file (of the current version)
+   * @return          value < 0 in case of an error
+   */
+  int openAppend(const std::string &filename);
+
+  /**
+   * Number of records in the archive, including the ones not committed yet.
+   */
+  size_t size() const {
+    return committed_records + index.size();
+  }
+
+  /**
+   * Appends a record.
+   * @param  record the record
+   * @return        size of the record in bytes, value < 0 in case of an error
+   */
+  int64_t append(const EncodedRecord &record);
+
+  /**
+   * Appends an auxiliary record (e.g. a dictionary the trees refer to); it is
+   * not part of the index.
+   * @param  record the record
+   * @return        offset of the record in words, value < 0 in case of an error
+   */
+  int64_t appendAuxiliary(const EncodedRecord &record);
+
+  /**
+   * Appends all records of an archive (and its auxiliary records) as they
+   * are: the words are copied at once, only the index is rewritten. References
+   * of records to other records (topology references, offsets of auxiliary
+   * records) are not adjusted.
+   * @param  archive the archive
+   * @return         value < 0 in case of an error
+   */
+  int appendArchive(const ArchiveReader &archive);
+
+  /**
+   * Writes the index of the records appended since the last commit and a
+   * trailer, and flushes the archive: up to here it can be read (and
+   * reopened after a crash). When the commit is written through to the disk,
+   * the records and the index are synced before the trailer is written.
+   * @param  sync write the commit through to the disk even if the sync
+   *              policy does not ask for it
+   * @return      value < 0 in case of an error
+   */
+  int commit(bool sync = false);
+
+  /**
+   * Commits the appended records and closes the archive.
+   * @return value < 0 in case of an error
+   */
+  int close();
+};
+
+/**
+ * Memory-mapped read access to an archive.
+ */
+struct ArchiveReader {
+  const uint64_t * words = NULL;
+  size_t n_words = 0;
+  const uint64_t * index = NULL;
+  size_t record_count = 0;
+
+  // the records (and the indexes of earlier commits) end where the last index
+  // starts, the archive ends after the last complete trailer
+  uint64_t records_end = 0;
+  uint64_t committed_words = 0;
+
+  // index of an archive that was committed more than once, joined from the
+  // indexes of the commits
+  std::vector<uint64_t> joined_index;
+
+  ArchiveReader() = default;
+  ArchiveReader(const ArchiveReader&) = delete;
+  ArchiveReader& operator=(const ArchiveReader&) = delete;
+  ~ArchiveReader();
+
+  /**
+   * Maps the archive file into memory; an archive that is being appended to is
+   * read as of its last complete commit.
+   * @param  filename archive file
+   * @return          value < 0 in case of an error
+   */
+  int open(const std::string &filename);
+
+  void close();
+
+  size_t size() const {
+    return record_count;
+  }
+
+  /**
+   * Returns a view of a record; the view is valid until the archive is closed.
+   * @param  i index of the record
+   * @return   view of the record
+   */
+  RecordView record(size_t i) const {
+    assert(i < record_count);
+    return recordAt(index[i]);
+  }
+
+  /**
+   * Returns a view of the record at the given offset (e.g. of an auxiliary record).
+   * @param  offset offset of the record in words
+   * @return        view of the record
+   */
+  RecordView recordAt(uint64_t offset) const;
+
+  /**
+   * Checks whether a record (or auxiliary record) can start at an offset,
+   * e.g. one read from another record.
+   */
+  bool isRecordOffset(uint64_t offset) const {
+    return offset >= ARCHIVE_HEADER_WORDS && offset < records_end;
+  }
+
+  /**
+   * Returns the kind of a record without viewing its sections.
+   * @param  i index of the record
+   * @return   record kind
+   */
+  unsigned int recordKind(size_t i) const {
+    assert(i < record_count);
+    return words[index[i]] & 0xFF;
+  }
+
+  /**
+   * Asks the kernel to read the records [first, last) ahead; returns at once.
+   * @param first index of the first record
+   * @param last  index after the last record
+   */
+  void prefetch(size_t first, size_t last) const;
+
+  /**
+   * Checks whether the words at the given offset are a trailer that completes
+   * a commit (the trailers of earlier commits are not checked).
+   */
+  bool validTrailer(uint64_t t) const;
+};
+
+#endif
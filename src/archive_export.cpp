@@ -0,0 +1,227 @@
+#include "archive_export.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "tree_range.h"
+
+/*
+ * The newick of the trees of a segment, once they are decoded. The decoder of
+ * the slot is reused for its segments; each starts at a keyframe.
+ */
+struct ExportSlot {
+  size_t segment = SIZE_MAX;
+  bool done = false;
+  TreeRangeState range;
+  std::string text;
+};
+
+/*
+ * Writes all of the data to a file descriptor.
+ */
+bool writeAll(int fd, const char * data, size_t bytes) {
+  while (bytes > 0) {
+    ssize_t n = write(fd, data, bytes);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    bytes -= n;
+  }
+  return true;
+}
+
+/*
+ * Appends the newick of a simple compression or a topology record straight
+ * from its structures, without building the tree; false if the structures do
+ * not form a tree.
+ */
+bool transcodeKeyframe(const ArchiveReader &archive, size_t i, std::string &newick) {
+  RecordView record = archive.record(i);
+  RecordView structures = record;
+  if (record.kind == RECORD_TOPOLOGY) {
+    uint64_t id = uncompressTopologyId(record.sections[SECTION_TOPOLOGY_ID]);
+    if (id >= archive.size() || archive.recordKind(id) != RECORD_SIMPLE) {
+      // ERROR: the reference is not a simple compression of the archive
+      return false;
+    }
+    structures = archive.record(id);
+  }
+  sdsl::bit_vector succinct_structure = uncompressSuccinctStructure(structures.sections[SECTION_TOPOLOGY]);
+  sdsl::int_vector<> node_permutation = uncompressSimplePermutation(structures.sections[SECTION_NODE_PERMUTATION]);
+  std::vector<double> branch_lengths = uncompressBranchLengths(record.sections[SECTION_BRANCH_LENGTHS]);
+
+  size_t size = succinct_structure.size();
+  if (size < 10 || node_permutation.size() != (size + 2) / 4 || node_permutation[0] != 1
+        || branch_lengths.size() != size / 2 - 1) {
+    // ERROR: the structures do not fit together
+    return false;
+  }
+  simple_uncompression_newick(succinct_structure, node_permutation, branch_lengths, newick);
+  return true;
+}
+
+/*
+ * Decodes the selected trees of the records [begin, end) into newick lines;
+ * false if a record could not be decoded.
+ */
+bool exportSegment(size_t begin, size_t end, size_t burnin, size_t thin, ExportSlot &slot) {
+  const ArchiveReader &archive = *slot.range.archive;
+
+  // the first selected tree in the segment
+  size_t first = std::max(begin, burnin);
+  first = burnin + (first - burnin + thin - 1) / thin * thin;
+
+  for (size_t i = first; i < end; i += thin) {
+    slot.text += "   tree gen.";
+    slot.text += std::to_string(i);
+    slot.text += " = [&U] ";
+
+    // a simple compression that no delta is stored on is transcoded straight
+    // to newick
+    unsigned int kind = archive.recordKind(i);
+    bool transcode = (kind == RECORD_SIMPLE || kind == RECORD_TOPOLOGY)
+          && (i + 1 == archive.size() || isKeyframe(archive.recordKind(i + 1)));
+    if (transcode) {
+      if (!transcodeKeyframe(archive, i, slot.text)) {
+        return false;
+      }
+    } else {
+      pll_unode_t * tree = decodeTree(slot.range, i);
+      if (tree == NULL) {
+        return false;
+      }
+      appendNewick(tree, slot.text);
+    }
+    slot.text += '\n';
+  }
+  return true;
+}
+
+int export_archive(const std::string &archive_file, const std::string &output, size_t burnin, size_t thin,
+          size_t threads) {
+  ArchiveReader archive;
+  if (archive.open(archive_file) < 0) {
+    return -1;
+  }
+  size_t count = archive.size();
+  if (count > 0 && !isKeyframe(archive.recordKind(0))) {
+    // ERROR: archive starts with a delta to a tree outside of the archive
+    return -1;
+  }
+  thin = std::max(thin, (size_t) 1);
+
+  // segments [bounds[s], bounds[s + 1]) from the last keyframe before the
+  // burn-in on, each from a keyframe to the first keyframe after
+  // EXPORT_SEGMENT_RECORDS records
+  std::vector<size_t> bounds;
+  if (burnin < count) {
+    size_t begin = burnin;
+    while (!isKeyframe(archive.recordKind(begin))) {
+      begin--;
+    }
+    while (begin < count) {
+      bounds.push_back(begin);
+      begin += EXPORT_SEGMENT_RECORDS;
+      while (begin < count && !isKeyframe(archive.recordKind(begin))) {
+        begin++;
+      }
+    }
+    bounds.push_back(count);
+  }
+  size_t segments = bounds.empty() ? 0 : bounds.size() - 1;
+
+  int fd = output == "-" ? STDOUT_FILENO : open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  std::string header = "#NEXUS\nbegin trees;\n";
+  bool failed = !writeAll(fd, header.data(), header.size());
+
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  threads = std::max(std::min(threads, segments), (size_t) 1);
+  size_t ring = threads * EXPORT_SLOTS_PER_THREAD;
+  std::vector<ExportSlot> slots(ring);
+
+  for (auto &slot: slots) {
+    slot.range.archive = &archive;
+    slot.range.decoder.archive = &archive;
+    slot.range.prefetch_records = thin;
+  }
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  size_t next_segment = 0;
+  size_t written = 0;
+
+  // segment s goes into slot s % ring, once segment s - ring has been written
+  auto worker = [&]() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      changed.wait(lock, [&]() { return failed || next_segment >= segments || next_segment < written + ring; });
+      if (failed || next_segment >= segments) {
+        return;
+      }
+      size_t s = next_segment++;
+      ExportSlot &slot = slots[s % ring];
+      slot.segment = s;
+      slot.done = false;
+      lock.unlock();
+
+      // the segment starts at a keyframe, the decoder does not need the tree
+      // before it
+      slot.range.has_decoded = false;
+      slot.text.clear();
+      bool decoded = exportSegment(bounds[s], bounds[s + 1], burnin, thin, slot);
+
+      lock.lock();
+      slot.done = true;
+      // ERROR: record could not be decoded
+      failed = failed || !decoded;
+      changed.notify_all();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads && segments > 0; t++) {
+    workers.push_back(std::thread(worker));
+  }
+  for (size_t s = 0; s < segments; s++) {
+    ExportSlot &slot = slots[s % ring];
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, [&]() { return failed || (slot.segment == s && slot.done); });
+      if (failed) {
+        break;
+      }
+    }
+    bool ok = writeAll(fd, slot.text.data(), slot.text.size());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    written++;
+    failed = failed || !ok;
+    changed.notify_all();
+  }
+  for (auto &w: workers) {
+    w.join();
+  }
+
+  std::string footer = "end;\n";
+  failed = failed || !writeAll(fd, footer.data(), footer.size());
+  if (fd != STDOUT_FILENO && close(fd) != 0) {
+    failed = true;
+  }
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,45 @@
+#ifndef ARCHIVE_EXPORT_H
+#define ARCHIVE_EXPORT_H
+
+#include <string>
+
+/**
+ * Export of the trees of an archive as a nexus tree file, like the .t files of
+ * MrBayes ("tree gen.<index> = [&U] <newick>" per tree, the taxa are given by
+ * their numbers).
+ *
+ * The archive is cut into segments at keyframes: a segment ends at the first
+ * keyframe after EXPORT_SEGMENT_RECORDS records, so each one can be decoded on
+ * its own (the chain compressors store a keyframe at least every
+ * KEYFRAME_INTERVAL records; an archive without them is one segment per run of
+ * deltas). The segments are decoded and written to newick on a pool of worker
+ * threads, each into the buffer of its slot in a ring of
+ * EXPORT_SLOTS_PER_THREAD slots per worker; the calling thread writes the
+ * buffers to the output in the order of the segments. A worker only takes a
+ * slot once its last segment has been written, so the workers wait when the
+ * output falls behind and the memory use stays bounded.
+ *
+ * Simple compressions (and topology records) that no delta is stored on are
+ * transcoded straight to newick with simple_uncompression_newick, without
+ * building the tree.
+ */
+
+// smallest number of records per segment (the last one may have fewer)
+#define EXPORT_SEGMENT_RECORDS 256
+
+// slots of the ring per worker thread
+#define EXPORT_SLOTS_PER_THREAD 4
+
+/**
+ * Exports the trees burnin, burnin + thin, ... of an archive.
+ * @param  archive_file archive file (has to start with a keyframe)
+ * @param  output       output file, "-" for stdout
+ * @param  burnin       index of the first tree
+ * @param  thin         step between two trees
+ * @param  threads      number of worker threads, 0 for one per core
+ * @return              value < 0 in case of an error
+ */
+int export_archive(const std::string &archive_file, const std::string &output, size_t burnin, size_t thin,
+          size_t threads);
+
+#endif
@@ -0,0 +1,228 @@
+#include "archive_merge.h"
+
+#include <algorithm>
+#include <memory>
+
+#include "datastructure_compression_functions.h"
+#include "flat_tree.h"
+#include "topology_dictionary.h"
+#include "tree_range.h"
+
+// sections that hold the topology of a simple compression
+static const unsigned int topology_sections[] = {SECTION_TOPOLOGY, SECTION_NODE_PERMUTATION};
+
+/*
+ * Hash of the encoded topology of a simple compression. The encoding of a
+ * topology is canonical, so equal topologies have equal words.
+ */
+uint64_t encodedTopologyHash(const RecordView &view) {
+  uint64_t hash = 0;
+  for (auto s: topology_sections) {
+    hash = mixLabel(hash ^ view.sections[s].length);
+    for (size_t i = 0; i < view.sections[s].n_words; i++) {
+      hash = mixLabel(hash ^ view.sections[s].words[i]);
+    }
+  }
+  return hash;
+}
+
+/*
+ * Checks whether two simple compressions store the same topology.
+ */
+bool sameEncodedTopology(const RecordView &view1, const RecordView &view2) {
+  for (auto s: topology_sections) {
+    const SectionView &section1 = view1.sections[s];
+    const SectionView &section2 = view2.sections[s];
+    if (section1.length != section2.length
+          || !std::equal(section1.words, section1.words + section1.n_words, section2.words)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Adds the labels of the leaves of the subtree behind node.
+ */
+void collectTaxa(const pll_unode_t * node, std::vector<std::string> &taxa) {
+  if (node->next == NULL) {
+    taxa.push_back(node->label);
+    return;
+  }
+  for (const pll_unode_t * child = node->next; child != node; child = child->next) {
+    collectTaxa(child->back, taxa);
+  }
+}
+
+/*
+ * The taxa of an archive (sorted), from its first tree; none if it is empty.
+ * Returns false if the tree could not be decoded.
+ */
+bool archiveTaxa(const ArchiveReader &archive, std::vector<std::string> &taxa) {
+  taxa.clear();
+  if (archive.size() == 0) {
+    return true;
+  }
+  TreeRangeState state;
+  state.archive = &archive;
+  state.decoder.archive = &archive;
+  state.decoder.topology_only = true;
+  const pll_unode_t * tree = decodeTree(state, 0);
+  if (tree == NULL) {
+    return false;
+  }
+  taxa.push_back(tree->label);
+  collectTaxa(tree->back, taxa);
+  std::sort(taxa.begin(), taxa.end());
+  return true;
+}
+
+int mergeArchives(const std::vector<std::string> &inputs, const std::string &output) {
+  // the inputs stay mapped until the end: the keyframes are compared with the
+  // simple compressions of the later inputs
+  std::vector<std::unique_ptr<ArchiveReader>> readers;
+  for (auto &input: inputs) {
+    readers.emplace_back(new ArchiveReader());
+    if (readers.back()->open(input) < 0) {
+      // ERROR: archive could not be read
+      return -1;
+    }
+    if (readers.back()->size() > 0 && !isKeyframe(readers.back()->recordKind(0))) {
+      // ERROR: archive starts with a delta to a tree outside of the archive
+      return -1;
+    }
+  }
+
+  // the trees of all archives have to be on the same taxa
+  std::vector<std::string> taxa;
+  std::vector<std::string> archive_taxa;
+  for (auto &reader: readers) {
+    if (!archiveTaxa(*reader, archive_taxa)) {
+      // ERROR: first tree could not be decoded
+      return -1;
+    }
+    if (taxa.empty()) {
+      taxa.swap(archive_taxa);
+    } else if (!archive_taxa.empty() && archive_taxa != taxa) {
+      // ERROR: archives of different taxon sets
+      return -1;
+    }
+  }
+
+  ArchiveWriter writer;
+  if (writer.open(output) < 0) {
+    return -1;
+  }
+
+  // topology dictionary of the merged archive, with a view of each keyframe
+  TopologyDictionary dictionary;
+  std::vector<RecordView> keyframe_views;
+
+  for (auto &reader: readers) {
+    // merged index of the keyframe of each simple compression of this archive
+    std::vector<uint64_t> keyframe_of(reader->size(), TOPOLOGY_NONE);
+    // merged offset of each auxiliary record of this archive; copied before
+    // the first record that refers to it
+    std::vector<std::pair<uint64_t, int64_t>> auxiliary_offsets;
+    auto copyAuxiliary = [&](uint64_t offset, unsigned int kind) -> int64_t {
+      for (auto &copied: auxiliary_offsets) {
+        if (copied.first == offset) {
+          return copied.second;
+        }
+      }
+      RecordView auxiliary = reader->recordAt(offset);
+      if (auxiliary.kind != kind) {
+        // ERROR: reference to a record of another kind
+        return -1;
+      }
+      auxiliary_offsets.push_back(std::make_pair(offset, writer.appendAuxiliary(copyRecord(auxiliary))));
+      return auxiliary_offsets.back().second;
+    };
+
+    for (size_t i = 0; i < reader->size(); i++) {
+      RecordView view = reader->record(i);
+      EncodedRecord record;
+
+      if (view.kind == RECORD_SIMPLE) {
+        uint64_t hash = encodedTopologyHash(view);
+        uint32_t entry = dictionary.find(hash, [&](uint32_t e) {
+          return sameEncodedTopology(keyframe_views[e], view);
+        });
+        if (entry == UINT32_MAX) {
+          entry = dictionary.insert(hash, writer.size());
+          keyframe_views.push_back(view);
+          record = copyRecord(view);
+        } else {
+          // the topology is stored already: keep the branch lengths only
+          record.kind = RECORD_TOPOLOGY;
+          compressTopologyId(dictionary.keyframes[entry], record.sections[SECTION_TOPOLOGY_ID]);
+          const SectionView &branches = view.sections[SECTION_BRANCH_LENGTHS];
+          record.sections[SECTION_BRANCH_LENGTHS].words.assign(branches.words, branches.words + branches.n_words);
+          record.sections[SECTION_BRANCH_LENGTHS].length = branches.length;
+        }
+        keyframe_of[i] = dictionary.keyframes[entry];
+      } else if (view.kind == RECORD_TOPOLOGY) {
+        uint64_t id = uncompressTopologyId(view.sections[SECTION_TOPOLOGY_ID]);
+        if (id >= i || keyframe_of[id] == TOPOLOGY_NONE) {
+          // ERROR: reference to a record that is no simple compression
+          return -1;
+        }
+        record = copyRecord(view);
+        compressTopologyId(keyframe_of[id], record.sections[SECTION_TOPOLOGY_ID]);
+      } else if (view.kind == RECORD_SPLITS) {
+        int64_t offset = copyAuxiliary(uncompressSplitDictionaryOffset(view.sections[SECTION_SPLIT_DICTIONARY]),
+              RECORD_SPLIT_DICTIONARY);
+        if (offset < 0) {
+          return -1;
+        }
+        record = copyRecord(view);
+        compressSplitDictionaryOffset(offset, record.sections[SECTION_SPLIT_DICTIONARY]);
+      } else if (view.kind == RECORD_DAG_TREE) {
+        std::pair<uint64_t, uint64_t> reference = uncompressDagReference(view.sections[SECTION_DAG_REFERENCE]);
+        int64_t offset = copyAuxiliary(reference.first, RECORD_SUBTREE_DAG);
+        if (offset < 0) {
+          return -1;
+        }
+        record = copyRecord(view);
+        compressDagReference(offset, reference.second, record.sections[SECTION_DAG_REFERENCE]);
+      } else {
+        record = copyRecord(view);
+      }
+
+      if (writer.append(record) < 0) {
+        return -1;
+      }
+    }
+  }
+
+  return writer.close();
+}
+
+int concatArchives(const std::vector<std::string> &inputs, const std::string &output) {
+  ArchiveWriter writer;
+  if (writer.open(output) < 0) {
+    return -1;
+  }
+  for (auto &input: inputs) {
+    ArchiveReader reader;
+    if (reader.open(input) < 0) {
+      // ERROR: archive could not be read
+      return -1;
+    }
+    if (reader.size() > 0 && !isKeyframe(reader.recordKind(0))) {
+      // ERROR: archive starts with a delta to a tree outside of the archive
+      return -1;
+    }
+    for (size_t i = 0; i < reader.size(); i++) {
+      unsigned int kind = reader.recordKind(i);
+      if (kind == RECORD_TOPOLOGY || kind == RECORD_SPLITS || kind == RECORD_DAG_TREE) {
+        // ERROR: the reference of the record would point into another archive
+        return -1;
+      }
+    }
+    if (writer.appendArchive(reader) < 0) {
+      return -1;
+    }
+  }
+  return writer.close();
+}
@@ -0,0 +1,42 @@
+#ifndef ARCHIVE_MERGE_H
+#define ARCHIVE_MERGE_H
+
+#include <string>
+#include <vector>
+
+#include "archive.h"
+
+/**
+ * Merges archives (e.g. of independent runs) into one archive that holds
+ * their records one after another.
+ *
+ * The topology dictionaries are merged as well: a simple compression whose
+ * topology is already stored in an earlier simple compression of the merged
+ * archive is turned into a topology reference, and the topology references
+ * are renumbered. The auxiliary records (split dictionaries, subtree DAGs)
+ * are copied along.
+ * Each archive has to start with a keyframe, and the archives have to be on
+ * the same taxa (their first trees are compared).
+ *
+ * @param  inputs archive files
+ * @param  output merged archive file
+ * @return        value < 0 in case of an error
+ */
+int mergeArchives(const std::vector<std::string> &inputs, const std::string &output);
+
+/**
+ * Concatenates archives (e.g. the shards of a run compressed independently)
+ * into one archive without decoding their records: the records are copied as
+ * they are and only the index is rewritten.
+ *
+ * Each archive has to start with a keyframe, and its records must not refer
+ * to other records (topology references, split records and DAG trees); such
+ * archives have to be merged with mergeArchives.
+ *
+ * @param  inputs archive files
+ * @param  output concatenated archive file
+ * @return        value < 0 in case of an error
+ */
+int concatArchives(const std::vector<std::string> &inputs, const std::string &output);
+
+#endif
@@ -0,0 +1,135 @@
+#include "async_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+AsyncWriter::~AsyncWriter() {
+  if (isOpen()) {
+    close(false);
+  }
+}
+
+int AsyncWriter::open(const std::string &filename, uint64_t start) {
+  fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | (start == 0 ? O_TRUNC : 0), 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  for (auto &buffer: buffers) {
+    void * memory;
+    if (posix_memalign(&memory, ASYNC_WRITER_ALIGNMENT, ASYNC_WRITER_BUFFER_BYTES) != 0) {
+      close(false);
+      return -1;
+    }
+    buffer = (char *) memory;
+  }
+  position = start;
+  active = 0;
+  filled = 0;
+  handed_bytes = 0;
+  stop = false;
+  failed = false;
+  thread = std::thread(&AsyncWriter::run, this);
+  return 0;
+}
+
+void AsyncWriter::write(const void * data, size_t bytes) {
+  const char * source = (const char *) data;
+  while (bytes > 0) {
+    size_t n = std::min(bytes, (size_t) ASYNC_WRITER_BUFFER_BYTES - filled);
+    memcpy(buffers[active] + filled, source, n);
+    filled += n;
+    source += n;
+    bytes -= n;
+    if (filled == ASYNC_WRITER_BUFFER_BYTES) {
+      handOff();
+    }
+  }
+}
+
+void AsyncWriter::handOff() {
+  if (filled == 0) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, [&]() { return handed_bytes == 0; });
+  handed = active;
+  handed_bytes = filled;
+  handed_position = position;
+  changed.notify_all();
+
+  position += filled;
+  filled = 0;
+  active = 1 - active;
+}
+
+int AsyncWriter::flush(bool sync) {
+  handOff();
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, [&]() { return handed_bytes == 0; });
+  if (sync && fsync(fd) != 0) {
+    failed = true;
+  }
+  return failed ? -1 : 0;
+}
+
+int AsyncWriter::close(bool sync) {
+  int result = 0;
+  if (thread.joinable()) {
+    result = flush(sync);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = true;
+      changed.notify_all();
+    }
+    thread.join();
+  }
+  if (::close(fd) != 0) {
+    result = -1;
+  }
+  fd = -1;
+  for (auto &buffer: buffers) {
+    free(buffer);
+    buffer = NULL;
+  }
+  return result;
+}
+
+void AsyncWriter::run() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    changed.wait(lock, [&]() { return handed_bytes > 0 || stop; });
+    if (handed_bytes == 0) {
+      return;
+    }
+    const char * data = buffers[handed];
+    size_t bytes = handed_bytes;
+    uint64_t offset = handed_position;
+    lock.unlock();
+
+    bool written = true;
+    while (bytes > 0) {
+      ssize_t n = pwrite(fd, data, bytes, offset);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        // ERROR: data could not be written
+        written = false;
+        break;
+      }
+      data += n;
+      bytes -= n;
+      offset += n;
+    }
+
+    lock.lock();
+    failed = failed || !written;
+    handed_bytes = 0;
+    changed.notify_all();
+  }
+}
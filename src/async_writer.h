@@ -0,0 +1,96 @@
+#ifndef ASYNC_WRITER_H
+#define ASYNC_WRITER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * Output file written by a background thread. The data is copied into one of
+ * two large, page aligned buffers; a full buffer is handed to the thread,
+ * which writes it with pwrite at its position in the file while the other
+ * buffer is filled. Writing data thus only copies it, unless both buffers are
+ * full.
+ */
+
+// size of each of the two buffers
+#define ASYNC_WRITER_BUFFER_BYTES (4 << 20)
+#define ASYNC_WRITER_ALIGNMENT 4096
+
+struct AsyncWriter {
+  int fd = -1;
+
+  // the buffer being filled and the position in the file of its first byte
+  char * buffers[2] = {NULL, NULL};
+  unsigned int active = 0;
+  size_t filled = 0;
+  uint64_t position = 0;
+
+  // the buffer handed to the thread (its size is 0 if there is none)
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable changed;
+  unsigned int handed = 0;
+  size_t handed_bytes = 0;
+  uint64_t handed_position = 0;
+  bool stop = false;
+
+  // a write failed
+  std::atomic<bool> failed{false};
+
+  AsyncWriter() = default;
+  AsyncWriter(const AsyncWriter&) = delete;
+  AsyncWriter& operator=(const AsyncWriter&) = delete;
+  ~AsyncWriter();
+
+  /**
+   * Opens the file and starts the thread.
+   * @param  filename file
+   * @param  start    position of the first byte written; the file is
+   *                  truncated if it is 0
+   * @return          value < 0 in case of an error
+   */
+  int open(const std::string &filename, uint64_t start);
+
+  bool isOpen() const {
+    return fd >= 0;
+  }
+
+  /**
+   * Appends data to the file.
+   * @param data  the data
+   * @param bytes its size
+   */
+  void write(const void * data, size_t bytes);
+
+  /**
+   * Waits until all data is written.
+   * @param  sync also write it through to the disk (fsync)
+   * @return      value < 0 if any write failed
+   */
+  int flush(bool sync);
+
+  /**
+   * Writes the remaining data, stops the thread and closes the file.
+   * @param  sync also write the data through to the disk (fsync)
+   * @return      value < 0 if any write failed
+   */
+  int close(bool sync);
+
+  /**
+   * Hands the filled part of the buffer to the thread, once it has written
+   * the other one.
+   */
+  void handOff();
+
+  /**
+   * Loop of the thread.
+   */
+  void run();
+};
+
+#endif
@@ -0,0 +1,175 @@
+#include "chain_append.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+
+#include "compress_functions.h"
+
+TreeStream::~TreeStream() {
+  if (fd >= 0 && !is_stdin) {
+    ::close(fd);
+  }
+}
+
+int TreeStream::open(const std::string &input) {
+  is_stdin = input == "-";
+  fd = is_stdin ? STDIN_FILENO : ::open(input.c_str(), O_RDONLY);
+  return fd >= 0 ? 0 : -1;
+}
+
+/*
+ * Takes the tree of a line of a tree file, if it has one; the line "end;"
+ * ends the trees.
+ */
+bool treeOfLine(const std::string &line, std::string &newick, bool &finished) {
+  size_t first = line.find_first_not_of(" \t\r");
+  if (first == std::string::npos) {
+    return false;
+  }
+  size_t last = line.find_last_not_of(" \t\r");
+  const char * text = line.c_str() + first;
+  size_t length = last + 1 - first;
+
+  if (text[0] == '(') {
+    newick.assign(text, length);
+    return true;
+  }
+  if (length == 4 && strncasecmp(text, "end;", 4) == 0) {
+    finished = true;
+    return false;
+  }
+  if (length < 5 || strncasecmp(text, "tree", 4) != 0 || (text[4] != ' ' && text[4] != '\t')) {
+    // nexus header, translate block, ...
+    return false;
+  }
+
+  // "tree <name> = [&U] <newick>": the newick starts with the first
+  // parenthesis after the "="
+  size_t equals = line.find('=', first);
+  size_t open = equals == std::string::npos ? std::string::npos : line.find('(', equals);
+  if (open == std::string::npos || open > last) {
+    return false;
+  }
+  newick.assign(line, open, last + 1 - open);
+  return true;
+}
+
+int TreeStream::next(std::string &newick) {
+  while (!finished) {
+    size_t end = pending.find('\n', start);
+    if (end != std::string::npos) {
+      std::string line = pending.substr(start, end - start);
+      start = end + 1;
+      if (treeOfLine(line, newick, finished)) {
+        return 1;
+      }
+      continue;
+    }
+
+    // read more of the input; a line that is not complete yet stays pending
+    pending.erase(0, start);
+    start = 0;
+    if (is_stdin) {
+      struct pollfd input = {fd, POLLIN, 0};
+      if (poll(&input, 1, APPEND_POLL_MS) == 0) {
+        return 0;
+      }
+    }
+    char buffer[1 << 16];
+    ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n > 0) {
+      pending.append(buffer, n);
+    } else if (n < 0) {
+      // ERROR: input could not be read
+      failed = true;
+      finished = true;
+    } else if (!is_stdin) {
+      // the file may still grow
+      std::this_thread::sleep_for(std::chrono::milliseconds(APPEND_POLL_MS));
+      return 0;
+    } else if (pending.empty()) {
+      finished = true;
+    } else {
+      // the last line of stdin may lack its newline
+      pending.push_back('\n');
+    }
+  }
+  return -1;
+}
+
+int append_compression(const std::string &input, const std::string &archive_file,
+          CompressionStatistics &statistics, int flags) {
+  TreeStream stream;
+  if (stream.open(input) < 0) {
+    return -1;
+  }
+  // a commit survives a crash of the system as well
+  ArchiveWriter writer;
+  writer.sync_policy = ARCHIVE_SYNC_COMMIT;
+  if (access(archive_file.c_str(), F_OK) == 0) {
+    if (writer.openAppend(archive_file) < 0) {
+      return -1;
+    }
+  } else if (writer.open(archive_file) < 0) {
+    return -1;
+  }
+
+  // the trees of the archive were compressed before a crash (or before the run
+  // was continued): skip them without parsing them
+  std::string newick;
+  for (size_t skipped = 0; skipped < writer.size(); ) {
+    int result = stream.next(newick);
+    if (result < 0) {
+      // ERROR: the archive holds more trees than the input
+      return -1;
+    }
+    skipped += result;
+  }
+
+  // the chain starts again with a keyframe; the topology references use the
+  // indexes of the whole archive
+  CompressionContext context;
+  context.record_index = writer.size();
+  EncodedRecord record;
+  auto last_commit = std::chrono::steady_clock::now();
+  int result;
+  while ((result = stream.next(newick)) >= 0) {
+    if (result == 0) {
+      // no new tree for now: make the trees so far visible, unless that was
+      // done only a moment ago
+      auto now = std::chrono::steady_clock::now();
+      if (!writer.index.empty() && now - last_commit >= std::chrono::milliseconds(APPEND_IDLE_COMMIT_MS)) {
+        if (writer.commit() < 0) {
+          return -1;
+        }
+        last_commit = now;
+      }
+      continue;
+    }
+    if (parseFlatTreeString(newick.c_str(), context.next, context.scratch.flat) < 0) {
+      // ERROR: tree could not be parsed
+      return -1;
+    }
+    if (chainNext(context, record, flags) < 0 || writer.append(record) < 0) {
+      return -1;
+    }
+    if (writer.index.size() >= APPEND_COMMIT_RECORDS) {
+      if (writer.commit() < 0) {
+        return -1;
+      }
+      last_commit = std::chrono::steady_clock::now();
+    }
+  }
+  statistics.add(context.statistics);
+  if (stream.failed) {
+    // the trees so far are committed
+    writer.close();
+    return -1;
+  }
+  return writer.close();
+}
@@ -0,0 +1,84 @@
+#ifndef CHAIN_APPEND_H
+#define CHAIN_APPEND_H
+
+#include <string>
+
+struct CompressionStatistics;
+
+/**
+ * Compression of the samples of a run while it is still running: the trees
+ * are read from a growing tree file (e.g. the .t file of MrBayes) or from
+ * stdin and appended to a chain archive as they come in.
+ *
+ * The archive is committed (see ArchiveWriter::commit) every
+ * APPEND_COMMIT_RECORDS trees and when no new tree is available, at most
+ * every APPEND_IDLE_COMMIT_MS then, so a reader always sees the trees up to
+ * the last commit. A run that samples slowly thus does not add an index and a
+ * trailer for every tree. An archive left by a
+ * crash is continued after its last commit: the trees it holds are skipped in
+ * the input without parsing them, and the chain starts again with a keyframe.
+ */
+
+// largest number of trees appended before a commit
+#define APPEND_COMMIT_RECORDS 64
+
+// time to wait for the tree file to grow
+#define APPEND_POLL_MS 500
+
+// shortest time between two commits while no new tree is available
+#define APPEND_IDLE_COMMIT_MS 5000
+
+/**
+ * Trees of a tree file that may still grow, one tree per line: newick lines,
+ * or the "tree <name> = <newick>" lines of a nexus file (the other lines of a
+ * nexus file are skipped).
+ */
+struct TreeStream {
+  int fd = -1;
+  bool is_stdin = false;
+
+  // the end of the trees ("end;" of the trees block, or the end of stdin),
+  // or of a read error
+  bool finished = false;
+  bool failed = false;
+
+  // input read but not consumed yet, from start on
+  std::string pending;
+  size_t start = 0;
+
+  TreeStream() = default;
+  TreeStream(const TreeStream&) = delete;
+  TreeStream& operator=(const TreeStream&) = delete;
+  ~TreeStream();
+
+  /**
+   * Opens the tree file.
+   * @param  input tree file, "-" for stdin
+   * @return       value < 0 in case of an error
+   */
+  int open(const std::string &input);
+
+  /**
+   * Reads the next tree.
+   * @param  newick the tree in newick format
+   * @return        1 if a tree was read, 0 if none became available within
+   *                APPEND_POLL_MS (the file may still grow), -1 at the end of
+   *                the trees
+   */
+  int next(std::string &newick);
+};
+
+/**
+ * Appends the trees of a tree file to a chain archive as they are written,
+ * until the end of the trees. The archive is created if it does not exist,
+ * otherwise continued after the trees it holds.
+ * @param  input        tree file, "-" for stdin
+ * @param  archive_file archive file
+ * @param  statistics   statistics of the appended trees
+ * @param  flags        flags (see compress_functions.h)
+ * @return              value < 0 in case of an error
+ */
+int append_compression(const std::string &input, const std::string &archive_file,
+          CompressionStatistics &statistics, int flags);
+
+#endif
@@ -0,0 +1,219 @@
+#include "chain_pipeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include "compress_functions.h"
+#include "archive_merge.h"
+
+/*
+ * A tree in flight: its canonical form and splits once it is parsed, its
+ * record once its delta is encoded. The stages publish their work by storing
+ * the index of the tree in parsed and encoded (SIZE_MAX for none).
+ */
+struct PipelineSlot {
+  std::atomic<size_t> parsed{SIZE_MAX};
+  std::atomic<size_t> encoded{SIZE_MAX};
+  FlatTree flat;
+  ClusterIndex clusters;
+  EncodedRecord record;
+};
+
+/*
+ * Waits until a condition holds: spins for a while, then yields the core and
+ * finally sleeps between the checks.
+ */
+template <typename Condition>
+void waitUntil(Condition condition) {
+  for (unsigned int spins = 0; !condition(); spins++) {
+    if (spins >= PIPELINE_YIELDS) {
+      std::this_thread::sleep_for(std::chrono::microseconds(PIPELINE_SLEEP_US));
+    } else if (spins >= PIPELINE_SPINS) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+/*
+ * The chain compressed tree by tree on the calling thread.
+ */
+int serialChainCompression(const std::vector<std::string> &tree_files, ArchiveWriter &writer,
+          CompressionContext &context, int flags) {
+  EncodedRecord record;
+  for (auto &tree_file: tree_files) {
+    if (chain_compression(tree_file.c_str(), context, record, flags) < 0 || writer.append(record) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int chain_archive_compression(const std::vector<std::string> &tree_files, const std::string &archive_file,
+          CompressionContext &context, size_t threads, int flags) {
+  ArchiveWriter writer;
+  if (writer.open(archive_file) < 0) {
+    return -1;
+  }
+  size_t tree_count = tree_files.size();
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  threads = std::min(threads, std::max(tree_count, (size_t) 1));
+  if (threads == 1) {
+    if (serialChainCompression(tree_files, writer, context, flags) < 0) {
+      return -1;
+    }
+    return writer.close();
+  }
+
+  // tree i is held in slot i % ring; its slot is reused for tree i + ring once
+  // tree i + 1, the last tree that refers to it, has been written
+  size_t ring = std::max(threads * PIPELINE_SLOTS_PER_THREAD, (size_t) 3);
+  std::vector<PipelineSlot> slots(ring);
+  const FlatTree * first_reference = context.has_reference ? &context.reference : NULL;
+
+  // every stage claims the trees in order
+  std::atomic<size_t> next_parse(0);
+  std::atomic<size_t> next_encode(0);
+  std::atomic<size_t> written(0);
+  std::atomic<bool> failed(false);
+
+  auto parser = [&]() {
+    FlatTreeScratch scratch;
+    for (size_t j = next_parse++; j < tree_count; j = next_parse++) {
+      waitUntil([&]() { return failed || j + 2 <= written + ring; });
+      if (failed) {
+        return;
+      }
+      PipelineSlot &slot = slots[j % ring];
+      if (parseFlatTree(tree_files[j].c_str(), slot.flat, scratch) < 0) {
+        // ERROR: tree could not be parsed
+        failed = true;
+        return;
+      }
+      indexClusters(slot.flat, slot.clusters, scratch);
+      slot.parsed.store(j, std::memory_order_release);
+    }
+  };
+
+  size_t parsers = std::max(threads / 2, (size_t) 1);
+  size_t encoders = threads - parsers;
+  std::vector<CompressionContext> contexts(encoders);
+  auto encoder = [&](CompressionContext &local) {
+    local.deduplicate_topologies = context.deduplicate_topologies;
+    local.spr_moves = context.spr_moves;
+    local.spr_evaluations = context.spr_evaluations;
+    local.adaptive_keyframes = context.adaptive_keyframes;
+    for (size_t i = next_encode++; i < tree_count; i = next_encode++) {
+      PipelineSlot &slot = slots[i % ring];
+      PipelineSlot &previous = slots[(i + ring - 1) % ring];
+      waitUntil([&]() {
+        return failed || (slot.parsed.load(std::memory_order_acquire) == i
+              && (i == 0 || previous.parsed.load(std::memory_order_acquire) == i - 1));
+      });
+      if (failed) {
+        return;
+      }
+      const FlatTree * reference = i == 0 ? first_reference : &previous.flat;
+      const ClusterIndex * reference_clusters = i == 0 ? &context.reference_clusters : &previous.clusters;
+      if (chainDelta(local, reference, reference_clusters, slot.flat, slot.record, flags) < 0) {
+        failed = true;
+        return;
+      }
+      slot.encoded.store(i, std::memory_order_release);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < parsers; t++) {
+    workers.push_back(std::thread(parser));
+  }
+  for (size_t t = 0; t < encoders; t++) {
+    workers.push_back(std::thread(encoder, std::ref(contexts[t])));
+  }
+
+  // the records go through the topology dictionary and into the archive in
+  // the order of the trees
+  for (size_t i = 0; i < tree_count; i++) {
+    PipelineSlot &slot = slots[i % ring];
+    waitUntil([&]() { return failed || slot.encoded.load(std::memory_order_acquire) == i; });
+    if (failed) {
+      break;
+    }
+    const FlatTree * reference = i == 0 ? first_reference : &slots[(i + ring - 1) % ring].flat;
+    chainDictionary(context, reference, slot.flat, slot.record, flags);
+    if (writer.append(slot.record) < 0) {
+      failed = true;
+      break;
+    }
+    written.store(i + 1, std::memory_order_release);
+  }
+
+  for (auto &w: workers) {
+    w.join();
+  }
+  for (auto &local: contexts) {
+    context.statistics.add(local.statistics);
+  }
+  if (failed) {
+    return -1;
+  }
+
+  // the last tree is the reference of a chain that is continued
+  if (tree_count > 0) {
+    PipelineSlot &last = slots[(tree_count - 1) % ring];
+    std::swap(context.reference, last.flat);
+    std::swap(context.reference_clusters, last.clusters);
+    context.has_reference = true;
+  }
+  return writer.close();
+}
+
+int sharded_chain_compression(const std::vector<std::string> &tree_files, const std::string &archive_file,
+          size_t shards, size_t threads, CompressionStatistics &statistics, int flags) {
+  size_t tree_count = tree_files.size();
+  shards = std::max(std::min(shards, tree_count), (size_t) 1);
+  std::vector<std::string> shard_files;
+  for (size_t k = 0; k < shards; k++) {
+    shard_files.push_back(archive_file + ".shard" + std::to_string(k));
+  }
+  std::vector<CompressionContext> contexts(shards);
+
+  // each thread takes the next shard; shard k holds the trees
+  // [k * tree_count / shards, (k + 1) * tree_count / shards)
+  std::atomic<size_t> next_shard(0);
+  std::atomic<bool> failed(false);
+  auto worker = [&]() {
+    for (size_t k = next_shard++; k < shards && !failed; k = next_shard++) {
+      std::vector<std::string> files(tree_files.begin() + k * tree_count / shards,
+            tree_files.begin() + (k + 1) * tree_count / shards);
+      contexts[k].deduplicate_topologies = false;
+      if (chain_archive_compression(files, shard_files[k], contexts[k], 1, flags) < 0) {
+        failed = true;
+      }
+    }
+  };
+
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  threads = std::min(threads, shards);
+  std::vector<std::thread> workers;
+  for (size_t t = 1; t < threads; t++) {
+    workers.push_back(std::thread(worker));
+  }
+  worker();
+  for (auto &w: workers) {
+    w.join();
+  }
+
+  int result = failed ? -1 : concatArchives(shard_files, archive_file);
+  for (size_t k = 0; k < shards; k++) {
+    statistics.add(contexts[k].statistics);
+    std::remove(shard_files[k].c_str());
+  }
+  return result;
+}
@@ -0,0 +1,73 @@
+#ifndef CHAIN_PIPELINE_H
+#define CHAIN_PIPELINE_H
+
+#include <string>
+#include <vector>
+
+struct CompressionContext;
+struct CompressionStatistics;
+
+/**
+ * Compression of a run into a chain archive as a pipeline of three stages:
+ *   1. parsing a tree, canonicalising it and indexing its splits,
+ *   2. matching its splits with the predecessor and encoding the delta
+ *      (chainDelta),
+ *   3. the topology dictionary (chainDictionary) and writing the record, in
+ *      the order of the trees.
+ * Stage 1 runs on a pool of parser threads, stage 2 on a pool of encoder
+ * threads and stage 3 on the calling thread. The trees in flight are held in
+ * a ring of slots that connects the stages without locks: each stage claims
+ * the trees in order with an atomic counter, and a slot carries the index of
+ * the tree whose parse and whose encoding are done, so the next stage knows
+ * when it may go on. A tree is only parsed once the slot of an earlier tree
+ * has been written and is no longer needed as a predecessor, so the parsers
+ * wait when the writer falls behind.
+ *
+ * The archive is the same as the one written by chain_compression tree by
+ * tree.
+ */
+
+// slots of the ring per worker thread
+#define PIPELINE_SLOTS_PER_THREAD 4
+
+// a stage that waits spins PIPELINE_SPINS times, then yields the core up to
+// PIPELINE_YIELDS checks and sleeps PIPELINE_SLEEP_US microseconds after that
+#define PIPELINE_SPINS 64
+#define PIPELINE_YIELDS 1024
+#define PIPELINE_SLEEP_US 50
+
+/**
+ * Compresses the given trees as a chain into an archive.
+ * @param  tree_files   trees in newick format
+ * @param  archive_file archive file
+ * @param  context      state of the chain (its settings are used by all
+ *                      workers; holds the last tree and the statistics
+ *                      afterwards)
+ * @param  threads      number of worker threads (half of them parsers, at
+ *                      least one), 0 for one per core; with 1 the trees
+ *                      are compressed one after another
+ * @param  flags        flags (see compress_functions.h)
+ * @return              value < 0 in case of an error
+ */
+int chain_archive_compression(const std::vector<std::string> &tree_files, const std::string &archive_file,
+          CompressionContext &context, size_t threads, int flags);
+
+/**
+ * Compresses the given trees as independent chains (shards) of contiguous
+ * trees, each starting with a keyframe, and concatenates them into one
+ * archive (see concatArchives). The shards do not depend on each other and
+ * are compressed in parallel; their topologies are not deduplicated, as a
+ * topology reference would point into another shard. The shards are written
+ * to archive_file + ".shard<k>" and removed afterwards.
+ * @param  tree_files   trees in newick format
+ * @param  archive_file archive file
+ * @param  shards       number of shards
+ * @param  threads      number of threads, 0 for one per core
+ * @param  statistics   statistics of all shards
+ * @param  flags        flags (see compress_functions.h)
+ * @return              value < 0 in case of an error
+ */
+int sharded_chain_compression(const std::vector<std::string> &tree_files, const std::string &archive_file,
+          size_t shards, size_t threads, CompressionStatistics &statistics, int flags);
+
+#endif
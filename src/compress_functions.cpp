@@ -1,49 +1,35 @@
 #include "compress_functions.h"
 #include "datastructure_compression_functions.h"
 
-int simple_compression(const char * tree_file, const char * succinct_structure_file,
-        const char * node_permutation_file, const char * branch_lengths_file, int flags) {
-
-  /* tree properties */
-  pll_utree_t * tree = NULL;
-  unsigned int tip_count;
-
-  /* parse the input tree */
-  tree = pll_utree_parse_newick (tree_file);
-  if(tree == NULL) {
-      // ERROR: tree could not be parsed
-      // --> syntax of newick file is not correct
-      // --> tree has less than 3 leaves
-      return -1;
-  }
-  tip_count = tree->tip_count;
+int simpleCompression(const FlatTree &tree, EncodedRecord &record, int flags, CompressionScratch &scratch) {
+  unsigned int tip_count = tree.tip_count;
   assert(tip_count >= 3);
 
-  // search for the root of the tree
-  pll_unode_t * root = searchRoot(tree);
-
-  // set and order the tree
-  setTree(root);
-  orderTree(root);
-
   // succinct_structure stores the topology in balanced parantheses ("0=(, 1=)")
-  sdsl::bit_vector succinct_structure(4 * tip_count - 2, 0);
+  sdsl::bit_vector &succinct_structure = scratch.succinct_structure;
   // succinct_structure stores the permutation of the taxa
-  sdsl::int_vector<> node_permutation(tip_count, 0, 32);
+  sdsl::int_vector<> &node_permutation = scratch.node_permutation;
   // branch_lengths stores all branch lengths of the tree
-  std::vector<double> branch_lengths(2 * tip_count - 2);
-  // create mapping from node_id to branch_id
-  unsigned int* node_id_to_branch_id = (unsigned int*) malloc ((tree->inner_count * 3 + tree->tip_count) * sizeof(unsigned int));
-  // fill the created structures with the given tree
-  assignBranchNumbers(root, succinct_structure, node_permutation, branch_lengths, node_id_to_branch_id);
+  std::vector<double> &branch_lengths = scratch.branch_lengths;
+  // the structures are only resized if the number of taxa changes (resizing
+  // an sdsl vector reallocates it)
+  if (node_permutation.size() != tip_count) {
+    succinct_structure.resize(4 * tip_count - 2);
+    node_permutation.resize(tip_count);
+  }
+  branch_lengths.resize(2 * tip_count - 2);
+  // fill the created structures with the given tree (the flat tree is ordered)
+  assignBranchNumbers(tree, succinct_structure, node_permutation, branch_lengths);
 
-  auto size_topology = compressAndStoreSuccinctStructure(succinct_structure, succinct_structure_file);
-  auto size_node_permutation = compressAndStoreSimplePermutation(node_permutation, node_permutation_file);
-  auto size_branches = compressAndStoreBranchLengths(branch_lengths, branch_lengths_file);
+  resetRecord(record, RECORD_SIMPLE);
+  auto size_topology = compressSuccinctStructure(succinct_structure.data(), succinct_structure.size(),
+            scratch.topology, record.sections[SECTION_TOPOLOGY]);
+  auto size_node_permutation = compressSimplePermutation(node_permutation, record.sections[SECTION_NODE_PERMUTATION]);
+  auto size_branches = compressBranchLengths(branch_lengths, record.sections[SECTION_BRANCH_LENGTHS]);
 
   if (flags & PRINT_COMPRESSION_STRUCTURES) {
     std::cout << "Succinct representation: " << succinct_structure << "\n";
-    std::cout << "\tuncompressed size: " << size_topology << " bytes\n";
+    std::cout << "\tcompressed size: " << size_topology << " bytes\n";
 
     std::cout << "Node permutation: " << node_permutation << "\n";
     std::cout << "\tcompressed size: " << size_node_permutation << " bytes\n";
@@ -64,792 +50,723 @@ int simple_compression(const char * tree_file, const char * succinct_structure_f
     std::cout << "---------------------------------------------------------\n";
   }
 
-  free(node_id_to_branch_id);
-
   return 0;
 }
 
-void commonBranchesOrderedRec(pll_unode_t * tree, const std::vector<bool> &edgeIncidentPresent2, std::vector<double> &branches) {
-  assert(tree != NULL);
+int simple_compression(const char * tree_file, EncodedRecord &record, int flags) {
 
-  if(!edgeIncidentPresent2[tree->node_index]) {
-    branches.push_back(tree->length);
+  /* parse the input tree */
+  FlatTree tree;
+  CompressionScratch scratch;
+  if(parseFlatTree(tree_file, tree, scratch.flat) < 0) {
+      // ERROR: tree could not be parsed
+      // --> syntax of newick file is not correct
+      // --> tree has less than 3 leaves
+      return -1;
   }
-  if(tree->next == NULL) {
-    // leaf
-  } else {
-    // inner node
-    assert(tree->next != NULL);
-    assert(tree->next->next->next == tree);
-
-    // if(edgeIncidentPresent2[tree->next->node_index]) {
-    //     branches.push_back(tree->next->length);
-    // }
-    commonBranchesOrderedRec(tree->next->back, edgeIncidentPresent2, branches);
-    // if(edgeIncidentPresent2[tree->next->next->node_index]) {
-    //     branches.push_back(tree->next->next->length);
-    // }
-    commonBranchesOrderedRec(tree->next->next->back, edgeIncidentPresent2, branches);
+  return simpleCompression(tree, record, flags, scratch);
+}
 
+void CompressionScratch::reserve(size_t tip_count) {
+  if (tip_count <= reserved_tips) {
+    return;
   }
+  reserved_tips = tip_count;
+
+  // a tree has less than 2 * tip_count nodes, every node is part of at most
+  // one rf subtree and one children set
+  size_t nodes = 2 * tip_count;
+  size_t slots = 1;
+  while (slots < 2 * nodes) {
+    slots *= 2;
+  }
+  flat.reserve(nodes);
+  match.reserve(nodes);
+  contracted.reserve(nodes);
+  edges_to_contract.reserve(nodes);
+  consensus_branches.reserve(nodes);
+  tasks.reserve(nodes);
+  subtree_bits.reserve(4 * nodes);
+  subtree_start.reserve(nodes + 1);
+  subtree_leaves.reserve(nodes);
+  leaves_start.reserve(nodes + 1);
+  subtree_branches.reserve(nodes);
+  branches_start.reserve(nodes + 1);
+  consensus_children.reserve(nodes);
+  consensus_sets.reserve(nodes);
+  consensus_start.reserve(nodes + 1);
+  set_hashes.reserve(slots);
+  set_ids.reserve(slots);
+  position.reserve(tip_count + 1);
+  stamp.reserve(tip_count + 1);
+  match_index.reserve(nodes);
+  permutations.reserve(nodes);
+  permutation_sizes.reserve(nodes);
+  non_consensus_branches.reserve(nodes);
+  subtree_roots.reserve(nodes);
+  unmatched.reserve(nodes);
+  moved_subtrees.reserve(nodes);
+  subtrees_succinct.reserve((4 * nodes + 63) / 64);
+  branch_lengths.reserve(nodes);
 }
 
-std::vector<double> commonBranchesOrdered(pll_unode_t * tree, const std::vector<bool> &edgeIncidentPresent2) {
-    std::vector<double> branches;
-    branches.push_back(0);
-    commonBranchesOrderedRec(tree, edgeIncidentPresent2, branches);
-    return branches;
+/*
+ * Prints the values separated by spaces (like sdsl prints int vectors).
+ */
+template <typename T>
+void printValues(const T * values, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    std::cout << values[i];
+    if (i + 1 < count) {
+      std::cout << " ";
+    }
+  }
 }
 
-
-
-void commonBranchesOrderedCompareRec(pll_unode_t * tree, pll_unode_t * consensus, const std::vector<bool> &edgeIncidentPresent2, std::vector<double> &branches) {
-  assert(tree != NULL);
-  assert(consensus != NULL);
-
-  if(tree->next == NULL) {
-      assert(consensus->next == NULL);
-      return;
+/*
+ * Appends the children of node v in the consensus tree, i.e. the children of v
+ * in tree 1 where each child above a contracted branch is replaced by its own
+ * children in the consensus tree.
+ */
+void appendConsensusChildren(const FlatTree &tree, const std::vector<bool> &contracted, uint32_t v,
+            std::vector<uint32_t> &children) {
+  for (uint32_t c = tree.first_child[v]; c != FLAT_NONE; c = tree.next_sibling[c]) {
+    if (contracted[c]) {
+      appendConsensusChildren(tree, contracted, c, children);
+    } else {
+      children.push_back(c);
+    }
   }
+}
 
-  assert(tree->next->next->next == tree); // tree is binary
-
-  int i = 1;
-  pll_unode_t * temp = consensus->next;
-  while(temp != consensus) {
-      temp = temp->next;
-      i++;
+/*
+ * Traverses the consensus tree in postorder and appends the children (given by
+ * their smallest taxon) of each node with more than two children to
+ * scratch.consensus_sets. scratch.consensus_children is used as a stack.
+ */
+void consensusChildrenSetsRec(const FlatTree &tree, const std::vector<bool> &contracted, uint32_t v,
+            CompressionScratch &scratch) {
+  std::vector<uint32_t> &children = scratch.consensus_children;
+  size_t first = children.size();
+  appendConsensusChildren(tree, contracted, v, children);
+  size_t last = children.size();
+
+  for (size_t i = first; i < last; i++) {
+    consensusChildrenSetsRec(tree, contracted, children[i], scratch);
   }
-
-  if(i > 3) {
-      int x = (intptr_t) tree->next->data;
-      int y = (intptr_t) tree->next->next->data;
-      pll_unode_t * subtree1;
-      pll_unode_t * subtree2;
-
-      pll_unode_t * temp = consensus->next;
-      if((intptr_t) temp->data == x) {
-          subtree1 = temp;
-      }
-      if((intptr_t) temp->data == y) {
-          subtree2 = temp;
-      }
-      while(temp != consensus) {
-          if((intptr_t) temp->data == x) {
-              subtree1 = temp;
-          }
-          if((intptr_t) temp->data == y) {
-              subtree2 = temp;
-          }
-          temp = temp->next;
-      }
-      assert(subtree1 != NULL);
-      assert(subtree2 != NULL);
-
-      if(!edgeIncidentPresent2[tree->next->node_index]) {
-          assert((intptr_t) tree->next->data == (intptr_t) subtree1->data);
-          branches.push_back(tree->next->length - subtree1->length);
-          commonBranchesOrderedCompareRec(tree->next->back, subtree1->back, edgeIncidentPresent2, branches);
-      } else {
-          assert((intptr_t) tree->next->data == (intptr_t) subtree1->data);
-          commonBranchesOrderedCompareRec(tree->next->back, consensus, edgeIncidentPresent2, branches);
-      }
-
-      if(!edgeIncidentPresent2[tree->next->next->node_index]) {
-          assert((intptr_t) tree->next->next->data == (intptr_t) subtree2->data);
-          branches.push_back(tree->next->next->length - subtree2->length);
-          commonBranchesOrderedCompareRec(tree->next->next->back, subtree2->back, edgeIncidentPresent2, branches);
-      } else {
-          assert((intptr_t) tree->next->next->data == (intptr_t) subtree2->data);
-          commonBranchesOrderedCompareRec(tree->next->next->back, consensus, edgeIncidentPresent2, branches);
-      }
-
-  } else {
-      assert(i == 3);
-      assert((intptr_t) tree->next->data == (intptr_t) consensus->next->data);
-      assert((intptr_t) tree->next->next->data == (intptr_t) consensus->next->next->data);
-      branches.push_back(tree->next->length - consensus->next->length);
-      commonBranchesOrderedCompareRec(tree->next->back, consensus->next->back, edgeIncidentPresent2, branches);
-      branches.push_back(tree->next->next->length - consensus->next->next->length);
-      commonBranchesOrderedCompareRec(tree->next->next->back, consensus->next->next->back, edgeIncidentPresent2, branches);
+  if (last - first > 2) {
+    for (size_t i = first; i < last; i++) {
+      scratch.consensus_sets.push_back(tree.min_taxon[children[i]]);
+    }
+    scratch.consensus_start.push_back(scratch.consensus_sets.size());
   }
+  children.resize(first);
 }
 
-std::vector<double> commonBranchesOrderedCompare(pll_unode_t * tree, pll_unode_t * consensus, const std::vector<bool> &edgeIncidentPresent2) {
-    std::vector<double> branches;
-    branches.push_back(0);
-    branches.push_back(tree->length - consensus->length);
-    commonBranchesOrderedCompareRec(tree, consensus, edgeIncidentPresent2, branches);
-    return branches;
+/*
+ * Stores the balanced parantheses of the consensus tree below node v.
+ */
+void consensusStructureRec(const FlatTree &tree, const std::vector<bool> &contracted, uint32_t v,
+            sdsl::bit_vector &bp, size_t * bp_idx) {
+  std::vector<uint32_t> children;
+  appendConsensusChildren(tree, contracted, v, children);
+  for (auto c: children) {
+    bp[(*bp_idx)++] = 0;
+    consensusStructureRec(tree, contracted, c, bp, bp_idx);
+    bp[(*bp_idx)++] = 1;
+  }
 }
 
-
-std::tuple<std::vector<int>, std::vector<int>, std::vector<double>> findRFSubtreesRecL(pll_unode_t * tree, const std::vector<bool> &edgeIncidentPresent2,
-            std::stack<pll_unode_t *> &tasks) {
-  assert(tree != NULL);
-  std::vector<int> return_vector_topology;
-  std::vector<int> return_vector_order;
-  std::vector<double> return_branches;
-
-  if(tree->next == NULL) {
-    // leaf; edge incident is always present in both trees
-    //std::cout << "Leaf: " << tree->node_index << "\t    Edge incident present: " << edgeIncidentPresent2[tree->node_index] << "\n";
-  } else {
-    // inner node
-    assert(tree->next != NULL);
-    assert(tree->next->next != NULL);
-    assert(tree->next->back != NULL);
-    assert(tree->next->next->back != NULL);
-    assert(tree->next->next->next = tree);
-
-    //std::cout << "Inner node: " << tree->node_index << "\t    Edge incident present: " << edgeIncidentPresent2[tree->node_index] << "\n";
-
-    //std::cout << "1. Inner node: " << tree->next->node_index <<
-    //   "\t    Edge incident present: " << edgeIncidentPresent2[tree->next->node_index] << "\n";
-    if(edgeIncidentPresent2[tree->next->node_index] && edgeIncidentPresent2[tree->next->next->node_index]) {
-          std::vector<int> temp_topology_right;
-          std::vector<int> temp_order_right;
-          std::vector<double> temp_branches_right;
-          std::tie (temp_topology_right, temp_order_right, temp_branches_right) = findRFSubtreesRecL(tree->next->next->back, edgeIncidentPresent2, tasks);
-
-          std::vector<int> temp_topology_left;
-          std::vector<int> temp_order_left;
-          std::vector<double> temp_branches_left;
-          std::tie (temp_topology_left, temp_order_left, temp_branches_left) = findRFSubtreesRecL(tree->next->back, edgeIncidentPresent2, tasks);
-
-          return_vector_topology.push_back(0);
-          return_vector_topology.insert(return_vector_topology.end(), temp_topology_left.begin(), temp_topology_left.end());
-          return_vector_order.insert(return_vector_order.end(), temp_order_left.begin(), temp_order_left.end());
-          return_vector_topology.push_back(1);
-          return_vector_topology.push_back(0);
-          return_vector_topology.insert(return_vector_topology.end(), temp_topology_right.begin(), temp_topology_right.end());
-          return_vector_order.insert(return_vector_order.end(), temp_order_right.begin(), temp_order_right.end());
-          return_vector_topology.push_back(1);
-          return_branches.push_back(tree->next->back->length);
-          return_branches.insert(return_branches.end(), temp_branches_left.begin(), temp_branches_left.end());
-          return_branches.push_back(tree->next->next->back->length);
-          return_branches.insert(return_branches.end(), temp_branches_right.begin(), temp_branches_right.end());
-    } else if(edgeIncidentPresent2[tree->next->node_index]) {
-          assert(!edgeIncidentPresent2[tree->next->next->node_index]);
-
-          tasks.push(tree->next->next->back);
-
-          return_vector_topology.push_back(0);
-          std::vector<int> temp_topology;
-          std::vector<int> temp_order;
-          std::vector<double> temp_branches;
-          std::tie (temp_topology, temp_order, temp_branches) = findRFSubtreesRecL(tree->next->back, edgeIncidentPresent2, tasks);
-          return_vector_topology.insert(return_vector_topology.end(), temp_topology.begin(), temp_topology.end());
-          return_vector_order.insert(return_vector_order.end(), temp_order.begin(), temp_order.end());
-          return_vector_topology.push_back(1);
-
-          return_vector_topology.push_back(0);
-          return_vector_order.push_back((intptr_t) tree->next->next->back->data);
-          return_vector_topology.push_back(1);
-          return_branches.push_back(tree->next->back->length);
-          return_branches.insert(return_branches.end(), temp_branches.begin(), temp_branches.end());
-    } else if(edgeIncidentPresent2[tree->next->next->node_index]) {
-          assert(!edgeIncidentPresent2[tree->next->node_index]);
-
-          return_vector_topology.push_back(0);
-          return_vector_order.push_back((intptr_t) tree->next->back->data);
-          return_vector_topology.push_back(1);
-
-          return_vector_topology.push_back(0);
-          std::vector<int> temp_topology;
-          std::vector<int> temp_order;
-          std::vector<double> temp_branches;
-          std::tie (temp_topology, temp_order, temp_branches) = findRFSubtreesRecL(tree->next->next->back, edgeIncidentPresent2, tasks);
-          return_vector_topology.insert(return_vector_topology.end(), temp_topology.begin(), temp_topology.end());
-          return_vector_order.insert(return_vector_order.end(), temp_order.begin(), temp_order.end());
-          return_vector_topology.push_back(1);
-          return_branches.push_back(tree->next->next->back->length);
-          return_branches.insert(return_branches.end(), temp_branches.begin(), temp_branches.end());
-
-          tasks.push(tree->next->back);
-    } else {
-          assert(!edgeIncidentPresent2[tree->next->node_index] && !edgeIncidentPresent2[tree->next->next->node_index]);
-
-          tasks.push(tree->next->next->back);
-          tasks.push(tree->next->back);
-          return_vector_topology.push_back(0);
-          return_vector_order.push_back((intptr_t) tree->next->back->data);
-          return_vector_topology.push_back(1);
-          return_vector_topology.push_back(0);
-          return_vector_order.push_back((intptr_t) tree->next->next->back->data);
-          return_vector_topology.push_back(1);
+/*
+ * Prints the splits of a tree, i.e. the taxa below each inner branch.
+ */
+void printSplits(const FlatTree &tree, const std::vector<uint32_t> * match) {
+  for (uint32_t v = 2; v < tree.size(); v++) {
+    if (tree.isLeaf(v)) {
+      continue;
+    }
+    std::string split(tree.tip_count, '0');
+    for (uint32_t u = v; u < v + tree.subtree_size[v]; u++) {
+      if (tree.taxon[u] != 0) {
+        split[tree.taxon[u] - 1] = '1';
+      }
     }
+    std::cout << split;
+    if (match != NULL) {
+      std::cout << ((*match)[v] != FLAT_NONE ? " common" : " not common") << " Length:" << tree.length[v];
+    }
+    std::cout << "\n";
   }
-  return std::make_tuple(return_vector_topology, return_vector_order, return_branches);
+  std::cout << "\n";
 }
 
 /**
- * If the queue of tasks is not empty, the method pops a subtree of the queue
- * and searches for a node with degree > 3. The method returns the rf-subtree
- * topology and permutation of the nodes.
- * @param tasks                queue of subtrees to check
- * @param edgeIncidentPresent2 vector indicating which edges are are present in
- * both trees (edges of the consensus tree)
+ * Collects the rf subtree of tree 2 below node v: the part of the tree that is
+ * connected to v by branches that are not present in tree 1. Children below
+ * common branches become the leaves of the rf subtree (given by their smallest
+ * taxon) and are appended to tasks.
+ * @param tree     tree 2
+ * @param match    node of tree 1 with the same split as each node of tree 2
+ * @param v        root of the rf subtree
+ * @param topology balanced parantheses of the rf subtree (without the root)
+ * @param order    leaves of the rf subtree
+ * @param branches lengths of the inner branches of the rf subtree in dfs
+ * @param tasks    roots of the subtrees to search next
  */
-std::tuple<std::vector<int>, std::vector<int>, std::vector<double>> findRFSubtreesL(std::stack<pll_unode_t *> &tasks,
-                      const std::vector<bool> &edgeIncidentPresent2) {
-  std::vector<int> return_topology;
-  std::vector<int> return_order;
-  std::vector<double> return_branches;
-  if(tasks.empty()) {
-    return std::make_tuple(return_topology, return_order, return_branches);
-  }
-  pll_unode_t * tree = tasks.top();
-  tasks.pop();
-
-  if(tree == NULL) {
-    return std::make_tuple(return_topology, return_order, return_branches);
-  } else {
-      return findRFSubtreesRecL(tree, edgeIncidentPresent2, tasks);
+void findRFSubtreeRec(const FlatTree &tree, const std::vector<uint32_t> &match, uint32_t v,
+            std::vector<uint8_t> &topology, std::vector<uint32_t> &order, std::vector<double> &branches,
+            std::vector<uint32_t> &tasks) {
+  for (uint32_t c = tree.first_child[v]; c != FLAT_NONE; c = tree.next_sibling[c]) {
+    topology.push_back(0);
+    if (match[c] == FLAT_NONE) {
+      branches.push_back(tree.length[c]);
+      findRFSubtreeRec(tree, match, c, topology, order, branches, tasks);
+    } else {
+      order.push_back(tree.min_taxon[c]);
+      tasks.push_back(c);
+    }
+    topology.push_back(1);
   }
 }
 
-void free_leaf(pll_unode_t * leaf) {
-    if (leaf->label)
-      free(leaf->label);
-    free(leaf);
-}
-
-void free_inner_node(pll_unode_t * node) {
-  if (node->label)
-    free(node->label);
-  free(node);
-}
-
-bool innerNodeCompare_(pll_unode_t * node1, pll_unode_t * node2) {
-  return ((intptr_t) node1->data) < ((intptr_t) node2->data);
+/**
+ * Order-independent hash of a set of labels.
+ * @param  labels labels of the set
+ * @param  count  number of labels
+ * @return        hash of the set
+ */
+uint64_t labelSetHash(const uint32_t * labels, size_t count) {
+  uint64_t hash = 0;
+  for (size_t i = 0; i < count; i++) {
+    hash += mixLabel(labels[i]);
+  }
+  return mixLabel(hash ^ count);
 }
 
-void consensusDiffRec(pll_utree_t * tree1, pll_utree_t * tree2, pll_unode_t * node,
-              unsigned int * bl_idx, std::vector<double> &branch_lengths) {
-  assert(node != NULL);
-
-  double diff = tree2->nodes[node->pmatrix_index]->length - node->length;
-
-  branch_lengths[*bl_idx] = diff;
-  (*bl_idx)++;
-  if(node->next == NULL) {
-    // leaf
-
-  } else {
-    // inner node
-
-    // assign inner nodes to an array
-    std::vector<pll_unode_t*> inner_nodes;
-    pll_unode_t * temp_node = node->next;
-    while(temp_node->node_index != node->node_index) {
-      inner_nodes.push_back(temp_node);
-      assert(temp_node->next != NULL);
-      temp_node = temp_node->next;
+/**
+ * Matches every children set of the consensus tree (scratch.consensus_sets)
+ * with the leaf set of the rf subtree of tree 2 (scratch.subtree_leaves) that
+ * contains the same labels.
+ *
+ * scratch.match_index[j] is the rf subtree matched with the j-th consensus set.
+ * Element i of the j-th normalized permutation (stored in scratch.permutations
+ * at the positions of the j-th consensus set) tells on which position in the
+ * consensus set the i-th leaf of the matched rf subtree is found.
+ *
+ * @param scratch buffers holding the sets and the results
+ */
+void matchChildrenSets(CompressionScratch &scratch) {
+  const std::vector<uint32_t> &tree2_sets = scratch.subtree_leaves;
+  const std::vector<size_t> &tree2_start = scratch.leaves_start;
+  const std::vector<uint32_t> &consensus_sets = scratch.consensus_sets;
+  const std::vector<size_t> &consensus_start = scratch.consensus_start;
+  size_t tree2_count = tree2_start.size() - 1;
+  size_t consensus_count = consensus_start.size() - 1;
+
+  // open addressing table of the tree 2 sets by their hash
+  size_t slots = 1;
+  while (slots < 2 * tree2_count) {
+    slots *= 2;
+  }
+  size_t mask = slots - 1;
+  scratch.set_hashes.resize(slots);
+  scratch.set_ids.assign(slots, UINT32_MAX);
+  uint32_t max_label = 0;
+  for (size_t i = 0; i < tree2_count; i++) {
+    size_t size = tree2_start[i + 1] - tree2_start[i];
+    uint64_t hash = labelSetHash(tree2_sets.data() + tree2_start[i], size);
+    size_t slot = hash & mask;
+    while (scratch.set_ids[slot] != UINT32_MAX) {
+      slot = (slot + 1) & mask;
     }
-    assert(temp_node->node_index == node->node_index);
-
-    // sort the internal nodes
-    std::sort (inner_nodes.begin(), inner_nodes.end(), innerNodeCompare_);
-
-
-    for (size_t i = 0; i < inner_nodes.size(); i++) {
-        consensusDiffRec(tree1, tree2, inner_nodes[i]->back, bl_idx, branch_lengths);
+    scratch.set_hashes[slot] = hash;
+    scratch.set_ids[slot] = i;
+    for (size_t j = tree2_start[i]; j < tree2_start[i + 1]; j++) {
+      max_label = std::max(max_label, tree2_sets[j]);
     }
   }
-}
-
-void consensusDiff(pll_utree_t * tree1, pll_utree_t * tree2, pll_unode_t * node,
-            std::vector<double> &branch_lengths) {
-  assert(node->next == NULL);
-  assert(atoi(node->label) == 1);
-  unsigned int bl_idx = 1;
-  consensusDiffRec(tree1, tree2, node->back, &bl_idx, branch_lengths);
-  assert(bl_idx == branch_lengths.size());
-}
+  for (auto label: consensus_sets) {
+    max_label = std::max(max_label, label);
+  }
 
-void nonConsensusBranchLengthsRec(pll_unode_t * tree, const std::vector<bool> node_incident, std::vector<double> &branch_lengths) {
-  assert(tree != NULL);
+  // position[label] is the position of label in the current consensus set if stamp[label] is current
+  std::vector<uint32_t> &position = scratch.position;
+  std::vector<uint32_t> &stamp = scratch.stamp;
+  position.assign(max_label + 1, 0);
+  stamp.assign(max_label + 1, 0);
+
+  scratch.match_index.clear();
+  scratch.permutations.clear();
+  scratch.permutation_sizes.clear();
+  for (size_t c = 0; c < consensus_count; c++) {
+    const uint32_t * set = consensus_sets.data() + consensus_start[c];
+    size_t size = consensus_start[c + 1] - consensus_start[c];
+    for (size_t j = 0; j < size; j++) {
+      position[set[j]] = j;
+      stamp[set[j]] = c + 1;
+    }
 
-  if(tree->next == NULL) {
-    // leaf
-  } else {
-    // inner node
-    if(node_incident[tree->node_index] == false) {
-      branch_lengths.push_back(tree->length);
+    // verify the candidates with the same hash label by label
+    uint32_t match = UINT32_MAX;
+    uint64_t hash = labelSetHash(set, size);
+    for (size_t slot = hash & mask; scratch.set_ids[slot] != UINT32_MAX && match == UINT32_MAX;
+        slot = (slot + 1) & mask) {
+      uint32_t candidate = scratch.set_ids[slot];
+      if (scratch.set_hashes[slot] != hash || tree2_start[candidate + 1] - tree2_start[candidate] != size) {
+        continue;
+      }
+      bool equal = true;
+      for (size_t j = tree2_start[candidate]; j < tree2_start[candidate + 1]; j++) {
+        if (stamp[tree2_sets[j]] != c + 1) {
+          equal = false;
+          break;
+        }
+      }
+      if (equal) {
+        match = candidate;
+      }
     }
-    pll_unode_t * current_node = tree->next;
-    while(current_node != tree) {
-      pll_unode_t * temp_node = current_node;
-      nonConsensusBranchLengthsRec(current_node->back, node_incident, branch_lengths);
-      current_node = current_node->next;
+    assert(match != UINT32_MAX); // children set must be present
+
+    for (size_t j = tree2_start[match]; j < tree2_start[match + 1]; j++) {
+      scratch.permutations.push_back(position[tree2_sets[j]]);
     }
+    scratch.permutation_sizes.push_back(size);
+    scratch.match_index.push_back(match);
   }
 }
 
-/**
- * Stores all branch lengths of the branches that are not part of the consensus
- * tree in an array
- * @param root           root of the tree
- * @param node_incident  vector telling which node is incident to an edge in the consensus tree
- * @param branch_lengths return vector to write branch lengths in
+/*
+ * Number of bits needed to store x.
  */
-void nonConsensusBranchLengths(pll_unode_t * root, const std::vector<bool> node_incident, std::vector<double> &branch_lengths) {
-  assert(root->back != NULL);
-  assert(node_incident[root->node_index] == true);
-  assert(node_incident[root->back->node_index] == true);
-
-  nonConsensusBranchLengthsRec(root->back, node_incident, branch_lengths);
+static size_t bitWidth(uint64_t x) {
+  return 64 - __builtin_clzll(x | 1);
 }
 
 /**
- * Compares the sum of the element of two arrays
- * @param  a first array
- * @param  b second array
- * @return   true if sum of first array is greater than the sum of the second array
+ * Finds the rf subtrees that are smaller as SPR moves applied to the
+ * resolution of their node of the consensus tree in tree 1 (resolutionTree)
+ * than as parantheses and permutation. When a clade moves, the splits along
+ * its path form one rf subtree, and most of the structure of that subtree is
+ * the one of tree 1. Each subtree is searched on its own, with at most
+ * RF_MOVES_MAX_DEPTH moves that each have to make more of its splits equal.
+ *
+ * scratch.moved_subtrees[j] tells whether the subtree matched with the j-th
+ * consensus set is stored as moves, scratch.subtree_moves holds the moves as
+ * expected by expandSubtreeMoves.
+ *
+ * @param tree1   tree 1
+ * @param tree2   tree 2
+ * @param scratch buffers of the rf distance compression (after matchChildrenSets)
  */
-bool arraySumComp(const std::vector<int> &a, const std::vector<int> &b) {
-  int sum_a = 0;
-  for (size_t i = 0; i < a.size(); i++) {
-    sum_a += a[i];
+void findSubtreeMoves(const FlatTree &tree1, const FlatTree &tree2, CompressionScratch &scratch) {
+  size_t subtree_count = scratch.match_index.size();
+  scratch.moved_subtrees.assign(subtree_count, false);
+  scratch.subtree_moves.clear();
+  bool candidates = false;
+  for (size_t j = 0; j < subtree_count; j++) {
+    size_t leaves = scratch.consensus_start[j + 1] - scratch.consensus_start[j];
+    candidates = candidates || (leaves >= RF_MOVES_MIN_LEAVES && leaves <= RF_MOVES_MAX_LEAVES);
   }
-  int sum_b = 0;
-  for (size_t i = 0; i < b.size(); i++) {
-    sum_b += b[i];
+  if (!candidates) {
+    return;
   }
-  return sum_a > sum_b ;
-}
 
-/**
- * Find the permuation to get from vector a to vector. Element i in the resulting
- * vector tells on which position in array b element a[i] is found.
- *
- * @param  a source vector
- * @param  b destination vector
- * @return   permuations to permutate vector a into vector b
- */
-// Precondition: a and b must have the same length and contain the same, unique elements.
-std::vector<int> findPermutation(const std::vector<int> &a, const std::vector<int> &b) {
-    std::vector<int> permutation(a.size());
-    for (size_t i = 0; i < a.size(); i++) {
-      for (size_t j = 0; j < b.size(); j++) {
-        if(a[i] == b[j]) {
-          permutation[i] = j;
-          break;
-        }
-      }
+  SprScratch &spr = scratch.spr;
+  std::vector<uint32_t> &polytomies = spr.polytomies;
+  consensusPolytomies(tree1, scratch.contracted, polytomies, spr);
+  assert(polytomies.size() == subtree_count);
+  scratch.unmatched.resize(tree2.size());
+  for (uint32_t v = 0; v < tree2.size(); v++) {
+    scratch.unmatched[v] = scratch.match[v] == FLAT_NONE;
+  }
+
+  size_t evaluations = RF_MOVES_EVALUATIONS;
+  size_t last = 0;
+  double saved_bits = 0;
+  for (size_t j = 0; j < subtree_count; j++) {
+    size_t leaves = scratch.consensus_start[j + 1] - scratch.consensus_start[j];
+    if (leaves < RF_MOVES_MIN_LEAVES || leaves > RF_MOVES_MAX_LEAVES) {
+      continue;
     }
-    return permutation;
+    if (evaluations == 0) {
+      break;
+    }
+    resolutionTree(tree1, scratch.contracted, polytomies[j], spr.from, spr);
+    resolutionTree(tree2, scratch.unmatched, scratch.subtree_roots[scratch.match_index[j]], spr.to, spr);
+    if (findSprMoves(spr.from, spr.to, RF_MOVES_MAX_DEPTH, leaves, evaluations, spr) < 0) {
+      continue;
+    }
+
+    // parantheses and permutation (about log2(leaves!) bits) against the moves
+    double explicit_bits = 4 * leaves - 2;
+    for (size_t k = 2; k <= leaves; k++) {
+      explicit_bits += std::log2(k);
+    }
+    double moves_bits = (2 + spr.moves.size()) * bitWidth(2 * leaves);
+    if (moves_bits >= explicit_bits) {
+      continue;
+    }
+    scratch.subtree_moves.push_back(j - last);
+    scratch.subtree_moves.push_back(spr.moves.size() / 2);
+    scratch.subtree_moves.insert(scratch.subtree_moves.end(), spr.moves.begin(), spr.moves.end());
+    scratch.moved_subtrees[j] = true;
+    last = j;
+    saved_bits += explicit_bits - moves_bits;
+  }
+
+  // the section itself takes a length, a count and a block header word
+  if (saved_bits <= 3 * 64) {
+    scratch.moved_subtrees.assign(subtree_count, false);
+    scratch.subtree_moves.clear();
+  }
 }
 
-int rf_distance_compression(const char * tree1_file, const char * tree2_file,
-        const char * edges_to_contract_file, const char * subtrees_succinct_file,
-        const char * node_permutations_file, const char * branch_lengths_consensus_file,
-        const char * branch_lengths_non_consensus_file, int flags) {
+/*
+ * Compresses a tree with the same topology as its predecessor: a repeat record
+ * if the branch lengths are equal as well, otherwise a record with the branch
+ * length diffs only.
+ */
+int sameTopologyCompression(const FlatTree &tree1, const FlatTree &tree2, EncodedRecord &record, int flags,
+        CompressionScratch &scratch) {
+  // diffs of all branch lengths in dfs, laid out like the consensus branches
+  // of an rf delta
+  std::vector<double> &diffs = scratch.consensus_branches;
+  diffs.assign(1, 0);
+  bool same_lengths = true;
+  for (uint32_t v = 1; v < tree2.size(); v++) {
+    diffs.push_back(tree2.length[v] - tree1.length[v]);
+    same_lengths = same_lengths && tree2.length[v] == tree1.length[v];
+  }
 
-  /* tree properties */
-  pll_utree_t * tree1 = NULL,
-              * tree2 = NULL;
-  unsigned int tip_count;
+  size_t size_branches = 0;
+  if (same_lengths) {
+    resetRecord(record, RECORD_REPEAT);
+  } else {
+    resetRecord(record, RECORD_BRANCH_LENGTHS);
+    size_branches = compressBranchLengths(diffs, record.sections[SECTION_CONSENSUS_BRANCHES]);
+  }
 
-  /* parse the input trees */
-  tree1 = pll_utree_parse_newick (tree1_file);
-  if(tree1 == NULL) {
-      // ERROR: tree could not be parsed
-      // --> syntax of newick file is not correct
-      // --> tree has less than 3 leaves
-      return -1;
+  if(flags & PRINT_COMPRESSION_STRUCTURES) {
+    std::cout << "RF-distance: 0\n";
+    std::cout << (same_lengths ? "Same tree\n" : "Same topology\n");
   }
-  tree2 = pll_utree_parse_newick (tree2_file);
-  if(tree2 == NULL) {
-      // ERROR: tree could not be parsed
-      // --> syntax of newick file is not correct
-      // --> tree has less than 3 leaves
-      return -1;
+
+  if(flags & PRINT_COMPRESSION) {
+    std::cout << "\nRF compression size: " << size_branches << " (consensus branches) = "
+    << size_branches << " bytes\n";
+
+    std::cout << "---------------------------------------------------------\n";
   }
-  tip_count = tree1->tip_count;
 
-  if (tip_count != tree2->tip_count) {
+  return 0;
+}
+
+int rfDistanceCompression(const FlatTree &tree1, const ClusterIndex &clusters1, const FlatTree &tree2,
+        EncodedRecord &record, int flags, CompressionScratch &scratch) {
+  unsigned int tip_count = tree1.tip_count;
+
+  if (tip_count != tree2.tip_count) {
     // ERROR: Trees have different number of tips!
     return -1;
   }
 
-  if (!pllmod_utree_consistency_set(tree1, tree2)) {
-    // ERROR: Cannot set trees consistent!
-    return -1;
+  scratch.reserve(tip_count);
+
+  // consecutive trees of a chain often share their topology: then no splits
+  // need to be matched
+  if (sameTopology(tree1, tree2)) {
+    return sameTopologyCompression(tree1, tree2, record, flags, scratch);
   }
 
-  if (!pllmod_utree_consistency_check(tree1, tree2)) {
-    // ERROR: Tip node IDs are not consistent!
+  // match[v] is the node of tree 1 with the same split as node v of tree 2
+  std::vector<uint32_t> &match = scratch.match;
+  matchClusters(clusters1, tree2, match, scratch.flat);
+  if (match[1] == FLAT_NONE) {
+    // ERROR: Trees have different taxa!
     return -1;
   }
 
-  // search for the root of the trees
-  pll_unode_t * root1 = searchRoot(tree1);
-  pll_unode_t * root2 = searchRoot(tree2);
-
-  // set and order both trees
-  setTree(root1);
-  setTree(root2);
-  orderTree(root1);
-  orderTree(root2);
+  if(flags & PRINT_COMPRESSION_STRUCTURES) {
+    // succinct_structure stores the topology in balanced parantheses ("0=(, 1=)")
+    sdsl::bit_vector succinct_structure1(4 * tip_count - 2, 0);
+    sdsl::int_vector<> node_permutation1(tip_count, 0, 32);
+    std::vector<double> branch_lengths1(2 * tip_count - 2);
+    assignBranchNumbers(tree1, succinct_structure1, node_permutation1, branch_lengths1);
 
-  // succinct_structure stores the topology in balanced parantheses ("0=(, 1=)")
-  sdsl::bit_vector succinct_structure1(4 * tip_count - 2, 0);
-  // succinct_structure stores the permutation of the taxa
-  sdsl::int_vector<> node_permutation1(tip_count, 0, 32);
-  // branch_lengths stores all branch lengths of the tree
-  // TODO: lots of potential here!
-  std::vector<double> branch_lengths1(2 * tip_count - 2);
-  // create mapping from node_id to branch_id
-  unsigned int* node_id_to_branch_id1 = (unsigned int*) malloc ((tree1->inner_count * 3 + tree1->tip_count) * sizeof(unsigned int));
-  // fill the created structures with the given tree
-  assignBranchNumbers(root1, succinct_structure1, node_permutation1, branch_lengths1, node_id_to_branch_id1);
-
-  sdsl::bit_vector succinct_structure2(4 * tip_count - 2, 0);
-  sdsl::int_vector<> node_permutation2(tip_count, 0, 32);
-  std::vector<double> branch_lengths2(2 * tip_count - 2);
-  unsigned int* node_id_to_branch_id2 = (unsigned int*) malloc ((tree2->inner_count * 3 + tree2->tip_count) * sizeof(unsigned int));
-  assignBranchNumbers(root2, succinct_structure2, node_permutation2, branch_lengths2, node_id_to_branch_id2);
+    sdsl::bit_vector succinct_structure2(4 * tip_count - 2, 0);
+    sdsl::int_vector<> node_permutation2(tip_count, 0, 32);
+    std::vector<double> branch_lengths2(2 * tip_count - 2);
+    assignBranchNumbers(tree2, succinct_structure2, node_permutation2, branch_lengths2);
 
-  if(flags & PRINT_COMPRESSION_STRUCTURES) {
     std::cout << "Succinct representation tree 1: " << succinct_structure1 << "\n";
     std::cout << "Succinct representation tree 2: " << succinct_structure2 << "\n";
   }
 
-  /* 1. creating the split sets manually */
-  unsigned int n_splits = tip_count - 3;
-  pll_unode_t ** splits_to_node1 = (pll_unode_t **) malloc(n_splits * sizeof(pll_unode_t *));
-  pll_split_t * splits1 = pllmod_utree_split_create(tree1->nodes[tip_count],
-                                                    tip_count,
-                                                    splits_to_node1);
-
   if (flags & PRINT_SPLITS) {
-    unsigned int i;
-    for (i=0; i<n_splits; ++i)
-    {
-      pllmod_utree_split_show(splits1[i], tip_count);
-      printf("\n");
-    }
-    printf("\n");
-  }
-
-  /* compute the splits, but also the nodes corresponding to each split */
-  pll_unode_t ** splits_to_node2 = (pll_unode_t **) malloc(n_splits * sizeof(pll_unode_t *));
-  pll_split_t * splits2 = pllmod_utree_split_create(tree2->nodes[tip_count],
-                                                    tip_count,
-                                                    splits_to_node2);
-
-  if(flags & PRINT_SPLITS) {
-    unsigned int i;
-    for (i=0; i<n_splits; ++i)
-    {
-      pllmod_utree_split_show(splits2[i], tip_count);
-      printf(" node: Pmatrix:%d Nodes:%d<->%d Length:%lf\n",
-      splits_to_node2[i]->pmatrix_index,
-      splits_to_node2[i]->node_index,
-      splits_to_node2[i]->back->node_index,
-      splits_to_node2[i]->length);
-    }
+    printSplits(tree1, NULL);
+    printSplits(tree2, &match);
   }
 
-  // create arrays indicating whether a split is common in both trees or not
-  int * s1_present = (int*) calloc(n_splits, sizeof(int));
-  int * s2_present = (int*) calloc(n_splits, sizeof(int));
-
-  // fill the arrays s1_present and s2_present
-  int rf_distance = pllmod_utree_split_rf_distance_extended(splits1, splits2, s1_present, s2_present, tip_count);
-
-  // vector storing if node is incident to edge in consensus tree
-  // true -> is incident
-  // false -> is not incident
-  std::vector<bool> node_incident (3 * (tip_count - 2) + tip_count, true);
-
-  for (unsigned int i=0; i<n_splits; ++i) {
-    if (s2_present[i] != 1) {
-      node_incident[splits_to_node2[i]->node_index] = false;
-      node_incident[splits_to_node2[i]->back->node_index] = false;
+  // the inner branches of tree 1 that are not in tree 2 are contracted to get
+  // the consensus tree
+  std::vector<bool> &contracted = scratch.contracted;
+  contracted.assign(tree1.size(), true);
+  for (uint32_t v = 0; v < tree2.size(); v++) {
+    if (match[v] != FLAT_NONE) {
+      contracted[match[v]] = false;
+    }
+  }
+  int rf_distance = 0;
+  for (uint32_t v = 0; v < tree2.size(); v++) {
+    if (match[v] == FLAT_NONE) {
+      rf_distance++;
     }
   }
+  rf_distance *= 2;
 
   if(flags & PRINT_COMPRESSION_STRUCTURES) {
     std::cout << "RF-distance: " << rf_distance << "\n";
   }
 
-  assert(rf_distance % 2 == 0);
-  // create array containing all edges to contract in tree1
-  sdsl::int_vector<> edges_to_contract(rf_distance / 2, 0);
-  size_t idx = 0;
-
-  // create consensus tree
-  for (size_t i = 0; i < n_splits; i++) {
-      if(s1_present[i] == 0) {
-          // contract edge in tree 1 to get to the conseneus tree
-          contractEdge(splits_to_node1[i]);
-          edges_to_contract[idx] = node_id_to_branch_id1[splits_to_node1[i]->node_index];
-          idx++;
-      }
+  // create array containing all edges to contract in tree 1; the branch above
+  // node v has the number v + 1 (compare assignBranchNumbers)
+  std::vector<uint64_t> &edges_to_contract = scratch.edges_to_contract;
+  edges_to_contract.clear();
+  for (uint32_t v = 0; v < tree1.size(); v++) {
+    if (contracted[v]) {
+      assert(v > 1 && !tree1.isLeaf(v));
+      edges_to_contract.push_back(v + 1);
+    }
   }
+  assert(edges_to_contract.size() == (size_t) rf_distance / 2);
 
-  // sort all edges to contract
-  sort(edges_to_contract.begin(), edges_to_contract.end());
-
-  // // TODO: elias-fano encoding for the ordered edges?
-  // sdsl::util::bit_compress(edges_to_contract);
-  // auto size_edges_to_contract = sdsl::size_in_bytes(edges_to_contract);
-
-  auto size_edges_to_contract = compressAndStoreRFEdgesToContract(edges_to_contract, edges_to_contract_file);
+  resetRecord(record, RECORD_RF);
+  auto size_edges_to_contract = compressRFEdgesToContract(edges_to_contract, record.sections[SECTION_EDGES_TO_CONTRACT]);
 
   if(flags & PRINT_COMPRESSION_STRUCTURES) {
-    std::cout << "Edges to contract in tree 1: " << edges_to_contract << "\n";
+    std::cout << "Edges to contract in tree 1: ";
+    printValues(edges_to_contract.data(), edges_to_contract.size());
+    std::cout << "\n";
     std::cout << "\tcompressed size: " << size_edges_to_contract << " bytes\n\n";
-  }
-
-  // succinct_structure stores the topology for the consensus tree in balanced parantheses ("0=(, 1=)")
-  sdsl::bit_vector consensus_succinct_structure(4 * tip_count - rf_distance - 2, 0);
-  sdsl::int_vector<> consensus_node_permutation(tip_count, 0, 32);
-  std::vector<double> consensus_branch_lengths(2 * tip_count - 2 - (rf_distance / 2));
-
-  unsigned int* consensus_node_id_to_branch_id = (unsigned int*) malloc ((tree1->inner_count * 3 + tree1->tip_count) * sizeof(unsigned int));
-  assignBranchNumbers(root1, consensus_succinct_structure, consensus_node_permutation, consensus_branch_lengths, consensus_node_id_to_branch_id);
-
-  std::vector<double> consensus_branch_diff_lengths(2 * tip_count - 2 - (rf_distance / 2));
-  consensusDiff(tree1, tree2, root1, consensus_branch_diff_lengths);
-
-  // TODO: later, new method
-  //auto size_consensus_branch_lengths = compressBranchLengthsAndStore(consensus_branch_diff_lengths, branch_lengths_consensus_file);
-  //auto size_consensus_branch_lengths = writeDoubleVector(consensus_branch_diff_lengths, branch_lengths_consensus_file);
 
-
-  /*std::cout << "size consensus= " << consensus_branch_diff_lengths.size() * 8 << std::endl;
-  std::cout << "complete size = " << sdsl::size_in_bytes(wt) << std::endl;
-  std::cout << "bits per number = " << (sdsl::size_in_bytes(wt)*8.0)/seq.size() << std::endl;*/
-
-  if(flags & PRINT_COMPRESSION_STRUCTURES) {
+    // succinct_structure stores the topology for the consensus tree in balanced parantheses ("0=(, 1=)")
+    sdsl::bit_vector consensus_succinct_structure(4 * tip_count - rf_distance - 2, 0);
+    consensus_succinct_structure[0] = 0;
+    consensus_succinct_structure[1] = 0;
+    consensus_succinct_structure[2] = 1;
+    consensus_succinct_structure[3] = 0;
+    size_t bp_idx = 4;
+    consensusStructureRec(tree1, contracted, 1, consensus_succinct_structure, &bp_idx);
+    consensus_succinct_structure[bp_idx++] = 1;
+    consensus_succinct_structure[bp_idx++] = 1;
+    assert(bp_idx == consensus_succinct_structure.size());
     std::cout << "Consensus tree after edge contraction: " << consensus_succinct_structure << "\n";
   }
 
-  // create an array that indicates whether the edge incident to the node_id in tree 2 is common in both trees or not
-  std::vector<bool> edgeIncidentPresent2 (tree2->inner_count * 3 + tree2->tip_count);
-  for (unsigned int i=0; i<n_splits; ++i)
-  {
-
-    if(s2_present[i] == 0) {
-      // edge is not common in both trees
-      edgeIncidentPresent2[splits_to_node2[i]->node_index] = true;
-      edgeIncidentPresent2[splits_to_node2[i]->back->node_index] = true;
-    } else {
-      // edge is common in both trees
-      edgeIncidentPresent2[splits_to_node2[i]->node_index] = false;
-      edgeIncidentPresent2[splits_to_node2[i]->back->node_index] = false;
+  // diffs of the branch lengths of the common branches, in dfs of tree 2
+  std::vector<double> &branches_tree2_compare = scratch.consensus_branches;
+  branches_tree2_compare.clear();
+  branches_tree2_compare.push_back(0);
+  branches_tree2_compare.push_back(tree2.length[1] - tree1.length[1]);
+  for (uint32_t v = 2; v < tree2.size(); v++) {
+    if (match[v] != FLAT_NONE) {
+      branches_tree2_compare.push_back(tree2.length[v] - tree1.length[match[v]]);
     }
   }
 
-  std::vector<double> branches_common_tree2 = commonBranchesOrdered(root2->back, edgeIncidentPresent2);
+  auto size_consensus_branch_lengths = compressBranchLengths(branches_tree2_compare,
+            record.sections[SECTION_CONSENSUS_BRANCHES]);
 
-  std::vector<double> branches_tree2_compare = commonBranchesOrderedCompare(root2->back, root1->back, edgeIncidentPresent2);
+  std::vector<uint32_t> &tasks = scratch.tasks;
+  tasks.assign(1, 1);
 
-  auto size_consensus_branch_lengths = compressAndStoreBranchLengths(branches_tree2_compare, branch_lengths_consensus_file);
+  std::vector<uint8_t> &subtree_bits = scratch.subtree_bits;
+  std::vector<uint32_t> &subtree_leaves = scratch.subtree_leaves;
+  std::vector<double> &subtree_branches = scratch.subtree_branches;
+  subtree_bits.clear();
+  subtree_leaves.clear();
+  subtree_branches.clear();
+  scratch.subtree_start.assign(1, 0);
+  scratch.leaves_start.assign(1, 0);
+  scratch.branches_start.assign(1, 0);
+  scratch.subtree_roots.clear();
 
-  std::stack<pll_unode_t *> tasks;
-  tasks.push(root2->back);
-
-  std::vector<std::vector<int>> subtrees;
-  std::vector<std::vector<int>> permutations;
-  std::vector<std::vector<double>> branch_lengths;
-
-  // recursively find all subtrees that need to be inserted into the consensus tree
+  // find all subtrees that need to be inserted into the consensus tree
   while(!tasks.empty()) {
-      std::vector<int> subtree;
-      std::vector<int> leaf_order;
-      std::vector<double> branches;
-
-      std::tie(subtree, leaf_order, branches) = findRFSubtreesL(tasks, edgeIncidentPresent2);
-
-      if(!subtree.empty() && leaf_order.size() > 2) {
-          std::vector<int> subtree_extended;
-          subtree_extended.push_back(0);
-          subtree_extended.insert(subtree_extended.end(), subtree.begin(), subtree.end());
-          subtree_extended.push_back(1);
-          subtrees.push_back(subtree_extended);
-          permutations.push_back(leaf_order);
-          branch_lengths.push_back(branches);
+      uint32_t v = tasks.back();
+      tasks.pop_back();
+      if (tree2.isLeaf(v)) {
+        continue;
       }
-  }
-
-    std::vector<int> permutations_index(permutations.size(), 0);
-    for (int i = 0 ; i != permutations_index.size() ; i++) {
-        permutations_index[i] = i;
-    }
-
-    std::sort(permutations_index.begin(), permutations_index.end(),
-                                        [&](const int& a, const int& b) {
-                                              return (arraySumComp(permutations[a], permutations[b]));
-                                          });
-
-    std::vector<int> permutations_index2;
 
+      size_t bits = subtree_bits.size();
+      size_t leaves = subtree_leaves.size();
+      size_t branches = subtree_branches.size();
+      subtree_bits.push_back(0);
+      findRFSubtreeRec(tree2, match, v, subtree_bits, subtree_leaves, subtree_branches, tasks);
+      subtree_bits.push_back(1);
+
+      if(subtree_leaves.size() - leaves > 2) {
+          scratch.subtree_start.push_back(subtree_bits.size());
+          scratch.leaves_start.push_back(subtree_leaves.size());
+          scratch.branches_start.push_back(subtree_branches.size());
+          scratch.subtree_roots.push_back(v);
+      } else {
+          subtree_bits.resize(bits);
+          subtree_leaves.resize(leaves);
+          subtree_branches.resize(branches);
+      }
+  }
+  size_t subtree_count = scratch.subtree_start.size() - 1;
 
-    std::sort(permutations.begin(), permutations.end(), arraySumComp);
+    // children of the multifurcating nodes of the consensus tree
+    scratch.consensus_children.clear();
+    scratch.consensus_sets.clear();
+    scratch.consensus_start.assign(1, 0);
+    consensusChildrenSetsRec(tree1, contracted, 1, scratch);
 
-    std::vector<std::vector<int>> tree2_perms;
-    traverseConsensus(root1, tree2_perms);
+    // find corresponding permutations of nodes
+    matchChildrenSets(scratch);
+    const std::vector<uint32_t> &match_index = scratch.match_index;
+    assert(match_index.size() == subtree_count);
 
     if(flags & PRINT_COMPRESSION_STRUCTURES) {
       std::cout << "\nPermutations:\n";
       std::cout << "tree 2 <---> consensus tree\n";
-    }
-
-    // find corresponding permutations of nodes
-    std::vector<std::vector<int>> normalized_permutations;
-    int permutation_elements = 0;
-    for(auto perm: tree2_perms) {
-        permutation_elements += perm.size();
-
-        size_t index = std::lower_bound(permutations.begin(), permutations.end(), perm, arraySumComp) - permutations.begin();
-
-        assert(!arraySumComp(permutations[index], perm)); // permutation must be present
-
-        size_t temp_index = index;
-        while(!arraySumComp(permutations[temp_index], perm) && temp_index < permutations.size()) {
-          if(isPermutation(permutations[temp_index], perm)) {
-            if(flags & PRINT_COMPRESSION_STRUCTURES) {
-              for(auto x: permutations[temp_index]) {
-                  std::cout << x << " ";
-              }
-              std::cout << "<---> ";
-              for(auto x: perm) {
-                  std::cout << x << " ";
-              }
-
-              std::cout << "\t\tpermutation: ";
-              for(auto x: findPermutation(permutations[temp_index], perm)) {
-                  std::cout << x << " ";
-              }
-              std::cout <<  '\n';
-            }
-            normalized_permutations.push_back(findPermutation(permutations[temp_index], perm));
-
-            permutations_index2.push_back(temp_index);
-
-            break;
-          }
-          temp_index++;
+      for (size_t i = 0; i < match_index.size(); i++) {
+        for (size_t j = scratch.leaves_start[match_index[i]]; j < scratch.leaves_start[match_index[i] + 1]; j++) {
+            std::cout << subtree_leaves[j] << " ";
+        }
+        std::cout << "<---> ";
+        for (size_t j = scratch.consensus_start[i]; j < scratch.consensus_start[i + 1]; j++) {
+            std::cout << scratch.consensus_sets[j] << " ";
         }
-        assert(temp_index < permutations.size()); // no matching permutation found
-    }
 
-    size_t permutation_index = 0;
-    // succinct_permutations stores all permutations according to the subtrees, split by a "0"
-    // TODO: prefix sum?
-    sdsl::int_vector<> succinct_permutations(permutation_elements, 0);
-    for (std::vector<int> i: normalized_permutations) {
-      for (auto j : i) {
-        succinct_permutations[permutation_index] = j;
-        permutation_index++;
+        std::cout << "\t\tpermutation: ";
+        for (size_t j = scratch.consensus_start[i]; j < scratch.consensus_start[i + 1]; j++) {
+            std::cout << scratch.permutations[j] << " ";
+        }
+        std::cout <<  '\n';
       }
     }
-    assert(permutation_index = succinct_permutations.size());
-
 
+    findSubtreeMoves(tree1, tree2, scratch);
+    const std::vector<bool> &moved_subtrees = scratch.moved_subtrees;
 
-    if(!subtrees.empty()) {
+    if(subtree_count > 0) {
       if(flags & PRINT_COMPRESSION_STRUCTURES) {
         std::cout << "\nSubtrees: \n";
       }
-      int subtree_elements = 0;
-      for (size_t i = 0; i < subtrees.size(); i++) {
-        subtree_elements += subtrees[i].size();
-        if(flags & PRINT_COMPRESSION_STRUCTURES) {
-        }
-      }
-
-      // reorder subtrees
-      std::vector<std::vector<int>> subtrees_perms_1 (subtrees.size());
-      for (size_t i = 0; i < subtrees_perms_1.size(); i++) {
-        subtrees_perms_1[i] = subtrees[permutations_index[i]];
-      }
 
-      std::vector<std::vector<int>> subtrees_perms_2 (subtrees.size());
-      for (size_t i = 0; i < subtrees_perms_2.size(); i++) {
-        subtrees_perms_2[i] = subtrees_perms_1[permutations_index2[i]];
+      // reorder subtrees and branches: subtrees_succinct stores all subtrees to
+      // insert into the consensus tree that are not stored as moves
+      size_t explicit_bits = 0;
+      for (size_t i = 0; i < subtree_count; i++) {
+        if (!moved_subtrees[i]) {
+          explicit_bits += scratch.subtree_start[match_index[i] + 1] - scratch.subtree_start[match_index[i]];
+        }
       }
-      for (size_t i = 0; i < subtrees.size(); i++) {
-        if(flags & PRINT_COMPRESSION_STRUCTURES) {
-          for (auto j : subtrees_perms_2[i]) {
-            std::cout << j;
+      std::vector<uint64_t> &subtrees_succinct = scratch.subtrees_succinct;
+      subtrees_succinct.assign((explicit_bits + 63) / 64, 0);
+      std::vector<double> &non_consensus_branch_lengths = scratch.non_consensus_branches;
+      non_consensus_branch_lengths.clear();
+      size_t subtrees_index = 0;
+      for (size_t i = 0; i < subtree_count; i++) {
+        uint32_t s = match_index[i];
+        non_consensus_branch_lengths.insert(non_consensus_branch_lengths.end(),
+          subtree_branches.begin() + scratch.branches_start[s], subtree_branches.begin() + scratch.branches_start[s + 1]);
+        if (moved_subtrees[i]) {
+          continue;
+        }
+        for (size_t j = scratch.subtree_start[s]; j < scratch.subtree_start[s + 1]; j++) {
+          subtrees_succinct[subtrees_index >> 6] |= (uint64_t) subtree_bits[j] << (subtrees_index & 0x3F);
+          subtrees_index++;
+          if(flags & PRINT_COMPRESSION_STRUCTURES) {
+            std::cout << (int) subtree_bits[j];
           }
+        }
+        if(flags & PRINT_COMPRESSION_STRUCTURES) {
           std::cout << "\n";
         }
       }
+      assert(subtrees_index == explicit_bits);
 
-      // reorder branches
-      std::vector<std::vector<double>> branches_perms_1 (branch_lengths.size());
-      for (size_t i = 0; i < branches_perms_1.size(); i++) {
-        branches_perms_1[i] = branch_lengths[permutations_index[i]];
-      }
+      auto size_non_consensus_branch_lengths = compressBranchLengths(non_consensus_branch_lengths,
+                record.sections[SECTION_NON_CONSENSUS_BRANCHES]);
 
-      std::vector<std::vector<double>> branches_perms_2 (branch_lengths.size());
-      for (size_t i = 0; i < branches_perms_2.size(); i++) {
-        branches_perms_2[i] = branches_perms_1[permutations_index2[i]];
+      size_t size_subtrees = 0;
+      if (explicit_bits > 0) {
+        size_subtrees = compressRFSubtreeDirectory(subtrees_succinct.data(), explicit_bits,
+                  record.sections[SECTION_SUBTREE_DIRECTORY])
+                  + compressSuccinctStructure(subtrees_succinct.data(), explicit_bits, scratch.topology,
+                  record.sections[SECTION_SUBTREES]);
       }
 
-
-
-      std::vector<double> non_consensus_branch_lengths;
-
-      for (size_t i = 0; i < branches_perms_2.size(); i++) {
-        non_consensus_branch_lengths.insert(non_consensus_branch_lengths.end(),
-        branches_perms_2[i].begin(), branches_perms_2[i].end());
+      if(flags & PRINT_COMPRESSION_STRUCTURES) {
+        std::cout << "\nSuccinct subtree representation: ";
+        for (size_t i = 0; i < explicit_bits; i++) {
+          std::cout << ((subtrees_succinct[i >> 6] >> (i & 0x3F)) & 1);
+        }
+        std::cout << "\n";
+        std::cout << "\tcompressed size: " << size_subtrees << " bytes\n";
       }
 
-      // auto size_non_consensus_branch_lengths = compressBranchLengthsAndStore(non_consensus_branch_lengths, branch_lengths_non_consensus_file);
-      auto size_non_consensus_branch_lengths = compressAndStoreBranchLengths(non_consensus_branch_lengths, branch_lengths_non_consensus_file);
-
-
-      subtrees = subtrees_perms_2;
-
-      size_t subtrees_index = 0;
-      // subtrees_succinct stores all subtrees to insert into the consensus tree
-      sdsl::bit_vector subtrees_succinct(subtree_elements, 1);
-      for (std::vector<int> i: subtrees) {
-        for (auto j : i) {
-          subtrees_succinct[subtrees_index] = j;
-          subtrees_index++;
+    // the subtrees stored as moves instead
+    size_t size_moves = 0;
+    if (!scratch.subtree_moves.empty()) {
+      size_moves = compressRFSubtreeMoves(scratch.subtree_moves, record.sections[SECTION_SUBTREE_MOVES]);
+
+      // drop their permutations
+      size_t kept = 0;
+      size_t kept_sets = 0;
+      for (size_t i = 0; i < subtree_count; i++) {
+        if (moved_subtrees[i]) {
+          continue;
         }
+        for (size_t j = scratch.consensus_start[i]; j < scratch.consensus_start[i + 1]; j++) {
+          scratch.permutations[kept++] = scratch.permutations[j];
+        }
+        scratch.permutation_sizes[kept_sets++] = scratch.permutation_sizes[i];
       }
-      assert(subtrees_index = subtrees_succinct.size());
-
-      auto size_subtrees = sdsl::size_in_bytes(subtrees_succinct);
+      scratch.permutations.resize(kept);
+      scratch.permutation_sizes.resize(kept_sets);
 
       if(flags & PRINT_COMPRESSION_STRUCTURES) {
-        std::cout << "\nSuccinct subtree representation: " << subtrees_succinct << "\n";
-        std::cout << "\tcompressed size: " << size_subtrees << " bytes\n";
+        std::cout << "\nSubtrees stored as moves: ";
+        printValues(scratch.subtree_moves.data(), scratch.subtree_moves.size());
+        std::cout << "\n";
+        std::cout << "\tcompressed size: " << size_moves << " bytes\n";
       }
+    }
 
-    // TODO: better compression?
-    // sdsl::util::bit_compress(succinct_permutations);
-    // auto size_permutations = sdsl::size_in_bytes(succinct_permutations);
-
-    auto size_permutations = compressAndStoreRFSubtreePermutations(succinct_permutations, node_permutations_file);
+    // succinct_permutations stores all permutations according to the subtrees
+    size_t size_permutations = 0;
+    if (!scratch.permutations.empty()) {
+      size_permutations = compressRFSubtreePermutations(scratch.permutations, scratch.permutation_sizes,
+                  record.sections[SECTION_SUBTREE_PERMUTATIONS]);
+    }
 
     if(flags & PRINT_COMPRESSION_STRUCTURES) {
-      std::cout << "\nSuccinct permutation representation: " << succinct_permutations << "\n";
+      std::cout << "\nSuccinct permutation representation: ";
+      printValues(scratch.permutations.data(), scratch.permutations.size());
+      std::cout << "\n";
       std::cout << "\tcompressed size: " << size_permutations << " bytes\n";
     }
 
     if(flags & PRINT_COMPRESSION) {
       std::cout << "\nRF compression size: " << size_edges_to_contract
       << " (edges to contract) + " << size_subtrees << " (subtrees) + "
-      << size_permutations << " (permutations) + " << branch_lengths1.size() * 8 << " (branches) = "
-      << size_edges_to_contract + size_subtrees + size_permutations + branch_lengths1.size() * 8
+      << size_permutations << " (permutations) + " << (2 * tip_count - 2) * 8 << " (branches) = "
+      << size_edges_to_contract + size_subtrees + size_permutations + (2 * tip_count - 2) * 8
       << " bytes\n";
 
       std::cout << "\nRF compression size: " << size_edges_to_contract
       << " (edges to contract) + " << size_subtrees << " (subtrees) + "
-      << size_permutations << " (permutations) + " << size_consensus_branch_lengths
+      << size_permutations << " (permutations) + " << size_moves << " (subtree moves) + " << size_consensus_branch_lengths
       << " (consensus branches) + " << size_non_consensus_branch_lengths << " (non-consensus branches) = "
-      << size_edges_to_contract + size_subtrees + size_permutations + size_consensus_branch_lengths + size_non_consensus_branch_lengths
+      << size_edges_to_contract + size_subtrees + size_permutations + size_moves + size_consensus_branch_lengths
+        + size_non_consensus_branch_lengths
       << " bytes\n";
 
       std::cout << "---------------------------------------------------------\n";
@@ -862,38 +779,275 @@ int rf_distance_compression(const char * tree1_file, const char * tree2_file,
 
     }
 
-    // write stuctures to file
-    // store_to_file(edges_to_contract, edges_to_contract_file);
-    store_to_file(subtrees_succinct, subtrees_succinct_file);
-    //store_to_file(succinct_permutations, node_permutations_file);
   }
 
-  // TODO: free procs segmentation fault
-
   //printf("RF [manual]\n");
   //printf("distance = %d\n", rf_dist);
   //printf("relative = %.2f%%\n", 100.0*rf_dist/(2*(tip_count-3)));
 
   //printf("Amount of branchs with same lengths = %d\n", same_branchs);
 
-  pllmod_utree_split_destroy(splits1);
-  pllmod_utree_split_destroy(splits2);
-  free(splits_to_node1);
-  free(splits_to_node2);
+  return 0;
+}
+
+int rf_distance_compression(const char * tree1_file, const char * tree2_file,
+        EncodedRecord &record, int flags) {
+
+  /* parse the input trees */
+  FlatTree tree1, tree2;
+  CompressionScratch scratch;
+  if(parseFlatTree(tree1_file, tree1, scratch.flat) < 0 || parseFlatTree(tree2_file, tree2, scratch.flat) < 0) {
+      // ERROR: tree could not be parsed
+      // --> syntax of newick file is not correct
+      // --> tree has less than 3 leaves
+      return -1;
+  }
+  ClusterIndex clusters1;
+  if (!sameTopology(tree1, tree2)) {
+    indexClusters(tree1, clusters1, scratch.flat);
+  }
+  return rfDistanceCompression(tree1, clusters1, tree2, record, flags, scratch);
+}
+
+int topologyCompression(const FlatTree &tree, uint64_t keyframe, EncodedRecord &record, int flags) {
+  resetRecord(record, RECORD_TOPOLOGY);
+  auto size_id = compressTopologyId(keyframe, record.sections[SECTION_TOPOLOGY_ID]);
+  // the branch lengths in dfs, as in the simple compression (length[0] is 0)
+  auto size_branches = compressBranchLengths(tree.length, record.sections[SECTION_BRANCH_LENGTHS]);
+
+  if (flags & PRINT_COMPRESSION_STRUCTURES) {
+    std::cout << "Topology of record " << keyframe << "\n";
+  }
+
+  if(flags & PRINT_COMPRESSION) {
+    std::cout << "Topology reference size: " << size_id
+    << " (topology) + " << size_branches << " (branches) = " << size_id + size_branches
+    << " bytes\n";
+
+    std::cout << "---------------------------------------------------------\n";
+  }
+
+  return 0;
+}
+
+/*
+ * Searches the topology of a tree in the dictionary of a chain. An entry
+ * without keyframe is taken as found, as its topology cannot be checked.
+ */
+uint32_t findTopology(const CompressionContext &context, const FlatTree &tree) {
+  return context.topologies.find(tree.topology_hash, [&](uint32_t entry) {
+    size_t offset = context.shape_offsets[entry];
+    if (offset == SIZE_MAX) {
+      return true;
+    }
+    const uint32_t * shape = context.keyframe_shapes.data() + offset;
+    size_t n = tree.size();
+    return shape[0] == n && std::equal(tree.taxon.begin(), tree.taxon.end(), shape + 1)
+        && std::equal(tree.subtree_size.begin(), tree.subtree_size.end(), shape + 1 + n);
+  });
+}
+
+/*
+ * Records that the tree is stored in the next record as a simple compression
+ * (entry: its dictionary entry, UINT32_MAX if it has none yet).
+ */
+void addKeyframe(CompressionContext &context, const FlatTree &tree, uint32_t entry) {
+  if (entry == UINT32_MAX) {
+    entry = context.topologies.insert(tree.topology_hash, context.record_index);
+    context.shape_offsets.push_back(SIZE_MAX);
+  }
+  context.topologies.keyframes[entry] = context.record_index;
+  context.shape_offsets[entry] = context.keyframe_shapes.size();
+  context.keyframe_shapes.push_back(tree.size());
+  context.keyframe_shapes.insert(context.keyframe_shapes.end(), tree.taxon.begin(), tree.taxon.end());
+  context.keyframe_shapes.insert(context.keyframe_shapes.end(), tree.subtree_size.begin(), tree.subtree_size.end());
+}
+
+/*
+ * Replaces an rf delta by SPR moves if a short sequence of moves is found and
+ * its record is smaller.
+ */
+void sprInsteadOfDelta(CompressionContext &context, const FlatTree &reference, const ClusterIndex &reference_clusters,
+          const FlatTree &tree, EncodedRecord &record, int flags) {
+  if (context.spr_moves == 0 || record.kind != RECORD_RF) {
+    return;
+  }
+  EncodedRecord &candidate = context.candidate;
+  if (sprCompression(reference, reference_clusters, tree, candidate, context.spr_moves,
+          context.spr_evaluations, context.spr) < 0 || recordWords(candidate) >= recordWords(record)) {
+    return;
+  }
+  if (flags & PRINT_COMPRESSION) {
+    std::cout << "SPR compression: " << context.spr.moves.size() / 2 << " moves, "
+    << recordWords(candidate) * sizeof(uint64_t) << " instead of " << recordWords(record) * sizeof(uint64_t)
+    << " bytes\n";
+  }
+  record = candidate;
+}
+
+/*
+ * Replaces a delta by the simple compression of the tree if that is smaller.
+ * The simple compression is only encoded if an estimate says that it may be:
+ * its topology takes about 2 bits per node, its permutation the bits of the
+ * number of taxa per taxon and its branch lengths about as many words as the
+ * branch length diffs of the delta. Returns whether the delta was replaced.
+ */
+bool keyframeInsteadOfDelta(CompressionContext &context, const FlatTree &tree, EncodedRecord &record, int flags) {
+  if (!context.adaptive_keyframes || (record.kind != RECORD_RF && record.kind != RECORD_SPR)) {
+    return false;
+  }
+  CompressionStatistics &statistics = context.statistics;
+  size_t delta_words = recordWords(record);
+  size_t estimate = 4 + (2 * tree.size() + 63) / 64 + (tree.tip_count * bitWidth(tree.tip_count) + 63) / 64
+      + record.sections[SECTION_CONSENSUS_BRANCHES].words.size()
+      + record.sections[SECTION_NON_CONSENSUS_BRANCHES].words.size();
+  if (estimate > delta_words + delta_words / 8) {
+    statistics.keyframe_estimates++;
+    return false;
+  }
+
+  statistics.keyframe_trials++;
+  EncodedRecord &candidate = context.candidate;
+  if (simpleCompression(tree, candidate, 0, context.scratch) < 0 || recordWords(candidate) >= delta_words) {
+    return false;
+  }
+  if (flags & PRINT_COMPRESSION) {
+    std::cout << "Simple compression: " << recordWords(candidate) * sizeof(uint64_t) << " instead of "
+    << delta_words * sizeof(uint64_t) << " bytes\n";
+  }
+  statistics.keyframes_chosen++;
+  record = candidate;
+  return true;
+}
+
+int chainDelta(CompressionContext &context, const FlatTree * reference, const ClusterIndex * reference_clusters,
+          const FlatTree &tree, EncodedRecord &record, int flags) {
+  if (reference == NULL) {
+    return simpleCompression(tree, record, flags, context.scratch);
+  }
+  int result = rfDistanceCompression(*reference, *reference_clusters, tree, record, flags, context.scratch);
+  if (result < 0) {
+    return result;
+  }
+  sprInsteadOfDelta(context, *reference, *reference_clusters, tree, record, flags);
+  if (!context.deduplicate_topologies || sameTopology(*reference, tree)) {
+    keyframeInsteadOfDelta(context, tree, record, flags);
+  }
+  return 0;
+}
 
-  /* clean */
-  //pll_utree_destroy_consensus (tree1);
+void chainDictionary(CompressionContext &context, const FlatTree * reference, const FlatTree &tree,
+          EncodedRecord &record, int flags) {
+  if (!context.deduplicate_topologies) {
+    // nothing to do
+  } else if (reference == NULL) {
+    addKeyframe(context, tree, findTopology(context, tree));
+  } else if (!sameTopology(*reference, tree)) {
+    uint32_t entry = findTopology(context, tree);
+    if (entry == UINT32_MAX) {
+      // new topology
+      entry = context.topologies.insert(tree.topology_hash, TOPOLOGY_NONE);
+      context.shape_offsets.push_back(SIZE_MAX);
+      if (keyframeInsteadOfDelta(context, tree, record, flags)) {
+        addKeyframe(context, tree, entry);
+      }
+    } else {
+      // revisited topology: a keyframe (for the next visits) or a reference to
+      // the keyframe is used instead of the delta if it is not larger
+      EncodedRecord &candidate = context.candidate;
+      bool keyframe = context.topologies.keyframes[entry] == TOPOLOGY_NONE;
+      if (keyframe) {
+        simpleCompression(tree, candidate, 0, context.scratch);
+      } else {
+        topologyCompression(tree, context.topologies.keyframes[entry], candidate, 0);
+      }
+      if (recordWords(candidate) <= recordWords(record)) {
+        record = candidate;
+        if (keyframe) {
+          addKeyframe(context, tree, entry);
+        }
+      }
+    }
+  }
+
+  if (!isKeyframe(record.kind) && context.keyframe_interval > 0
+        && context.record_index - context.last_keyframe >= context.keyframe_interval) {
+    // too far from the last keyframe: a reference to the keyframe of the
+    // topology if there is one, the simple compression otherwise
+    uint32_t entry = context.deduplicate_topologies ? findTopology(context, tree) : UINT32_MAX;
+    if (entry != UINT32_MAX && context.topologies.keyframes[entry] != TOPOLOGY_NONE) {
+      topologyCompression(tree, context.topologies.keyframes[entry], record, 0);
+    } else {
+      simpleCompression(tree, record, 0, context.scratch);
+      if (context.deduplicate_topologies) {
+        addKeyframe(context, tree, entry);
+      }
+    }
+    context.statistics.keyframes_forced++;
+  }
+  if (isKeyframe(record.kind)) {
+    context.last_keyframe = context.record_index;
+  }
+  context.record_index++;
+  context.statistics.records[record.kind]++;
+  context.statistics.words[record.kind] += recordWords(record);
+}
 
-  traverseTree(root1, free_leaf, free_inner_node);
-  free(tree1->nodes);
-  free(tree1);
-  pll_utree_destroy (tree2, NULL);
+int chain_compression(const char * tree_file, CompressionContext &context, EncodedRecord &record, int flags) {
+  /* parse the input tree */
+  if(parseFlatTree(tree_file, context.next, context.scratch.flat) < 0) {
+      // ERROR: tree could not be parsed
+      return -1;
+  }
+  return chainNext(context, record, flags);
+}
 
-  free(node_id_to_branch_id1);
-  free(node_id_to_branch_id2);
-  free(consensus_node_id_to_branch_id);
-  free(s1_present);
-  free(s2_present);
+int chainNext(CompressionContext &context, EncodedRecord &record, int flags) {
+  FlatTree &tree = context.next;
 
+  const FlatTree * reference = context.has_reference ? &context.reference : NULL;
+  if (chainDelta(context, reference, &context.reference_clusters, tree, record, flags) < 0) {
+    return -1;
+  }
+  chainDictionary(context, reference, tree, record, flags);
+
+  // the tree is the reference of the next one: keep its canonical form and
+  // splits (the buffers of the old reference are reused for the next tree);
+  // the splits only change with the topology
+  std::swap(context.reference, context.next);
+  if (record.kind != RECORD_REPEAT && record.kind != RECORD_BRANCH_LENGTHS) {
+    indexClusters(context.reference, context.reference_clusters, context.scratch.flat);
+  }
+  context.has_reference = true;
   return 0;
 }
+
+void CompressionStatistics::add(const CompressionStatistics &other) {
+  for (unsigned int kind = 0; kind < ARCHIVE_RECORD_KINDS; kind++) {
+    records[kind] += other.records[kind];
+    words[kind] += other.words[kind];
+  }
+  keyframe_trials += other.keyframe_trials;
+  keyframes_chosen += other.keyframes_chosen;
+  keyframe_estimates += other.keyframe_estimates;
+  keyframes_forced += other.keyframes_forced;
+}
+
+void printCompressionStatistics(const CompressionStatistics &statistics) {
+  static const char * names[ARCHIVE_RECORD_KINDS] = {"simple", "rf delta", "repeat", "branch lengths",
+    "topology reference", "split dictionary", "splits", "subtree DAG", "DAG tree", "SPR moves"};
+  size_t records = 0;
+  size_t words = 0;
+  for (unsigned int kind = 0; kind < ARCHIVE_RECORD_KINDS; kind++) {
+    if (statistics.records[kind] > 0) {
+      std::cout << names[kind] << ": " << statistics.records[kind] << " records, "
+      << statistics.words[kind] * sizeof(uint64_t) << " bytes\n";
+    }
+    records += statistics.records[kind];
+    words += statistics.words[kind];
+  }
+  std::cout << "total: " << records << " records, " << words * sizeof(uint64_t) << " bytes\n";
+  std::cout << "simple instead of delta: " << statistics.keyframes_chosen << " of " << statistics.keyframe_trials
+  << " tried (" << statistics.keyframe_estimates << " deltas kept by the estimate)\n";
+  std::cout << "keyframes forced by the interval: " << statistics.keyframes_forced << "\n";
+}
@@ -18,10 +18,17 @@ extern "C" {
 #include <sdsl/select_support_mcl.hpp>
 #include <sdsl/wavelet_trees.hpp>
 #include <algorithm>
+#include <string>
+#include <unordered_map>
 
 #include "util.h"
 
 #include "uncompress_functions.h"
+#include "archive.h"
+#include "flat_tree.h"
+#include "topology_dictionary.h"
+#include "spr_moves.h"
+#include "topology_codec.h"
 
 enum Flags{
     // print out size that is needed to store the compression
@@ -38,13 +45,11 @@ enum Flags{
  * Takes a tree file and computes a simple compression of the tree.
  *
  * @param  tree_file               tree in newick format to compress
- * @param  succinct_structure_file file to store succinct structure
- * @param  node_permutation_file   file to store node permutation
+ * @param  record                  record to store the compressed tree
  * @param  flags                   flags
  * @return                         value < 0 in case of an eŕror
  */
-int simple_compression(const char * tree_file, const char * succinct_structure_file,
-        const char * node_permutation_file, const char * branch_lengths_file, int flags);
+int simple_compression(const char * tree_file, EncodedRecord &record, int flags);
 
 /**
  * Takes two tree files and computes a compression between the two
@@ -52,13 +57,249 @@ int simple_compression(const char * tree_file, const char * succinct_structure_f
  *
  * @param tree1_file             first tree in newick format
  * @param tree2_file             second tree in newick format
- * @param edges_to_contract_file file to store edges to contract
- * @param subtrees_succinct_file file to store subtrees succinct
- * @param node_permutations_file file to store node permutations
+ * @param record                 record to store the compressed second tree
  * @param flags                  flags
  * @return                       value < 0 in case of an eŕror
  */
  int rf_distance_compression(const char * tree1_file, const char * tree2_file,
-         const char * edges_to_contract_file, const char * subtrees_succinct_file,
-         const char * node_permutations_file, const char * branch_lengths_consensus_file,
-         const char * branch_lengths_non_consensus, int flags);
+         EncodedRecord &record, int flags);
+
+/**
+ * Buffers of the rf distance and the simple compression. All of them are
+ * reserved for the largest number of taxa seen so far, so compressing further
+ * pairs of trees with as many taxa does not allocate (the encoders write into
+ * the sections of a reused record, see resetRecord).
+ */
+struct CompressionScratch {
+  FlatTreeScratch flat;
+
+  // node of tree 1 with the same split as each node of tree 2
+  std::vector<uint32_t> match;
+  // the branches of tree 1 that are contracted to get the consensus tree
+  std::vector<bool> contracted;
+  std::vector<uint64_t> edges_to_contract;
+  std::vector<double> consensus_branches;
+  std::vector<uint32_t> tasks;
+
+  // rf subtrees of tree 2: subtree i consists of the entries
+  // [subtree_start[i], subtree_start[i + 1]) of subtree_bits, and so on
+  std::vector<uint8_t> subtree_bits;
+  std::vector<size_t> subtree_start;
+  std::vector<uint32_t> subtree_leaves;
+  std::vector<size_t> leaves_start;
+  std::vector<double> subtree_branches;
+  std::vector<size_t> branches_start;
+
+  // children sets of the multifurcating nodes of the consensus tree
+  std::vector<uint32_t> consensus_children;
+  std::vector<uint32_t> consensus_sets;
+  std::vector<size_t> consensus_start;
+
+  // matching of the children sets
+  std::vector<uint64_t> set_hashes;
+  std::vector<uint32_t> set_ids;
+  std::vector<uint32_t> position;
+  std::vector<uint32_t> stamp;
+  std::vector<uint32_t> match_index;
+  std::vector<uint32_t> permutations;
+  std::vector<unsigned int> permutation_sizes;
+  std::vector<double> non_consensus_branches;
+
+  // rf subtrees stored as moves (see findSubtreeMoves): root of each rf
+  // subtree in tree 2, the nodes of tree 2 that are not in tree 1, the
+  // subtrees (by their children set) and their moves
+  std::vector<uint32_t> subtree_roots;
+  std::vector<bool> unmatched;
+  std::vector<bool> moved_subtrees;
+  std::vector<uint64_t> subtree_moves;
+  SprScratch spr;
+
+  // the rf subtrees that are stored explicitly, in words
+  std::vector<uint64_t> subtrees_succinct;
+  TopologyScratch topology;
+
+  // structures of the simple compression
+  sdsl::bit_vector succinct_structure;
+  sdsl::int_vector<> node_permutation = sdsl::int_vector<>(0, 0, 32);
+  std::vector<double> branch_lengths;
+
+  size_t reserved_tips = 0;
+
+  /**
+   * Reserves all buffers for trees with the given number of taxa (does
+   * nothing if they are already large enough).
+   */
+  void reserve(size_t tip_count);
+};
+
+/**
+ * Simple compression of a parsed tree (see simple_compression).
+ * @param scratch buffers
+ */
+int simpleCompression(const FlatTree &tree, EncodedRecord &record, int flags, CompressionScratch &scratch);
+
+/**
+ * Rf distance compression of tree2 relative to tree1 (see rf_distance_compression).
+ * If both trees have the same topology, a repeat record or a branch length
+ * record is stored instead of an rf delta.
+ * @param clusters1 split set of tree1 (indexClusters)
+ * @param scratch   buffers
+ */
+int rfDistanceCompression(const FlatTree &tree1, const ClusterIndex &clusters1, const FlatTree &tree2,
+        EncodedRecord &record, int flags, CompressionScratch &scratch);
+
+/**
+ * Compression of a tree whose topology is stored in an earlier simple
+ * compression: the index of that record and the branch lengths of the tree.
+ * @param keyframe index of the record that stores the topology
+ */
+int topologyCompression(const FlatTree &tree, uint64_t keyframe, EncodedRecord &record, int flags);
+
+/**
+ * Decisions taken while compressing a chain: the records written of each kind
+ * and their size, and how often a delta was checked against (and replaced by)
+ * a simple compression.
+ */
+struct CompressionStatistics {
+  size_t records[ARCHIVE_RECORD_KINDS] = {0};
+  size_t words[ARCHIVE_RECORD_KINDS] = {0};
+
+  // deltas whose simple compression was encoded as it may be smaller, those
+  // replaced by it, and deltas that were kept without encoding it
+  size_t keyframe_trials = 0;
+  size_t keyframes_chosen = 0;
+  size_t keyframe_estimates = 0;
+
+  // deltas replaced by a keyframe as the last one was KEYFRAME_INTERVAL
+  // records before
+  size_t keyframes_forced = 0;
+
+  /**
+   * Adds the statistics of another part of the chain.
+   */
+  void add(const CompressionStatistics &other);
+};
+
+/**
+ * Prints the statistics of a chain (the run report).
+ */
+void printCompressionStatistics(const CompressionStatistics &statistics);
+
+// a chain stores a keyframe at least every KEYFRAME_INTERVAL records (the
+// segments of an export start at keyframes, see EXPORT_SEGMENT_RECORDS)
+#define KEYFRAME_INTERVAL 256
+
+/**
+ * State carried from one tree of a chain to the next: the last compressed
+ * tree in canonical form and its split set. Every tree of a chain is parsed,
+ * canonicalised and split only once.
+ *
+ * The context also holds the topology dictionary of the chain. When a
+ * topology is revisited (not by the next tree), it is stored as a simple
+ * compression; further trees with this topology are stored as a reference to
+ * it plus their branch lengths. Either is only used if its record is not
+ * larger than the rf delta to the predecessor.
+ *
+ * A delta of a tree that differs a lot from its predecessor can be larger than
+ * the simple compression of the tree; the tree is then stored as a simple
+ * compression (a keyframe) instead. A keyframe is also stored after
+ * keyframe_interval records without one, such that an archive can be decoded
+ * from many points at once (see export_archive).
+ *
+ * The context owns all buffers of the compression and should be reused for a
+ * whole chain, as should the record passed to it: once they have seen a tree
+ * with the most taxa, compressing a tree does not allocate (parsing a tree
+ * from newick still does, and the topology dictionary grows with every new
+ * topology).
+ */
+struct CompressionContext {
+  // the last compressed tree; the next tree is stored relative to it
+  FlatTree reference;
+  ClusterIndex reference_clusters;
+  bool has_reference = false;
+
+  // the tree being compressed, swapped with reference afterwards
+  FlatTree next;
+  CompressionScratch scratch;
+
+  // a record that may replace the delta (SPR moves, keyframe, topology
+  // reference); copied into the record if it does, such that both keep their
+  // memory
+  EncodedRecord candidate;
+
+  // index of the next record in the archive; to be set if the chain does not
+  // start the archive
+  uint64_t record_index = 0;
+
+  // topology dictionary; for each entry with a keyframe the offset of its
+  // shape (number of nodes, taxa and subtree sizes in dfs) in keyframe_shapes,
+  // SIZE_MAX for the other entries
+  bool deduplicate_topologies = true;
+  TopologyDictionary topologies;
+  std::vector<size_t> shape_offsets;
+  std::vector<uint32_t> keyframe_shapes;
+
+  // an rf delta is replaced by SPR moves if they are found within
+  // spr_evaluations candidate moves and their record is smaller; spr_moves is
+  // the largest number of moves (0 disables the search)
+  size_t spr_moves = 2;
+  size_t spr_evaluations = SPR_EVALUATIONS;
+  SprScratch spr;
+
+  // a delta is replaced by a simple compression if that is smaller
+  bool adaptive_keyframes = true;
+
+  // largest number of records from one keyframe to the next (0: no limit) and
+  // index of the last keyframe
+  size_t keyframe_interval = KEYFRAME_INTERVAL;
+  uint64_t last_keyframe = 0;
+  CompressionStatistics statistics;
+};
+
+/**
+ * Compresses the next tree of a chain: the first tree with simple compression,
+ * each further tree with rf distance compression (or SPR moves) relative to its
+ * predecessor or, if its topology was seen before, through the topology
+ * dictionary.
+ *
+ * @param tree_file              tree in newick format
+ * @param context                state of the chain, updated to the given tree
+ * @param record                 record to store the compressed tree
+ * @param flags                  flags
+ * @return                       value < 0 in case of an eŕror
+ */
+int chain_compression(const char * tree_file, CompressionContext &context, EncodedRecord &record, int flags);
+
+/**
+ * Compresses the tree in context.next as the next tree of a chain (see
+ * chain_compression), for trees that do not come from a file.
+ * @param  context state of the chain, updated to the tree
+ * @param  record  record to store the compressed tree
+ * @param  flags   flags
+ * @return         value < 0 in case of an error
+ */
+int chainNext(CompressionContext &context, EncodedRecord &record, int flags);
+
+/**
+ * The part of chain_compression that only depends on the tree and its
+ * predecessor: the rf delta, or SPR moves or a simple compression if that is
+ * smaller (the simple compression for the first tree). Uses the settings and
+ * buffers of the context; a tree whose topology differs from the one of its
+ * predecessor still has to go through chainDictionary.
+ * @param  reference          the predecessor, NULL for the first tree
+ * @param  reference_clusters split set of the predecessor
+ * @return                    value < 0 in case of an error
+ */
+int chainDelta(CompressionContext &context, const FlatTree * reference, const ClusterIndex * reference_clusters,
+          const FlatTree &tree, EncodedRecord &record, int flags);
+
+/**
+ * The part of chain_compression that has to run in the order of the trees:
+ * the topology dictionary may replace the record of chainDelta by a
+ * keyframe or a topology reference, and a delta is replaced by a keyframe once
+ * keyframe_interval records were written since the last one. Advances the
+ * record index and counts the record in the statistics.
+ * @param reference the predecessor, NULL for the first tree
+ */
+void chainDictionary(CompressionContext &context, const FlatTree * reference, const FlatTree &tree,
+          EncodedRecord &record, int flags);
@@ -1,196 +1,271 @@
 #include "datastructure_compression_functions.h"
+#include "int_codec.h"
+#include "permutation_codec.h"
+#include "topology_codec.h"
 
-size_t writeDoubleVectorUncompressed(const std::vector<double>& myVector, std::string filename) {
-  std::ofstream ofs(filename, std::ios::out | std::ofstream::binary);
-  std::ostream_iterator<char> osi{ ofs };
-  const char* beginByte = (char*)&myVector[0];
-
-  const char* endByte = (char*)&myVector.back() + sizeof(double);
-  std::copy(beginByte, endByte, osi);
-
-  return myVector.size() * 8;
-}
-
-std::vector<double> readDoubleVectorUncompressed(std::string filename) {
-  std::vector<char> buffer{};
-  std::ifstream ifs(filename, std::ios::in | std::ifstream::binary);
-  std::istreambuf_iterator<char> iter(ifs);
-  std::istreambuf_iterator<char> end{};
-  std::copy(iter, end, std::back_inserter(buffer));
-  std::vector<double> newVector(buffer.size() / sizeof(double));
-  memcpy(&newVector[0], &buffer[0], buffer.size());
-  return newVector;
-}
-
-uint64_t enc(double x, size_t precision) {
+int64_t quantiseBranchLength(double x, size_t precision) {
     double expo = 1;
     for (size_t i=0; i<precision; ++i) {
       expo *= 10;
     }
-
-    int64_t y;
-    uint64_t z;
-    y = llround(x*expo);
-    if ( y < 0 ) {
-        z = 2*static_cast<uint64_t>(-y)-1;
-    } else {
-        z = 2*static_cast<uint64_t>(y);
-    }
-    return z;
+    return llround(x*expo);
 }
 
-double dec(uint64_t z, size_t precision) {
+double dequantiseBranchLength(int64_t y, size_t precision) {
     double expo = 1;
     for (size_t i=0; i<precision; ++i) {
       expo *= 10;
     }
-
-    int64_t y;
-    if ( z % 2 ) {
-        y = -static_cast<int64_t>((z+1)/2);
-    } else {
-        y = static_cast<int64_t>(z/2);
-    }
     return (static_cast<double>(y))/expo;
 }
 
-size_t compressBranchLengthsAndStore(std::vector<double> branch_lengths, std::string filename) {
-  std::vector<uint64_t> vec;
-
-  uint64_t z;
-  for (size_t i = 0; i < branch_lengths.size(); i++) {
-    z = enc(branch_lengths[i], PRECISION);
-    vec.push_back(z);
-  }
-
-  uint64_t max_number = *max_element(vec.begin(), vec.end());
-  uint32_t width = sdsl::bits::hi(max_number);
-
-  sdsl::int_vector<0> seq(branch_lengths.size(), 0, width+1);
+/**
+ * Sets the length of a section encoded with the integer codec and returns its
+ * size in bytes.
+ */
+size_t finishIntSection(EncodedSection &section) {
+    section.length = section.words.size();
+    return section.words.size() * sizeof(uint64_t);
+}
 
-  for (size_t i=0; i<vec.size(); ++i) {
-       seq[i] = vec[i];
-  }
+/**
+ * Encodes the given values with the integer codec.
+ */
+size_t encodeIntSection(const std::vector<uint64_t> &values, IntCodecVariant variant, EncodedSection &section) {
+    encodeInts(values, variant, section.words);
+    return finishIntSection(section);
+}
 
-  sdsl::wt_int<sdsl::rrr_vector<63>> wt;
-  sdsl::construct_im(wt, seq);
+/**
+ * Decodes a section encoded with encodeIntSection.
+ */
+std::vector<uint64_t> decodeIntSection(const SectionView &section) {
+    if (section.n_words == 0) {
+      return std::vector<uint64_t>();
+    }
 
-  sdsl::store_to_file(wt, filename);
+    std::vector<uint64_t> values(intCount(section.words));
+    decodeInts(section.words, section.n_words, values.data());
+    return values;
+}
 
-  return sdsl::size_in_bytes(wt);
+sdsl::int_vector<> toIntVector(const std::vector<uint64_t> &values) {
+    sdsl::int_vector<> seq(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+      seq[i] = values[i];
+    }
+    sdsl::util::bit_compress(seq);
+    return seq;
 }
 
-std::vector<double> uncompressBranchLengthsWV(std::string filename) {
-  sdsl::wt_int<sdsl::rrr_vector<63>> loaded_wt;
-  sdsl::load_from_file(loaded_wt, filename);
+size_t compressSuccinctStructure(const uint64_t * succinct_structure, size_t bits, TopologyScratch &scratch,
+              EncodedSection &section) {
+    encodeTopology(succinct_structure, bits, scratch);
 
-  std::vector<double> loaded(loaded_wt.size());
-  for (size_t i = 0; i < loaded_wt.size(); i++) {
-    loaded[i] = dec(loaded_wt[i], PRECISION);
-  }
+    section.length = scratch.out.size();
+    section.words.assign((scratch.out.size() + 7) / 8, 0);
+    memcpy(section.words.data(), scratch.out.data(), scratch.out.size());
+    return section.words.size() * sizeof(uint64_t);
+}
 
-  return loaded;
+size_t compressSimplePermutation(const sdsl::int_vector<> &permutation, EncodedSection &section) {
+    IntEncoder encoder(section.words, INT_CODEC_PLAIN);
+    for (auto value: permutation) {
+      encoder.add(value);
+    }
+    encoder.finish();
+    return finishIntSection(section);
 }
 
+size_t compressRFEdgesToContract(const std::vector<uint64_t> &edges_to_contract, EncodedSection &section) {
+    // edges_to_contract is sorted, the codec stores the gaps
+    return encodeIntSection(edges_to_contract, INT_CODEC_DELTA, section);
+}
 
-size_t compressAndStoreSuccinctStructure(sdsl::bit_vector &succinct_structure, std::string filename) {
+size_t compressRFSubtreeDirectory(const uint64_t * subtrees_succinct, size_t bits, EncodedSection &section) {
+    // prefix sums of the numbers of leaves of the subtrees; a subtree with k
+    // leaves takes 4k - 2 bits
+    IntEncoder encoder(section.words, INT_CODEC_DELTA);
+    encoder.add(0);
+    size_t start = 0;
+    size_t depth = 0;
+    for (size_t i = 0; i < bits; i++) {
+        if (((subtrees_succinct[i >> 6] >> (i & 0x3F)) & 1) == 0) {
+            depth++;
+        } else {
+            assert(depth > 0);
+            depth--;
+            if (depth == 0) {
+                assert((i - start + 3) % 4 == 0);
+                encoder.add(encoder.previous + (i - start + 3) / 4);
+                start = i + 1;
+            }
+        }
+    }
+    assert(depth == 0);
+    encoder.finish();
+    return finishIntSection(section);
+}
 
-  auto size = sdsl::size_in_bytes(succinct_structure);
-  store_to_file(succinct_structure, filename);
+size_t compressRFSubtreePermutations(const std::vector<uint32_t> &subtree_permutations,
+              const std::vector<unsigned int> &permutation_sizes, EncodedSection &section) {
+    section.length = encodePermutations(subtree_permutations, permutation_sizes, section.words);
+    return section.words.size() * sizeof(uint64_t);
+}
 
-  return size;
+size_t compressBranchLengths(const std::vector<double> &branch_lengths, EncodedSection &section) {
+    // the lengths are quantised while they are encoded
+    IntEncoder encoder(section.words, INT_CODEC_ZIGZAG);
+    for (auto length: branch_lengths) {
+      encoder.add(quantiseBranchLength(length, PRECISION));
+    }
+    encoder.finish();
+    return finishIntSection(section);
 }
 
-size_t compressAndStoreSimplePermutation(sdsl::int_vector<> &permutation, std::string filename) {
-    // TODO: compress
+size_t compressTopologyId(uint64_t record, EncodedSection &section) {
+    IntEncoder encoder(section.words, INT_CODEC_PLAIN);
+    encoder.add(record);
+    encoder.finish();
+    return finishIntSection(section);
+}
 
-    sdsl::util::bit_compress(permutation);
-    auto size = sdsl::size_in_bytes(permutation);
+size_t compressSplits(const std::vector<uint64_t> &splits, EncodedSection &section) {
+    section.words = splits;
+    section.length = splits.size();
+    return section.words.size() * sizeof(uint64_t);
+}
 
-    store_to_file(permutation, filename);
+size_t compressSplitCounts(const std::vector<uint64_t> &values, EncodedSection &section) {
+    return encodeIntSection(values, INT_CODEC_PLAIN, section);
+}
 
-    return size;
+size_t compressSplitDictionaryOffset(uint64_t offset, EncodedSection &section) {
+    IntEncoder encoder(section.words, INT_CODEC_PLAIN);
+    encoder.add(offset);
+    encoder.finish();
+    return finishIntSection(section);
 }
 
-size_t compressAndStoreRFEdgesToContract(sdsl::int_vector<> &edges_to_contract, std::string filename) {
-    std::vector<uint64_t> vec;
-    vec.push_back(edges_to_contract[0]);
-    for (size_t i = 0; i < edges_to_contract.size()-1; i++) {
-        vec.push_back(edges_to_contract[i+1]-edges_to_contract[i]);
+size_t compressSplitBitmap(const std::vector<uint64_t> &ids, uint64_t frequent, EncodedSection &section) {
+    section.words.assign((frequent + 63) / 64, 0);
+    section.length = frequent;
+    for (auto id: ids) {
+      if (id >= frequent) {
+        break;
+      }
+      section.words[id / 64] |= 1ULL << (id % 64);
     }
+    return section.words.size() * sizeof(uint64_t);
+}
 
-    uint64_t max_number = *max_element(vec.begin(), vec.end());
-    uint32_t width = sdsl::bits::hi(max_number);
-
-    sdsl::int_vector<0> seq(edges_to_contract.size(), 0, width+1);
+size_t compressSplitIds(const std::vector<uint64_t> &ids, EncodedSection &section) {
+    return encodeIntSection(ids, INT_CODEC_DELTA, section);
+}
 
-    for (size_t i=0; i<vec.size(); ++i) {
-       seq[i] = vec[i];
-    }
+size_t compressDagNodes(const std::vector<uint64_t> &values, EncodedSection &section) {
+    return encodeIntSection(values, INT_CODEC_PLAIN, section);
+}
 
-    sdsl::util::bit_compress(seq);
+size_t compressDagReference(uint64_t offset, uint64_t root, EncodedSection &section) {
+    IntEncoder encoder(section.words, INT_CODEC_PLAIN);
+    encoder.add(offset);
+    encoder.add(root);
+    encoder.finish();
+    return finishIntSection(section);
+}
 
-    auto size = sdsl::size_in_bytes(seq);    
-    store_to_file(seq, filename);
+size_t compressSprMoves(const std::vector<uint64_t> &moves, EncodedSection &section) {
+    return encodeIntSection(moves, INT_CODEC_PLAIN, section);
+}
 
-    return size;
+size_t compressRFSubtreeMoves(const std::vector<uint64_t> &subtree_moves, EncodedSection &section) {
+    return encodeIntSection(subtree_moves, INT_CODEC_PLAIN, section);
 }
 
-size_t compressAndStoreRFSubtreePermutations(sdsl::int_vector<> &subtree_permutations, std::string filename) {
-    sdsl::util::bit_compress(subtree_permutations);
-    auto size = sdsl::size_in_bytes(subtree_permutations);
 
-    store_to_file(subtree_permutations, filename);
 
-    return size;
+sdsl::bit_vector uncompressSuccinctStructure(const SectionView &section) {
+    return decodeTopology((const uint8_t *) section.words, section.length);
 }
 
-size_t compressAndStoreBranchLengths(std::vector<double> branch_lengths, std::string filename) {
-    return compressBranchLengthsAndStore(branch_lengths, filename);
+sdsl::int_vector<> uncompressSimplePermutation(const SectionView &section) {
+    return toIntVector(decodeIntSection(section));
 }
 
+sdsl::int_vector<> uncompressRFEdgesToContract(const SectionView &section) {
+    return toIntVector(decodeIntSection(section));
+}
 
-
-sdsl::bit_vector uncompressSuccinctStructure(std::string filename) {
-    sdsl::bit_vector succinct_tree_loaded;
-    load_from_file(succinct_tree_loaded, filename);
-    return succinct_tree_loaded;
+std::vector<uint64_t> uncompressRFSubtreeDirectory(const SectionView &section) {
+    std::vector<uint64_t> subtree_offsets = decodeIntSection(section);
+    if (subtree_offsets.empty()) {
+      // no subtrees
+      subtree_offsets.push_back(0);
+    }
+    return subtree_offsets;
 }
 
-sdsl::int_vector<> uncompressSimplePermutation(std::string filename) {
-    sdsl::int_vector<> node_permutation_loaded;
-    load_from_file(node_permutation_loaded, filename);
-    return node_permutation_loaded;
+sdsl::int_vector<> uncompressRFSubtreePermutations(const SectionView &section, const std::vector<uint64_t> &subtree_offsets) {
+    std::vector<unsigned int> leaf_counts;
+    for (size_t i = 0; i + 1 < subtree_offsets.size(); i++) {
+      leaf_counts.push_back(subtree_offsets[i + 1] - subtree_offsets[i]);
+    }
+    return decodePermutations(section.words, section.length, leaf_counts);
 }
 
-sdsl::int_vector<> uncompressRFEdgesToContract(std::string filename) {
-    sdsl::int_vector<> edges_to_contract_loaded;
-    load_from_file(edges_to_contract_loaded, filename);
+std::vector<double> uncompressBranchLengths(const SectionView &section) {
+    std::vector<uint64_t> values = decodeIntSection(section);
 
-    std::vector<uint64_t> vec;
-    vec.push_back(edges_to_contract_loaded[0]);
-    for (size_t i = 1; i < edges_to_contract_loaded.size(); i++) {
-        vec.push_back(vec[i-1] + edges_to_contract_loaded[i]);
+    std::vector<double> branch_lengths(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+      branch_lengths[i] = dequantiseBranchLength(values[i], PRECISION);
     }
+    return branch_lengths;
+}
+
+uint64_t uncompressTopologyId(const SectionView &section) {
+    std::vector<uint64_t> values = decodeIntSection(section);
+    assert(values.size() == 1);
+    return values[0];
+}
 
-    uint64_t max_number = *max_element(vec.begin(), vec.end());
-    uint32_t width = sdsl::bits::hi(max_number);
+std::vector<uint64_t> uncompressSplitCounts(const SectionView &section) {
+    return decodeIntSection(section);
+}
 
-    sdsl::int_vector<0> seq(edges_to_contract_loaded.size(), 0, width+1);
+uint64_t uncompressSplitDictionaryOffset(const SectionView &section) {
+    std::vector<uint64_t> values = decodeIntSection(section);
+    assert(values.size() == 1);
+    return values[0];
+}
 
-    for (size_t i=0; i<vec.size(); ++i) {
-       seq[i] = vec[i];
+std::vector<uint64_t> uncompressSplitIds(const SectionView &bitmap, const SectionView &ids) {
+    std::vector<uint64_t> values;
+    for (size_t w = 0; w < bitmap.n_words; w++) {
+      for (uint64_t bits = bitmap.words[w]; bits != 0; bits &= bits - 1) {
+        values.push_back(64 * w + __builtin_ctzll(bits));
+      }
     }
+    std::vector<uint64_t> rest = decodeIntSection(ids);
+    values.insert(values.end(), rest.begin(), rest.end());
+    return values;
+}
 
-    return seq;
+std::vector<uint64_t> uncompressDagNodes(const SectionView &section) {
+    return decodeIntSection(section);
+}
+
+std::pair<uint64_t, uint64_t> uncompressDagReference(const SectionView &section) {
+    std::vector<uint64_t> values = decodeIntSection(section);
+    assert(values.size() == 2);
+    return std::make_pair(values[0], values[1]);
 }
 
-sdsl::int_vector<> uncompressRFSubtreePermutations(std::string filename) {
-    sdsl::int_vector<> permutations_loaded;
-    load_from_file(permutations_loaded, filename);
-    return permutations_loaded;
+std::vector<uint64_t> uncompressSprMoves(const SectionView &section) {
+    return decodeIntSection(section);
 }
 
-std::vector<double> uncompressBranchLengths(std::string filename) {
-    return uncompressBranchLengthsWV(filename);
+std::vector<uint64_t> uncompressRFSubtreeMoves(const SectionView &section) {
+    return decodeIntSection(section);
 }
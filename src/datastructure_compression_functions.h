@@ -9,31 +9,178 @@
 #include <sdsl/wavelet_trees.hpp>
 #include <algorithm>
 
+#include "archive.h"
+#include "topology_codec.h"
+
 /**
- * This class contains methods to compress and store the individual data structures
- * as well as methods to decompress them.
+ * This class contains methods to compress the individual data structures into
+ * archive sections as well as methods to decompress them from section views.
+ * The compression methods write into the given section and keep its memory,
+ * so a record that is reused does not allocate once its sections are large
+ * enough.
  */
 
 // precision to use in compression of branch lengths (number of decimals)
 #define PRECISION 9
 
-size_t compressAndStoreSuccinctStructure(sdsl::bit_vector &succinct_structure, std::string filename);
+/**
+ * Compresses balanced parantheses of one or more shapes.
+ * @param  succinct_structure words of the balanced parantheses
+ * @param  bits               number of parantheses
+ * @param  scratch            buffers of the topology encoder
+ * @param  section            the compressed shapes are stored in it (the
+ *                            content of a section is always replaced)
+ * @return                    size of the section in bytes
+ */
+size_t compressSuccinctStructure(const uint64_t * succinct_structure, size_t bits, TopologyScratch &scratch,
+              EncodedSection &section);
+
+size_t compressSimplePermutation(const sdsl::int_vector<> &permutation, EncodedSection &section);
 
-size_t compressAndStoreSimplePermutation(sdsl::int_vector<> &permutation, std::string filename);
+size_t compressRFEdgesToContract(const std::vector<uint64_t> &edges_to_contract, EncodedSection &section);
+
+/**
+ * Compresses the directory of the subtrees of an RF delta: the prefix sums of
+ * the numbers of leaves of the subtrees.
+ * @param  subtrees_succinct words of the balanced parantheses of the subtrees
+ * @param  bits              number of parantheses
+ * @param  section           compressed directory
+ * @return                   size of the section in bytes
+ */
+size_t compressRFSubtreeDirectory(const uint64_t * subtrees_succinct, size_t bits, EncodedSection &section);
 
-size_t compressAndStoreRFEdgesToContract(sdsl::int_vector<> &edges_to_contract, std::string filename);
+size_t compressRFSubtreePermutations(const std::vector<uint32_t> &subtree_permutations,
+              const std::vector<unsigned int> &permutation_sizes, EncodedSection &section);
+
+size_t compressBranchLengths(const std::vector<double> &branch_lengths, EncodedSection &section);
+
+/**
+ * Compresses the reference of a topology record: the index of the record
+ * that stores the topology.
+ * @param  record  index of the record
+ * @param  section compressed reference
+ * @return         size of the section in bytes
+ */
+size_t compressTopologyId(uint64_t record, EncodedSection &section);
+
+/**
+ * Compresses the splits of a split dictionary: the bit sets one after another.
+ * @param  splits  bit sets of the splits
+ * @param  section compressed splits
+ * @return         size of the section in bytes
+ */
+size_t compressSplits(const std::vector<uint64_t> &splits, EncodedSection &section);
 
-size_t compressAndStoreRFSubtreePermutations(sdsl::int_vector<> &edges_to_contract, std::string filename);
+/**
+ * Compresses the header (taxa, trees, frequent splits) and the split counts
+ * of a split dictionary.
+ * @param  values  header followed by the counts
+ * @param  section compressed values
+ * @return         size of the section in bytes
+ */
+size_t compressSplitCounts(const std::vector<uint64_t> &values, EncodedSection &section);
 
-size_t compressAndStoreBranchLengths(std::vector<double> branch_lengths, std::string filename);
+/**
+ * Compresses the reference of a split record to its dictionary.
+ * @param  offset  offset of the dictionary record in words
+ * @param  section compressed reference
+ * @return         size of the section in bytes
+ */
+size_t compressSplitDictionaryOffset(uint64_t offset, EncodedSection &section);
 
+/**
+ * Compresses the split ids of a tree below frequent as a bitmap.
+ * @param  ids      sorted split ids
+ * @param  frequent number of frequent splits (length of the bitmap)
+ * @param  section  compressed bitmap
+ * @return          size of the section in bytes
+ */
+size_t compressSplitBitmap(const std::vector<uint64_t> &ids, uint64_t frequent, EncodedSection &section);
 
-sdsl::bit_vector uncompressSuccinctStructure(std::string filename);
+/**
+ * Compresses sorted split ids (gap coded).
+ * @param  ids     sorted split ids
+ * @param  section compressed ids
+ * @return         size of the section in bytes
+ */
+size_t compressSplitIds(const std::vector<uint64_t> &ids, EncodedSection &section);
 
-sdsl::int_vector<> uncompressSimplePermutation(std::string filename);
+/**
+ * Compresses the subtrees of a subtree DAG (see encodeSubtreeDag).
+ * @param  values  encoded subtrees
+ * @param  section compressed subtrees
+ * @return         size of the section in bytes
+ */
+size_t compressDagNodes(const std::vector<uint64_t> &values, EncodedSection &section);
 
-sdsl::int_vector<> uncompressRFEdgesToContract(std::string filename);
+/**
+ * Compresses the reference of a DAG tree to its subtree.
+ * @param  offset  offset of the DAG record in words
+ * @param  root    id of the subtree in the DAG
+ * @param  section compressed reference
+ * @return         size of the section in bytes
+ */
+size_t compressDagReference(uint64_t offset, uint64_t root, EncodedSection &section);
+
+/**
+ * Compresses SPR moves: the prune and the regraft branch of each move.
+ * @param  moves   branch ids, two per move
+ * @param  section compressed moves
+ * @return         size of the section in bytes
+ */
+size_t compressSprMoves(const std::vector<uint64_t> &moves, EncodedSection &section);
+
+/**
+ * Compresses the rf subtrees of a delta that are stored as SPR moves (see
+ * expandSubtreeMoves).
+ * @param  subtree_moves index gap, number of moves and moves of each subtree
+ * @param  section       compressed moves
+ * @return               size of the section in bytes
+ */
+size_t compressRFSubtreeMoves(const std::vector<uint64_t> &subtree_moves, EncodedSection &section);
+
+
+sdsl::bit_vector uncompressSuccinctStructure(const SectionView &section);
+
+sdsl::int_vector<> uncompressSimplePermutation(const SectionView &section);
+
+sdsl::int_vector<> uncompressRFEdgesToContract(const SectionView &section);
+
+/**
+ * Decompresses the directory of the subtrees of an RF delta.
+ * @param  section compressed directory
+ * @return         element i is the number of leaves in the subtrees before
+ *                 subtree i (one element per subtree + 1)
+ */
+std::vector<uint64_t> uncompressRFSubtreeDirectory(const SectionView &section);
+
+sdsl::int_vector<> uncompressRFSubtreePermutations(const SectionView &section, const std::vector<uint64_t> &subtree_offsets);
+
+std::vector<double> uncompressBranchLengths(const SectionView &section);
+
+uint64_t uncompressTopologyId(const SectionView &section);
+
+std::vector<uint64_t> uncompressSplitCounts(const SectionView &section);
+
+uint64_t uncompressSplitDictionaryOffset(const SectionView &section);
+
+/**
+ * Decompresses the split ids of a tree: the set bits of the bitmap followed
+ * by the gap coded ids.
+ * @param  bitmap compressed bitmap (may be empty)
+ * @param  ids    compressed ids (may be empty)
+ * @return        sorted split ids
+ */
+std::vector<uint64_t> uncompressSplitIds(const SectionView &bitmap, const SectionView &ids);
+
+std::vector<uint64_t> uncompressDagNodes(const SectionView &section);
+
+/**
+ * Decompresses the reference of a DAG tree.
+ * @return offset of the DAG record and id of the subtree
+ */
+std::pair<uint64_t, uint64_t> uncompressDagReference(const SectionView &section);
 
-sdsl::int_vector<> uncompressRFSubtreePermutations(std::string filename);
+std::vector<uint64_t> uncompressSprMoves(const SectionView &section);
 
-std::vector<double> uncompressBranchLengths(std::string filename);
+std::vector<uint64_t> uncompressRFSubtreeMoves(const SectionView &section);
@@ -0,0 +1,433 @@
+#include "flat_tree.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <mutex>
+
+#include "util.h"
+
+/*
+ * Orders the children of a node by their smallest taxon. Arity is the number of
+ * children if it is known at compile time, 0 otherwise.
+ */
+template <unsigned int Arity>
+inline void orderChildren(uint32_t * children, size_t count, const uint32_t * min_taxon) {
+  // polytomies are rare and small: insertion sort in place
+  for (size_t i = 1; i < count; i++) {
+    uint32_t child = children[i];
+    size_t j = i;
+    for (; j > 0 && min_taxon[children[j - 1]] > min_taxon[child]; j--) {
+      children[j] = children[j - 1];
+    }
+    children[j] = child;
+  }
+}
+
+template <>
+inline void orderChildren<2>(uint32_t * children, size_t count, const uint32_t * min_taxon) {
+  assert(count == 2);
+  uint32_t a = children[0];
+  uint32_t b = children[1];
+  uint32_t swap = -(uint32_t) (min_taxon[a] > min_taxon[b]);
+  children[0] = a ^ ((a ^ b) & swap);
+  children[1] = b ^ ((a ^ b) & swap);
+}
+
+/*
+ * Writes a bit vector word by word, the bits are appended in runs.
+ */
+struct BitWriter {
+  uint64_t * words;
+  uint64_t current = 0;
+  size_t position = 0;
+
+  BitWriter(sdsl::bit_vector &bv) : words(bv.data()) {}
+
+  void append(bool bit, size_t count) {
+    while (count > 0) {
+      size_t offset = position % 64;
+      size_t take = std::min(count, 64 - offset);
+      if (bit) {
+        current |= (take == 64 ? ~0ULL : ((1ULL << take) - 1)) << offset;
+      }
+      position += take;
+      count -= take;
+      if (position % 64 == 0) {
+        words[position / 64 - 1] = current;
+        current = 0;
+      }
+    }
+  }
+
+  void flush() {
+    if (position % 64 != 0) {
+      words[position / 64] = current;
+    }
+  }
+};
+
+void FlatTree::reserve(size_t nodes) {
+  parent.reserve(nodes);
+  first_child.reserve(nodes);
+  next_sibling.reserve(nodes);
+  taxon.reserve(nodes);
+  min_taxon.reserve(nodes);
+  subtree_size.reserve(nodes);
+  length.reserve(nodes);
+}
+
+void FlatTreeScratch::reserve(size_t nodes) {
+  unode.reserve(nodes);
+  parent.reserve(nodes);
+  taxon.reserve(nodes);
+  length.reserve(nodes);
+  min_taxon.reserve(nodes);
+  child_count.reserve(nodes + 1);
+  child_offset.reserve(nodes + 1);
+  children.reserve(nodes);
+  last_child.reserve(nodes);
+  stack.reserve(nodes);
+  order_stack.reserve(nodes);
+  first_rank.reserve(nodes);
+  leaf_count.reserve(nodes);
+  max_rank.reserve(nodes);
+}
+
+void flattenTree(const pll_unode_t * root, FlatTree &tree, FlatTreeScratch &scratch) {
+  assert(root != NULL);
+  assert(root->next == NULL);
+  assert(root->back != NULL);
+  assert(atoi(root->label) == 1);
+
+  // collect the nodes in depth-first order of the rings; node v is entered
+  // through unode[v], the unode pointing to its parent
+  std::vector<const pll_unode_t *> &unode = scratch.unode;
+  std::vector<uint32_t> &parent = scratch.parent;
+  std::vector<std::pair<const pll_unode_t *, uint32_t>> &stack = scratch.stack;
+  unode.assign(1, root);
+  parent.assign(1, FLAT_NONE);
+  stack.assign(1, std::make_pair(root->back, 0));
+  while (!stack.empty()) {
+    const pll_unode_t * node = stack.back().first;
+    uint32_t v = unode.size();
+    parent.push_back(stack.back().second);
+    unode.push_back(node);
+    stack.pop_back();
+
+    if (node->next != NULL) {
+      for (const pll_unode_t * child = node->next; child != node; child = child->next) {
+        assert(child != NULL);
+        stack.push_back(std::make_pair(child->back, v));
+      }
+    }
+  }
+  size_t n = unode.size();
+
+  std::vector<uint32_t> &taxon = scratch.taxon;
+  std::vector<double> &length = scratch.length;
+  taxon.assign(n, 0);
+  length.resize(n);
+  for (size_t v = 0; v < n; v++) {
+    if (unode[v]->next == NULL) {
+      taxon[v] = atoi(unode[v]->label);
+    }
+    length[v] = v == 0 ? 0 : unode[v]->length;
+  }
+
+  buildFlatTree(parent, taxon, length, tree, scratch);
+}
+
+void buildFlatTree(const std::vector<uint32_t> &parent, const std::vector<uint32_t> &taxon,
+          const std::vector<double> &length, FlatTree &tree, FlatTreeScratch &scratch) {
+  size_t n = parent.size();
+  assert(n >= 2 && taxon.size() == n && length.size() == n);
+  assert(parent[0] == FLAT_NONE && taxon[0] == 1);
+
+  // 1. the smallest taxon of each subtree (compare setTree)
+  std::vector<uint32_t> &min_taxon = scratch.min_taxon;
+  std::vector<uint32_t> &child_count = scratch.child_count;
+  min_taxon.assign(n, UINT32_MAX);
+  child_count.assign(n + 1, 0);
+  for (size_t v = 0; v < n; v++) {
+    if (taxon[v] != 0) {
+      min_taxon[v] = taxon[v];
+    }
+  }
+  for (size_t v = n - 1; v > 0; v--) {
+    assert(parent[v] < v);
+    min_taxon[parent[v]] = std::min(min_taxon[parent[v]], min_taxon[v]);
+    child_count[parent[v]]++;
+  }
+
+  // 2. children of each node, ordered by their smallest taxon (compare orderTree)
+  std::vector<uint32_t> &child_offset = scratch.child_offset;
+  std::vector<uint32_t> &children = scratch.children;
+  child_offset.assign(n + 1, 0);
+  for (size_t v = 0; v < n; v++) {
+    child_offset[v + 1] = child_offset[v] + child_count[v];
+  }
+  children.resize(n - 1);
+  std::fill(child_count.begin(), child_count.end(), 0);
+  for (size_t v = 1; v < n; v++) {
+    children[child_offset[parent[v]] + child_count[parent[v]]++] = v;
+  }
+  for (size_t v = 0; v < n; v++) {
+    size_t count = child_offset[v + 1] - child_offset[v];
+    if (count == 2) {
+      orderChildren<2>(children.data() + child_offset[v], count, min_taxon.data());
+    } else if (count > 2) {
+      orderChildren<0>(children.data() + child_offset[v], count, min_taxon.data());
+    }
+  }
+
+  // 3. renumber the nodes in the ordered depth-first order
+  tree.parent.resize(n);
+  tree.first_child.assign(n, FLAT_NONE);
+  tree.next_sibling.assign(n, FLAT_NONE);
+  tree.taxon.resize(n);
+  tree.min_taxon.resize(n);
+  tree.subtree_size.assign(n, 1);
+  tree.length.resize(n);
+  tree.tip_count = 0;
+
+  std::vector<uint32_t> &last_child = scratch.last_child;
+  std::vector<std::pair<uint32_t, uint32_t>> &order_stack = scratch.order_stack;
+  last_child.assign(n, FLAT_NONE);
+  order_stack.assign(1, std::make_pair(0, FLAT_NONE));
+  uint32_t next_id = 0;
+  while (!order_stack.empty()) {
+    uint32_t old_v = order_stack.back().first;
+    uint32_t p = order_stack.back().second;
+    order_stack.pop_back();
+
+    uint32_t v = next_id++;
+    tree.parent[v] = p;
+    tree.taxon[v] = taxon[old_v];
+    tree.min_taxon[v] = min_taxon[old_v];
+    tree.length[v] = length[old_v];
+    if (p != FLAT_NONE) {
+      if (last_child[p] == FLAT_NONE) {
+        tree.first_child[p] = v;
+      } else {
+        tree.next_sibling[last_child[p]] = v;
+      }
+      last_child[p] = v;
+    }
+    for (uint32_t i = child_offset[old_v + 1]; i > child_offset[old_v]; i--) {
+      order_stack.push_back(std::make_pair(children[i - 1], v));
+    }
+  }
+  assert(next_id == n);
+
+  for (size_t v = n - 1; v > 0; v--) {
+    tree.subtree_size[tree.parent[v]] += tree.subtree_size[v];
+  }
+
+  // the depth-first order is canonical: the taxa and the subtree sizes in
+  // this order determine the topology
+  uint64_t hash = 0;
+  for (size_t v = 0; v < n; v++) {
+    if (tree.taxon[v] != 0) {
+      tree.tip_count++;
+    }
+    hash = (hash ^ ((uint64_t) tree.taxon[v] << 32 | tree.subtree_size[v])) * 0x100000001B3ULL;
+  }
+  tree.topology_hash = mixLabel(hash ^ n);
+}
+
+// the newick parser of libpll is not reentrant
+static std::mutex parse_mutex;
+
+/*
+ * Flattens a parsed tree and frees it.
+ */
+int flattenParsedTree(pll_utree_t * utree, FlatTree &tree, FlatTreeScratch &scratch) {
+  if (utree == NULL) {
+    return -1;
+  }
+  pll_unode_t * root = searchRoot(utree);
+  if (root == NULL) {
+    pll_utree_destroy(utree, NULL);
+    return -1;
+  }
+  flattenTree(root, tree, scratch);
+  pll_utree_destroy(utree, NULL);
+  return tree.tip_count >= 3 ? 0 : -1;
+}
+
+int parseFlatTree(const char * tree_file, FlatTree &tree, FlatTreeScratch &scratch) {
+  // the file is read outside of the lock, only the parser is serialised
+  FILE * file = fopen(tree_file, "rb");
+  if (file == NULL) {
+    return -1;
+  }
+  scratch.newick.clear();
+  char buffer[65536];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    scratch.newick.append(buffer, n);
+  }
+  bool read_error = ferror(file) != 0;
+  fclose(file);
+  if (read_error) {
+    return -1;
+  }
+  return parseFlatTreeString(scratch.newick.c_str(), tree, scratch);
+}
+
+int parseFlatTreeString(const char * newick, FlatTree &tree, FlatTreeScratch &scratch) {
+  pll_utree_t * utree;
+  {
+    std::lock_guard<std::mutex> lock(parse_mutex);
+    utree = pll_utree_parse_newick_string(newick);
+  }
+  return flattenParsedTree(utree, tree, scratch);
+}
+
+bool sameTopology(const FlatTree &tree1, const FlatTree &tree2) {
+  return tree1.topology_hash == tree2.topology_hash && tree1.taxon == tree2.taxon
+      && tree1.subtree_size == tree2.subtree_size;
+}
+
+void assignBranchNumbers(const FlatTree &tree, sdsl::bit_vector &bp, sdsl::int_vector<> &iv,
+                std::vector<double> &branch_lengths) {
+  assert(tree.size() >= 4);
+  assert(tree.taxon[0] == 1);
+  assert(branch_lengths.size() == tree.size());
+
+  // the succinct structure is rooted above the root leaf: "(" root leaf "()" "(" rest ")" ")"
+  BitWriter writer(bp);
+  writer.append(0, 2);
+  writer.append(1, 1);
+  writer.append(0, 1);
+  iv[0] = 1; // first node is always the root
+  branch_lengths[0] = 0;
+  branch_lengths[1] = tree.length[1];
+  size_t iv_idx = 1;
+
+  for (uint32_t v = 2; v < tree.size(); v++) {
+    branch_lengths[v] = tree.length[v];
+    if (tree.isLeaf(v)) {
+      iv[iv_idx++] = tree.taxon[v];
+
+      // "()" of the leaf, then close the subtrees that end with this leaf
+      size_t closing = 1;
+      for (uint32_t u = tree.parent[v]; u > 1 && u + tree.subtree_size[u] - 1 == v; u = tree.parent[u]) {
+        closing++;
+      }
+      writer.append(0, 1);
+      writer.append(1, closing);
+    } else {
+      writer.append(0, 1);
+    }
+  }
+  writer.append(1, 2);
+  writer.flush();
+  assert(writer.position == bp.size());
+  assert(iv_idx == iv.size());
+}
+
+/*
+ * Slot of a key in the open addressing table of a cluster index.
+ */
+inline size_t clusterSlot(uint64_t key, size_t mask) {
+  return (size_t) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+uint32_t ClusterIndex::find(uint64_t key) const {
+  size_t mask = keys.size() - 1;
+  for (size_t slot = clusterSlot(key, mask); keys[slot] != 0; slot = (slot + 1) & mask) {
+    if (keys[slot] == key) {
+      return nodes[slot];
+    }
+  }
+  return FLAT_NONE;
+}
+
+void indexClusters(const FlatTree &tree, ClusterIndex &index, FlatTreeScratch &scratch) {
+  // rank of each taxon among the leaves in depth-first order
+  uint32_t max_taxon = 0;
+  for (auto t: tree.taxon) {
+    max_taxon = std::max(max_taxon, t);
+  }
+  index.rank.assign(max_taxon + 1, FLAT_NONE);
+
+  // table with at least twice as many slots as subtrees
+  size_t slots = 1;
+  while (slots < 2 * tree.size()) {
+    slots *= 2;
+  }
+  index.keys.assign(slots, 0);
+  index.nodes.resize(slots);
+  size_t mask = slots - 1;
+
+  // the leaves of a subtree have consecutive ranks: store each subtree by its
+  // first rank and its number of leaves (which is never 0, so no key is 0)
+  std::vector<uint32_t> &leaf_count = scratch.leaf_count;
+  std::vector<uint32_t> &first_rank = scratch.first_rank;
+  leaf_count.assign(tree.size(), 0);
+  first_rank.resize(tree.size());
+  uint32_t leaves = 0;
+  for (uint32_t v = 0; v < tree.size(); v++) {
+    first_rank[v] = leaves;
+    if (tree.taxon[v] != 0) {
+      index.rank[tree.taxon[v]] = leaves++;
+    }
+  }
+  for (uint32_t v = tree.size(); v-- > 0;) {
+    if (tree.taxon[v] != 0) {
+      leaf_count[v]++;
+    }
+    if (v > 0) {
+      leaf_count[tree.parent[v]] += leaf_count[v];
+    }
+    uint64_t key = (uint64_t) first_rank[v] << 32 | leaf_count[v];
+    size_t slot = clusterSlot(key, mask);
+    while (index.keys[slot] != 0 && index.keys[slot] != key) {
+      slot = (slot + 1) & mask;
+    }
+    // nested subtrees with the same leaves: the topmost one is kept
+    index.keys[slot] = key;
+    index.nodes[slot] = v;
+  }
+}
+
+void matchClusters(const ClusterIndex &index1, const FlatTree &tree2, std::vector<uint32_t> &match,
+          FlatTreeScratch &scratch) {
+  const std::vector<uint32_t> &rank = index1.rank;
+
+  // a subtree of tree2 is a subtree of tree1 iff the ranks of its leaves are
+  // consecutive and form a subtree of tree1; a subtree with a taxon that is not
+  // in tree1 gets the maximum rank FLAT_NONE and never matches
+  std::vector<uint32_t> &min_rank = scratch.first_rank;
+  std::vector<uint32_t> &max_rank = scratch.max_rank;
+  std::vector<uint32_t> &count = scratch.leaf_count;
+  match.assign(tree2.size(), FLAT_NONE);
+  min_rank.assign(tree2.size(), UINT32_MAX);
+  max_rank.assign(tree2.size(), 0);
+  count.assign(tree2.size(), 0);
+  for (uint32_t v = tree2.size(); v-- > 0;) {
+    if (tree2.taxon[v] != 0) {
+      uint32_t r = tree2.taxon[v] < rank.size() ? rank[tree2.taxon[v]] : FLAT_NONE;
+      if (r == FLAT_NONE) {
+        max_rank[v] = FLAT_NONE;
+      } else {
+        min_rank[v] = std::min(min_rank[v], r);
+        max_rank[v] = std::max(max_rank[v], r);
+        count[v]++;
+      }
+    }
+    if (max_rank[v] != FLAT_NONE && count[v] == max_rank[v] - min_rank[v] + 1) {
+      match[v] = index1.find((uint64_t) min_rank[v] << 32 | count[v]);
+    }
+    if (v > 0) {
+      uint32_t p = tree2.parent[v];
+      min_rank[p] = std::min(min_rank[p], min_rank[v]);
+      max_rank[p] = std::max(max_rank[p], max_rank[v]);
+      count[p] += count[v];
+    }
+  }
+}
@@ -0,0 +1,192 @@
+#ifndef FLAT_TREE_H
+#define FLAT_TREE_H
+
+#include <assert.h>
+#include <stdint.h>
+
+#include <libpll/pll_tree.h>
+#include <sdsl/bit_vectors.hpp>
+#include <string>
+#include <vector>
+
+#define FLAT_NONE UINT32_MAX
+
+/**
+ * Mixes the bits of x (splitmix64 finalizer).
+ */
+inline uint64_t mixLabel(uint64_t x) {
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+/**
+ * Tree stored as arrays, indexed by the nodes in depth-first order.
+ *
+ * The tree is rooted at the leaf with label "1" (node 0), its only child is
+ * node 1. The children of each node are ordered by their smallest taxon
+ * (compare setTree and orderTree), so the depth-first order is canonical.
+ * The subtree of node v consists of the nodes [v, v + subtree_size[v]).
+ *
+ * Compression runs on flat trees; pll_unode_t trees are converted when they
+ * are parsed (flattenTree).
+ */
+struct FlatTree {
+  std::vector<uint32_t> parent;       // FLAT_NONE for the root
+  std::vector<uint32_t> first_child;  // FLAT_NONE for leaves
+  std::vector<uint32_t> next_sibling; // FLAT_NONE for the last child
+  std::vector<uint32_t> taxon;        // taxon id of a leaf, 0 for inner nodes
+  std::vector<uint32_t> min_taxon;    // smallest taxon id in the subtree
+  std::vector<uint32_t> subtree_size; // number of nodes in the subtree
+  std::vector<double> length;         // length of the branch to the parent
+
+  size_t tip_count = 0;
+
+  // hash of the topology (of the taxon and subtree size sequences), equal for
+  // trees with the same topology
+  uint64_t topology_hash = 0;
+
+  size_t size() const {
+    return parent.size();
+  }
+
+  bool isLeaf(uint32_t v) const {
+    return first_child[v] == FLAT_NONE;
+  }
+
+  void reserve(size_t nodes);
+};
+
+/**
+ * Split set of a tree: the subtrees of the tree, each given by the ranks of its
+ * leaves in depth-first order (which are consecutive).
+ */
+struct ClusterIndex {
+  // rank of each taxon among the leaves, FLAT_NONE if the taxon is not in the tree
+  std::vector<uint32_t> rank;
+
+  // open addressing table of the subtrees: key (first rank << 32 | number of
+  // leaves), 0 for an empty slot, and the node
+  std::vector<uint64_t> keys;
+  std::vector<uint32_t> nodes;
+
+  /**
+   * Returns the node with the given key, FLAT_NONE if there is none.
+   */
+  uint32_t find(uint64_t key) const;
+};
+
+/**
+ * Buffers used while flattening and matching trees. Reusing them (together
+ * with the flat trees and cluster indices) avoids allocations once they are
+ * large enough.
+ */
+struct FlatTreeScratch {
+  // flattenTree
+  std::vector<const pll_unode_t *> unode;
+  std::vector<uint32_t> parent;
+  std::vector<uint32_t> taxon;
+  std::vector<double> length;
+  std::vector<uint32_t> min_taxon;
+  std::vector<uint32_t> child_count;
+  std::vector<uint32_t> child_offset;
+  std::vector<uint32_t> children;
+  std::vector<uint32_t> last_child;
+  std::vector<std::pair<const pll_unode_t *, uint32_t>> stack;
+  std::vector<std::pair<uint32_t, uint32_t>> order_stack;
+
+  // indexClusters and matchClusters
+  std::vector<uint32_t> first_rank;
+  std::vector<uint32_t> leaf_count;
+  std::vector<uint32_t> max_rank;
+
+  // parseFlatTree: the content of the tree file
+  std::string newick;
+
+  void reserve(size_t nodes);
+};
+
+/**
+ * Converts a tree into a flat tree.
+ * @param  root    leaf with label "1" of the tree
+ * @param  tree    the flat tree
+ * @param  scratch buffers
+ */
+void flattenTree(const pll_unode_t * root, FlatTree &tree, FlatTreeScratch &scratch);
+
+/**
+ * Builds a flat tree from a tree given by the parent of each node. Node 0 is
+ * the leaf with taxon 1, every other node comes after its parent.
+ * @param  parent  parent of each node (FLAT_NONE for node 0)
+ * @param  taxon   taxon id of each leaf, 0 for inner nodes
+ * @param  length  length of the branch to the parent of each node
+ * @param  tree    the flat tree
+ * @param  scratch buffers (must not hold the given arrays except parent, taxon
+ *                 and length)
+ */
+void buildFlatTree(const std::vector<uint32_t> &parent, const std::vector<uint32_t> &taxon,
+          const std::vector<double> &length, FlatTree &tree, FlatTreeScratch &scratch);
+
+/**
+ * Parses a tree file into a flat tree. Safe to call from several threads: only
+ * the newick parser runs alone, the file is read and the parsed tree is
+ * flattened concurrently.
+ * @param  tree_file tree in newick format
+ * @param  tree      the flat tree
+ * @param  scratch   buffers
+ * @return           value < 0 in case of an error (the tree could not be parsed,
+ *                   has less than 3 leaves or no leaf with label "1")
+ */
+int parseFlatTree(const char * tree_file, FlatTree &tree, FlatTreeScratch &scratch);
+
+/**
+ * Parses a tree given in newick format into a flat tree (see parseFlatTree).
+ * @param  newick  the tree
+ * @param  tree    the flat tree
+ * @param  scratch buffers
+ * @return         value < 0 in case of an error
+ */
+int parseFlatTreeString(const char * newick, FlatTree &tree, FlatTreeScratch &scratch);
+
+/**
+ * Checks whether two flat trees have the same topology (and the same taxa).
+ * @param  tree1 first tree
+ * @param  tree2 second tree
+ * @return       true iff the topologies are equal
+ */
+bool sameTopology(const FlatTree &tree1, const FlatTree &tree2);
+
+/**
+ * Traverses the given tree in depth-first order and stores its balanced
+ * parentheses, its leaves and its branch lengths. The branch above node v
+ * (v > 0) is branch v + 1, branch 0 is unused.
+ * @param tree           the tree
+ * @param bp             vector to store succinct representation (balaced parantheses, ( = 0, ) = 1)
+ * @param iv             vector to store labels of leafs in depth-first order
+ * @param branch_lengths vector to store all branch_lengths in dfs
+ */
+void assignBranchNumbers(const FlatTree &tree, sdsl::bit_vector &bp, sdsl::int_vector<> &iv,
+                std::vector<double> &branch_lengths);
+
+/**
+ * Builds the split set of a tree.
+ * @param  tree    the tree
+ * @param  index   the split set
+ * @param  scratch buffers
+ */
+void indexClusters(const FlatTree &tree, ClusterIndex &index, FlatTreeScratch &scratch);
+
+/**
+ * Matches the nodes of two trees on the same taxa that have the same set of
+ * leaves underneath (i.e. the same split) in linear time.
+ * @param  index1  split set of the first tree
+ * @param  tree2   second tree
+ * @param  match   for each node of tree2 the node of the first tree with the
+ *                 same leaves, FLAT_NONE if there is no such node
+ * @param  scratch buffers
+ */
+void matchClusters(const ClusterIndex &index1, const FlatTree &tree2, std::vector<uint32_t> &match,
+          FlatTreeScratch &scratch);
+
+#endif
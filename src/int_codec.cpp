@@ -0,0 +1,425 @@
+#include "int_codec.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// number of interleaved lanes of a full block (four 64 bit lanes = one AVX2 register)
+#define INT_CODEC_LANES 4
+
+// the header word of a block stores the base in the upper bits, the patched
+// flag in bit 7 and the width in the lower 7 bits
+#define INT_CODEC_WIDTH_BITS 7
+#define INT_CODEC_PATCHED (1ULL << INT_CODEC_WIDTH_BITS)
+#define INT_CODEC_HEADER_BITS (INT_CODEC_WIDTH_BITS + 1)
+#define INT_CODEC_MAX_BASE (1ULL << (64 - INT_CODEC_HEADER_BITS))
+
+// bits of the position of an exception in its block
+#define INT_CODEC_POSITION_BITS 8
+
+uint64_t zigzagEncode(uint64_t x) {
+  return (x << 1) ^ (uint64_t) ((int64_t) x >> 63);
+}
+
+uint64_t zigzagDecode(uint64_t z) {
+  return (z >> 1) ^ (0 - (z & 1));
+}
+
+unsigned int bitWidth(uint64_t x) {
+  return x == 0 ? 0 : sdsl::bits::hi(x) + 1;
+}
+
+uint64_t widthMask(unsigned int w) {
+  return w >= 64 ? ~0ULL : (1ULL << w) - 1;
+}
+
+/*
+ * Packs a full block. Value i goes to lane i % 4; word j of lane l is stored
+ * at out[4 * j + l], i.e. the block takes 4 * w words.
+ */
+void packBlock(const uint64_t * in, uint64_t base, unsigned int w, uint64_t * out) {
+  if (w == 0) {
+    return;
+  }
+#if defined(__AVX2__)
+  __m256i frame = _mm256_set1_epi64x(base);
+  __m256i acc = _mm256_setzero_si256();
+  unsigned int pos = 0;
+  size_t word = 0;
+  for (size_t j = 0; j < INT_CODEC_BLOCK_SIZE / INT_CODEC_LANES; j++) {
+    __m256i v = _mm256_sub_epi64(_mm256_loadu_si256((const __m256i *) (in + INT_CODEC_LANES * j)), frame);
+    acc = _mm256_or_si256(acc, _mm256_sll_epi64(v, _mm_cvtsi32_si128(pos)));
+    pos += w;
+    if (pos >= 64) {
+      _mm256_storeu_si256((__m256i *) (out + INT_CODEC_LANES * word), acc);
+      word++;
+      pos -= 64;
+      acc = pos > 0 ? _mm256_srl_epi64(v, _mm_cvtsi32_si128(w - pos)) : _mm256_setzero_si256();
+    }
+  }
+#elif defined(__SSE2__)
+  __m128i frame = _mm_set1_epi64x(base);
+  __m128i acc_lo = _mm_setzero_si128();
+  __m128i acc_hi = _mm_setzero_si128();
+  unsigned int pos = 0;
+  size_t word = 0;
+  for (size_t j = 0; j < INT_CODEC_BLOCK_SIZE / INT_CODEC_LANES; j++) {
+    __m128i v_lo = _mm_sub_epi64(_mm_loadu_si128((const __m128i *) (in + INT_CODEC_LANES * j)), frame);
+    __m128i v_hi = _mm_sub_epi64(_mm_loadu_si128((const __m128i *) (in + INT_CODEC_LANES * j + 2)), frame);
+    __m128i shift = _mm_cvtsi32_si128(pos);
+    acc_lo = _mm_or_si128(acc_lo, _mm_sll_epi64(v_lo, shift));
+    acc_hi = _mm_or_si128(acc_hi, _mm_sll_epi64(v_hi, shift));
+    pos += w;
+    if (pos >= 64) {
+      _mm_storeu_si128((__m128i *) (out + INT_CODEC_LANES * word), acc_lo);
+      _mm_storeu_si128((__m128i *) (out + INT_CODEC_LANES * word + 2), acc_hi);
+      word++;
+      pos -= 64;
+      if (pos > 0) {
+        shift = _mm_cvtsi32_si128(w - pos);
+        acc_lo = _mm_srl_epi64(v_lo, shift);
+        acc_hi = _mm_srl_epi64(v_hi, shift);
+      } else {
+        acc_lo = _mm_setzero_si128();
+        acc_hi = _mm_setzero_si128();
+      }
+    }
+  }
+#else
+  for (size_t l = 0; l < INT_CODEC_LANES; l++) {
+    uint64_t acc = 0;
+    unsigned int pos = 0;
+    size_t word = 0;
+    for (size_t j = 0; j < INT_CODEC_BLOCK_SIZE / INT_CODEC_LANES; j++) {
+      uint64_t v = in[INT_CODEC_LANES * j + l] - base;
+      acc |= v << pos;
+      pos += w;
+      if (pos >= 64) {
+        out[INT_CODEC_LANES * word + l] = acc;
+        word++;
+        pos -= 64;
+        acc = pos > 0 ? v >> (w - pos) : 0;
+      }
+    }
+  }
+#endif
+}
+
+/*
+ * Unpacks a full block packed with packBlock and adds the base.
+ */
+void unpackBlock(const uint64_t * in, uint64_t base, unsigned int w, uint64_t * out) {
+  if (w == 0) {
+    for (size_t i = 0; i < INT_CODEC_BLOCK_SIZE; i++) {
+      out[i] = base;
+    }
+    return;
+  }
+#if defined(__AVX2__)
+  __m256i frame = _mm256_set1_epi64x(base);
+  __m256i mask = _mm256_set1_epi64x(widthMask(w));
+  unsigned int pos = 0;
+  size_t word = 0;
+  for (size_t j = 0; j < INT_CODEC_BLOCK_SIZE / INT_CODEC_LANES; j++) {
+    __m256i cur = _mm256_loadu_si256((const __m256i *) (in + INT_CODEC_LANES * word));
+    __m256i v = _mm256_srl_epi64(cur, _mm_cvtsi32_si128(pos));
+    if (pos + w > 64) {
+      __m256i next = _mm256_loadu_si256((const __m256i *) (in + INT_CODEC_LANES * (word + 1)));
+      v = _mm256_or_si256(v, _mm256_sll_epi64(next, _mm_cvtsi32_si128(64 - pos)));
+    }
+    v = _mm256_add_epi64(_mm256_and_si256(v, mask), frame);
+    _mm256_storeu_si256((__m256i *) (out + INT_CODEC_LANES * j), v);
+    pos += w;
+    if (pos >= 64) {
+      pos -= 64;
+      word++;
+    }
+  }
+#elif defined(__SSE2__)
+  __m128i frame = _mm_set1_epi64x(base);
+  __m128i mask = _mm_set1_epi64x(widthMask(w));
+  unsigned int pos = 0;
+  size_t word = 0;
+  for (size_t j = 0; j < INT_CODEC_BLOCK_SIZE / INT_CODEC_LANES; j++) {
+    __m128i shift = _mm_cvtsi32_si128(pos);
+    __m128i v_lo = _mm_srl_epi64(_mm_loadu_si128((const __m128i *) (in + INT_CODEC_LANES * word)), shift);
+    __m128i v_hi = _mm_srl_epi64(_mm_loadu_si128((const __m128i *) (in + INT_CODEC_LANES * word + 2)), shift);
+    if (pos + w > 64) {
+      shift = _mm_cvtsi32_si128(64 - pos);
+      v_lo = _mm_or_si128(v_lo, _mm_sll_epi64(_mm_loadu_si128((const __m128i *) (in + INT_CODEC_LANES * (word + 1))), shift));
+      v_hi = _mm_or_si128(v_hi, _mm_sll_epi64(_mm_loadu_si128((const __m128i *) (in + INT_CODEC_LANES * (word + 1) + 2)), shift));
+    }
+    _mm_storeu_si128((__m128i *) (out + INT_CODEC_LANES * j), _mm_add_epi64(_mm_and_si128(v_lo, mask), frame));
+    _mm_storeu_si128((__m128i *) (out + INT_CODEC_LANES * j + 2), _mm_add_epi64(_mm_and_si128(v_hi, mask), frame));
+    pos += w;
+    if (pos >= 64) {
+      pos -= 64;
+      word++;
+    }
+  }
+#else
+  uint64_t mask = widthMask(w);
+  for (size_t l = 0; l < INT_CODEC_LANES; l++) {
+    unsigned int pos = 0;
+    size_t word = 0;
+    for (size_t j = 0; j < INT_CODEC_BLOCK_SIZE / INT_CODEC_LANES; j++) {
+      uint64_t v = in[INT_CODEC_LANES * word + l] >> pos;
+      if (pos + w > 64) {
+        v |= in[INT_CODEC_LANES * (word + 1) + l] << (64 - pos);
+      }
+      out[INT_CODEC_LANES * j + l] = (v & mask) + base;
+      pos += w;
+      if (pos >= 64) {
+        pos -= 64;
+        word++;
+      }
+    }
+  }
+#endif
+}
+
+/*
+ * Number of words taken by the packed values of a block.
+ */
+size_t blockWords(size_t count, unsigned int w) {
+  if (count == INT_CODEC_BLOCK_SIZE) {
+    return INT_CODEC_LANES * w;
+  }
+  return (count * w + 63) / 64;
+}
+
+/*
+ * Number of words taken by the exceptions of a patched block (without the
+ * word that holds their number and width).
+ */
+size_t exceptionWords(size_t exceptions, unsigned int high_width) {
+  return (exceptions * INT_CODEC_POSITION_BITS + 63) / 64 + (exceptions * high_width + 63) / 64;
+}
+
+/*
+ * Chooses the width of a block whose largest offset from the frame has width
+ * max_width: the one that minimises the words of the block, given how many
+ * offsets have each width. Offsets wider than the returned width become
+ * exceptions.
+ */
+unsigned int patchedWidth(size_t count, const size_t * width_counts, unsigned int max_width) {
+  unsigned int best = max_width;
+  size_t best_words = blockWords(count, max_width);
+  size_t exceptions = 0;
+  for (unsigned int w = max_width; w-- > 0; ) {
+    exceptions += width_counts[w + 1];
+    size_t words = blockWords(count, w) + 1 + exceptionWords(exceptions, max_width - w);
+    if (words < best_words) {
+      best = w;
+      best_words = words;
+    }
+  }
+  return best;
+}
+
+/*
+ * Encodes a block of mapped values; before is the value preceding the block
+ * (for INT_CODEC_DELTA).
+ */
+void encodeBlock(std::vector<uint64_t> &words, IntCodecVariant variant, const uint64_t * in, size_t count,
+          uint64_t before) {
+  // the header of a delta block stores the value preceding the block such
+  // that each block can be decoded on its own; the gaps are packed as they are
+  uint64_t header_base;
+  uint64_t frame;
+  if (variant == INT_CODEC_DELTA) {
+    header_base = before;
+    assert(header_base < INT_CODEC_MAX_BASE);
+    frame = 0;
+  } else {
+    frame = *std::min_element(in, in + count);
+    if (frame >= INT_CODEC_MAX_BASE) {
+      frame = 0;
+    }
+    header_base = frame;
+  }
+
+  size_t width_counts[65] = {0};
+  unsigned int max_width = 0;
+  for (size_t i = 0; i < count; i++) {
+    unsigned int width = bitWidth(in[i] - frame);
+    width_counts[width]++;
+    max_width = std::max(max_width, width);
+  }
+  unsigned int w = patchedWidth(count, width_counts, max_width);
+  bool patched = w < max_width;
+  words.push_back((header_base << INT_CODEC_HEADER_BITS) | (patched ? INT_CODEC_PATCHED : 0) | w);
+
+  // the packed values only keep the low bits of the exceptions
+  uint64_t low[INT_CODEC_BLOCK_SIZE];
+  uint64_t mask = widthMask(w);
+  for (size_t i = 0; i < count; i++) {
+    low[i] = ((in[i] - frame) & mask) + frame;
+  }
+
+  size_t offset = words.size();
+  words.resize(offset + blockWords(count, w), 0);
+  if (count == INT_CODEC_BLOCK_SIZE) {
+    packBlock(low, frame, w, &words[offset]);
+  } else if (w > 0) {
+    for (size_t i = 0; i < count; i++) {
+      size_t bit = i * w;
+      sdsl::bits::write_int(&words[offset + (bit >> 6)], low[i] - frame, bit & 0x3F, w);
+    }
+  }
+
+  if (patched) {
+    size_t exceptions = 0;
+    for (unsigned int width = w + 1; width <= max_width; width++) {
+      exceptions += width_counts[width];
+    }
+    unsigned int high_width = max_width - w;
+    words.push_back((exceptions << INT_CODEC_WIDTH_BITS) | high_width);
+
+    size_t positions = words.size();
+    size_t highs = positions + (exceptions * INT_CODEC_POSITION_BITS + 63) / 64;
+    words.resize(positions + exceptionWords(exceptions, high_width), 0);
+    size_t e = 0;
+    for (size_t i = 0; i < count; i++) {
+      uint64_t high = (in[i] - frame) >> w;
+      if (high != 0) {
+        size_t bit = e * INT_CODEC_POSITION_BITS;
+        sdsl::bits::write_int(&words[positions + (bit >> 6)], i, bit & 0x3F, INT_CODEC_POSITION_BITS);
+        bit = e * high_width;
+        sdsl::bits::write_int(&words[highs + (bit >> 6)], high, bit & 0x3F, high_width);
+        e++;
+      }
+    }
+  }
+}
+
+IntEncoder::IntEncoder(std::vector<uint64_t> &stream, IntCodecVariant codec_variant)
+    : words(stream), variant(codec_variant) {
+  // the number of values is filled in by finish
+  words.assign(1, 0);
+}
+
+void IntEncoder::add(uint64_t value) {
+  // map the value to the unsigned integer that is bit-packed
+  if (variant == INT_CODEC_DELTA) {
+    assert(value >= previous);
+    block[count++] = value - previous;
+  } else if (variant == INT_CODEC_ZIGZAG) {
+    block[count++] = zigzagEncode(value);
+  } else {
+    block[count++] = value;
+  }
+  previous = value;
+  if (count == INT_CODEC_BLOCK_SIZE) {
+    encodeBlock(words, variant, block, count, before);
+    before = previous;
+    added += count;
+    count = 0;
+  }
+}
+
+void IntEncoder::finish() {
+  if (count > 0) {
+    encodeBlock(words, variant, block, count, before);
+    added += count;
+    count = 0;
+  }
+  words[0] = (added << 2) | variant;
+}
+
+void encodeInts(const std::vector<uint64_t> &values, IntCodecVariant variant, std::vector<uint64_t> &words) {
+  IntEncoder encoder(words, variant);
+  for (auto value: values) {
+    encoder.add(value);
+  }
+  encoder.finish();
+}
+
+size_t intCount(const uint64_t * words) {
+  return words[0] >> 2;
+}
+
+/*
+ * Decodes the block whose header is at words[*pos] and advances *pos to the
+ * header of the next block.
+ */
+void decodeBlockAt(const uint64_t * words, size_t n_words, size_t * pos, size_t count, uint64_t * out) {
+  IntCodecVariant variant = (IntCodecVariant) (words[0] & 3);
+  assert(*pos < n_words);
+  uint64_t header = words[*pos];
+  unsigned int w = header & widthMask(INT_CODEC_WIDTH_BITS);
+  uint64_t header_base = header >> INT_CODEC_HEADER_BITS;
+  uint64_t frame = variant == INT_CODEC_DELTA ? 0 : header_base;
+  const uint64_t * in = words + *pos + 1;
+  assert(*pos + 1 + blockWords(count, w) <= n_words);
+
+  if (count == INT_CODEC_BLOCK_SIZE) {
+    unpackBlock(in, frame, w, out);
+  } else {
+    uint64_t mask = widthMask(w);
+    for (size_t i = 0; i < count; i++) {
+      size_t bit = i * w;
+      out[i] = (w > 0 ? sdsl::bits::read_int(in + (bit >> 6), bit & 0x3F, w) & mask : 0) + frame;
+    }
+  }
+  *pos += 1 + blockWords(count, w);
+
+  if (header & INT_CODEC_PATCHED) {
+    // add the high bits of the exceptions
+    assert(*pos < n_words);
+    size_t exceptions = words[*pos] >> INT_CODEC_WIDTH_BITS;
+    unsigned int high_width = words[*pos] & widthMask(INT_CODEC_WIDTH_BITS);
+    const uint64_t * positions = words + *pos + 1;
+    const uint64_t * highs = positions + (exceptions * INT_CODEC_POSITION_BITS + 63) / 64;
+    assert(*pos + 1 + exceptionWords(exceptions, high_width) <= n_words);
+    for (size_t e = 0; e < exceptions; e++) {
+      size_t bit = e * INT_CODEC_POSITION_BITS;
+      size_t i = sdsl::bits::read_int(positions + (bit >> 6), bit & 0x3F, INT_CODEC_POSITION_BITS);
+      bit = e * high_width;
+      uint64_t high = sdsl::bits::read_int(highs + (bit >> 6), bit & 0x3F, high_width);
+      assert(i < count);
+      out[i] += high << w;
+    }
+    *pos += 1 + exceptionWords(exceptions, high_width);
+  }
+
+  if (variant == INT_CODEC_DELTA) {
+    uint64_t previous = header_base;
+    for (size_t i = 0; i < count; i++) {
+      previous += out[i];
+      out[i] = previous;
+    }
+  } else if (variant == INT_CODEC_ZIGZAG) {
+    for (size_t i = 0; i < count; i++) {
+      out[i] = zigzagDecode(out[i]);
+    }
+  }
+}
+
+void decodeInts(const uint64_t * words, size_t n_words, uint64_t * out) {
+  size_t n = intCount(words);
+  size_t pos = 1;
+  for (size_t start = 0; start < n; start += INT_CODEC_BLOCK_SIZE) {
+    size_t count = std::min((size_t) INT_CODEC_BLOCK_SIZE, n - start);
+    decodeBlockAt(words, n_words, &pos, count, out + start);
+  }
+  assert(pos == n_words);
+}
+
+size_t decodeIntBlock(const uint64_t * words, size_t n_words, size_t block, uint64_t * out) {
+  size_t n = intCount(words);
+  assert(block * INT_CODEC_BLOCK_SIZE < n);
+
+  // skip the preceding blocks by their headers
+  size_t pos = 1;
+  for (size_t b = 0; b < block; b++) {
+    uint64_t header = words[pos];
+    pos += 1 + blockWords(INT_CODEC_BLOCK_SIZE, header & widthMask(INT_CODEC_WIDTH_BITS));
+    if (header & INT_CODEC_PATCHED) {
+      pos += 1 + exceptionWords(words[pos] >> INT_CODEC_WIDTH_BITS, words[pos] & widthMask(INT_CODEC_WIDTH_BITS));
+    }
+  }
+  size_t count = std::min((size_t) INT_CODEC_BLOCK_SIZE, n - block * INT_CODEC_BLOCK_SIZE);
+  decodeBlockAt(words, n_words, &pos, count, out);
+  return count;
+}
@@ -0,0 +1,112 @@
+#ifndef INT_CODEC_H
+#define INT_CODEC_H
+
+#include <assert.h>
+
+#include <sdsl/int_vector.hpp>
+#include <vector>
+
+/**
+ * Integer codec shared by all integer streams (leaf permutations, edges to
+ * contract, quantised branch lengths).
+ *
+ * The values are split into blocks of INT_CODEC_BLOCK_SIZE values. Each block
+ * stores a header word (frame of reference base, bit width and whether it is
+ * patched) followed by the values minus the base, bit-packed at the width. Full
+ * blocks are packed in four interleaved lanes so that they can be packed and
+ * unpacked with SSE / AVX2; the last, partial block is packed sequentially.
+ *
+ * The width is chosen per block to minimise its size. If a few outliers are
+ * wider than it (patched frame of reference), the packed values hold their low
+ * bits and the block ends with the exceptions: a word with their number and
+ * the width of their high bits, their positions in the block and their high
+ * bits, each packed sequentially.
+ *
+ * Layout: word 0 holds the number of values and the variant, then the blocks.
+ */
+
+#define INT_CODEC_BLOCK_SIZE 256
+
+enum IntCodecVariant {
+    // frame of reference + bit-packing of the values
+    INT_CODEC_PLAIN  = 0,
+
+    // non-decreasing values (< 2^56), bit-packing of the gaps
+    INT_CODEC_DELTA  = 1,
+
+    // signed values (two's complement), zigzag mapped before bit-packing
+    INT_CODEC_ZIGZAG = 2
+};
+
+/**
+ * Encodes a stream value by value, without a vector of all values: the values
+ * are collected in a block, which is encoded once it is full. The words of
+ * the stream keep their memory from one stream to the next.
+ */
+struct IntEncoder {
+  std::vector<uint64_t> &words;
+  IntCodecVariant variant;
+
+  // mapped values of the current block; the last value added and the one
+  // before the block
+  uint64_t block[INT_CODEC_BLOCK_SIZE];
+  size_t count = 0;
+  uint64_t previous = 0;
+  uint64_t before = 0;
+  size_t added = 0;
+
+  /**
+   * Starts a stream.
+   * @param stream        the stream is stored in it (its content is replaced)
+   * @param codec_variant codec variant
+   */
+  IntEncoder(std::vector<uint64_t> &stream, IntCodecVariant codec_variant);
+
+  /**
+   * Adds the next value.
+   * @param value the value; for INT_CODEC_ZIGZAG the bit pattern of a signed
+   *              64 bit integer
+   */
+  void add(uint64_t value);
+
+  /**
+   * Encodes the last block; to be called after all values are added.
+   */
+  void finish();
+};
+
+/**
+ * Encodes the given values.
+ * @param values  values to encode; for INT_CODEC_ZIGZAG these are the bit
+ *                patterns of signed 64 bit integers
+ * @param variant codec variant
+ * @param words   the encoded values are stored in it (its content is replaced)
+ */
+void encodeInts(const std::vector<uint64_t> &values, IntCodecVariant variant, std::vector<uint64_t> &words);
+
+/**
+ * Returns the number of values stored in an encoded stream.
+ * @param  words encoded stream
+ * @return       number of values
+ */
+size_t intCount(const uint64_t * words);
+
+/**
+ * Decodes a whole stream.
+ * @param words   encoded stream
+ * @param n_words number of words in the stream
+ * @param out     array to store the intCount(words) values
+ */
+void decodeInts(const uint64_t * words, size_t n_words, uint64_t * out);
+
+/**
+ * Decodes a single block of a stream (used for bulk scans).
+ * @param  words   encoded stream
+ * @param  n_words number of words in the stream
+ * @param  block   index of the block
+ * @param  out     array to store up to INT_CODEC_BLOCK_SIZE values
+ * @return         number of values in the block
+ */
+size_t decodeIntBlock(const uint64_t * words, size_t n_words, size_t block, uint64_t * out);
+
+#endif
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdarg.h>
+#include <stdlib.h>
 
 #include <iostream>
 #include <iomanip>
@@ -7,8 +8,15 @@
 
 #include "util.h"
 #include "compress_functions.h"
+#include "chain_pipeline.h"
+#include "chain_append.h"
+#include "archive_export.h"
 #include "uncompress_functions.h"
 #include "datastructure_compression_functions.h"
+#include "tree_range.h"
+#include "archive_merge.h"
+#include "split_dictionary.h"
+#include "subtree_dag.h"
 
 /* static functions */
 static void fatal (const char * format, ...);
@@ -27,16 +35,15 @@ void simpleCompressionEqual(const char * tree_file, std::string time_id) {
   std::string comp_path = "../compressions/sc_" + getFileName(std::string(tree_file))
     + "_" +  time_id + "_";
 
-  std::string succinct_tree = (comp_path + std::string("succinct_tree.sdsl"));
-  std::string node_permutation = (comp_path + std::string("node_permutation.sdsl"));
-  std::string branch_lengths_uncompressed = (comp_path + std::string("branch_lengths_uncompressed.sdsl"));
+  std::string archive_file = (comp_path + std::string("archive.tca"));
 
-  // compress the given tree and store the structures to file
-  simple_compression(tree_file,
-    succinct_tree.c_str(),
-    node_permutation.c_str(),
-    branch_lengths_uncompressed.c_str(),
-    print_comp);
+  // compress the given tree and store it to an archive
+  EncodedRecord record;
+  simple_compression(tree_file, record, print_comp);
+
+  ArchiveWriter writer;
+  if (writer.open(archive_file) < 0 || writer.append(record) < 0 || writer.close() < 0)
+    fatal("Could not write archive %s", archive_file.c_str());
 
   pll_utree_t * tree = pll_utree_parse_newick(tree_file);
 
@@ -44,20 +51,21 @@ void simpleCompressionEqual(const char * tree_file, std::string time_id) {
   setTree(root);
   orderTree(root);
 
-  // load the decompress structures from disc
-  sdsl::bit_vector succinct_tree_loaded = uncompressSuccinctStructure(succinct_tree.c_str());
-  sdsl::int_vector<> node_permutation_loaded = uncompressSimplePermutation(node_permutation.c_str());
-  std::vector<double> branch_lengths = uncompressBranchLengths(branch_lengths_uncompressed.c_str());
-
-  // reconstruct the tree
-  pll_unode_t * tree_loaded = simple_uncompression(succinct_tree_loaded, node_permutation_loaded, branch_lengths);
+  // load the archive; the trees are decoded while iterating over it
+  ArchiveReader reader;
+  if (reader.open(archive_file) < 0)
+    fatal("Could not read archive %s", archive_file.c_str());
 
-  // print the newick reconstruction of the loaded tree
-  // std::cout << "Newick representation original: " << toNewick(root) << "\n\n\n";
-  std::cout << "Newick representation reconstruction: " << toNewick(tree_loaded) << "\n";
+  for (pll_unode_t * tree_loaded : treeRange(reader, 0, reader.size())) {
+    if (tree_loaded == NULL)
+      fatal("Could not decode archive %s", archive_file.c_str());
+    // print the newick reconstruction of the loaded tree
+    // std::cout << "Newick representation original: " << toNewick(root) << "\n\n\n";
+    std::cout << "Newick representation reconstruction: " << toNewick(tree_loaded) << "\n";
 
-  // print whether input tree and loaded tree are equal
-  std::cout << "Trees equal: " << std::boolalpha << treesEqual(root->back, tree_loaded->back) << "\n-----------------------------------------------------------\n";
+    // print whether input tree and loaded tree are equal
+    std::cout << "Trees equal: " << std::boolalpha << treesEqual(root->back, tree_loaded->back) << "\n-----------------------------------------------------------\n";
+  }
 }
 
 /**
@@ -75,52 +83,44 @@ void RFCompressionEqual(const char * tree_file1, const char * tree_file2, std::s
     std::string comp_path = "../compressions/rfc_" + getFileName(std::string(tree_file1))
       + "_" + getFileName(std::string(tree_file2)) + "_" +  time_id + "_";
 
-    std::string edges_to_contract_str = (comp_path + std::string("edges_to_contract.sdsl"));
-    std::string subtrees_succinct_str = (comp_path + std::string("subtrees_succinct.sdsl"));
-    std::string node_permutations_str = (comp_path + std::string("node_permutations.sdsl"));
-    std::string consensus_branches_str = (comp_path + std::string("consensus_branches.sdsl"));
-    std::string non_consensus_branches_str = (comp_path + std::string("non_consensus_branches.sdsl"));
-
-    // compress the given trees and store the structures to file
-    rf_distance_compression(tree_file1, tree_file2,
-      edges_to_contract_str.c_str(),
-      subtrees_succinct_str.c_str(),
-      node_permutations_str.c_str(),
-      consensus_branches_str.c_str(),
-      non_consensus_branches_str.c_str(),
-      print_comp);
-
-    // load the decompress structures from disc
-    sdsl::int_vector<> edges_to_contract_loaded = uncompressRFEdgesToContract(edges_to_contract_str.c_str());
-    sdsl::bit_vector subtrees_succinct_loaded = uncompressSuccinctStructure(subtrees_succinct_str.c_str());
-    sdsl::int_vector<> permutations_loaded = uncompressRFSubtreePermutations(node_permutations_str.c_str());
-
-    std::vector<double> consensus_branches = uncompressBranchLengths(consensus_branches_str.c_str());
-    std::vector<double> non_consensus_branches = uncompressBranchLengths(non_consensus_branches_str.c_str());
-
-    // load the first tree to recontruct the second tree applying the topology changes
+    std::string archive_file = (comp_path + std::string("archive.tca"));
+
+    // compress the given trees and store the second one to an archive
+    EncodedRecord record;
+    rf_distance_compression(tree_file1, tree_file2, record, print_comp);
+
+    ArchiveWriter writer;
+    if (writer.open(archive_file) < 0 || writer.append(record) < 0 || writer.close() < 0)
+      fatal("Could not write archive %s", archive_file.c_str());
+
+    // load the first tree, the archive stores the second tree relative to it
     pll_utree_t * tree1 = pll_utree_parse_newick (tree_file1);
     pll_unode_t * root1 = searchRoot(tree1);
     setTree(root1);
     orderTree(root1);
 
-    // decompress the structures; recontruct the second tree
-    pll_unode_t * tree_rf = rf_distance_uncompression(root1, edges_to_contract_loaded, subtrees_succinct_loaded,
-                    permutations_loaded, consensus_branches, non_consensus_branches);
+    ArchiveReader reader;
+    if (reader.open(archive_file) < 0)
+      fatal("Could not read archive %s", archive_file.c_str());
 
     pll_utree_t * tree2 = pll_utree_parse_newick (tree_file2);
     pll_unode_t * root2 = searchRoot(tree2);
     setTree(root2);
     orderTree(root2);
 
-    // print the newick reconstruction of the loaded tree
-    // std::cout << toNewick(root2) << "\n\n\n";
-    std::cout << "Newick representation reconstruction: " << toNewick(tree_rf) << "\n";
+    // decompress the structures; recontruct the second tree applying the topology changes
+    for (pll_unode_t * tree_rf : treeRange(reader, 0, reader.size(), 1, false, root1)) {
+      if (tree_rf == NULL)
+        fatal("Could not decode archive %s", archive_file.c_str());
+      // print the newick reconstruction of the loaded tree
+      // std::cout << toNewick(root2) << "\n\n\n";
+      std::cout << "Newick representation reconstruction: " << toNewick(tree_rf) << "\n";
 
-    assert(treesEqual(tree_rf->back, root2->back));
+      assert(treesEqual(tree_rf->back, root2->back));
 
-    // check whether the loaded second tree is equal to the decompressed second tree.
-    std::cout << "\n" << std::boolalpha << "trees equal: " << treesEqual(tree_rf->back, root2->back) << "\n";
+      // check whether the loaded second tree is equal to the decompressed second tree.
+      std::cout << "\n" << std::boolalpha << "trees equal: " << treesEqual(tree_rf->back, root2->back) << "\n";
+    }
 }
 
 /**
@@ -129,8 +129,83 @@ void RFCompressionEqual(const char * tree_file1, const char * tree_file2, std::s
  */
 int main (int argc, const char * argv[])
 {
+  if (argc >= 4 && std::string(argv[1]) == "merge") {
+    // merge the archives of independent runs
+    std::vector<std::string> inputs(argv + 3, argv + argc);
+    if (mergeArchives(inputs, argv[2]) < 0)
+      fatal ("archives could not be merged");
+    return 0;
+  }
+
+  if (argc >= 4 && std::string(argv[1]) == "chain") {
+    // compress the samples of a run as a chain of deltas
+    std::vector<std::string> tree_files(argv + 3, argv + argc);
+    CompressionContext context;
+    if (chain_archive_compression(tree_files, argv[2], context, 0, 0) < 0)
+      fatal ("trees could not be compressed");
+    printCompressionStatistics(context.statistics);
+    return 0;
+  }
+
+  if (argc >= 5 && std::string(argv[1]) == "shards") {
+    // compress the samples of a run as independent chains in parallel
+    std::vector<std::string> tree_files(argv + 4, argv + argc);
+    CompressionStatistics statistics;
+    if (sharded_chain_compression(tree_files, argv[2], atoi(argv[3]), 0, statistics, 0) < 0)
+      fatal ("trees could not be compressed");
+    printCompressionStatistics(statistics);
+    return 0;
+  }
+
+  if (argc >= 4 && std::string(argv[1]) == "concat") {
+    // concatenate the archives of shards of a run
+    std::vector<std::string> inputs(argv + 3, argv + argc);
+    if (concatArchives(inputs, argv[2]) < 0)
+      fatal ("archives could not be concatenated");
+    return 0;
+  }
+
+  if (argc == 4 && std::string(argv[1]) == "append") {
+    // append the samples of a running run to an archive as they are written
+    CompressionStatistics statistics;
+    if (append_compression(argv[3], argv[2], statistics, 0) < 0)
+      fatal ("trees could not be appended");
+    printCompressionStatistics(statistics);
+    return 0;
+  }
+
+  if (argc >= 4 && argc <= 6 && std::string(argv[1]) == "export") {
+    // write the trees of an archive to a nexus tree file, after the burn-in
+    // and thinned
+    size_t burnin = argc > 4 ? atoi(argv[4]) : 0;
+    size_t thin = argc > 5 ? atoi(argv[5]) : 1;
+    if (export_archive(argv[2], argv[3], burnin, thin, 0) < 0)
+      fatal ("archive could not be exported");
+    return 0;
+  }
+
+  if (argc >= 4 && std::string(argv[1]) == "splits") {
+    // compress the samples of a run with a global split dictionary
+    std::vector<std::string> tree_files(argv + 3, argv + argc);
+    if (split_compression(tree_files, argv[2], PRINT_COMPRESSION) < 0)
+      fatal ("trees could not be compressed");
+    return 0;
+  }
+
+  if (argc >= 4 && std::string(argv[1]) == "dag") {
+    // compress the samples of a run with shared subtrees
+    std::vector<std::string> tree_files(argv + 3, argv + argc);
+    if (dag_compression(tree_files, argv[2], 0, PRINT_COMPRESSION) < 0)
+      fatal ("trees could not be compressed");
+    return 0;
+  }
+
   if (argc != 3)
-    fatal (" syntax: %s [newick] [newick]", argv[0]);
+    fatal (" syntax: %s [newick] [newick]\n         %s merge [archive] [archive]...\n         %s chain [archive] [newick]...\n"
+          "         %s shards [archive] [count] [newick]...\n         %s concat [archive] [archive]...\n"
+          "         %s append [archive] [tree file|-]\n         %s export [archive] [tree file|-] [burnin] [thin]\n"
+          "         %s splits [archive] [newick]...\n         %s dag [archive] [newick]...",
+          argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
 
   std::stringstream time_id;
   auto t = std::time(nullptr);
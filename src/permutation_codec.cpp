@@ -0,0 +1,209 @@
+#include "permutation_codec.h"
+
+/*
+ * Number of bits needed to store a value in [0, product).
+ */
+unsigned int bitsForProduct(uint64_t product) {
+  return product <= 1 ? 0 : sdsl::bits::hi(product - 1) + 1;
+}
+
+/*
+ * The digit at position i of the Lehmer code of a permutation of k elements
+ * lies in [0, k - i). Starting at digit start, this method returns the end of
+ * the longest run of digits whose radices can be multiplied within one word.
+ * The product of the radices is stored in product.
+ */
+unsigned int chunkEnd(unsigned int k, unsigned int start, uint64_t * product) {
+  unsigned int end = start;
+  *product = 1;
+  // the last digit has radix 1 and is never stored
+  while (end + 1 < k && *product <= UINT64_MAX / (k - end)) {
+    *product *= (k - end);
+    end++;
+  }
+  return end;
+}
+
+unsigned int permutationBits(unsigned int k) {
+  unsigned int bits = 0;
+  unsigned int start = 0;
+  while (start + 1 < k) {
+    uint64_t product;
+    start = chunkEnd(k, start, &product);
+    bits += bitsForProduct(product);
+  }
+  return bits;
+}
+
+/*
+ * Turns the Lehmer code digits into the permutation they describe.
+ */
+void unrankLehmer(const std::vector<unsigned int> &digits, std::vector<unsigned int> &permutation) {
+  std::vector<unsigned int> available(digits.size());
+  for (size_t i = 0; i < available.size(); i++) {
+    available[i] = i;
+  }
+  permutation.resize(digits.size());
+  for (size_t i = 0; i < digits.size(); i++) {
+    assert(digits[i] < available.size());
+    permutation[i] = available[digits[i]];
+    available.erase(available.begin() + digits[i]);
+  }
+}
+
+/*
+ * Splits the rank of a permutation of k elements (k <= 20) into its Lehmer
+ * code digits.
+ */
+void rankToDigits(uint64_t rank, unsigned int k, std::vector<unsigned int> &digits) {
+  digits.assign(k, 0);
+  for (unsigned int i = k - 1; i-- > 0;) {
+    digits[i] = rank % (k - i);
+    rank /= (k - i);
+  }
+  assert(rank == 0);
+}
+
+std::vector<std::vector<uint32_t>> buildPermutationTable() {
+  std::vector<std::vector<uint32_t>> table(PERMUTATION_TABLE_MAX_SIZE + 1);
+  std::vector<unsigned int> digits;
+  std::vector<unsigned int> permutation;
+
+  uint64_t factorial = 1;
+  for (unsigned int k = 1; k <= PERMUTATION_TABLE_MAX_SIZE; k++) {
+    factorial *= k;
+    table[k].resize(factorial);
+    for (uint64_t rank = 0; rank < factorial; rank++) {
+      rankToDigits(rank, k, digits);
+      unrankLehmer(digits, permutation);
+
+      // every element of a permutation of size <= 8 fits into a nibble
+      uint32_t packed = 0;
+      for (unsigned int j = 0; j < k; j++) {
+        packed |= permutation[j] << (4 * j);
+      }
+      table[k][rank] = packed;
+    }
+  }
+  return table;
+}
+
+/*
+ * Table mapping (k, rank) to the permutation of k elements with this rank,
+ * packed into nibbles.
+ */
+const std::vector<std::vector<uint32_t>> &permutationTable() {
+  static const std::vector<std::vector<uint32_t>> table = buildPermutationTable();
+  return table;
+}
+
+size_t encodePermutations(const std::vector<uint32_t> &permutations,
+              const std::vector<unsigned int> &sizes, std::vector<uint64_t> &words) {
+  size_t bit_size = 0;
+  for (auto k: sizes) {
+    bit_size += permutationBits(k);
+  }
+  words.assign((bit_size + 63) / 64, 0);
+
+  size_t perm_idx = 0;
+  size_t bit_idx = 0;
+  for (auto k: sizes) {
+    assert(perm_idx + k <= permutations.size());
+    const uint32_t * permutation = &permutations[perm_idx];
+
+    unsigned int start = 0;
+    while (start + 1 < k) {
+      uint64_t product;
+      unsigned int end = chunkEnd(k, start, &product);
+      uint64_t value = 0;
+      for (unsigned int i = start; i < end; i++) {
+        // digit i of the Lehmer code counts the elements right of position i
+        // that are smaller
+        assert(permutation[i] < k);
+        unsigned int digit = 0;
+        for (unsigned int j = i + 1; j < k; j++) {
+          digit += permutation[j] < permutation[i];
+        }
+        value = value * (k - i) + digit;
+      }
+      unsigned int bits = bitsForProduct(product);
+      if (bits > 0) {
+        sdsl::bits::write_int(&words[bit_idx >> 6], value, bit_idx & 0x3F, bits);
+      }
+      bit_idx += bits;
+      start = end;
+    }
+    perm_idx += k;
+  }
+  assert(perm_idx == permutations.size());
+  assert(bit_idx == bit_size);
+
+  return bit_size;
+}
+
+sdsl::int_vector<> decodePermutations(const uint64_t * data, size_t bit_size,
+              const std::vector<unsigned int> &sizes) {
+  size_t n = 0;
+  unsigned int max_k = 1;
+  for (auto k: sizes) {
+    n += k;
+    max_k = std::max(max_k, k);
+  }
+  sdsl::int_vector<> permutations(n, 0, sdsl::bits::hi(max_k) + 1);
+
+  const std::vector<std::vector<uint32_t>> &table = permutationTable();
+  std::vector<unsigned int> digits;
+  std::vector<unsigned int> permutation;
+  size_t perm_idx = 0;
+  size_t bit_idx = 0;
+  for (auto k: sizes) {
+    if (k <= PERMUTATION_TABLE_MAX_SIZE) {
+      // a single chunk
+      unsigned int bits = permutationBits(k);
+      if (bit_idx + bits > bit_size) {
+        // ERROR: too few bits
+        return sdsl::int_vector<>();
+      }
+      uint64_t rank = bits > 0 ? sdsl::bits::read_int(data + (bit_idx >> 6), bit_idx & 0x3F, bits) : 0;
+      bit_idx += bits;
+      if (rank >= table[k].size()) {
+        // ERROR: not the rank of a permutation
+        return sdsl::int_vector<>();
+      }
+
+      uint32_t packed = table[k][rank];
+      for (unsigned int j = 0; j < k; j++) {
+        permutations[perm_idx + j] = (packed >> (4 * j)) & 0xF;
+      }
+    } else {
+      digits.assign(k, 0);
+      unsigned int start = 0;
+      while (start + 1 < k) {
+        uint64_t product;
+        unsigned int end = chunkEnd(k, start, &product);
+        unsigned int bits = bitsForProduct(product);
+        if (bit_idx + bits > bit_size) {
+          return sdsl::int_vector<>();
+        }
+        uint64_t value = sdsl::bits::read_int(data + (bit_idx >> 6), bit_idx & 0x3F, bits);
+        bit_idx += bits;
+        for (unsigned int i = end; i-- > start;) {
+          digits[i] = value % (k - i);
+          value /= (k - i);
+        }
+        start = end;
+      }
+      unrankLehmer(digits, permutation);
+      for (unsigned int j = 0; j < k; j++) {
+        permutations[perm_idx + j] = permutation[j];
+      }
+    }
+    perm_idx += k;
+  }
+  if (bit_idx != bit_size) {
+    // ERROR: the bits do not match the sizes
+    return sdsl::int_vector<>();
+  }
+
+  return permutations;
+}
@@ -0,0 +1,45 @@
+#include <assert.h>
+
+#include <sdsl/bit_vectors.hpp>
+#include <sdsl/int_vector.hpp>
+#include <vector>
+
+/**
+ * Codec for the permutations of the children of multifurcating consensus
+ * nodes. A permutation of k elements is ranked by its Lehmer code and the
+ * digits are packed as a mixed-radix number, i.e. the permutation needs
+ * ceil(log2(k!)) bits. Permutations with more than 20 elements do not fit into
+ * a single word; their digits are split into several mixed-radix chunks.
+ */
+
+// permutations up to this size are decoded by a single table lookup
+#define PERMUTATION_TABLE_MAX_SIZE 6
+
+/**
+ * Returns the number of bits used to store a permutation of k elements.
+ * @param  k number of elements
+ * @return   number of bits
+ */
+unsigned int permutationBits(unsigned int k);
+
+/**
+ * Encodes the given permutations by their Lehmer codes.
+ * @param  permutations all permutations, one after another
+ * @param  sizes        number of elements of each permutation
+ * @param  words        the packed ranks are stored in it (its content is
+ *                      replaced)
+ * @return              number of bits of the packed ranks
+ */
+size_t encodePermutations(const std::vector<uint32_t> &permutations,
+              const std::vector<unsigned int> &sizes, std::vector<uint64_t> &words);
+
+/**
+ * Decodes permutations encoded with encodePermutations.
+ * @param  data     words containing the packed ranks
+ * @param  bit_size number of valid bits in data
+ * @param  sizes    number of elements of each permutation
+ * @return          all permutations, one after another (empty if the bits do
+ *                  not match the sizes)
+ */
+sdsl::int_vector<> decodePermutations(const uint64_t * data, size_t bit_size,
+              const std::vector<unsigned int> &sizes);
@@ -0,0 +1,200 @@
+#include "sequential_decoder.h"
+
+/*
+ * Frees all unodes of the subtree behind node, including the leaf labels.
+ */
+void releaseSubtree(pll_unode_t * node) {
+  if (node->next == NULL) {
+    free(node->label);
+    free(node);
+    return;
+  }
+  pll_unode_t * current = node->next;
+  while (current != node) {
+    pll_unode_t * next = current->next;
+    releaseSubtree(current->back);
+    free(current);
+    current = next;
+  }
+  free(node);
+}
+
+/*
+ * Gives the leaves of a copied tree their own labels and drops the
+ * (shared) labels of the inner nodes, so the decoder owns all labels.
+ */
+void ownLabelsRec(pll_unode_t * node) {
+  if (node->next == NULL) {
+    node->label = strdup(node->label);
+    return;
+  }
+  pll_unode_t * current = node->next;
+  while (current != node) {
+    ownLabelsRec(current->back);
+    current->label = NULL;
+    current = current->next;
+  }
+  node->label = NULL;
+}
+
+SequentialDecoder::~SequentialDecoder() {
+  clear();
+  for (auto node: free_nodes) {
+    free(node);
+  }
+}
+
+void SequentialDecoder::clear() {
+  if (tree != NULL) {
+    releaseSubtree(tree->back);
+    free(tree->label);
+    free(tree);
+  }
+  tree = NULL;
+}
+
+void SequentialDecoder::start(const pll_unode_t * start_tree) {
+  assert(start_tree->next == NULL);
+  clear();
+
+  tree = copyTree(start_tree);
+  tree->label = strdup(tree->label);
+  ownLabelsRec(tree->back);
+}
+
+pll_unode_t * SequentialDecoder::next(const RecordView &record) {
+  if (!isKeyframe(record.kind) && tree == NULL) {
+    // ERROR: a delta without a tree (the chain was not started, or a record
+    // before it could not be decoded)
+    return NULL;
+  }
+
+  if (record.kind == RECORD_SIMPLE) {
+    clear();
+
+    sdsl::bit_vector succinct_structure = uncompressSuccinctStructure(record.sections[SECTION_TOPOLOGY]);
+    sdsl::int_vector<> node_permutation = uncompressSimplePermutation(record.sections[SECTION_NODE_PERMUTATION]);
+    std::vector<double> branch_lengths;
+    if (!topology_only) {
+      branch_lengths = uncompressBranchLengths(record.sections[SECTION_BRANCH_LENGTHS]);
+    }
+    tree = simple_uncompression(succinct_structure, node_permutation, branch_lengths);
+  } else if (record.kind == RECORD_TOPOLOGY) {
+    // the topology of the referenced simple compression with the own branch lengths
+    assert(archive != NULL);
+    uint64_t id = uncompressTopologyId(record.sections[SECTION_TOPOLOGY_ID]);
+    if (id >= archive->size() || archive->recordKind(id) != RECORD_SIMPLE) {
+      // ERROR: the reference is not a simple compression of the archive
+      clear();
+      return NULL;
+    }
+    RecordView keyframe = archive->record(id);
+    keyframe.sections[SECTION_BRANCH_LENGTHS] = record.sections[SECTION_BRANCH_LENGTHS];
+    return next(keyframe);
+  } else if (record.kind == RECORD_SPLITS) {
+    // the dictionary is decoded once for all records that refer to it
+    assert(archive != NULL);
+    uint64_t offset = uncompressSplitDictionaryOffset(record.sections[SECTION_SPLIT_DICTIONARY]);
+    clear();
+    if (offset != split_dictionary_offset) {
+      split_dictionary_offset = UINT64_MAX;
+      if (!archive->isRecordOffset(offset) || decodeSplitDictionary(archive->recordAt(offset), split_dictionary) < 0) {
+        // ERROR: no split dictionary at the offset
+        return NULL;
+      }
+      split_dictionary_offset = offset;
+    }
+    tree = split_uncompression(split_dictionary, record, topology_only);
+    if (tree == NULL) {
+      // ERROR: the splits do not form a tree
+      return NULL;
+    }
+  } else if (record.kind == RECORD_DAG_TREE) {
+    // the DAG is decoded once for all records that refer to it
+    assert(archive != NULL);
+    uint64_t offset = uncompressDagReference(record.sections[SECTION_DAG_REFERENCE]).first;
+    clear();
+    if (offset != dag_offset) {
+      dag_offset = UINT64_MAX;
+      if (!archive->isRecordOffset(offset) || decodeSubtreeDag(archive->recordAt(offset), dag) < 0) {
+        // ERROR: no subtree DAG at the offset
+        return NULL;
+      }
+      dag_offset = offset;
+    }
+    tree = dag_uncompression(dag, record, topology_only);
+    if (tree == NULL) {
+      // ERROR: the reference is not a tree of the DAG
+      return NULL;
+    }
+  } else if (record.kind == RECORD_SPR) {
+    std::vector<double> branches;
+    if (!topology_only) {
+      branches = uncompressBranchLengths(record.sections[SECTION_CONSENSUS_BRANCHES]);
+    }
+    if (applySprMoves(tree, uncompressSprMoves(record.sections[SECTION_SPR_MOVES]), branches, topology_only, spr) < 0) {
+      // ERROR: the moves do not fit the working tree
+      clear();
+      return NULL;
+    }
+    return tree;
+  } else if (record.kind == RECORD_REPEAT) {
+    // the working tree stays set and ordered
+    return tree;
+  } else if (record.kind == RECORD_BRANCH_LENGTHS) {
+    if (!topology_only) {
+      addBranchLengthDiffs(tree, uncompressBranchLengths(record.sections[SECTION_CONSENSUS_BRANCHES]));
+    }
+    return tree;
+  } else if (record.kind != RECORD_RF) {
+    // ERROR: unknown record kind
+    clear();
+    return NULL;
+  } else {
+
+    sdsl::int_vector<> edges_to_contract = uncompressRFEdgesToContract(record.sections[SECTION_EDGES_TO_CONTRACT]);
+    std::vector<uint64_t> subtree_offsets = uncompressRFSubtreeDirectory(record.sections[SECTION_SUBTREE_DIRECTORY]);
+    sdsl::bit_vector subtrees_succinct = uncompressSuccinctStructure(record.sections[SECTION_SUBTREES]);
+    if (checkRFSubtreeDirectory(subtree_offsets, subtrees_succinct.size()) < 0) {
+      // ERROR: the directory does not fit the subtrees
+      clear();
+      return NULL;
+    }
+    sdsl::int_vector<> permutations = uncompressRFSubtreePermutations(record.sections[SECTION_SUBTREE_PERMUTATIONS], subtree_offsets);
+    if (permutations.size() != subtree_offsets.back()) {
+      // ERROR: the permutation section is too short
+      clear();
+      return NULL;
+    }
+    std::vector<double> consensus_branches;
+    std::vector<double> non_consensus_branches;
+    if (!topology_only) {
+      consensus_branches = uncompressBranchLengths(record.sections[SECTION_CONSENSUS_BRANCHES]);
+      non_consensus_branches = uncompressBranchLengths(record.sections[SECTION_NON_CONSENSUS_BRANCHES]);
+    }
+
+    if (record.sections[SECTION_SUBTREE_MOVES].n_words > 0) {
+      // subtrees stored as moves on the working tree, before it is contracted
+      int result = expandSubtreeMoves(tree, edges_to_contract,
+                uncompressRFSubtreeMoves(record.sections[SECTION_SUBTREE_MOVES]), subtrees_succinct,
+                subtree_offsets, permutations, spr);
+      if (result < 0) {
+        // ERROR: the moves do not fit the working tree
+        clear();
+        return NULL;
+      }
+    }
+
+    if (applyRFDelta(tree, edges_to_contract, subtrees_succinct, subtree_offsets, permutations,
+              consensus_branches, non_consensus_branches, free_nodes) < 0) {
+      // ERROR: the delta does not fit the working tree
+      clear();
+      return NULL;
+    }
+  }
+
+  // the next delta is relative to the ordered tree
+  setTree(tree);
+  orderTree(tree);
+  return tree;
+}
@@ -0,0 +1,71 @@
+#ifndef SEQUENTIAL_DECODER_H
+#define SEQUENTIAL_DECODER_H
+
+#include "uncompress_functions.h"
+#include "datastructure_compression_functions.h"
+#include "split_dictionary.h"
+#include "subtree_dag.h"
+#include "spr_moves.h"
+
+/**
+ * Decodes a chain of compressed trees (a simple compression followed by RF
+ * deltas, each relative to its predecessor) on one working tree.
+ *
+ * Each RF delta is applied in place; the unodes it removes are kept in a free
+ * list and reused for the subtrees of the following deltas, so walking a chain
+ * neither copies the tree nor grows the memory use.
+ */
+struct SequentialDecoder {
+  // working tree, given by its leaf with label "1"; set and ordered
+  pll_unode_t * tree = NULL;
+
+  // unodes removed from the working tree
+  std::vector<pll_unode_t *> free_nodes;
+
+  // skip the branch length sections; the branch lengths of the working tree
+  // are then meaningless
+  bool topology_only = false;
+
+  // archive the records belong to; needed for topology references, split
+  // records and DAG trees only
+  const ArchiveReader * archive = NULL;
+
+  // split dictionary of the last split record and its offset in the archive
+  SplitDictionary split_dictionary;
+  uint64_t split_dictionary_offset = UINT64_MAX;
+
+  // subtree DAG of the last DAG tree and its offset in the archive
+  SubtreeDag dag;
+  uint64_t dag_offset = UINT64_MAX;
+
+  SprScratch spr;
+
+  SequentialDecoder() = default;
+  SequentialDecoder(const SequentialDecoder&) = delete;
+  SequentialDecoder& operator=(const SequentialDecoder&) = delete;
+  ~SequentialDecoder();
+
+  /**
+   * Starts the chain with a copy of the given tree.
+   * @param start_tree leaf with label "1" of a set and ordered tree
+   */
+  void start(const pll_unode_t * start_tree);
+
+  /**
+   * Decodes the next tree of the chain. A simple compression, a topology
+   * reference, a split record or a DAG tree replaces the working tree, an RF
+   * delta, SPR moves or a branch length record is applied to it.
+   * @param  record the compressed tree
+   * @return        the working tree (valid until the next call), NULL if the
+   *                record is corrupt or refers to something that is not in
+   *                the archive (the working tree is dropped then)
+   */
+  pll_unode_t * next(const RecordView &record);
+
+  /**
+   * Frees the working tree.
+   */
+  void clear();
+};
+
+#endif
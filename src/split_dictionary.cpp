@@ -0,0 +1,356 @@
+#include "split_dictionary.h"
+
+#include <algorithm>
+
+#include "compress_functions.h"
+#include "datastructure_compression_functions.h"
+
+static uint64_t splitHash(const uint64_t * split, size_t words) {
+  uint64_t hash = words;
+  for (size_t i = 0; i < words; i++) {
+    hash = mixLabel(hash ^ split[i]);
+  }
+  return hash;
+}
+
+void SplitDictionary::reset(uint32_t taxon_count) {
+  taxa = taxon_count;
+  split_words = (taxon_count + 63) / 64;
+  trees = 0;
+  frequent = 0;
+  splits.clear();
+  counts.clear();
+  table.clear();
+}
+
+uint32_t SplitDictionary::find(const uint64_t * split) const {
+  return table.find(splitHash(split, split_words), [&](uint32_t id) {
+    return std::equal(split, split + split_words, this->split(id));
+  });
+}
+
+uint32_t SplitDictionary::insert(const uint64_t * split, uint64_t count) {
+  assert(find(split) == UINT32_MAX);
+  uint32_t id = table.insert(splitHash(split, split_words), TOPOLOGY_NONE);
+  assert(id == size());
+  splits.insert(splits.end(), split, split + split_words);
+  counts.push_back(count);
+  return id;
+}
+
+/*
+ * Checks that the tree is binary and its taxa are 1..taxa.
+ */
+static bool splitTaxa(const FlatTree &tree, uint32_t taxa) {
+  if (tree.tip_count != taxa || tree.size() != 2 * (size_t) taxa - 2) {
+    return false;
+  }
+  for (size_t v = 0; v < tree.size(); v++) {
+    if (tree.taxon[v] > taxa) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void treeSplits(const FlatTree &tree, size_t split_words, std::vector<uint64_t> &splits) {
+  size_t n = tree.size();
+  splits.assign(n * split_words, 0);
+  for (size_t v = n - 1; v >= 2; v--) {
+    uint64_t * split = splits.data() + v * split_words;
+    if (tree.isLeaf(v)) {
+      split[(tree.taxon[v] - 1) / 64] |= 1ULL << ((tree.taxon[v] - 1) % 64);
+    }
+    // the parent of node 2 and its siblings is node 1, whose split is trivial
+    if (tree.parent[v] >= 2) {
+      uint64_t * parent_split = splits.data() + tree.parent[v] * split_words;
+      for (size_t i = 0; i < split_words; i++) {
+        parent_split[i] |= split[i];
+      }
+    }
+  }
+}
+
+int buildSplitDictionary(const std::vector<std::string> &tree_files, SplitDictionary &dictionary) {
+  FlatTree tree;
+  FlatTreeScratch scratch;
+  std::vector<uint64_t> splits;
+
+  // collect the splits in the order they are seen
+  SplitDictionary seen;
+  for (size_t i = 0; i < tree_files.size(); i++) {
+    if (parseFlatTree(tree_files[i].c_str(), tree, scratch) < 0) {
+      // ERROR: tree could not be parsed
+      return -1;
+    }
+    if (i == 0) {
+      seen.reset(tree.tip_count);
+    }
+    if (!splitTaxa(tree, seen.taxa)) {
+      // ERROR: tree on other taxa or not binary
+      return -1;
+    }
+
+    treeSplits(tree, seen.split_words, splits);
+    for (size_t v = 2; v < tree.size(); v++) {
+      if (!tree.isLeaf(v)) {
+        const uint64_t * split = splits.data() + v * seen.split_words;
+        uint32_t id = seen.find(split);
+        if (id == UINT32_MAX) {
+          id = seen.insert(split, 0);
+        }
+        seen.counts[id]++;
+      }
+    }
+    seen.trees++;
+  }
+
+  // ids by decreasing frequency
+  std::vector<uint32_t> order(seen.size());
+  for (size_t id = 0; id < order.size(); id++) {
+    order[id] = id;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return seen.counts[a] > seen.counts[b];
+  });
+
+  dictionary.reset(seen.taxa);
+  dictionary.trees = seen.trees;
+  for (auto id: order) {
+    dictionary.insert(seen.split(id), seen.counts[id]);
+    if (2 * seen.counts[id] >= seen.trees) {
+      dictionary.frequent++;
+    }
+  }
+  return 0;
+}
+
+EncodedRecord encodeSplitDictionary(const SplitDictionary &dictionary) {
+  std::vector<uint64_t> values = {dictionary.taxa, dictionary.trees, dictionary.frequent};
+  values.insert(values.end(), dictionary.counts.begin(), dictionary.counts.end());
+
+  EncodedRecord record;
+  record.kind = RECORD_SPLIT_DICTIONARY;
+  compressSplits(dictionary.splits, record.sections[SECTION_SPLITS]);
+  compressSplitCounts(values, record.sections[SECTION_SPLIT_COUNTS]);
+  return record;
+}
+
+int decodeSplitDictionary(const RecordView &record, SplitDictionary &dictionary) {
+  if (record.kind != RECORD_SPLIT_DICTIONARY) {
+    return -1;
+  }
+  std::vector<uint64_t> values = uncompressSplitCounts(record.sections[SECTION_SPLIT_COUNTS]);
+  if (values.size() < 3) {
+    return -1;
+  }
+  dictionary.reset(values[0]);
+  dictionary.trees = values[1];
+  dictionary.frequent = values[2];
+
+  const SectionView &splits = record.sections[SECTION_SPLITS];
+  size_t count = values.size() - 3;
+  if (splits.n_words != count * dictionary.split_words) {
+    return -1;
+  }
+  for (size_t id = 0; id < count; id++) {
+    dictionary.insert(splits.words + id * dictionary.split_words, values[3 + id]);
+  }
+  return 0;
+}
+
+// words a section takes in a record
+static size_t sectionCost(const EncodedSection &section) {
+  return section.length > 0 ? 1 + section.words.size() : 0;
+}
+
+int splitCompression(const FlatTree &tree, const SplitDictionary &dictionary, uint64_t dictionary_offset,
+          EncodedRecord &record, int flags, std::vector<uint64_t> &scratch) {
+  if (!splitTaxa(tree, dictionary.taxa)) {
+    // ERROR: tree on other taxa or not binary
+    return -1;
+  }
+  treeSplits(tree, dictionary.split_words, scratch);
+
+  // branch lengths: the leaf branches in the order of the taxa (the branch of
+  // taxon 1 is the one above node 1), then the splits in the order of the ids
+  std::vector<double> branch_lengths(dictionary.taxa);
+  std::vector<std::pair<uint64_t, double>> split_branches;
+  branch_lengths[0] = tree.length[1];
+  for (size_t v = 2; v < tree.size(); v++) {
+    if (tree.isLeaf(v)) {
+      branch_lengths[tree.taxon[v] - 1] = tree.length[v];
+    } else {
+      uint32_t id = dictionary.find(scratch.data() + v * dictionary.split_words);
+      if (id == UINT32_MAX) {
+        // ERROR: split is not in the dictionary
+        return -1;
+      }
+      split_branches.push_back(std::make_pair(id, tree.length[v]));
+    }
+  }
+  std::sort(split_branches.begin(), split_branches.end());
+  std::vector<uint64_t> ids;
+  for (auto &split: split_branches) {
+    ids.push_back(split.first);
+    branch_lengths.push_back(split.second);
+  }
+
+  resetRecord(record, RECORD_SPLITS);
+  compressSplitDictionaryOffset(dictionary_offset, record.sections[SECTION_SPLIT_DICTIONARY]);
+
+  // the ids either all gap coded or the frequent ones as a bitmap
+  EncodedSection all_ids;
+  EncodedSection bitmap;
+  EncodedSection rest_ids;
+  compressSplitIds(ids, all_ids);
+  if (dictionary.frequent > 0) {
+    std::vector<uint64_t> rest(std::lower_bound(ids.begin(), ids.end(), dictionary.frequent), ids.end());
+    compressSplitBitmap(ids, dictionary.frequent, bitmap);
+    compressSplitIds(rest, rest_ids);
+  }
+  size_t size_ids;
+  if (dictionary.frequent > 0 && sectionCost(bitmap) + sectionCost(rest_ids) < sectionCost(all_ids)) {
+    size_ids = setSection(record, SECTION_SPLIT_BITMAP, std::move(bitmap))
+        + setSection(record, SECTION_SPLIT_IDS, std::move(rest_ids));
+  } else {
+    size_ids = setSection(record, SECTION_SPLIT_IDS, std::move(all_ids));
+  }
+  auto size_branches = compressBranchLengths(branch_lengths, record.sections[SECTION_BRANCH_LENGTHS]);
+
+  if (flags & PRINT_COMPRESSION_STRUCTURES) {
+    std::cout << "Split ids: ";
+    for (auto id: ids) {
+      std::cout << id << " ";
+    }
+    std::cout << "\n\tcompressed size: " << size_ids << " bytes\n";
+  }
+
+  if (flags & PRINT_COMPRESSION) {
+    std::cout << "Split compression size: " << size_ids << " (splits) + " << size_branches
+    << " (branches) = " << size_ids + size_branches << " bytes\n";
+
+    std::cout << "---------------------------------------------------------\n";
+  }
+  return 0;
+}
+
+int split_compression(const std::vector<std::string> &tree_files, const std::string &archive_file, int flags) {
+  SplitDictionary dictionary;
+  if (buildSplitDictionary(tree_files, dictionary) < 0) {
+    return -1;
+  }
+
+  ArchiveWriter writer;
+  if (writer.open(archive_file) < 0) {
+    return -1;
+  }
+  EncodedRecord record = encodeSplitDictionary(dictionary);
+  int64_t dictionary_offset = writer.appendAuxiliary(record);
+  if (dictionary_offset < 0) {
+    return -1;
+  }
+  if (flags & PRINT_COMPRESSION) {
+    std::cout << "Split dictionary: " << dictionary.size() << " splits (" << dictionary.frequent
+    << " frequent), " << recordWords(record) * sizeof(uint64_t) << " bytes\n";
+  }
+
+  FlatTree tree;
+  FlatTreeScratch scratch;
+  std::vector<uint64_t> splits;
+  for (auto &tree_file: tree_files) {
+    if (parseFlatTree(tree_file.c_str(), tree, scratch) < 0
+          || splitCompression(tree, dictionary, dictionary_offset, record, flags, splits) < 0
+          || writer.append(record) < 0) {
+      return -1;
+    }
+  }
+  return writer.close();
+}
+
+pll_unode_t * split_uncompression(const SplitDictionary &dictionary, const RecordView &record, bool topology_only) {
+  uint32_t taxa = dictionary.taxa;
+  std::vector<uint64_t> ids = uncompressSplitIds(record.sections[SECTION_SPLIT_BITMAP], record.sections[SECTION_SPLIT_IDS]);
+  if (taxa < 3 || ids.size() != taxa - 3 || std::adjacent_find(ids.begin(), ids.end()) != ids.end()) {
+    // ERROR: not a binary tree
+    return NULL;
+  }
+  size_t k = ids.size();
+  std::vector<double> lengths(taxa + k, 0);
+  if (!topology_only) {
+    lengths = uncompressBranchLengths(record.sections[SECTION_BRANCH_LENGTHS]);
+    if (lengths.size() != taxa + k) {
+      return NULL;
+    }
+  }
+
+  // the splits by decreasing size: every split comes after the splits that contain it
+  std::vector<std::pair<uint32_t, uint32_t>> by_size(k);
+  for (size_t i = 0; i < k; i++) {
+    if (ids[i] >= dictionary.size()) {
+      return NULL;
+    }
+    const uint64_t * split = dictionary.split(ids[i]);
+    uint32_t size = 0;
+    for (size_t w = 0; w < dictionary.split_words; w++) {
+      size += __builtin_popcountll(split[w]);
+    }
+    by_size[i] = std::make_pair(size, i);
+  }
+  std::sort(by_size.begin(), by_size.end(), [](const std::pair<uint32_t, uint32_t> &a, const std::pair<uint32_t, uint32_t> &b) {
+    return a.first > b.first;
+  });
+
+  // nodes: the leaf with taxon 1, its neighbour, the splits, the other leaves;
+  // every node follows its parent
+  size_t n = 2 + k + taxa - 1;
+  std::vector<uint32_t> parent(n);
+  std::vector<uint32_t> taxon(n, 0);
+  std::vector<double> length(n);
+  parent[0] = FLAT_NONE;
+  taxon[0] = 1;
+  length[0] = 0;
+  parent[1] = 0;
+  length[1] = lengths[0];
+
+  // deepest split seen so far that contains each taxon
+  std::vector<uint32_t> deepest(taxa + 1, 1);
+  for (size_t j = 0; j < k; j++) {
+    uint32_t node = 2 + j;
+    uint32_t i = by_size[j].second;
+    const uint64_t * split = dictionary.split(ids[i]);
+    parent[node] = FLAT_NONE;
+    for (size_t w = 0; w < dictionary.split_words; w++) {
+      for (uint64_t bits = split[w]; bits != 0; bits &= bits - 1) {
+        uint32_t t = 64 * w + __builtin_ctzll(bits) + 1;
+        if (parent[node] == FLAT_NONE) {
+          parent[node] = deepest[t];
+        }
+        if (t == 1 || deepest[t] != parent[node]) {
+          // ERROR: incompatible splits
+          return NULL;
+        }
+        deepest[t] = node;
+      }
+    }
+    length[node] = lengths[taxa + i];
+  }
+  for (uint32_t t = 2; t <= taxa; t++) {
+    uint32_t node = 2 + k + t - 2;
+    parent[node] = deepest[t];
+    taxon[node] = t;
+    length[node] = lengths[t - 1];
+  }
+
+  FlatTree tree;
+  FlatTreeScratch scratch;
+  // n - 3 distinct compatible splits resolve the tree completely
+  buildFlatTree(parent, taxon, length, tree, scratch);
+
+  // rebuild the tree from its simple compression structures
+  sdsl::bit_vector succinct_structure(4 * taxa - 2, 0);
+  sdsl::int_vector<> node_permutation(taxa, 0, 32);
+  std::vector<double> branch_lengths(2 * taxa - 2);
+  assignBranchNumbers(tree, succinct_structure, node_permutation, branch_lengths);
+  return simple_uncompression(succinct_structure, node_permutation, branch_lengths);
+}
@@ -0,0 +1,140 @@
+#ifndef SPLIT_DICTIONARY_H
+#define SPLIT_DICTIONARY_H
+
+#include <string>
+#include <vector>
+
+#include "uncompress_functions.h"
+#include "archive.h"
+#include "flat_tree.h"
+#include "topology_dictionary.h"
+
+/**
+ * Global split dictionary of a set of trees on the same taxa 1..n (e.g. the
+ * samples of a run). A non-trivial split is given by the taxa below its
+ * branch when the tree is rooted at taxon 1, stored as a bit set (bit t - 1
+ * for taxon t). Every distinct split gets an id; the ids are ordered by
+ * decreasing frequency, so the splits of the majority rule consensus come
+ * first.
+ *
+ * A split archive starts with the dictionary (an auxiliary record), followed
+ * by one split record per tree: the ids of its n - 3 splits, stored as a
+ * bitmap over the frequent splits plus the gap coded remaining ids (or all
+ * ids gap coded, whichever is smaller), and its branch lengths per split.
+ * Every tree can be decoded on its own, and the frequency of a clade can be
+ * read off the dictionary.
+ */
+struct SplitDictionary {
+  uint32_t taxa = 0;
+  size_t split_words = 0;
+
+  // number of trees, the splits [0, frequent) are in at least half of them
+  uint64_t trees = 0;
+  uint64_t frequent = 0;
+
+  // bit set (split_words words) and number of trees of each split
+  std::vector<uint64_t> splits;
+  std::vector<uint64_t> counts;
+
+  // hash set of the splits: entry i is split i
+  TopologyDictionary table;
+
+  size_t size() const {
+    return counts.size();
+  }
+
+  const uint64_t * split(uint32_t id) const {
+    assert(id < size());
+    return splits.data() + id * split_words;
+  }
+
+  // fraction of the trees that contain the split
+  double frequency(uint32_t id) const {
+    assert(id < size());
+    return trees == 0 ? 0 : (double) counts[id] / trees;
+  }
+
+  /**
+   * Clears the dictionary for trees with the given number of taxa.
+   */
+  void reset(uint32_t taxon_count);
+
+  /**
+   * Searches a split.
+   * @param  split bit set of the split
+   * @return       id of the split, UINT32_MAX if it is not in the dictionary
+   */
+  uint32_t find(const uint64_t * split) const;
+
+  /**
+   * Adds a split that is not in the dictionary yet.
+   * @param  split bit set of the split
+   * @param  count number of trees that contain it
+   * @return       id of the split
+   */
+  uint32_t insert(const uint64_t * split, uint64_t count);
+};
+
+/**
+ * Computes the splits of a tree: for each node v the bit set of the taxa
+ * below it (split_words words at offset v * split_words). Nodes 0 and 1 are
+ * left empty, the leaves have trivial splits.
+ * @param tree        the tree
+ * @param split_words number of words of a bit set
+ * @param splits      bit sets of the nodes
+ */
+void treeSplits(const FlatTree &tree, size_t split_words, std::vector<uint64_t> &splits);
+
+/**
+ * Parses the trees and collects their splits, with the ids ordered by
+ * decreasing frequency.
+ * @param  tree_files trees in newick format
+ * @param  dictionary the dictionary
+ * @return            value < 0 in case of an error (e.g. trees on different taxa)
+ */
+int buildSplitDictionary(const std::vector<std::string> &tree_files, SplitDictionary &dictionary);
+
+/**
+ * Encodes the dictionary as an auxiliary record.
+ */
+EncodedRecord encodeSplitDictionary(const SplitDictionary &dictionary);
+
+/**
+ * Decodes a dictionary record.
+ * @return value < 0 in case of an error
+ */
+int decodeSplitDictionary(const RecordView &record, SplitDictionary &dictionary);
+
+/**
+ * Compresses a tree through the split dictionary.
+ * @param  tree              the tree
+ * @param  dictionary        dictionary that holds all splits of the tree
+ * @param  dictionary_offset offset of the dictionary record in the archive
+ * @param  record            record to store the compressed tree
+ * @param  flags             flags (see compress_functions.h)
+ * @param  scratch           buffer for the splits of the tree
+ * @return                   value < 0 in case of an error
+ */
+int splitCompression(const FlatTree &tree, const SplitDictionary &dictionary, uint64_t dictionary_offset,
+          EncodedRecord &record, int flags, std::vector<uint64_t> &scratch);
+
+/**
+ * Compresses the given trees into a split archive (two passes over the
+ * trees: one to build the dictionary, one to encode them).
+ * @param  tree_files   trees in newick format
+ * @param  archive_file archive file
+ * @param  flags        flags (see compress_functions.h)
+ * @return              value < 0 in case of an error
+ */
+int split_compression(const std::vector<std::string> &tree_files, const std::string &archive_file, int flags);
+
+/**
+ * Decodes a split record.
+ * @param  dictionary   the dictionary of the record
+ * @param  record       the compressed tree
+ * @param  topology_only skip the branch lengths
+ * @return              leaf with label "1" of the tree, NULL in case of an error
+ */
+pll_unode_t * split_uncompression(const SplitDictionary &dictionary, const RecordView &record, bool topology_only);
+
+#endif
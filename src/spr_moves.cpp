@@ -0,0 +1,554 @@
+#include "spr_moves.h"
+
+#include <algorithm>
+
+#include "datastructure_compression_functions.h"
+
+/*
+ * The other child of the parent of a node in a binary tree.
+ */
+static uint32_t sibling(const FlatTree &tree, uint32_t v) {
+  uint32_t first = tree.first_child[tree.parent[v]];
+  return first == v ? tree.next_sibling[v] : first;
+}
+
+void sprMove(const FlatTree &tree, uint32_t prune, uint32_t regraft, FlatTree &moved, SprScratch &scratch) {
+  size_t n = tree.size();
+  uint32_t q = tree.parent[prune];
+  uint32_t s = sibling(tree, prune);
+  assert(prune >= 2 && regraft >= 1 && regraft != q && regraft != s);
+  assert(regraft < prune || regraft >= prune + tree.subtree_size[prune]);
+
+  // suppress the parent of the pruned subtree and insert it above regraft
+  std::vector<uint32_t> &parent = scratch.parent;
+  parent.assign(tree.parent.begin(), tree.parent.end());
+  parent[s] = tree.parent[q];
+  parent[q] = parent[regraft];
+  parent[regraft] = q;
+
+  // lengths: the suppressed branches are joined, the regraft branch is split
+  std::vector<double> &length = scratch.length;
+  length.assign(tree.length.begin(), tree.length.end());
+  length[s] += length[q];
+  length[q] = length[regraft] / 2;
+  length[regraft] -= length[q];
+
+  // renumber in preorder, so every node follows its parent
+  std::vector<uint32_t> &child_offset = scratch.child_offset;
+  std::vector<uint32_t> &children = scratch.children;
+  child_offset.assign(n + 1, 0);
+  for (size_t v = 1; v < n; v++) {
+    child_offset[parent[v] + 1]++;
+  }
+  for (size_t v = 0; v < n; v++) {
+    child_offset[v + 1] += child_offset[v];
+  }
+  children.resize(n - 1);
+  std::vector<uint32_t> &order = scratch.order;
+  order.assign(child_offset.begin(), child_offset.end() - 1);
+  for (size_t v = 1; v < n; v++) {
+    children[order[parent[v]]++] = v;
+  }
+
+  std::vector<uint32_t> &stack = scratch.stack;
+  order.assign(n, FLAT_NONE);
+  stack.assign(1, 0);
+  std::vector<uint32_t> &preorder = scratch.preorder;
+  preorder.clear();
+  while (!stack.empty()) {
+    uint32_t v = stack.back();
+    stack.pop_back();
+    order[v] = preorder.size();
+    preorder.push_back(v);
+    for (uint32_t i = child_offset[v]; i < child_offset[v + 1]; i++) {
+      stack.push_back(children[i]);
+    }
+  }
+  assert(preorder.size() == n);
+
+  std::vector<uint32_t> &moved_parent = scratch.moved_parent;
+  std::vector<uint32_t> &moved_taxon = scratch.moved_taxon;
+  std::vector<double> &moved_length = scratch.moved_length;
+  moved_parent.resize(n);
+  moved_taxon.resize(n);
+  moved_length.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    uint32_t v = preorder[i];
+    moved_parent[i] = v == 0 ? FLAT_NONE : order[parent[v]];
+    moved_taxon[i] = tree.taxon[v];
+    moved_length[i] = length[v];
+  }
+  buildFlatTree(moved_parent, moved_taxon, moved_length, moved, scratch.flat);
+}
+
+/*
+ * Number of inner nodes of tree2 whose split is not in the other tree.
+ */
+static size_t unmatchedSplits(const FlatTree &tree2, const std::vector<uint32_t> &match) {
+  size_t unmatched = 0;
+  for (size_t v = 2; v < tree2.size(); v++) {
+    if (!tree2.isLeaf(v) && match[v] == FLAT_NONE) {
+      unmatched++;
+    }
+  }
+  return unmatched;
+}
+
+/*
+ * Node of the current tree above which the subtree below prune has to be
+ * regrafted to get the same sibling as the matching node of the target tree,
+ * FLAT_NONE if there is no such node or the move does not change the tree.
+ */
+static uint32_t regraftTarget(const FlatTree &current, uint32_t prune, const FlatTree &target, uint32_t v,
+          SprScratch &scratch) {
+  // taxa of the sibling in the target tree (a range in depth-first order)
+  uint32_t sv = sibling(target, v);
+  std::vector<uint32_t> &counts = scratch.counts;
+  counts.assign(current.size(), 0);
+  uint32_t cluster_size = 0;
+  for (uint32_t u = sv; u < sv + target.subtree_size[sv]; u++) {
+    if (target.isLeaf(u)) {
+      if (target.taxon[u] >= scratch.leaf_of.size() || scratch.leaf_of[target.taxon[u]] == 0) {
+        return FLAT_NONE;
+      }
+      counts[scratch.leaf_of[target.taxon[u]]]++;
+      cluster_size++;
+    }
+  }
+  for (size_t u = current.size() - 1; u >= 2; u--) {
+    counts[current.parent[u]] += counts[u];
+  }
+
+  // the deepest node with all these taxa has to have no others (besides the
+  // pruned ones)
+  uint32_t regraft = FLAT_NONE;
+  for (size_t u = current.size() - 1; u >= 1; u--) {
+    if (counts[u] == cluster_size) {
+      regraft = u;
+      break;
+    }
+  }
+  if (regraft == FLAT_NONE) {
+    return FLAT_NONE;
+  }
+  uint32_t leaves = scratch.leaves[regraft];
+  if (regraft < prune && prune < regraft + current.subtree_size[regraft]) {
+    leaves -= scratch.leaves[prune];
+  }
+  if (leaves != cluster_size || regraft == current.parent[prune] || regraft == sibling(current, prune)) {
+    return FLAT_NONE;
+  }
+  return regraft;
+}
+
+int findSprMoves(const FlatTree &reference, const FlatTree &tree, size_t max_moves, size_t max_unmatched,
+          size_t &evaluations, SprScratch &scratch) {
+  if (tree.tip_count != reference.tip_count) {
+    return -1;
+  }
+  FlatTree &current = scratch.current;
+  current = reference;
+  scratch.moves.clear();
+
+  indexClusters(current, scratch.clusters, scratch.flat);
+  matchClusters(scratch.clusters, tree, scratch.match, scratch.flat);
+  size_t unmatched = unmatchedSplits(tree, scratch.match);
+  if (unmatched > max_unmatched) {
+    return -1;
+  }
+  while (unmatched > 0) {
+    if (scratch.moves.size() >= 2 * max_moves) {
+      return -1;
+    }
+
+    size_t n = current.size();
+    scratch.reverse.assign(n, FLAT_NONE);
+    for (size_t v = 0; v < tree.size(); v++) {
+      if (scratch.match[v] != FLAT_NONE) {
+        scratch.reverse[scratch.match[v]] = v;
+      }
+    }
+    scratch.leaf_of.assign(current.tip_count + 1, 0);
+    scratch.leaves.assign(n, 0);
+    for (size_t u = n - 1; u >= 1; u--) {
+      if (current.isLeaf(u)) {
+        if (current.taxon[u] > current.tip_count) {
+          return -1;
+        }
+        scratch.leaf_of[current.taxon[u]] = u;
+        scratch.leaves[u] = 1;
+      }
+      if (u >= 2) {
+        scratch.leaves[current.parent[u]] += scratch.leaves[u];
+      }
+    }
+
+    // candidates: shared subtrees next to a differing split in either tree
+    uint32_t best_prune = FLAT_NONE;
+    uint32_t best_regraft = FLAT_NONE;
+    size_t best_unmatched = unmatched;
+    for (uint32_t prune = 2; prune < n; prune++) {
+      uint32_t v = scratch.reverse[prune];
+      if (v == FLAT_NONE || (scratch.reverse[current.parent[prune]] != FLAT_NONE
+            && scratch.match[tree.parent[v]] != FLAT_NONE)) {
+        continue;
+      }
+      uint32_t regraft = regraftTarget(current, prune, tree, v, scratch);
+      if (regraft == FLAT_NONE) {
+        continue;
+      }
+      if (evaluations == 0) {
+        return -1;
+      }
+      evaluations--;
+
+      sprMove(current, prune, regraft, scratch.candidate, scratch);
+      indexClusters(scratch.candidate, scratch.clusters, scratch.flat);
+      matchClusters(scratch.clusters, tree, scratch.candidate_match, scratch.flat);
+      size_t candidate_unmatched = unmatchedSplits(tree, scratch.candidate_match);
+      if (candidate_unmatched < best_unmatched) {
+        best_prune = prune;
+        best_regraft = regraft;
+        best_unmatched = candidate_unmatched;
+        std::swap(scratch.best, scratch.candidate);
+        std::swap(scratch.best_match, scratch.candidate_match);
+      }
+    }
+    if (best_prune == FLAT_NONE) {
+      return -1;
+    }
+    std::swap(scratch.match, scratch.best_match);
+    scratch.moves.push_back(best_prune + 1);
+    scratch.moves.push_back(best_regraft + 1);
+    std::swap(current, scratch.best);
+    unmatched = best_unmatched;
+  }
+  return 0;
+}
+
+int sprCompression(const FlatTree &reference, const ClusterIndex &reference_clusters, const FlatTree &tree,
+          EncodedRecord &record, size_t max_moves, size_t max_evaluations, SprScratch &scratch) {
+  size_t evaluations = max_evaluations;
+  if (findSprMoves(reference, tree, max_moves, SPR_MAX_PATH * max_moves, evaluations, scratch) < 0) {
+    return -1;
+  }
+
+  // branch lengths relative to the predecessor
+  matchClusters(reference_clusters, tree, scratch.match, scratch.flat);
+  std::vector<double> &branches = scratch.branches;
+  branches.resize(tree.size() - 1);
+  for (size_t v = 1; v < tree.size(); v++) {
+    branches[v - 1] = tree.length[v];
+    if (scratch.match[v] != FLAT_NONE) {
+      branches[v - 1] -= reference.length[scratch.match[v]];
+    }
+  }
+
+  resetRecord(record, RECORD_SPR);
+  compressSprMoves(scratch.moves, record.sections[SECTION_SPR_MOVES]);
+  compressBranchLengths(branches, record.sections[SECTION_CONSENSUS_BRANCHES]);
+  return 0;
+}
+
+/*
+ * Collects the unodes through which the nodes of a set and ordered binary
+ * tree are entered, in canonical depth-first order, and their parents.
+ */
+static void orderedNodes(pll_unode_t * tree, std::vector<pll_unode_t *> &nodes, std::vector<uint32_t> &parent,
+          std::vector<uint32_t> &stack) {
+  nodes.assign(1, tree);
+  parent.assign(1, FLAT_NONE);
+  stack.clear();
+  pll_unode_t * node = tree->back;
+  uint32_t node_parent = 0;
+  for (;;) {
+    uint32_t v = nodes.size();
+    nodes.push_back(node);
+    parent.push_back(node_parent);
+    if (node->next != NULL) {
+      // the second child is visited after the subtree of the first one
+      stack.push_back(v);
+      node = node->next->back;
+      node_parent = v;
+    } else if (!stack.empty()) {
+      node_parent = stack.back();
+      node = nodes[node_parent]->next->next->back;
+      stack.pop_back();
+    } else {
+      break;
+    }
+  }
+}
+
+int applySprMoves(pll_unode_t * tree, const std::vector<uint64_t> &moves, const std::vector<double> &branches,
+          bool topology_only, SprScratch &scratch) {
+  if (moves.size() % 2 != 0) {
+    // ERROR: a move without regraft branch
+    return -1;
+  }
+  if (!topology_only) {
+    flattenTree(tree, scratch.current, scratch.flat);
+    indexClusters(scratch.current, scratch.clusters, scratch.flat);
+  }
+
+  std::vector<pll_unode_t *> &nodes = scratch.nodes;
+  for (size_t i = 0; i < moves.size(); i += 2) {
+    orderedNodes(tree, nodes, scratch.node_parent, scratch.stack);
+    if (moves[i] < 3 || moves[i] > nodes.size() || moves[i + 1] < 2 || moves[i + 1] > nodes.size()) {
+      // ERROR: branch not in the tree
+      return -1;
+    }
+    uint32_t prune = moves[i] - 1;
+    uint32_t regraft = moves[i + 1] - 1;
+
+    uint32_t prune_parent = scratch.node_parent[prune];
+    if (regraft == prune_parent || scratch.node_parent[regraft] == prune_parent) {
+      // ERROR: regraft branch above or beside the pruned subtree (no move)
+      return -1;
+    }
+    for (uint32_t v = regraft; v != FLAT_NONE; v = scratch.node_parent[v]) {
+      if (v == prune) {
+        // ERROR: regraft branch in the pruned subtree (the move makes a cycle)
+        return -1;
+      }
+    }
+
+    // ring of the parent: towards the pruned subtree, its parent and its sibling
+    pll_unode_t * u = nodes[prune];
+    pll_unode_t * pruned_side = u->back;
+    pll_unode_t * parent_side = nodes[scratch.node_parent[prune]];
+    pll_unode_t * sibling_side = pruned_side->next == parent_side ? parent_side->next : pruned_side->next;
+    assert(parent_side != pruned_side && sibling_side != pruned_side && sibling_side != parent_side);
+
+    // suppress the parent
+    pll_unode_t * a = parent_side->back;
+    pll_unode_t * b = sibling_side->back;
+    a->back = b;
+    b->back = a;
+    a->length = b->length = parent_side->length + sibling_side->length;
+
+    // reuse its ring above regraft
+    pll_unode_t * r = nodes[regraft];
+    assert(r != b);
+    pll_unode_t * above = r->back;
+    double length = r->length / 2;
+    parent_side->back = above;
+    above->back = parent_side;
+    sibling_side->back = r;
+    r->back = sibling_side;
+    parent_side->length = above->length = length;
+    sibling_side->length = r->length = length;
+
+    setTree(tree);
+    orderTree(tree);
+  }
+
+  if (!topology_only) {
+    flattenTree(tree, scratch.candidate, scratch.flat);
+    matchClusters(scratch.clusters, scratch.candidate, scratch.match, scratch.flat);
+    orderedNodes(tree, nodes, scratch.node_parent, scratch.stack);
+    if (branches.size() + 1 != nodes.size()) {
+      // ERROR: not one branch length per branch
+      return -1;
+    }
+    for (size_t v = 1; v < nodes.size(); v++) {
+      double length = branches[v - 1];
+      if (scratch.match[v] != FLAT_NONE) {
+        length += scratch.current.length[scratch.match[v]];
+      }
+      nodes[v]->length = nodes[v]->back->length = length;
+    }
+  }
+  return 0;
+}
+
+void consensusPolytomies(const FlatTree &tree, const std::vector<bool> &contracted, std::vector<uint32_t> &nodes,
+          SprScratch &scratch) {
+  // the node of the consensus tree each node is merged into and the number of
+  // children of each node of the consensus tree
+  size_t n = tree.size();
+  std::vector<uint32_t> &merged = scratch.order;
+  std::vector<uint32_t> &children = scratch.counts;
+  merged.resize(n);
+  children.assign(n, 0);
+  merged[0] = 0;
+  for (uint32_t v = 1; v < n; v++) {
+    merged[v] = contracted[v] ? merged[tree.parent[v]] : v;
+    if (v >= 2 && !contracted[v]) {
+      children[merged[tree.parent[v]]]++;
+    }
+  }
+
+  // a node is done when the depth-first order leaves its subtree
+  std::vector<uint32_t> &stack = scratch.stack;
+  stack.clear();
+  nodes.clear();
+  for (uint32_t v = 1; v <= n; v++) {
+    while (!stack.empty() && v >= stack.back() + tree.subtree_size[stack.back()]) {
+      if (children[stack.back()] > 2) {
+        nodes.push_back(stack.back());
+      }
+      stack.pop_back();
+    }
+    if (v < n && !contracted[v] && !tree.isLeaf(v)) {
+      stack.push_back(v);
+    }
+  }
+}
+
+void resolutionTree(const FlatTree &tree, const std::vector<bool> &expanded, uint32_t v, FlatTree &resolution,
+          SprScratch &scratch) {
+  std::vector<uint32_t> &parent = scratch.moved_parent;
+  std::vector<uint32_t> &taxon = scratch.moved_taxon;
+  std::vector<double> &length = scratch.moved_length;
+  std::vector<uint32_t> &labels = scratch.leaves;
+  parent.assign(1, FLAT_NONE);
+  parent.push_back(0);
+  taxon.assign(1, 1);
+  taxon.push_back(0);
+  labels.clear();
+
+  // open inner nodes as pairs of the node in the tree and in the resolution
+  std::vector<uint32_t> &stack = scratch.stack;
+  stack.assign(1, v);
+  stack.push_back(1);
+  for (uint32_t u = v + 1; u < v + tree.subtree_size[v]; ) {
+    while (u >= stack[stack.size() - 2] + tree.subtree_size[stack[stack.size() - 2]]) {
+      stack.resize(stack.size() - 2);
+    }
+    parent.push_back(stack.back());
+    if (expanded[u] && !tree.isLeaf(u)) {
+      taxon.push_back(0);
+      stack.push_back(u);
+      stack.push_back(parent.size() - 1);
+      u++;
+    } else {
+      taxon.push_back(tree.min_taxon[u]);
+      labels.push_back(tree.min_taxon[u]);
+      u += tree.subtree_size[u];
+    }
+  }
+
+  // the leaves are labelled by the rank of their smallest taxon
+  std::sort(labels.begin(), labels.end());
+  for (size_t i = 2; i < taxon.size(); i++) {
+    if (taxon[i] != 0) {
+      taxon[i] = std::lower_bound(labels.begin(), labels.end(), taxon[i]) - labels.begin() + 2;
+    }
+  }
+  length.assign(parent.size(), 0);
+  buildFlatTree(parent, taxon, length, resolution, scratch.flat);
+}
+
+int expandSubtreeMoves(pll_unode_t * tree, const sdsl::int_vector<> &edges_to_contract,
+          const std::vector<uint64_t> &subtree_moves, sdsl::bit_vector &subtrees_succinct,
+          std::vector<uint64_t> &subtree_offsets, sdsl::int_vector<> &succinct_permutations, SprScratch &scratch) {
+  FlatTree &predecessor = scratch.best;
+  flattenTree(tree, predecessor, scratch.flat);
+  size_t n = predecessor.size();
+  std::vector<bool> &contracted = scratch.contracted;
+  contracted.assign(n, false);
+  for (size_t i = 0; i < edges_to_contract.size(); i++) {
+    uint64_t v = edges_to_contract[i] - 1;
+    if (edges_to_contract[i] < 3 || v >= n || predecessor.isLeaf(v)) {
+      return -1;
+    }
+    contracted[v] = true;
+  }
+  std::vector<uint32_t> &polytomies = scratch.polytomies;
+  consensusPolytomies(predecessor, contracted, polytomies, scratch);
+
+  // merge the subtrees given by moves and the explicit ones in the order of
+  // the consensus tree
+  std::vector<uint8_t> bits;
+  std::vector<uint32_t> permutations;
+  std::vector<uint64_t> offsets(1, 0);
+  size_t explicit_count = subtree_offsets.size() - 1;
+  size_t next_explicit = 0;
+  size_t moves_idx = 0;
+  size_t next_moved = subtree_moves.empty() ? SIZE_MAX : subtree_moves[0];
+  for (size_t i = 0; i < polytomies.size(); i++) {
+    if (i != next_moved) {
+      if (next_explicit >= explicit_count) {
+        return -1;
+      }
+      size_t leaves = subtree_offsets[next_explicit + 1] - subtree_offsets[next_explicit];
+      size_t start = 4 * subtree_offsets[next_explicit] - 2 * next_explicit;
+      for (size_t j = start; j < start + 4 * leaves - 2; j++) {
+        bits.push_back(subtrees_succinct[j]);
+      }
+      for (size_t j = subtree_offsets[next_explicit]; j < subtree_offsets[next_explicit + 1]; j++) {
+        permutations.push_back(succinct_permutations[j]);
+      }
+      offsets.push_back(offsets.back() + leaves);
+      next_explicit++;
+      continue;
+    }
+
+    if (moves_idx + 2 > subtree_moves.size() || moves_idx + 2 + 2 * subtree_moves[moves_idx + 1] > subtree_moves.size()) {
+      return -1;
+    }
+    FlatTree &from = scratch.from;
+    resolutionTree(predecessor, contracted, polytomies[i], from, scratch);
+
+    // position of each leaf in the children set of the consensus node
+    std::vector<uint32_t> &position = scratch.leaf_of;
+    position.assign(from.tip_count + 1, 0);
+    uint32_t leaves = 0;
+    for (uint32_t u = 1; u < from.size(); u++) {
+      if (from.isLeaf(u)) {
+        position[from.taxon[u]] = leaves++;
+      }
+    }
+
+    size_t count = subtree_moves[moves_idx + 1];
+    for (size_t m = 0; m < count; m++) {
+      uint64_t prune = subtree_moves[moves_idx + 2 + 2 * m] - 1;
+      uint64_t regraft = subtree_moves[moves_idx + 3 + 2 * m] - 1;
+      if (prune < 2 || prune >= from.size() || regraft < 1 || regraft >= from.size()
+            || regraft == from.parent[prune] || regraft == sibling(from, prune)
+            || (prune <= regraft && regraft < prune + from.subtree_size[prune])) {
+        // ERROR: not a valid move
+        return -1;
+      }
+      sprMove(from, prune, regraft, scratch.to, scratch);
+      std::swap(from, scratch.to);
+    }
+
+    // parantheses and permutation of the moved resolution, as stored for an
+    // explicit subtree
+    std::vector<uint32_t> &stack = scratch.stack;
+    stack.clear();
+    for (uint32_t u = 1; u <= from.size(); u++) {
+      while (!stack.empty() && u >= stack.back() + from.subtree_size[stack.back()]) {
+        bits.push_back(1);
+        stack.pop_back();
+      }
+      if (u < from.size()) {
+        bits.push_back(0);
+        stack.push_back(u);
+        if (from.isLeaf(u)) {
+          permutations.push_back(position[from.taxon[u]]);
+        }
+      }
+    }
+    offsets.push_back(offsets.back() + leaves);
+
+    moves_idx += 2 + 2 * count;
+    next_moved = moves_idx < subtree_moves.size() ? i + subtree_moves[moves_idx] : SIZE_MAX;
+  }
+  if (next_explicit != explicit_count || moves_idx != subtree_moves.size()) {
+    return -1;
+  }
+
+  subtrees_succinct = sdsl::bit_vector(bits.size(), 0);
+  for (size_t j = 0; j < bits.size(); j++) {
+    subtrees_succinct[j] = bits[j];
+  }
+  succinct_permutations = sdsl::int_vector<>(permutations.size(), 0, 32);
+  for (size_t j = 0; j < permutations.size(); j++) {
+    succinct_permutations[j] = permutations[j];
+  }
+  subtree_offsets = std::move(offsets);
+  return 0;
+}
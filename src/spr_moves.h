@@ -0,0 +1,196 @@
+#ifndef SPR_MOVES_H
+#define SPR_MOVES_H
+
+#include <vector>
+
+#include "uncompress_functions.h"
+#include "archive.h"
+#include "flat_tree.h"
+
+/**
+ * Delta of a tree to its predecessor as a short sequence of SPR moves (NNI
+ * moves are SPR moves over one edge). A move prunes the subtree below a
+ * branch and regrafts it onto another branch; both are given by their branch
+ * ids in the canonical depth-first order of the tree the move is applied to
+ * (the branch above node v is branch v + 1, as in the rf distance compression).
+ *
+ * The moves are searched greedily: each candidate moves a subtree that both
+ * trees share next to the subtree it is attached to in the target tree; the
+ * candidate that leaves the fewest differing splits is taken. The search gives
+ * up after a number of moves or once it has evaluated a number of candidates,
+ * so it finds the same moves for the same trees on every run.
+ */
+
+// a move over k branches changes at most k splits; trees that differ in more
+// than SPR_MAX_PATH splits per allowed move are left to the rf delta
+#define SPR_MAX_PATH 8
+
+// candidate moves the search of an SPR record evaluates at most
+#define SPR_EVALUATIONS 64
+
+// rf subtrees with RF_MOVES_MIN_LEAVES to RF_MOVES_MAX_LEAVES leaves are tried
+// as at most RF_MOVES_MAX_DEPTH moves; the searches of one rf delta evaluate
+// RF_MOVES_EVALUATIONS candidate moves together
+#define RF_MOVES_MIN_LEAVES 6
+#define RF_MOVES_MAX_LEAVES 512
+#define RF_MOVES_MAX_DEPTH 4
+#define RF_MOVES_EVALUATIONS 256
+
+/**
+ * Buffers of the SPR search and of applying SPR moves.
+ */
+struct SprScratch {
+  FlatTreeScratch flat;
+  FlatTree current;
+  FlatTree candidate;
+  FlatTree best;
+  ClusterIndex clusters;
+
+  // resolutions of an rf subtree in both trees
+  FlatTree from;
+  FlatTree to;
+
+  // nodes of the consensus tree with more than two children, contracted
+  // branches of the predecessor
+  std::vector<uint32_t> polytomies;
+  std::vector<bool> contracted;
+
+  // nodes of the current tree matched with the target tree (and back)
+  std::vector<uint32_t> match;
+  std::vector<uint32_t> candidate_match;
+  std::vector<uint32_t> best_match;
+  std::vector<uint32_t> reverse;
+
+  // leaf of each taxon, leaves below each node, taxa of the target cluster
+  // below each node
+  std::vector<uint32_t> leaf_of;
+  std::vector<uint32_t> leaves;
+  std::vector<uint32_t> counts;
+
+  // moved tree before it is canonicalised, and in preorder
+  std::vector<uint32_t> parent;
+  std::vector<double> length;
+  std::vector<uint32_t> child_offset;
+  std::vector<uint32_t> children;
+  std::vector<uint32_t> order;
+  std::vector<uint32_t> stack;
+  std::vector<uint32_t> preorder;
+  std::vector<uint32_t> moved_parent;
+  std::vector<uint32_t> moved_taxon;
+  std::vector<double> moved_length;
+
+  // nodes of a pll tree in canonical depth-first order
+  std::vector<pll_unode_t *> nodes;
+  std::vector<uint32_t> node_parent;
+
+  std::vector<uint64_t> moves;
+  std::vector<double> branches;
+};
+
+/**
+ * Applies an SPR move to a flat tree.
+ * @param tree    the tree
+ * @param prune   node whose subtree is moved (at least 2)
+ * @param regraft node above which the subtree is attached (not in the moved
+ *                subtree, neither its parent nor its sibling)
+ * @param moved   the moved tree (canonical)
+ * @param scratch buffers
+ */
+void sprMove(const FlatTree &tree, uint32_t prune, uint32_t regraft, FlatTree &moved, SprScratch &scratch);
+
+/**
+ * Searches a short sequence of SPR moves that turns one tree into another one
+ * with the same taxa (see sprCompression). The moves are stored in
+ * scratch.moves, the tree reached in scratch.current.
+ * @param  reference     the tree the moves are applied to
+ * @param  tree          the tree to reach
+ * @param  max_moves     largest number of moves
+ * @param  max_unmatched largest number of differing splits the search starts with
+ * @param  evaluations   number of candidate moves the search may still
+ *                       evaluate; decreased by the ones it evaluates
+ * @param  scratch       buffers
+ * @return               value < 0 if no sequence of moves was found
+ */
+int findSprMoves(const FlatTree &reference, const FlatTree &tree, size_t max_moves, size_t max_unmatched,
+          size_t &evaluations, SprScratch &scratch);
+
+/**
+ * Compresses a tree as SPR moves applied to its predecessor plus its branch
+ * lengths, as diffs to the branch of the predecessor with the same split if
+ * there is one (in depth-first order).
+ * @param  reference          the predecessor
+ * @param  reference_clusters split set of the predecessor
+ * @param  tree               the tree
+ * @param  record             record to store the compressed tree
+ * @param  max_moves          largest number of moves
+ * @param  max_evaluations    largest number of candidate moves evaluated
+ * @param  scratch            buffers
+ * @return                    value < 0 if no sequence of moves was found
+ */
+int sprCompression(const FlatTree &reference, const ClusterIndex &reference_clusters, const FlatTree &tree,
+          EncodedRecord &record, size_t max_moves, size_t max_evaluations, SprScratch &scratch);
+
+/**
+ * Applies the moves of an SPR record to a tree and sets its branch lengths.
+ * A move whose branches are not in the tree or whose regraft branch lies in
+ * the pruned subtree (or next to it) is an error; the tree is then in an
+ * undefined state and has to be released.
+ * @param  tree          leaf with label "1" of a set and ordered tree; set and
+ *                       ordered again afterwards
+ * @param  moves         prune and regraft branch of each move
+ * @param  branches      branch length diffs (see sprCompression)
+ * @param  topology_only skip the branch lengths
+ * @param  scratch       buffers
+ * @return               value < 0 in case of an error
+ */
+int applySprMoves(pll_unode_t * tree, const std::vector<uint64_t> &moves, const std::vector<double> &branches,
+          bool topology_only, SprScratch &scratch);
+
+/**
+ * Nodes of the consensus tree of an rf delta with more than two children, in
+ * postorder: the order of the rf subtrees in the delta.
+ * @param tree       tree 1 of the delta
+ * @param contracted the contracted branches (by the node below them)
+ * @param nodes      the nodes
+ * @param scratch    buffers
+ */
+void consensusPolytomies(const FlatTree &tree, const std::vector<bool> &contracted, std::vector<uint32_t> &nodes,
+          SprScratch &scratch);
+
+/**
+ * Resolution of a node of the consensus tree in one of the trees of an rf
+ * delta: the tree below v where only the given inner nodes are expanded. The
+ * other nodes become its leaves, labelled 2, 3, ... in the order of their
+ * smallest taxon; label 1 stands for the rest of the tree. Both trees of the
+ * delta give the same leaves for a node of the consensus tree.
+ * @param tree       the tree
+ * @param expanded   the nodes that belong to the resolution
+ * @param v          root of the resolution
+ * @param resolution the resolution (canonical)
+ * @param scratch    buffers
+ */
+void resolutionTree(const FlatTree &tree, const std::vector<bool> &expanded, uint32_t v, FlatTree &resolution,
+          SprScratch &scratch);
+
+/**
+ * Restores the rf subtrees of a delta that are stored as moves (see
+ * SECTION_SUBTREE_MOVES): each is the resolution of its consensus node in the
+ * predecessor with the moves applied. They are inserted into the explicitly
+ * stored subtrees, which are given and returned as in applyRFDelta.
+ * @param  tree                  leaf with label "1" of the predecessor (set and
+ *                               ordered, with no edges contracted yet)
+ * @param  edges_to_contract     edges to contract in the predecessor
+ * @param  subtree_moves         the moves: for each subtree stored as moves its
+ *                               index minus the index of the one before, the
+ *                               number of moves and the moves
+ * @param  subtrees_succinct     the subtrees
+ * @param  subtree_offsets       prefix sums of the numbers of leaves of the subtrees
+ * @param  succinct_permutations the permutations of the subtrees
+ * @param  scratch               buffers
+ * @return                       value < 0 in case of an error
+ */
+int expandSubtreeMoves(pll_unode_t * tree, const sdsl::int_vector<> &edges_to_contract,
+          const std::vector<uint64_t> &subtree_moves, sdsl::bit_vector &subtrees_succinct,
+          std::vector<uint64_t> &subtree_offsets, sdsl::int_vector<> &succinct_permutations, SprScratch &scratch);
+
+#endif
@@ -0,0 +1,295 @@
+#include "subtree_dag.h"
+
+#include <algorithm>
+#include <atomic>
+
+#include "compress_functions.h"
+#include "datastructure_compression_functions.h"
+
+uint32_t SubtreeSet::intern(uint64_t hash, uint32_t taxon, const uint32_t * children, size_t count) {
+  unsigned int s = hash >> (64 - DAG_STRIPE_BITS);
+  Stripe &stripe = stripes[s];
+  std::lock_guard<std::mutex> lock(stripe.mutex);
+
+  uint32_t local = stripe.table.find(hash, [&](uint32_t i) {
+    return stripe.taxon[i] == taxon && stripe.child_start[i + 1] - stripe.child_start[i] == count
+        && std::equal(children, children + count, stripe.children.begin() + stripe.child_start[i]);
+  });
+  if (local == UINT32_MAX) {
+    local = stripe.table.insert(hash, TOPOLOGY_NONE);
+    stripe.taxon.push_back(taxon);
+    stripe.children.insert(stripe.children.end(), children, children + count);
+    stripe.child_start.push_back(stripe.children.size());
+  }
+  assert(local < (1U << (32 - DAG_STRIPE_BITS)));
+  return local << DAG_STRIPE_BITS | s;
+}
+
+size_t SubtreeSet::size() const {
+  size_t size = 0;
+  for (auto &stripe: stripes) {
+    size += stripe.taxon.size();
+  }
+  return size;
+}
+
+uint32_t internTree(const FlatTree &tree, SubtreeSet &set, std::vector<uint64_t> &hashes,
+          std::vector<uint32_t> &ids) {
+  size_t n = tree.size();
+  hashes.resize(n);
+  ids.resize(n);
+
+  // bottom-up: the children of a node come after it in depth-first order
+  std::vector<uint32_t> children;
+  for (size_t v = n - 1; v >= 1; v--) {
+    if (tree.isLeaf(v)) {
+      hashes[v] = mixLabel(tree.taxon[v]);
+      ids[v] = set.intern(hashes[v], tree.taxon[v], NULL, 0);
+    } else {
+      uint64_t hash = 0x9E3779B97F4A7C15ULL;
+      children.clear();
+      for (uint32_t c = tree.first_child[v]; c != FLAT_NONE; c = tree.next_sibling[c]) {
+        children.push_back(ids[c]);
+        hash = mixLabel(hash ^ hashes[c]);
+      }
+      hashes[v] = hash;
+      ids[v] = set.intern(hash, 0, children.data(), children.size());
+    }
+  }
+  return ids[1];
+}
+
+void finishSubtreeDag(const SubtreeSet &set, std::vector<uint32_t> &roots, SubtreeDag &dag) {
+  const unsigned int mask = (1U << DAG_STRIPE_BITS) - 1;
+  std::vector<uint32_t> renumbered[1 << DAG_STRIPE_BITS];
+  for (unsigned int s = 0; s <= mask; s++) {
+    renumbered[s].assign(set.stripes[s].taxon.size(), UINT32_MAX);
+  }
+  dag = SubtreeDag();
+
+  std::vector<uint32_t> stack;
+  for (auto &root: roots) {
+    stack.assign(1, root);
+    while (!stack.empty()) {
+      uint32_t id = stack.back();
+      const SubtreeSet::Stripe &stripe = set.stripes[id & mask];
+      uint32_t local = id >> DAG_STRIPE_BITS;
+      if (renumbered[id & mask][local] != UINT32_MAX) {
+        stack.pop_back();
+        continue;
+      }
+
+      // number the children first
+      size_t pending = stack.size();
+      for (size_t i = stripe.child_start[local + 1]; i > stripe.child_start[local]; i--) {
+        uint32_t child = stripe.children[i - 1];
+        if (renumbered[child & mask][child >> DAG_STRIPE_BITS] == UINT32_MAX) {
+          stack.push_back(child);
+        }
+      }
+      if (stack.size() > pending) {
+        continue;
+      }
+
+      stack.pop_back();
+      renumbered[id & mask][local] = dag.size();
+      dag.taxon.push_back(stripe.taxon[local]);
+      dag.max_taxon = std::max(dag.max_taxon, stripe.taxon[local]);
+      for (size_t i = stripe.child_start[local]; i < stripe.child_start[local + 1]; i++) {
+        uint32_t child = stripe.children[i];
+        dag.children.push_back(renumbered[child & mask][child >> DAG_STRIPE_BITS]);
+      }
+      dag.child_start.push_back(dag.children.size());
+    }
+    root = renumbered[root & mask][root >> DAG_STRIPE_BITS];
+  }
+}
+
+EncodedRecord encodeSubtreeDag(const SubtreeDag &dag) {
+  // per subtree: the number of children, then the taxon of a leaf or the
+  // distance back to each child
+  std::vector<uint64_t> values;
+  for (size_t i = 0; i < dag.size(); i++) {
+    values.push_back(dag.child_start[i + 1] - dag.child_start[i]);
+    if (values.back() == 0) {
+      values.push_back(dag.taxon[i]);
+    }
+    for (size_t c = dag.child_start[i]; c < dag.child_start[i + 1]; c++) {
+      values.push_back(i - dag.children[c]);
+    }
+  }
+
+  EncodedRecord record;
+  record.kind = RECORD_SUBTREE_DAG;
+  compressDagNodes(values, record.sections[SECTION_DAG_NODES]);
+  return record;
+}
+
+int decodeSubtreeDag(const RecordView &record, SubtreeDag &dag) {
+  if (record.kind != RECORD_SUBTREE_DAG) {
+    return -1;
+  }
+  std::vector<uint64_t> values = uncompressDagNodes(record.sections[SECTION_DAG_NODES]);
+  dag = SubtreeDag();
+  for (size_t j = 0; j < values.size(); ) {
+    uint64_t count = values[j++];
+    size_t i = dag.size();
+    if (count == 0) {
+      if (j >= values.size() || values[j] == 0 || values[j] > UINT32_MAX) {
+        return -1;
+      }
+      dag.taxon.push_back(values[j++]);
+      dag.max_taxon = std::max(dag.max_taxon, dag.taxon.back());
+    } else {
+      if (count < 2 || j + count > values.size()) {
+        return -1;
+      }
+      dag.taxon.push_back(0);
+      for (uint64_t c = 0; c < count; c++, j++) {
+        if (values[j] == 0 || values[j] > i) {
+          // ERROR: child does not precede the subtree
+          return -1;
+        }
+        dag.children.push_back(i - values[j]);
+      }
+    }
+    dag.child_start.push_back(dag.children.size());
+  }
+  return 0;
+}
+
+int dag_compression(const std::vector<std::string> &tree_files, const std::string &archive_file,
+          size_t threads, int flags) {
+  size_t tree_count = tree_files.size();
+  SubtreeSet set;
+  std::vector<uint32_t> roots(tree_count);
+  std::vector<EncodedSection> branches(tree_count);
+
+  // each thread takes the next tree
+  std::atomic<size_t> next_tree(0);
+  std::atomic<bool> failed(false);
+  auto worker = [&]() {
+    FlatTree tree;
+    FlatTreeScratch scratch;
+    std::vector<uint64_t> hashes;
+    std::vector<uint32_t> ids;
+    for (size_t i = next_tree++; i < tree_count && !failed; i = next_tree++) {
+      if (parseFlatTree(tree_files[i].c_str(), tree, scratch) < 0) {
+        // ERROR: tree could not be parsed
+        failed = true;
+        break;
+      }
+
+      roots[i] = internTree(tree, set, hashes, ids);
+      compressBranchLengths(std::vector<double>(tree.length.begin() + 1, tree.length.end()), branches[i]);
+    }
+  };
+
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1u);
+  }
+  threads = std::min(threads, std::max(tree_count, (size_t) 1));
+  std::vector<std::thread> workers;
+  for (size_t t = 1; t < threads; t++) {
+    workers.push_back(std::thread(worker));
+  }
+  worker();
+  for (auto &w: workers) {
+    w.join();
+  }
+  if (failed) {
+    return -1;
+  }
+
+  // the ids of the set depend on the order the threads added the subtrees;
+  // the DAG is numbered in the order of the trees
+  SubtreeDag dag;
+  finishSubtreeDag(set, roots, dag);
+
+  ArchiveWriter writer;
+  if (writer.open(archive_file) < 0) {
+    return -1;
+  }
+  EncodedRecord record = encodeSubtreeDag(dag);
+  int64_t dag_offset = writer.appendAuxiliary(record);
+  if (dag_offset < 0) {
+    return -1;
+  }
+  if (flags & PRINT_COMPRESSION) {
+    std::cout << "Subtree DAG: " << dag.size() << " subtrees, " << recordWords(record) * sizeof(uint64_t) << " bytes\n";
+  }
+
+  for (size_t i = 0; i < tree_count; i++) {
+    resetRecord(record, RECORD_DAG_TREE);
+    compressDagReference(dag_offset, roots[i], record.sections[SECTION_DAG_REFERENCE]);
+    setSection(record, SECTION_BRANCH_LENGTHS, std::move(branches[i]));
+    if (writer.append(record) < 0) {
+      return -1;
+    }
+  }
+  return writer.close();
+}
+
+pll_unode_t * dag_uncompression(const SubtreeDag &dag, const RecordView &record, bool topology_only) {
+  uint64_t root = uncompressDagReference(record.sections[SECTION_DAG_REFERENCE]).second;
+  if (root >= dag.size() || dag.taxon[root] != 0) {
+    return NULL;
+  }
+
+  // expand the DAG in depth-first order below the leaf with taxon 1; a corrupt
+  // DAG can reach a subtree more than once, so the expansion stops when a
+  // taxon repeats or the tree gets larger than a tree of all taxa
+  size_t max_size = 2 * (size_t) std::max(dag.max_taxon, 2U) - 2;
+  std::vector<bool> seen(dag.max_taxon + 1, false);
+  seen[1] = true;
+  std::vector<uint32_t> parent(1, FLAT_NONE);
+  std::vector<uint32_t> taxon(1, 1);
+  std::vector<double> length(1, 0);
+  std::vector<std::pair<uint32_t, uint32_t>> stack(1, std::make_pair(root, 0));
+  while (!stack.empty()) {
+    uint32_t id = stack.back().first;
+    if (parent.size() >= max_size) {
+      // ERROR: larger than a tree of all taxa
+      return NULL;
+    }
+    if (dag.taxon[id] != 0) {
+      if (seen[dag.taxon[id]]) {
+        // ERROR: a leaf is reached twice
+        return NULL;
+      }
+      seen[dag.taxon[id]] = true;
+    }
+    parent.push_back(stack.back().second);
+    taxon.push_back(dag.taxon[id]);
+    stack.pop_back();
+
+    uint32_t v = parent.size() - 1;
+    for (size_t c = dag.child_start[id + 1]; c > dag.child_start[id]; c--) {
+      stack.push_back(std::make_pair(dag.children[c - 1], v));
+    }
+  }
+  size_t n = parent.size();
+  length.resize(n, 0);
+  if (!topology_only) {
+    std::vector<double> lengths = uncompressBranchLengths(record.sections[SECTION_BRANCH_LENGTHS]);
+    if (lengths.size() != n - 1) {
+      return NULL;
+    }
+    std::copy(lengths.begin(), lengths.end(), length.begin() + 1);
+  }
+
+  FlatTree tree;
+  FlatTreeScratch scratch;
+  buildFlatTree(parent, taxon, length, tree, scratch);
+  if (tree.size() != 2 * (size_t) tree.tip_count - 2) {
+    // ERROR: not a binary tree
+    return NULL;
+  }
+
+  // rebuild the tree from its simple compression structures
+  sdsl::bit_vector succinct_structure(4 * tree.tip_count - 2, 0);
+  sdsl::int_vector<> node_permutation(tree.tip_count, 0, 32);
+  std::vector<double> branch_lengths(tree.size());
+  assignBranchNumbers(tree, succinct_structure, node_permutation, branch_lengths);
+  return simple_uncompression(succinct_structure, node_permutation, branch_lengths);
+}
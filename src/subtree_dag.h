@@ -0,0 +1,133 @@
+#ifndef SUBTREE_DAG_H
+#define SUBTREE_DAG_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "uncompress_functions.h"
+#include "archive.h"
+#include "flat_tree.h"
+#include "topology_dictionary.h"
+
+/**
+ * Subtree DAG of a set of trees (hash-consing): every distinct subtree, i.e.
+ * every distinct canonically ordered shape together with its taxa, is stored
+ * once as a leaf (its taxon) or as the list of its children; equal subtrees of
+ * different trees (or of one tree) are shared.
+ *
+ * A DAG archive starts with the DAG (an auxiliary record), followed by one
+ * record per tree: the subtree below the neighbour of taxon 1 and the branch
+ * lengths of the tree in canonical depth-first order.
+ */
+
+// the subtree set is split into 2^DAG_STRIPE_BITS stripes with a lock each
+#define DAG_STRIPE_BITS 6
+
+/**
+ * Concurrent hash set of subtrees, filled bottom-up: a subtree is looked up
+ * by a hash computed from the hashes of its children and compared through the
+ * ids of its children. The stripe of a subtree is given by the high bits of its
+ * hash; its id is its index in the stripe followed by the stripe.
+ */
+struct SubtreeSet {
+  struct Stripe {
+    std::mutex mutex;
+
+    // entry i is subtree i of the stripe
+    TopologyDictionary table;
+
+    // taxon of each leaf, 0 for inner subtrees; the children of subtree i are
+    // [child_start[i], child_start[i + 1]) of children
+    std::vector<uint32_t> taxon;
+    std::vector<size_t> child_start = std::vector<size_t>(1, 0);
+    std::vector<uint32_t> children;
+  };
+  Stripe stripes[1 << DAG_STRIPE_BITS];
+
+  /**
+   * Returns the id of a subtree and adds it if it is not in the set yet.
+   * Can be called by several threads at once.
+   * @param  hash     hash of the subtree
+   * @param  taxon    taxon of a leaf, 0 for an inner subtree
+   * @param  children ids of the ordered children
+   * @param  count    number of children
+   * @return          id of the subtree
+   */
+  uint32_t intern(uint64_t hash, uint32_t taxon, const uint32_t * children, size_t count);
+
+  // number of subtrees
+  size_t size() const;
+};
+
+/**
+ * Subtree DAG with consecutive ids; the children of a subtree have smaller
+ * ids than the subtree.
+ */
+struct SubtreeDag {
+  std::vector<uint32_t> taxon;
+  std::vector<size_t> child_start = std::vector<size_t>(1, 0);
+  std::vector<uint32_t> children;
+
+  // largest taxon of a leaf; a tree of the DAG has at most 2 * max_taxon - 2
+  // nodes
+  uint32_t max_taxon = 0;
+
+  size_t size() const {
+    return taxon.size();
+  }
+};
+
+/**
+ * Adds the subtrees of a tree to the set.
+ * @param  tree    the tree
+ * @param  set     the subtree set
+ * @param  hashes  buffer for the hash of each node
+ * @param  ids     buffer for the id of each node
+ * @return         id of the subtree below node 1 (the whole tree)
+ */
+uint32_t internTree(const FlatTree &tree, SubtreeSet &set, std::vector<uint64_t> &hashes,
+          std::vector<uint32_t> &ids);
+
+/**
+ * Numbers the subtrees reachable from the given roots consecutively (in
+ * postorder, in the order of the roots) and stores them as a DAG.
+ * @param set   the subtree set
+ * @param roots ids of the roots, replaced by their ids in the DAG
+ * @param dag   the DAG
+ */
+void finishSubtreeDag(const SubtreeSet &set, std::vector<uint32_t> &roots, SubtreeDag &dag);
+
+/**
+ * Encodes the DAG as an auxiliary record.
+ */
+EncodedRecord encodeSubtreeDag(const SubtreeDag &dag);
+
+/**
+ * Decodes a DAG record.
+ * @return value < 0 in case of an error
+ */
+int decodeSubtreeDag(const RecordView &record, SubtreeDag &dag);
+
+/**
+ * Compresses the given trees into a DAG archive. The trees are parsed and
+ * added to the DAG on several threads.
+ * @param  tree_files   trees in newick format
+ * @param  archive_file archive file
+ * @param  threads      number of threads, 0 for one per core
+ * @param  flags        flags (see compress_functions.h)
+ * @return              value < 0 in case of an error
+ */
+int dag_compression(const std::vector<std::string> &tree_files, const std::string &archive_file,
+          size_t threads, int flags);
+
+/**
+ * Decodes a DAG tree record.
+ * @param  dag           the DAG of the record
+ * @param  record        the compressed tree
+ * @param  topology_only skip the branch lengths
+ * @return               leaf with label "1" of the tree, NULL in case of an error
+ */
+pll_unode_t * dag_uncompression(const SubtreeDag &dag, const RecordView &record, bool topology_only);
+
+#endif
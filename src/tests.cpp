@@ -0,0 +1,689 @@
+/*
+ * Round-trip tests of the codecs, the record kinds and the archive modes:
+ *
+ *   ./tests <tree directory> [<tree directory of other taxa>]
+ *
+ * A tree directory holds the trees of a run as tree_1.nwk, tree_2.nwk, ...
+ * (see data/). Every archive test compresses the first TEST_TREES trees,
+ * decodes them again and compares them with the input; every archive mode is
+ * also checked to write the same bytes when it is run twice on the same input.
+ * The archives are written to the working directory and removed afterwards.
+ * The comment of each test names the requests (user-0xx) it covers.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <new>
+#include <random>
+#include <sstream>
+
+#include "compress_functions.h"
+#include "archive_export.h"
+#include "archive_merge.h"
+#include "chain_append.h"
+#include "chain_pipeline.h"
+#include "int_codec.h"
+#include "permutation_codec.h"
+#include "topology_codec.h"
+#include "tree_range.h"
+
+// largest number of trees of a directory the archive tests use
+#define TEST_TREES 300
+
+static size_t failures = 0;
+static std::vector<std::string> test_files;
+
+// SPR records written by testSpr; the trees of a directory may be too far
+// apart for any
+static size_t spr_records = 0;
+
+// number of calls of operator new, to check that compressing a chain does not
+// allocate; operator delete is not inlined, as the compiler would then see
+// free() on the memory of operator new
+static std::atomic<size_t> allocations(0);
+
+void * operator new(size_t size) {
+  allocations++;
+  void * p = malloc(size == 0 ? 1 : size);
+  if (p == NULL) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+__attribute__((noinline)) void operator delete(void * p) noexcept {
+  free(p);
+}
+
+__attribute__((noinline)) void operator delete(void * p, size_t) noexcept {
+  free(p);
+}
+
+/*
+ * Reports the result of a test.
+ */
+void check(const std::string &name, bool passed) {
+  printf("%-50s %s\n", name.c_str(), passed ? "ok" : "FAILED");
+  if (!passed) {
+    failures++;
+  }
+}
+
+/*
+ * Name of a file written by a test; it is removed at the end.
+ */
+std::string testFile(const std::string &name) {
+  test_files.push_back("tests_" + name);
+  return test_files.back();
+}
+
+/*
+ * The trees tree_1.nwk, ... of a directory, at most TEST_TREES.
+ */
+std::vector<std::string> treeFiles(const std::string &directory) {
+  std::vector<std::string> files;
+  for (size_t i = 1; i <= TEST_TREES; i++) {
+    std::string file = directory + "/tree_" + std::to_string(i) + ".nwk";
+    if (access(file.c_str(), R_OK) != 0) {
+      break;
+    }
+    files.push_back(file);
+  }
+  return files;
+}
+
+std::string readFile(const std::string &file) {
+  std::ifstream in(file, std::ios::binary);
+  std::stringstream content;
+  content << in.rdbuf();
+  return content.str();
+}
+
+bool sameBytes(const std::string &file1, const std::string &file2) {
+  std::string content = readFile(file1);
+  return !content.empty() && content == readFile(file2);
+}
+
+/*
+ * Checks whether a decoded tree equals the tree of a file.
+ */
+bool sameTree(pll_unode_t * decoded, const std::string &tree_file) {
+  pll_utree_t * tree = pll_utree_parse_newick(tree_file.c_str());
+  if (decoded == NULL || tree == NULL) {
+    return false;
+  }
+  pll_unode_t * root = searchRoot(tree);
+  setTree(root);
+  orderTree(root);
+  bool equal = treesEqual(decoded->back, root->back);
+  pll_utree_destroy(tree, NULL);
+  return equal;
+}
+
+/*
+ * Checks whether an archive holds the given trees, decoded one after another
+ * and in random order.
+ */
+bool holdsTrees(const std::string &archive_file, const std::vector<std::string> &files) {
+  ArchiveReader archive;
+  if (archive.open(archive_file) < 0 || archive.size() != files.size()) {
+    return false;
+  }
+  size_t i = 0;
+  for (pll_unode_t * tree : treeRange(archive, 0, archive.size())) {
+    if (!sameTree(tree, files[i++])) {
+      return false;
+    }
+  }
+
+  TreeRangeState state;
+  state.archive = &archive;
+  state.decoder.archive = &archive;
+  std::mt19937 random(1);
+  for (size_t k = 0; k < 20 && !files.empty(); k++) {
+    i = random() % files.size();
+    if (!sameTree(decodeTree(state, i), files[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Number of records of the given kind in an archive.
+ */
+size_t countRecords(const std::string &archive_file, unsigned int kind) {
+  ArchiveReader archive;
+  size_t count = 0;
+  if (archive.open(archive_file) == 0) {
+    for (size_t i = 0; i < archive.size(); i++) {
+      count += archive.recordKind(i) == kind;
+    }
+  }
+  return count;
+}
+
+/*
+ * Largest number of records from one keyframe of an archive to the next (or
+ * to its end).
+ */
+size_t largestKeyframeGap(const std::string &archive_file) {
+  ArchiveReader archive;
+  size_t gap = SIZE_MAX;
+  if (archive.open(archive_file) == 0) {
+    size_t last = 0;
+    gap = 0;
+    for (size_t i = 0; i <= archive.size(); i++) {
+      if (i == archive.size() || isKeyframe(archive.recordKind(i))) {
+        gap = std::max(gap, i - last);
+        last = i;
+      }
+    }
+  }
+  return gap;
+}
+
+/*
+ * Writes trees as a nexus tree file like the one of a MrBayes run.
+ */
+void writeNexus(const std::vector<std::string> &files, size_t count, const std::string &output) {
+  std::ofstream out(output);
+  out << "#NEXUS\nbegin trees;\n";
+  for (size_t i = 0; i < count; i++) {
+    std::string newick = readFile(files[i]);
+    newick.erase(newick.find_last_not_of(" \t\r\n") + 1);
+    out << "   tree gen." << i << " = [&U] " << newick << "\n";
+  }
+  out << "end;\n";
+}
+
+/*
+ * The newick strings of an exported tree file.
+ */
+std::vector<std::string> exportedTrees(const std::string &file) {
+  std::vector<std::string> trees;
+  std::istringstream lines(readFile(file));
+  std::string line;
+  while (std::getline(lines, line)) {
+    size_t start = line.find("[&U] ");
+    if (start != std::string::npos) {
+      trees.push_back(line.substr(start + 5));
+    }
+  }
+  return trees;
+}
+
+/*
+ * user-028: integer codec (delta, zigzag, patched blocks)
+ */
+void testIntCodec() {
+  std::mt19937_64 random(3);
+  bool passed = true;
+  // the buffer is reused from one stream to the next, as by the compression
+  std::vector<uint64_t> words;
+  for (int round = 0; round < 300 && passed; round++) {
+    IntCodecVariant variant = (IntCodecVariant) (round % 3);
+    size_t n = round % 7 == 0 ? INT_CODEC_BLOCK_SIZE * (random() % 4) : random() % 1200;
+    unsigned int width = random() % 65;
+    std::vector<uint64_t> values(n);
+    uint64_t sum = random() % 1000;
+    for (size_t i = 0; i < n; i++) {
+      uint64_t r = width == 64 ? random() : random() & ((1ULL << width) - 1);
+      if (round % 4 == 1 && random() % 16 == 0) {
+        // outliers of a patched block
+        r = random() >> (random() % 8);
+      }
+      if (variant == INT_CODEC_DELTA) {
+        sum += r >> 24;
+        values[i] = sum;
+      } else {
+        values[i] = r;
+      }
+    }
+    encodeInts(values, variant, words);
+    std::vector<uint64_t> decoded(n + 1);
+    decodeInts(words.data(), words.size(), decoded.data());
+    passed = intCount(words.data()) == n && std::equal(values.begin(), values.end(), decoded.begin());
+    for (size_t b = 0; b * INT_CODEC_BLOCK_SIZE < n && passed; b++) {
+      uint64_t block[INT_CODEC_BLOCK_SIZE];
+      size_t count = decodeIntBlock(words.data(), words.size(), b, block);
+      passed = std::equal(block, block + count, values.begin() + b * INT_CODEC_BLOCK_SIZE);
+    }
+  }
+  check("int codec (plain, delta, zigzag, patched blocks)", passed);
+}
+
+/*
+ * user-026: Lehmer ranks of the RF subtree permutations
+ */
+void testPermutationCodec() {
+  std::mt19937 random(1);
+  bool passed = true;
+  std::vector<uint64_t> words;
+  for (int round = 0; round < 200 && passed; round++) {
+    std::vector<uint32_t> permutations;
+    std::vector<unsigned int> sizes;
+    for (unsigned int p = random() % 8 + 1; p > 0; p--) {
+      unsigned int k = round % 3 == 0 ? random() % 60 + 1 : random() % 8 + 1;
+      std::vector<uint32_t> permutation(k);
+      for (unsigned int j = 0; j < k; j++) {
+        permutation[j] = j;
+      }
+      std::shuffle(permutation.begin(), permutation.end(), random);
+      sizes.push_back(k);
+      permutations.insert(permutations.end(), permutation.begin(), permutation.end());
+    }
+    size_t bits = encodePermutations(permutations, sizes, words);
+    sdsl::int_vector<> decoded = decodePermutations(words.data(), bits, sizes);
+    passed = decoded.size() == permutations.size();
+    for (size_t i = 0; i < permutations.size() && passed; i++) {
+      passed = decoded[i] == permutations[i];
+    }
+  }
+  check("permutation codec (Lehmer ranks)", passed);
+}
+
+/*
+ * Appends the balanced parentheses of a random binary tree shape with k leaves.
+ */
+void randomShape(std::vector<bool> &parentheses, unsigned int k, std::mt19937 &random) {
+  parentheses.push_back(false);
+  if (k > 1) {
+    unsigned int left = random() % (k - 1) + 1;
+    randomShape(parentheses, left, random);
+    randomShape(parentheses, k - left, random);
+  }
+  parentheses.push_back(true);
+}
+
+/*
+ * user-027: range coded topologies
+ */
+void testTopologyCodec() {
+  std::mt19937 random(7);
+  bool passed = true;
+  TopologyScratch scratch;
+  for (int round = 0; round < 200 && passed; round++) {
+    std::vector<bool> parentheses;
+    for (unsigned int s = random() % 5 + 1; s > 0; s--) {
+      randomShape(parentheses, round % 2 ? random() % 600 + 1 : random() % 20 + 1, random);
+    }
+    sdsl::bit_vector bp(parentheses.size());
+    for (size_t i = 0; i < parentheses.size(); i++) {
+      bp[i] = parentheses[i];
+    }
+    encodeTopology(bp.data(), bp.size(), scratch);
+    passed = decodeTopology(scratch.out.data(), scratch.out.size()) == bp;
+  }
+  check("topology codec (range coded shapes)", passed);
+}
+
+/*
+ * user-029, 030, 035, 036, 037, 039, 040, 044, 045: the records a chain
+ * chooses and their round trip; user-031, 032, 033: the reader, in-place
+ * decoding and the tree range (holdsTrees); user-046: pipeline; user-049:
+ * the archive writer; user-048: only the current version is read
+ */
+void testChain(const std::string &name, const std::vector<std::string> &files) {
+  std::string serial = testFile(name + "_serial.tca");
+  std::string again = testFile(name + "_again.tca");
+  std::string pipelined = testFile(name + "_pipeline.tca");
+  CompressionContext context1;
+  CompressionContext context2;
+  CompressionContext context3;
+  bool compressed = chain_archive_compression(files, serial, context1, 1, 0) == 0
+        && chain_archive_compression(files, again, context2, 1, 0) == 0
+        && chain_archive_compression(files, pipelined, context3, 3, 0) == 0;
+  check(name + ": chain round trip", compressed && holdsTrees(serial, files));
+  check(name + ": chain same bytes twice", compressed && sameBytes(serial, again));
+  check(name + ": pipeline same bytes as serial", compressed && sameBytes(serial, pipelined));
+
+  // only the current format version is read
+  std::string old_version = testFile(name + "_old_version.tca");
+  std::string content = readFile(serial);
+  uint64_t version = ARCHIVE_VERSION - 1;
+  if (content.size() >= 2 * sizeof(uint64_t)) {
+    memcpy(&content[sizeof(uint64_t)], &version, sizeof(uint64_t));
+  }
+  std::ofstream(old_version, std::ios::binary) << content;
+  ArchiveReader reader;
+  check(name + ": archive of an old version refused", compressed && reader.open(old_version) < 0);
+
+  // the kinds of records the chain chose are all decoded above
+  printf("  records: %zu simple, %zu rf, %zu topology, %zu spr, %zu branch lengths, %zu repeat\n",
+        countRecords(serial, RECORD_SIMPLE), countRecords(serial, RECORD_RF),
+        countRecords(serial, RECORD_TOPOLOGY), countRecords(serial, RECORD_SPR),
+        countRecords(serial, RECORD_BRANCH_LENGTHS), countRecords(serial, RECORD_REPEAT));
+}
+
+/*
+ * user-038: compression context without allocations
+ */
+void testAllocations(const std::string &name, const std::vector<std::string> &files) {
+  // the chain is compressed twice with the same context and record; the first
+  // pass lets the buffers grow to the largest records, the second one must not
+  // allocate (the topology dictionary is off, as it grows with every new
+  // topology)
+  std::vector<FlatTree> trees(files.size());
+  FlatTreeScratch scratch;
+  bool passed = true;
+  for (size_t i = 0; i < files.size() && passed; i++) {
+    passed = parseFlatTree(files[i].c_str(), trees[i], scratch) == 0;
+  }
+  CompressionContext context;
+  context.deduplicate_topologies = false;
+  EncodedRecord record;
+  size_t counted = 0;
+  for (int pass = 0; pass < 2 && passed; pass++) {
+    context.has_reference = false;
+    for (size_t i = 0; i < trees.size() && passed; i++) {
+      context.next = trees[i];
+      size_t before = allocations;
+      passed = chainNext(context, record, 0) == 0;
+      if (pass == 1) {
+        counted += allocations - before;
+      }
+    }
+  }
+  check(name + ": chain compression without allocations", passed && counted == 0);
+  if (counted > 0) {
+    printf("  %zu allocations for %zu trees\n", counted, trees.size());
+  }
+}
+
+/*
+ * user-043: SPR move records
+ */
+void testSpr(const std::string &name, const std::vector<std::string> &files) {
+  // each tree is stored as SPR moves on its predecessor if the search finds
+  // them, otherwise as a simple compression
+  std::string archive_file = testFile(name + "_spr.tca");
+  ArchiveWriter writer;
+  bool passed = writer.open(archive_file) == 0;
+  CompressionScratch scratch;
+  FlatTree reference;
+  FlatTree tree;
+  ClusterIndex reference_clusters;
+  EncodedRecord record;
+  for (size_t i = 0; i < files.size() && passed; i++) {
+    passed = parseFlatTree(files[i].c_str(), tree, scratch.flat) == 0;
+    if (passed && i > 0 && sprCompression(reference, reference_clusters, tree, record, 2, SPR_EVALUATIONS,
+          scratch.spr) == 0) {
+      spr_records++;
+    } else if (passed) {
+      passed = simpleCompression(tree, record, 0, scratch) == 0;
+    }
+    passed = passed && writer.append(record) >= 0;
+    std::swap(reference, tree);
+    indexClusters(reference, reference_clusters, scratch.flat);
+  }
+  passed = writer.close() == 0 && passed;
+  check(name + ": SPR records round trip", passed && holdsTrees(archive_file, files));
+}
+
+/*
+ * user-041, 043: corrupt RF and SPR deltas are reported
+ */
+void testCorruptRecords(const std::string &name, const std::vector<std::string> &files) {
+  // deltas that do not fit the working tree are reported and drop it
+  pll_utree_t * start = pll_utree_parse_newick(files[0].c_str());
+  if (start == NULL) {
+    check(name + ": corrupt deltas rejected", false);
+    return;
+  }
+  pll_unode_t * root = searchRoot(start);
+  setTree(root);
+  orderTree(root);
+
+  // node 3 is in the subtree of node 2 or its sibling
+  EncodedRecord spr;
+  spr.kind = RECORD_SPR;
+  compressSprMoves({3, 4}, spr.sections[SECTION_SPR_MOVES]);
+  // a branch that is not in the tree
+  EncodedRecord rf;
+  rf.kind = RECORD_RF;
+  compressRFEdgesToContract({1000000}, rf.sections[SECTION_EDGES_TO_CONTRACT]);
+
+  SequentialDecoder decoder;
+  bool passed = true;
+  for (auto record: {&spr, &rf}) {
+    decoder.start(root);
+    passed = passed && decoder.next(viewRecord(*record)) == NULL && decoder.tree == NULL;
+  }
+  pll_utree_destroy(start, NULL);
+  check(name + ": corrupt deltas rejected", passed);
+}
+
+/*
+ * user-034: newick transcoder
+ */
+void testTranscoder(const std::string &name, const std::vector<std::string> &files) {
+  // simple compressions transcoded to newick and decoded and printed
+  std::string archive_file = testFile(name + "_simple.tca");
+  ArchiveWriter writer;
+  bool passed = writer.open(archive_file) == 0;
+  EncodedRecord record;
+  for (size_t i = 0; i < files.size() && passed; i++) {
+    passed = simple_compression(files[i].c_str(), record, 0) == 0 && writer.append(record) >= 0;
+  }
+  passed = writer.close() == 0 && passed;
+
+  ArchiveReader archive;
+  passed = passed && archive.open(archive_file) == 0;
+  size_t i = 0;
+  for (pll_unode_t * tree : treeRange(archive, 0, passed ? archive.size() : 0)) {
+    RecordView view = archive.record(i++);
+    sdsl::bit_vector succinct_structure = uncompressSuccinctStructure(view.sections[SECTION_TOPOLOGY]);
+    sdsl::int_vector<> node_permutation = uncompressSimplePermutation(view.sections[SECTION_NODE_PERMUTATION]);
+    std::string transcoded;
+    simple_uncompression_newick(succinct_structure, node_permutation,
+          uncompressBranchLengths(view.sections[SECTION_BRANCH_LENGTHS]), transcoded);
+    std::string printed;
+    appendNewick(tree, printed);
+    passed = passed && tree != NULL && transcoded == printed;
+  }
+  check(name + ": newick transcoder same as decode and print", passed && i == files.size());
+}
+
+/*
+ * user-041: split dictionary
+ */
+void testSplits(const std::string &name, const std::vector<std::string> &files) {
+  std::string archive_file = testFile(name + "_splits.tca");
+  std::string again = testFile(name + "_splits_again.tca");
+  bool compressed = split_compression(files, archive_file, 0) == 0 && split_compression(files, again, 0) == 0;
+  check(name + ": split dictionary round trip", compressed && holdsTrees(archive_file, files));
+  check(name + ": split dictionary same bytes twice", compressed && sameBytes(archive_file, again));
+}
+
+/*
+ * user-042: subtree DAG
+ */
+void testDag(const std::string &name, const std::vector<std::string> &files) {
+  std::string archive_file = testFile(name + "_dag.tca");
+  std::string threaded = testFile(name + "_dag_threads.tca");
+  bool compressed = dag_compression(files, archive_file, 1, 0) == 0 && dag_compression(files, threaded, 3, 0) == 0;
+  check(name + ": subtree DAG round trip", compressed && holdsTrees(archive_file, files));
+  check(name + ": subtree DAG same bytes on 1 and 3 threads", compressed && sameBytes(archive_file, threaded));
+}
+
+/*
+ * user-042: a corrupt DAG is reported
+ */
+void testCorruptDag() {
+  // a corrupt DAG in which each subtree uses the one before twice would
+  // expand to 2^40 leaves
+  SubtreeDag dag;
+  dag.taxon = {2, 3, 0};
+  dag.children = {0, 1};
+  dag.child_start = {0, 0, 0, 2};
+  for (uint32_t id = 3; id < 42; id++) {
+    dag.taxon.push_back(0);
+    dag.children.push_back(id - 1);
+    dag.children.push_back(id - 1);
+    dag.child_start.push_back(dag.children.size());
+  }
+  dag.max_taxon = 3;
+  EncodedRecord record;
+  record.kind = RECORD_DAG_TREE;
+  compressDagReference(0, dag.size() - 1, record.sections[SECTION_DAG_REFERENCE]);
+  check("subtree DAG with repeated leaves rejected", dag_uncompression(dag, viewRecord(record), true) == NULL);
+}
+
+/*
+ * user-047: shards and concatenation
+ */
+void testShards(const std::string &name, const std::vector<std::string> &files) {
+  std::string archive_file = testFile(name + "_shards.tca");
+  std::string again = testFile(name + "_shards_again.tca");
+  CompressionStatistics statistics;
+  bool compressed = sharded_chain_compression(files, archive_file, 3, 2, statistics, 0) == 0
+        && sharded_chain_compression(files, again, 3, 1, statistics, 0) == 0;
+  check(name + ": shards and concatenation round trip", compressed && holdsTrees(archive_file, files));
+  check(name + ": shards same bytes on 1 and 2 threads", compressed && sameBytes(archive_file, again));
+}
+
+/*
+ * user-040: merge of archives of the same taxa
+ */
+void testMerge(const std::string &name, const std::vector<std::string> &files, const std::string &other_archive) {
+  size_t half = files.size() / 2;
+  std::vector<std::string> first(files.begin(), files.begin() + half);
+  std::vector<std::string> second(files.begin() + half, files.end());
+  std::string first_file = testFile(name + "_merge1.tca");
+  std::string second_file = testFile(name + "_merge2.tca");
+  std::string merged = testFile(name + "_merged.tca");
+  CompressionContext context1;
+  CompressionContext context2;
+  bool compressed = chain_archive_compression(first, first_file, context1, 1, 0) == 0
+        && chain_archive_compression(second, second_file, context2, 1, 0) == 0;
+  check(name + ": merge round trip",
+        compressed && mergeArchives({first_file, second_file}, merged) == 0 && holdsTrees(merged, files));
+  if (!other_archive.empty()) {
+    std::string refused = testFile(name + "_refused.tca");
+    check(name + ": merge refuses other taxa", compressed && mergeArchives({first_file, other_archive}, refused) < 0);
+  }
+}
+
+/*
+ * user-048: append to a live archive
+ */
+void testAppend(const std::string &name, const std::vector<std::string> &files) {
+  size_t part = files.size() / 3;
+  std::string run_part = testFile(name + "_part.t");
+  std::string run = testFile(name + "_run.t");
+  writeNexus(files, part, run_part);
+  writeNexus(files, files.size(), run);
+  CompressionStatistics statistics;
+
+  // a run continued after a crash: the archive of the first trees, then a
+  // commit that was cut off
+  std::string archive_file = testFile(name + "_append.tca");
+  bool passed = append_compression(run_part, archive_file, statistics, 0) == 0;
+  {
+    std::ofstream cut_off(archive_file, std::ios::app | std::ios::binary);
+    cut_off << std::string(100, 'x');
+  }
+  passed = passed && append_compression(run, archive_file, statistics, 0) == 0;
+  check(name + ": append and continue round trip", passed && holdsTrees(archive_file, files));
+
+  // an archive left before its first commit starts anew
+  std::string empty = testFile(name + "_append_empty.tca");
+  std::string header = testFile(name + "_append_header.tca");
+  std::string fresh = testFile(name + "_append_fresh.tca");
+  std::ofstream(empty).close();
+  std::ofstream(header, std::ios::binary) << readFile(archive_file).substr(0, 2 * sizeof(uint64_t));
+  passed = append_compression(run, empty, statistics, 0) == 0 && append_compression(run, header, statistics, 0) == 0
+        && append_compression(run, fresh, statistics, 0) == 0;
+  check(name + ": append to an archive without a commit", passed && holdsTrees(empty, files)
+        && sameBytes(empty, fresh) && sameBytes(header, fresh));
+}
+
+/*
+ * user-050: forced keyframes and the parallel export
+ */
+void testExport(const std::string &name, const std::vector<std::string> &files) {
+  std::string archive_file = testFile(name + "_export.tca");
+  std::string exported = testFile(name + "_export.t");
+  CompressionContext context;
+  context.keyframe_interval = 16;
+  size_t burnin = 10;
+  size_t thin = 3;
+  bool passed = chain_archive_compression(files, archive_file, context, 1, 0) == 0
+        && export_archive(archive_file, exported, burnin, thin, 3) == 0;
+  check(name + ": keyframe every 16 records", passed && largestKeyframeGap(archive_file) <= 16);
+
+  // the exported trees compressed again: the same trees, and the same text
+  // once they are exported again
+  std::vector<std::string> selected;
+  for (size_t i = burnin; i < files.size(); i += thin) {
+    selected.push_back(files[i]);
+  }
+  std::string again = testFile(name + "_export_again.tca");
+  std::string exported_again = testFile(name + "_export_again.t");
+  CompressionStatistics statistics;
+  passed = passed && append_compression(exported, again, statistics, 0) == 0
+        && export_archive(again, exported_again, 0, 1, 2) == 0;
+  check(name + ": export round trip", passed && holdsTrees(again, selected)
+        && exportedTrees(exported) == exportedTrees(exported_again));
+
+  std::string serial = testFile(name + "_export_serial.t");
+  passed = passed && export_archive(archive_file, serial, burnin, thin, 1) == 0;
+  check(name + ": export same bytes on 1 and 3 threads", passed && sameBytes(exported, serial));
+}
+
+int main(int argc, char * argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <tree directory> [<tree directory of other taxa>]\n", argv[0]);
+    return 1;
+  }
+  testIntCodec();
+  testPermutationCodec();
+  testTopologyCodec();
+  testCorruptDag();
+
+  std::string other_archive;
+  if (argc > 2) {
+    std::vector<std::string> other = treeFiles(argv[2]);
+    other.resize(std::min(other.size(), (size_t) 10));
+    other_archive = testFile("other.tca");
+    CompressionContext context;
+    if (other.empty() || chain_archive_compression(other, other_archive, context, 1, 0) < 0) {
+      other_archive.clear();
+    }
+  }
+
+  for (int a = 1; a < argc; a++) {
+    std::vector<std::string> files = treeFiles(argv[a]);
+    std::string name = argv[a];
+    name = name.substr(name.find_last_of('/') + 1);
+    if (files.size() < 20) {
+      check(name + ": trees found", false);
+      continue;
+    }
+    testChain(name, files);
+    testAllocations(name, files);
+    testSpr(name, files);
+    testCorruptRecords(name, files);
+    testTranscoder(name, files);
+    testSplits(name, files);
+    testDag(name, files);
+    testShards(name, files);
+    testMerge(name, files, a == 1 ? other_archive : "");
+    testAppend(name, files);
+    testExport(name, files);
+  }
+
+  check("SPR records written", spr_records > 0);
+
+  for (auto &file: test_files) {
+    remove(file.c_str());
+  }
+  printf("%zu failed\n", failures);
+  return failures == 0 ? 0 : 1;
+}
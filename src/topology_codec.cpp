@@ -0,0 +1,357 @@
+#include "topology_codec.h"
+
+/*
+ * Binary range coder (as used in LZMA) with 11 bit probabilities.
+ */
+#define RC_TOP_VALUE (1u << 24)
+#define RC_MODEL_BITS 11
+#define RC_MODEL_TOTAL (1u << RC_MODEL_BITS)
+#define RC_MOVE_BITS 5
+
+// number of adaptive contexts, selected by log2 of the number of leaves
+#define TOPOLOGY_CONTEXTS 16
+
+// the size of the smaller subtree is coded as log2 bucket plus raw bits
+#define TOPOLOGY_BUCKETS 32
+
+struct RangeEncoder {
+  std::vector<uint8_t> &out;
+  uint64_t low = 0;
+  uint32_t range = 0xFFFFFFFF;
+  uint8_t cache = 0;
+  uint64_t cache_size = 1;
+
+  RangeEncoder(std::vector<uint8_t> &out_) : out(out_) {
+    out.clear();
+  }
+
+  void shiftLow() {
+    if ((uint32_t) low < 0xFF000000u || (low >> 32) != 0) {
+      uint8_t carry = (uint8_t) (low >> 32);
+      uint8_t temp = cache;
+      do {
+        out.push_back((uint8_t) (temp + carry));
+        temp = 0xFF;
+      } while (--cache_size != 0);
+      cache = (uint8_t) (low >> 24);
+    }
+    cache_size++;
+    low = (low & 0x00FFFFFF) << 8;
+  }
+
+  void encodeBit(uint16_t &prob, unsigned int bit) {
+    uint32_t bound = (range >> RC_MODEL_BITS) * prob;
+    if (bit == 0) {
+      range = bound;
+      prob += (RC_MODEL_TOTAL - prob) >> RC_MOVE_BITS;
+    } else {
+      low += bound;
+      range -= bound;
+      prob -= prob >> RC_MOVE_BITS;
+    }
+    while (range < RC_TOP_VALUE) {
+      range <<= 8;
+      shiftLow();
+    }
+  }
+
+  void encodeDirectBits(uint64_t value, unsigned int bits) {
+    while (bits > 0) {
+      bits--;
+      range >>= 1;
+      if ((value >> bits) & 1) {
+        low += range;
+      }
+      while (range < RC_TOP_VALUE) {
+        range <<= 8;
+        shiftLow();
+      }
+    }
+  }
+
+  void flush() {
+    for (int i = 0; i < 5; i++) {
+      shiftLow();
+    }
+  }
+};
+
+struct RangeDecoder {
+  const uint8_t * data;
+  size_t bytes;
+  size_t pos = 0;
+  uint32_t range = 0xFFFFFFFF;
+  uint32_t code = 0;
+
+  RangeDecoder(const uint8_t * data_, size_t bytes_) : data(data_), bytes(bytes_) {
+    for (int i = 0; i < 5; i++) {
+      code = (code << 8) | nextByte();
+    }
+  }
+
+  uint8_t nextByte() {
+    return pos < bytes ? data[pos++] : 0;
+  }
+
+  unsigned int decodeBit(uint16_t &prob) {
+    uint32_t bound = (range >> RC_MODEL_BITS) * prob;
+    unsigned int bit;
+    if (code < bound) {
+      range = bound;
+      prob += (RC_MODEL_TOTAL - prob) >> RC_MOVE_BITS;
+      bit = 0;
+    } else {
+      code -= bound;
+      range -= bound;
+      prob -= prob >> RC_MOVE_BITS;
+      bit = 1;
+    }
+    while (range < RC_TOP_VALUE) {
+      range <<= 8;
+      code = (code << 8) | nextByte();
+    }
+    return bit;
+  }
+
+  uint64_t decodeDirectBits(unsigned int bits) {
+    uint64_t value = 0;
+    while (bits > 0) {
+      bits--;
+      range >>= 1;
+      // t is 0 if code >= range and all ones otherwise
+      code -= range;
+      uint32_t t = 0 - (code >> 31);
+      code += range & t;
+      value = (value << 1) | (t + 1);
+      while (range < RC_TOP_VALUE) {
+        range <<= 8;
+        code = (code << 8) | nextByte();
+      }
+    }
+    return value;
+  }
+};
+
+/*
+ * Adaptive probabilities of the split of large shapes.
+ */
+struct TopologyModel {
+  uint16_t bucket[TOPOLOGY_CONTEXTS][TOPOLOGY_BUCKETS];
+  uint16_t left_smaller[TOPOLOGY_CONTEXTS][TOPOLOGY_BUCKETS];
+
+  TopologyModel() {
+    for (int i = 0; i < TOPOLOGY_CONTEXTS; i++) {
+      for (int j = 0; j < TOPOLOGY_BUCKETS; j++) {
+        bucket[i][j] = RC_MODEL_TOTAL / 2;
+        left_smaller[i][j] = RC_MODEL_TOTAL / 2;
+      }
+    }
+  }
+};
+
+unsigned int topologyContext(unsigned int leaves) {
+  return std::min(sdsl::bits::hi(leaves), (uint32_t) TOPOLOGY_CONTEXTS - 1);
+}
+
+/*
+ * Number of bits needed to store a value in [0, count).
+ */
+unsigned int bitsForCount(uint64_t count) {
+  return count <= 1 ? 0 : sdsl::bits::hi(count - 1) + 1;
+}
+
+void encodeGamma(RangeEncoder &rc, uint64_t value) {
+  assert(value > 0);
+  unsigned int n = sdsl::bits::hi(value);
+  rc.encodeDirectBits(0, n);
+  rc.encodeDirectBits(value, n + 1);
+}
+
+uint64_t decodeGamma(RangeDecoder &rc) {
+  unsigned int n = 0;
+  while (rc.decodeDirectBits(1) == 0) {
+    n++;
+    assert(n < 64);
+  }
+  return (1ULL << n) | rc.decodeDirectBits(n);
+}
+
+/*
+ * catalan[k] is the number of binary shapes with k leaves; offsets[k][i] is
+ * the rank of the first shape with k leaves whose left subtree has i leaves.
+ */
+struct CatalanTables {
+  std::vector<uint64_t> catalan;
+  std::vector<std::vector<uint64_t>> offsets;
+
+  CatalanTables() : catalan(CATALAN_MAX_LEAVES + 1, 0), offsets(CATALAN_MAX_LEAVES + 1) {
+    catalan[1] = 1;
+    offsets[1].assign(1, 0);
+    for (unsigned int k = 2; k <= CATALAN_MAX_LEAVES; k++) {
+      offsets[k].assign(k + 1, 0);
+      for (unsigned int i = 1; i < k; i++) {
+        offsets[k][i + 1] = offsets[k][i] + catalan[i] * catalan[k - i];
+      }
+      catalan[k] = offsets[k][k];
+    }
+  }
+};
+
+const CatalanTables &catalanTables() {
+  static const CatalanTables tables;
+  return tables;
+}
+
+/*
+ * Returns the paranthesis at position idx of balanced parantheses stored in words.
+ */
+unsigned int bpBit(const uint64_t * bp, size_t idx) {
+  return (bp[idx >> 6] >> (idx & 0x3F)) & 1;
+}
+
+int parseShapeRec(const uint64_t * bp, size_t bits, size_t * idx, std::vector<ShapeNode> &nodes) {
+  assert(*idx + 1 < bits);
+  assert(bpBit(bp, *idx) == 0);
+  (*idx)++;
+
+  int node = nodes.size();
+  nodes.push_back(ShapeNode{1, -1, -1});
+  if (bpBit(bp, *idx) == 1) {
+    // leaf
+    (*idx)++;
+    return node;
+  }
+  int left = parseShapeRec(bp, bits, idx, nodes);
+  int right = parseShapeRec(bp, bits, idx, nodes);
+  assert(bpBit(bp, *idx) == 1); // shape is binary
+  (*idx)++;
+
+  nodes[node].left = left;
+  nodes[node].right = right;
+  nodes[node].leaves = nodes[left].leaves + nodes[right].leaves;
+  return node;
+}
+
+uint64_t rankShape(const std::vector<ShapeNode> &nodes, int node) {
+  const CatalanTables &tables = catalanTables();
+  unsigned int k = nodes[node].leaves;
+  if (k == 1) {
+    return 0;
+  }
+  int left = nodes[node].left;
+  int right = nodes[node].right;
+  unsigned int i = nodes[left].leaves;
+  return tables.offsets[k][i] + rankShape(nodes, left) * tables.catalan[k - i] + rankShape(nodes, right);
+}
+
+void encodeShape(RangeEncoder &rc, TopologyModel &model, const std::vector<ShapeNode> &nodes, int node) {
+  unsigned int k = nodes[node].leaves;
+  if (k <= CATALAN_MAX_LEAVES) {
+    rc.encodeDirectBits(rankShape(nodes, node), bitsForCount(catalanTables().catalan[k]));
+    return;
+  }
+
+  int left = nodes[node].left;
+  int right = nodes[node].right;
+  unsigned int i = nodes[left].leaves;
+  unsigned int ctx = topologyContext(k);
+
+  unsigned int m = std::min(i, k - i);
+  unsigned int b = sdsl::bits::hi(m);
+  for (unsigned int j = 0; j < b; j++) {
+    rc.encodeBit(model.bucket[ctx][j], 1);
+  }
+  if (b + 1 < TOPOLOGY_BUCKETS && (2u << b) <= k / 2) {
+    rc.encodeBit(model.bucket[ctx][b], 0);
+  }
+  rc.encodeDirectBits(m, b);
+  if (2 * m != k) {
+    rc.encodeBit(model.left_smaller[ctx][b], i == m);
+  }
+  encodeShape(rc, model, nodes, left);
+  encodeShape(rc, model, nodes, right);
+}
+
+void encodeTopology(const uint64_t * bp, size_t bits, TopologyScratch &scratch) {
+  std::vector<ShapeNode> &nodes = scratch.nodes;
+  nodes.clear();
+  scratch.roots.clear();
+  size_t idx = 0;
+  while (idx < bits) {
+    scratch.roots.push_back(parseShapeRec(bp, bits, &idx, nodes));
+  }
+  assert(idx == bits);
+
+  RangeEncoder rc(scratch.out);
+  TopologyModel model;
+  encodeGamma(rc, scratch.roots.size() + 1);
+  for (auto root: scratch.roots) {
+    encodeGamma(rc, nodes[root].leaves);
+    encodeShape(rc, model, nodes, root);
+  }
+  rc.flush();
+}
+
+void appendBit(sdsl::bit_vector &bp, size_t * idx, unsigned int bit) {
+  assert(*idx < bp.size());
+  bp[*idx] = bit;
+  (*idx)++;
+}
+
+void unrankShape(uint64_t rank, unsigned int k, sdsl::bit_vector &bp, size_t * idx) {
+  appendBit(bp, idx, 0);
+  if (k > 1) {
+    const CatalanTables &tables = catalanTables();
+    const std::vector<uint64_t> &offsets = tables.offsets[k];
+    // offsets[k] is increasing; find the size of the left subtree
+    unsigned int i = std::upper_bound(offsets.begin() + 1, offsets.end(), rank) - offsets.begin() - 1;
+    assert(i >= 1 && i < k);
+    rank -= offsets[i];
+    unrankShape(rank / tables.catalan[k - i], i, bp, idx);
+    unrankShape(rank % tables.catalan[k - i], k - i, bp, idx);
+  }
+  appendBit(bp, idx, 1);
+}
+
+void decodeShape(RangeDecoder &rc, TopologyModel &model, unsigned int k, sdsl::bit_vector &bp, size_t * idx) {
+  if (k <= CATALAN_MAX_LEAVES) {
+    uint64_t rank = rc.decodeDirectBits(bitsForCount(catalanTables().catalan[k]));
+    unrankShape(rank, k, bp, idx);
+    return;
+  }
+
+  unsigned int ctx = topologyContext(k);
+  unsigned int b = 0;
+  while (b + 1 < TOPOLOGY_BUCKETS && (2u << b) <= k / 2 && rc.decodeBit(model.bucket[ctx][b])) {
+    b++;
+  }
+  unsigned int m = (1u << b) | rc.decodeDirectBits(b);
+  unsigned int i = m;
+  if (2 * m != k && !rc.decodeBit(model.left_smaller[ctx][b])) {
+    i = k - m;
+  }
+  appendBit(bp, idx, 0);
+  decodeShape(rc, model, i, bp, idx);
+  decodeShape(rc, model, k - i, bp, idx);
+  appendBit(bp, idx, 1);
+}
+
+sdsl::bit_vector decodeTopology(const uint8_t * data, size_t bytes) {
+  sdsl::bit_vector bp;
+  if (bytes == 0) {
+    return bp;
+  }
+
+  RangeDecoder rc(data, bytes);
+  TopologyModel model;
+  size_t idx = 0;
+  uint64_t shapes = decodeGamma(rc) - 1;
+  for (uint64_t s = 0; s < shapes; s++) {
+    unsigned int k = decodeGamma(rc);
+    // a shape with k leaves takes 4k - 2 parantheses
+    bp.resize(idx + 4 * k - 2);
+    decodeShape(rc, model, k, bp, &idx);
+  }
+  assert(idx == bp.size());
+  return bp;
+}
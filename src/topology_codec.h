@@ -0,0 +1,63 @@
+#ifndef TOPOLOGY_CODEC_H
+#define TOPOLOGY_CODEC_H
+
+#include <assert.h>
+
+#include <sdsl/bit_vectors.hpp>
+#include <sdsl/int_vector.hpp>
+#include <vector>
+
+/**
+ * Codec for the balanced parantheses of rooted binary tree shapes
+ * (0 = "(", 1 = ")", a leaf is "()").
+ *
+ * A shape with at most CATALAN_MAX_LEAVES leaves is stored as its rank among
+ * all C(k-1) shapes with k leaves. Larger shapes are split at the root: the
+ * size of the smaller subtree is coded with an adaptive binary range coder
+ * (its magnitude adaptively, the remaining bits raw), so the lopsided splits
+ * of caterpillar-like trees become cheap. Both subtrees are then encoded
+ * recursively.
+ */
+
+// shapes up to this number of leaves are ranked with the catalan tables
+// (at most 37, the number of shapes must fit into a word)
+#define CATALAN_MAX_LEAVES 32
+
+/**
+ * A shape parsed from balanced parantheses; leaves have no children.
+ */
+struct ShapeNode {
+  unsigned int leaves;
+  int left;
+  int right;
+};
+
+/**
+ * Buffers of the encoder, kept from one call to the next such that encoding
+ * does not allocate once they are large enough.
+ */
+struct TopologyScratch {
+  std::vector<ShapeNode> nodes;
+  std::vector<int> roots;
+  // the encoded shapes
+  std::vector<uint8_t> out;
+};
+
+/**
+ * Encodes a sequence of binary tree shapes given in balanced parantheses.
+ * @param bp      balanced parantheses of one or more shapes, one after another
+ * @param bits    number of parantheses
+ * @param scratch buffers of the encoder; the encoded shapes are stored in
+ *                scratch.out
+ */
+void encodeTopology(const uint64_t * bp, size_t bits, TopologyScratch &scratch);
+
+/**
+ * Decodes shapes encoded with encodeTopology.
+ * @param  data  encoded shapes
+ * @param  bytes number of bytes in data
+ * @return       balanced parantheses of all shapes, one after another
+ */
+sdsl::bit_vector decodeTopology(const uint8_t * data, size_t bytes);
+
+#endif
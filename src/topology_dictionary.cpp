@@ -0,0 +1,41 @@
+#include "topology_dictionary.h"
+
+void TopologyDictionary::insertSlot(uint64_t hash, uint32_t entry) {
+  size_t mask = hashes.size() - 1;
+  size_t slot = hash & mask;
+  while (hashes[slot] != 0) {
+    slot = (slot + 1) & mask;
+  }
+  hashes[slot] = hash;
+  slot_entries[slot] = entry;
+}
+
+uint32_t TopologyDictionary::insert(uint64_t hash, uint64_t keyframe) {
+  hash = slotHash(hash);
+  uint32_t entry = keyframes.size();
+  keyframes.push_back(keyframe);
+
+  if (2 * keyframes.size() > hashes.size()) {
+    // grow the table: reinsert all occupied slots
+    std::vector<uint64_t> old_hashes;
+    std::vector<uint32_t> old_entries;
+    old_hashes.swap(hashes);
+    old_entries.swap(slot_entries);
+    size_t slots = old_hashes.empty() ? 64 : 2 * old_hashes.size();
+    hashes.assign(slots, 0);
+    slot_entries.assign(slots, 0);
+    for (size_t slot = 0; slot < old_hashes.size(); slot++) {
+      if (old_hashes[slot] != 0) {
+        insertSlot(old_hashes[slot], old_entries[slot]);
+      }
+    }
+  }
+  insertSlot(hash, entry);
+  return entry;
+}
+
+void TopologyDictionary::clear() {
+  hashes.clear();
+  slot_entries.clear();
+  keyframes.clear();
+}
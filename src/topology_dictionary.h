@@ -0,0 +1,76 @@
+#ifndef TOPOLOGY_DICTIONARY_H
+#define TOPOLOGY_DICTIONARY_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/**
+ * Dictionary of the topologies of an archive, keyed by a hash of the
+ * canonical topology. Each entry stores the index of the simple compression
+ * (keyframe) that holds the topology, or TOPOLOGY_NONE if the topology has
+ * been seen but is not stored in a keyframe yet.
+ *
+ * The entries are found through an open addressing table with linear probing
+ * that is kept at most half full. Different topologies may have the same hash;
+ * find therefore checks the candidates with the given predicate.
+ */
+
+#define TOPOLOGY_NONE UINT64_MAX
+
+struct TopologyDictionary {
+  // open addressing table: hash of each slot (0 for an empty slot) and entry
+  std::vector<uint64_t> hashes;
+  std::vector<uint32_t> slot_entries;
+
+  // record index of the keyframe of each entry
+  std::vector<uint64_t> keyframes;
+
+  size_t size() const {
+    return keyframes.size();
+  }
+
+  /**
+   * Searches an entry.
+   * @param  hash  hash of the topology
+   * @param  equal predicate that checks whether an entry (given by its index)
+   *               holds the topology
+   * @return       index of the entry, UINT32_MAX if there is none
+   */
+  template <typename Equal>
+  uint32_t find(uint64_t hash, Equal equal) const {
+    if (hashes.empty()) {
+      return UINT32_MAX;
+    }
+    hash = slotHash(hash);
+    size_t mask = hashes.size() - 1;
+    for (size_t slot = hash & mask; hashes[slot] != 0; slot = (slot + 1) & mask) {
+      if (hashes[slot] == hash && equal(slot_entries[slot])) {
+        return slot_entries[slot];
+      }
+    }
+    return UINT32_MAX;
+  }
+
+  /**
+   * Adds an entry.
+   * @param  hash     hash of the topology
+   * @param  keyframe record index of the keyframe, TOPOLOGY_NONE if there is none
+   * @return          index of the entry
+   */
+  uint32_t insert(uint64_t hash, uint64_t keyframe);
+
+  void clear();
+
+private:
+  // 0 marks empty slots
+  static uint64_t slotHash(uint64_t hash) {
+    return hash == 0 ? 1 : hash;
+  }
+
+  void insertSlot(uint64_t hash, uint32_t entry);
+};
+
+#endif
@@ -0,0 +1,64 @@
+#include "tree_range.h"
+
+pll_unode_t * decodeTree(TreeRangeState &state, size_t i) {
+  const ArchiveReader &archive = *state.archive;
+  assert(i < archive.size());
+
+  if (!state.has_decoded || state.decoded != i) {
+    // the working tree can be advanced if it is not behind the requested tree
+    bool advance = state.has_decoded && state.decoded < i;
+    size_t lowest = advance ? state.decoded + 1 : 0;
+
+    // restart at the last keyframe if there is one in between
+    size_t next = i + 1;
+    for (size_t j = i + 1; j > lowest; j--) {
+      if (isKeyframe(archive.recordKind(j - 1))) {
+        next = j - 1;
+        break;
+      }
+    }
+    if (next > i) {
+      if (advance) {
+        next = state.decoded + 1;
+      } else {
+        // the chain starts with an RF delta
+        assert(state.start_tree != NULL);
+        state.decoder.start(state.start_tree);
+        next = 0;
+      }
+    }
+
+    for (; next <= i; next++) {
+      if (state.decoder.next(archive.record(next)) == NULL) {
+        // ERROR: record could not be decoded
+        state.has_decoded = false;
+        return NULL;
+      }
+    }
+    state.decoded = i;
+    state.has_decoded = true;
+  }
+
+  // the records needed for the next tree of the range
+  archive.prefetch(i + 1, std::min(i + 1 + state.prefetch_records, archive.size()));
+
+  return state.decoder.tree;
+}
+
+TreeRange treeRange(const ArchiveReader &archive, size_t first, size_t last, size_t thin,
+          bool topology_only, const pll_unode_t * start_tree) {
+  assert(thin > 0);
+  last = std::min(last, archive.size());
+
+  TreeRange range;
+  range.state = std::make_shared<TreeRangeState>();
+  range.state->archive = &archive;
+  range.state->decoder.archive = &archive;
+  range.state->start_tree = start_tree;
+  range.state->prefetch_records = thin;
+  range.state->decoder.topology_only = topology_only;
+  range.first = first;
+  range.last = first < last ? first + (last - first + thin - 1) / thin * thin : first;
+  range.thin = thin;
+  return range;
+}
@@ -0,0 +1,125 @@
+#ifndef TREE_RANGE_H
+#define TREE_RANGE_H
+
+#include <iterator>
+#include <memory>
+
+#include "archive.h"
+#include "sequential_decoder.h"
+
+/**
+ * Lazy iteration over the trees of an archive:
+ *
+ *   for (pll_unode_t * tree : treeRange(archive, burnin, archive.size(), thin)) ...
+ *
+ * A tree is only decoded when its iterator is dereferenced. Trees between the
+ * dereferenced ones are skipped if possible: decoding restarts at the last
+ * keyframe (simple compression or topology reference) before the requested
+ * tree, only the deltas after it are applied. After a tree is decoded, the records of the next step are
+ * prefetched from the archive.
+ */
+
+/**
+ * State shared by the iterators of a range.
+ */
+struct TreeRangeState {
+  const ArchiveReader * archive = NULL;
+
+  // tree the first record is stored relative to (NULL if it is a simple compression)
+  const pll_unode_t * start_tree = NULL;
+
+  // number of records prefetched after a decoded tree
+  size_t prefetch_records = 1;
+
+  SequentialDecoder decoder;
+
+  // index of the record the working tree of the decoder belongs to
+  size_t decoded = 0;
+  bool has_decoded = false;
+};
+
+/**
+ * Decodes a tree of the archive on the working tree of the range state.
+ * @param  state state of the range
+ * @param  i     index of the record
+ * @return       the tree, given by its leaf with label "1" (valid until the
+ *               next tree is decoded on the state), NULL if a record could
+ *               not be decoded
+ */
+pll_unode_t * decodeTree(TreeRangeState &state, size_t i);
+
+class TreeIterator {
+public:
+  typedef std::input_iterator_tag iterator_category;
+  typedef pll_unode_t * value_type;
+  typedef std::ptrdiff_t difference_type;
+  typedef pll_unode_t * const * pointer;
+  typedef pll_unode_t * reference;
+
+  TreeIterator(std::shared_ptr<TreeRangeState> range_state, size_t position, size_t step)
+      : state(range_state), idx(position), thin(step) {}
+
+  reference operator*() const {
+    return decodeTree(*state, idx);
+  }
+
+  TreeIterator& operator++() {
+    idx += thin;
+    return *this;
+  }
+
+  TreeIterator operator++(int) {
+    TreeIterator old = *this;
+    idx += thin;
+    return old;
+  }
+
+  bool operator==(const TreeIterator &other) const {
+    return idx == other.idx;
+  }
+
+  bool operator!=(const TreeIterator &other) const {
+    return idx != other.idx;
+  }
+
+  size_t index() const {
+    return idx;
+  }
+
+private:
+  std::shared_ptr<TreeRangeState> state;
+  size_t idx;
+  size_t thin;
+};
+
+struct TreeRange {
+  std::shared_ptr<TreeRangeState> state;
+  size_t first;
+  size_t last; // past the last tree, first + a multiple of thin
+  size_t thin;
+
+  TreeIterator begin() const {
+    return TreeIterator(state, first, thin);
+  }
+
+  TreeIterator end() const {
+    return TreeIterator(state, last, thin);
+  }
+};
+
+/**
+ * Returns the range of the trees first, first + thin, ... before last.
+ * @param  archive       the archive, has to stay open while the range is used
+ * @param  first         index of the first tree (e.g. the burn-in)
+ * @param  last          index after the last tree
+ * @param  thin          step between two trees
+ * @param  topology_only do not decode branch lengths (the branch lengths of
+ *                       the trees are then meaningless)
+ * @param  start_tree    set and ordered tree the first record is stored
+ *                       relative to, if it is an RF delta
+ * @return               the range
+ */
+TreeRange treeRange(const ArchiveReader &archive, size_t first, size_t last, size_t thin = 1,
+          bool topology_only = false, const pll_unode_t * start_tree = NULL);
+
+#endif
@@ -40,9 +40,9 @@ pll_unode_t * createLeaf(double length, char * label) {
     return new_leaf;
 }
 
-pll_unode_t * createTreeRec(sdsl::bit_vector succinct_structure, unsigned int * succinct_idx,
-                        sdsl::int_vector<> node_permutation, unsigned int * node_idx,
-                        std::vector<double> branch_lengths, unsigned int * branch_idx) {
+pll_unode_t * createTreeRec(const sdsl::bit_vector &succinct_structure, unsigned int * succinct_idx,
+                        const sdsl::int_vector<> &node_permutation, unsigned int * node_idx,
+                        const std::vector<double> &branch_lengths, unsigned int * branch_idx) {
 
    assert(succinct_structure[*succinct_idx] == 0);
    assert(*succinct_idx < succinct_structure.size() - 1);
@@ -52,7 +52,7 @@ pll_unode_t * createTreeRec(sdsl::bit_vector succinct_structure, unsigned int *
      pll_unode_t * new_innernode = pllmod_utree_create_node(0, 0, NULL, NULL);
      double branch_length;
      (*succinct_idx)++;
-     branch_length = branch_lengths[*branch_idx];
+     branch_length = branch_lengths.empty() ? 0 : branch_lengths[*branch_idx];
      (*branch_idx)++;
      new_innernode->next->back = createTreeRec(succinct_structure, succinct_idx, node_permutation, node_idx, branch_lengths, branch_idx);
      new_innernode->next->back->length = branch_length;
@@ -61,7 +61,7 @@ pll_unode_t * createTreeRec(sdsl::bit_vector succinct_structure, unsigned int *
 
      assert(succinct_structure[*succinct_idx - 1] == 1);
      assert(succinct_structure[*succinct_idx] == 0);
-     branch_length = branch_lengths[*branch_idx];
+     branch_length = branch_lengths.empty() ? 0 : branch_lengths[*branch_idx];
      (*branch_idx)++;
      new_innernode->next->next->back = createTreeRec(succinct_structure, succinct_idx, node_permutation, node_idx, branch_lengths, branch_idx);
      new_innernode->next->next->back->length = branch_length;
@@ -86,17 +86,19 @@ pll_unode_t * createTreeRec(sdsl::bit_vector succinct_structure, unsigned int *
    }
 }
 
-pll_unode_t * createTreeRecSpecial(std::vector<int> succinct_structure, unsigned int * succinct_idx) {
+pll_unode_t * createTreeRecSpecial(const sdsl::bit_vector &succinct_structure, size_t * succinct_idx, size_t succinct_end,
+                        pll_unode_t ** inner_nodes, size_t * inner_idx) {
 
    assert(succinct_structure[*succinct_idx] == 0);
-   assert(*succinct_idx < succinct_structure.size() - 1);
+   assert(*succinct_idx < succinct_end - 1);
 
    if(succinct_structure[*succinct_idx + 1] == 0) {
-     // create a new node
-     pll_unode_t * new_innernode = pllmod_utree_create_node(0, 0, NULL, NULL);
+     // take the next preallocated node
+     pll_unode_t * new_innernode = inner_nodes[*inner_idx];
+     (*inner_idx)++;
      (*succinct_idx)++;
 
-     pll_unode_t * leaf = createTreeRecSpecial(succinct_structure, succinct_idx);
+     pll_unode_t * leaf = createTreeRecSpecial(succinct_structure, succinct_idx, succinct_end, inner_nodes, inner_idx);
      new_innernode->next->back = leaf;
      if(leaf != NULL) {
         leaf->back = new_innernode->next;
@@ -104,7 +106,7 @@ pll_unode_t * createTreeRecSpecial(std::vector<int> succinct_structure, unsigned
      assert(succinct_structure[*succinct_idx - 1] == 1);
      assert(succinct_structure[*succinct_idx] == 0);
 
-     leaf = createTreeRecSpecial(succinct_structure, succinct_idx);
+     leaf = createTreeRecSpecial(succinct_structure, succinct_idx, succinct_end, inner_nodes, inner_idx);
      new_innernode->next->next->back = leaf;
      if(leaf != NULL) {
         leaf->back = new_innernode->next->next;
@@ -135,8 +137,8 @@ pll_unode_t * createTreeRecSpecial(std::vector<int> succinct_structure, unsigned
  * @param  node_permutation   permutation of the nodes in the tree
  * @return                    root of the created tree
  */
-pll_unode_t * createTree(sdsl::bit_vector succinct_structure, sdsl::int_vector<> node_permutation,
-              std::vector<double> branch_lengths) {
+pll_unode_t * createTree(const sdsl::bit_vector &succinct_structure, const sdsl::int_vector<> &node_permutation,
+              const std::vector<double> &branch_lengths) {
 
       unsigned int succinct_idx = 0;
       unsigned int node_idx = 0;
@@ -146,19 +148,19 @@ pll_unode_t * createTree(sdsl::bit_vector succinct_structure, sdsl::int_vector<>
                   branch_lengths, &branch_idx);
       assert(succinct_idx == succinct_structure.size());
       assert(node_idx == node_permutation.size());
-      assert(branch_idx == branch_lengths.size());
+      assert(branch_lengths.empty() || branch_idx == branch_lengths.size());
 
       return tree;
 }
 
 void assignBranchLengthsSubtreeRec(pll_unode_t * tree, std::vector<pll_unode_t *> &leaves, unsigned int * node_idx,
-                  std::vector<double> branch_lengths, unsigned int * branch_idx){
+                  const double * branch_lengths, unsigned int * branch_idx){
   assert(tree != NULL);
   assert(tree->next != NULL);
   assert(tree->next->next->next == tree); // assert tree is binary
 
   if(tree->next->back != NULL) {
-    double bl = branch_lengths[*branch_idx];
+    double bl = branch_lengths == NULL ? 0 : branch_lengths[*branch_idx];
     tree->next->length = bl;
     tree->next->back->length = bl;
     (*branch_idx)++;
@@ -177,7 +179,7 @@ void assignBranchLengthsSubtreeRec(pll_unode_t * tree, std::vector<pll_unode_t *
   }
 
   if(tree->next->next->back != NULL) {
-    double bl = branch_lengths[*branch_idx];
+    double bl = branch_lengths == NULL ? 0 : branch_lengths[*branch_idx];
     tree->next->next->length = bl;
     tree->next->next->back->length = bl;
     (*branch_idx)++;
@@ -196,21 +198,27 @@ void assignBranchLengthsSubtreeRec(pll_unode_t * tree, std::vector<pll_unode_t *
   }
 }
 
-pll_unode_t * createTreeSpecial(std::vector<int> succinct_structure, std::vector<pll_unode_t *> &leaves,
-                std::vector<double> branch_lengths) {
+/**
+ * Creates the subtree stored in succinct_structure[succinct_start, succinct_end)
+ * and attaches the given leaves of the consensus tree to it. The k - 1 inner
+ * nodes of a subtree with k leaves are taken from inner_nodes.
+ */
+pll_unode_t * createTreeSpecial(const sdsl::bit_vector &succinct_structure, size_t succinct_start, size_t succinct_end,
+                std::vector<pll_unode_t *> &leaves, const double * branch_lengths, size_t branch_count,
+                pll_unode_t ** inner_nodes) {
 
-      unsigned int succinct_idx = 0;
+      size_t succinct_idx = succinct_start;
+      size_t inner_idx = 0;
       unsigned int node_idx = 0;
 
-      pll_unode_t * tree = createTreeRecSpecial(succinct_structure, &succinct_idx);
+      pll_unode_t * tree = createTreeRecSpecial(succinct_structure, &succinct_idx, succinct_end, inner_nodes, &inner_idx);
 
-      assert(succinct_idx == succinct_structure.size());
+      assert(succinct_idx == succinct_end);
+      assert(inner_idx == leaves.size() - 1);
 
       unsigned int branch_idx = 0;
       assignBranchLengthsSubtreeRec(tree, leaves, &node_idx, branch_lengths, &branch_idx);
-      assert(branch_idx == branch_lengths.size());
-
-
+      assert(branch_idx == branch_count);
 
       return tree;
 }
@@ -226,9 +234,81 @@ pll_unode_t * simple_uncompression(sdsl::bit_vector &succinct_structure, sdsl::i
   tree->next->next->back->back = root;
   root->length = root->back->length;
 
+  // the inner node above the root leaf is not part of the unrooted tree
+  free(tree->next->next);
+  free(tree->next);
+  free(tree);
+
   return root;
 }
 
+/*
+ * Appends a leaf label and the length of the branch above it.
+ */
+static inline void appendNewickLeaf(std::string &newick, uint64_t label, double length) {
+  char buffer[24];
+  char * end = buffer + sizeof(buffer);
+  char * p = end;
+  do {
+    *--p = '0' + label % 10;
+    label /= 10;
+  } while (label != 0);
+  newick.append(p, end - p);
+  appendBranchLength(newick, length);
+}
+
+void simple_uncompression_newick(const sdsl::bit_vector &succinct_structure, const sdsl::int_vector<> &node_permutation,
+          const std::vector<double> &branch_lengths, std::string &newick) {
+  size_t size = succinct_structure.size();
+  assert(size >= 10); // at least 3 leaves
+  assert(branch_lengths.empty() || branch_lengths.size() == size / 2 - 1);
+  assert(node_permutation.size() == (size + 2) / 4);
+  assert(node_permutation[0] == 1);
+
+  // the BP of the rooted tree: "(" root leaf "()" "(" rest of the tree ")" ")";
+  // every node but the root takes the next branch length in BP order
+  assert(succinct_structure[0] == 0 && succinct_structure[1] == 0 && succinct_structure[2] == 1);
+  assert(succinct_structure[3] == 0 && succinct_structure[size - 2] == 1 && succinct_structure[size - 1] == 1);
+
+  size_t node_idx = 1;
+  size_t branch_idx = 2;
+  auto length = [&](size_t i) { return branch_lengths.empty() ? 0.0 : branch_lengths[i]; };
+
+  // the root leaf takes the length of the branch above its neighbour
+  newick += '(';
+  appendNewickLeaf(newick, 1, length(1));
+  newick += ',';
+
+  // branch index of each open inner node (the depth is at most the number of leaves)
+  std::vector<uint32_t> open_branches;
+  open_branches.reserve(64);
+
+  for (size_t i = 4; i < size - 2; i++) {
+    if (succinct_structure[i] == 0) {
+      if (succinct_structure[i - 1] == 1) {
+        // a sibling was closed before this node
+        newick += ',';
+      }
+      if (succinct_structure[i + 1] == 1) {
+        appendNewickLeaf(newick, node_permutation[node_idx++], length(branch_idx++));
+        i++;
+      } else {
+        newick += '(';
+        open_branches.push_back(branch_idx++);
+      }
+    } else {
+      newick += ')';
+      appendBranchLength(newick, length(open_branches.back()));
+      open_branches.pop_back();
+    }
+  }
+  newick += ");";
+
+  assert(open_branches.empty());
+  assert(node_idx == node_permutation.size());
+  assert(branch_lengths.empty() || branch_idx == branch_lengths.size());
+}
+
 pll_unode_t * copyTreeRec(const pll_unode_t * original) {
     if(original->next == NULL) {
         // leaf
@@ -266,7 +346,7 @@ pll_unode_t * copyTreeRec(const pll_unode_t * original) {
  * @return      creates copy of the trees topology
  */
 pll_unode_t * copyTree(const pll_unode_t * tree) {
-    if(tree->next == NULL && tree->back >= NULL) {
+    if(tree->next == NULL && tree->back != NULL) {
         // root of the tree is a leaf
         pll_unode_t * root = createLeaf(tree->length, tree->label);
         root->back = copyTreeRec(tree->back);
@@ -280,11 +360,9 @@ void traverseAndDeleteEdgesRec(pll_unode_t * tree, sdsl::int_vector<> &edges_to_
                   unsigned int * edges_to_contract_idx, unsigned int * edges_idx,
                   std::vector<pll_unode_t *> &nodes_to_contract) {
 
-  bool contract = false;
-
   if(*edges_to_contract_idx < edges_to_contract.size() &&
                 *edges_idx == edges_to_contract[*edges_to_contract_idx]) {
-      assert(tree->next != NULL);
+      // a leaf branch is marked as well; traverseAndDeleteEdges rejects it
       (*edges_to_contract_idx)++;
       nodes_to_contract.push_back(tree);
   }
@@ -302,34 +380,56 @@ void traverseAndDeleteEdgesRec(pll_unode_t * tree, sdsl::int_vector<> &edges_to_
 
 /**
  * Traverses the given tree and contracts the edges given by the vector "edges_to_contract"
- * @param tree              tree
- * @param edges_to_contract edges to contract in the tree
+ * @param  tree              tree
+ * @param  edges_to_contract edges to contract in the tree
+ * @param  removed_nodes     vector to append the unodes of the contracted edges to
+ * @return                   value < 0 if the edges are not increasing inner
+ *                           edges of the tree (nothing is contracted then)
  */
-void traverseAndDeleteEdges(pll_unode_t * tree, sdsl::int_vector<> &edges_to_contract) {
+int traverseAndDeleteEdges(pll_unode_t * tree, sdsl::int_vector<> &edges_to_contract,
+                  std::vector<pll_unode_t *> &removed_nodes) {
     if(edges_to_contract.size() == 0) {
-      return;
+      return 0;
+    }
+    if(edges_to_contract[0] <= 2) {
+      // ERROR: the branches at the root leaf cannot be contracted
+      return -1;
     }
-    assert(edges_to_contract[0] > 2);
     unsigned int edges_to_contract_idx = 0;
     unsigned int edges_idx = 2;
     std::vector<pll_unode_t *> nodes_to_contract;
     traverseAndDeleteEdgesRec(tree->back, edges_to_contract, &edges_to_contract_idx, &edges_idx, nodes_to_contract);
+    if(edges_to_contract_idx != edges_to_contract.size()) {
+      // ERROR: edges not increasing or not in the tree
+      return -1;
+    }
+    for(auto node: nodes_to_contract){
+      if(node->next == NULL) {
+        // ERROR: leaf branch
+        return -1;
+      }
+    }
 
     for(auto node: nodes_to_contract){
       contractEdge(node);
+      removed_nodes.push_back(node);
+      removed_nodes.push_back(node->back);
     }
+    return 0;
 }
 
-void applyBranchLengthDiffsRec(pll_unode_t * tree, std::vector<double> consensus_branch_diffs,
+void applyBranchLengthDiffsRec(pll_unode_t * tree, const std::vector<double> &consensus_branch_diffs,
                       unsigned int * branches_idx) {
     assert(tree != NULL);
 
     if(((intptr_t) tree->data != 0) || ((intptr_t) tree->back->data != 0)) {
-        // apply branch diff
-        double new_bl = tree->length + consensus_branch_diffs[*branches_idx];
+        // apply branch diff (the number of diffs is checked afterwards)
+        if(*branches_idx < consensus_branch_diffs.size()) {
+          double new_bl = tree->length + consensus_branch_diffs[*branches_idx];
+          tree->length = new_bl;
+          tree->back->length = new_bl;
+        }
         (*branches_idx)++;
-        tree->length = new_bl;
-        tree->back->length = new_bl;
     } else {
         assert((intptr_t) tree->data == 0 && (intptr_t) tree->back->data == 0);
     }
@@ -344,108 +444,239 @@ void applyBranchLengthDiffsRec(pll_unode_t * tree, std::vector<double> consensus
     applyBranchLengthDiffsRec(tree->next->next->back, consensus_branch_diffs, branches_idx);
 }
 
-void applyBranchLengthDiffs(pll_unode_t * tree, std::vector<double> consensus_diffs) {
+/**
+ * Adds the consensus branch length diffs of an RF delta.
+ * @return value < 0 if there is not one diff per consensus branch
+ */
+int applyBranchLengthDiffs(pll_unode_t * tree, const std::vector<double> &consensus_diffs) {
     unsigned int branches_idx = 1;
     applyBranchLengthDiffsRec(tree->back, consensus_diffs, &branches_idx);
-    assert(branches_idx == consensus_diffs.size());
+    return branches_idx == consensus_diffs.size() ? 0 : -1;
 }
 
-pll_unode_t * rf_distance_uncompression(const pll_unode_t * predecessor_tree, sdsl::int_vector<> &edges_to_contract,
-          sdsl::bit_vector &subtrees_succinct, sdsl::int_vector<> &succinct_permutations,
-          std::vector<double> consensus_branches, std::vector<double> non_consensus_branches) {
+void addBranchLengthDiffsRec(pll_unode_t * tree, const std::vector<double> &diffs, size_t * diffs_idx) {
+    double new_bl = tree->length + diffs[(*diffs_idx)++];
+    tree->length = new_bl;
+    tree->back->length = new_bl;
+
+    if(tree->next == NULL) {
+      return;
+    }
+
+    assert(tree->next->next->next == tree);
+
+    addBranchLengthDiffsRec(tree->next->back, diffs, diffs_idx);
+    addBranchLengthDiffsRec(tree->next->next->back, diffs, diffs_idx);
+}
+
+void addBranchLengthDiffs(pll_unode_t * tree, const std::vector<double> &diffs) {
+    assert(tree->next == NULL);
+    size_t diffs_idx = 1;
+    addBranchLengthDiffsRec(tree->back, diffs, &diffs_idx);
+    assert(diffs_idx == diffs.size());
+}
+
+/**
+ * Creates the subtrees first..last-1 of an RF delta and stores them in subtrees.
+ * Different subtrees attach disjoint sets of consensus leaves, so disjoint ranges
+ * can be created concurrently.
+ */
+void createSubtrees(size_t first, size_t last, const sdsl::bit_vector &subtrees_succinct,
+          const std::vector<uint64_t> &subtree_offsets, const sdsl::int_vector<> &succinct_permutations,
+          const std::vector<double> &non_consensus_branches,
+          std::vector<std::vector<pll_unode_t *>> &consensus_orders, std::vector<pll_unode_t *> &inner_nodes,
+          std::vector<pll_unode_t *> &subtrees) {
+  for (size_t i = first; i < last; i++) {
+    size_t leaves = subtree_offsets[i + 1] - subtree_offsets[i];
+    assert(consensus_orders[i].size() == leaves);
+
+    // subtree i starts after i subtrees with subtree_offsets[i] leaves in total;
+    // a subtree with k leaves takes 4k - 2 parantheses and has k - 2 inner branches
+    // and k - 1 inner nodes
+    size_t succinct_start = 4 * subtree_offsets[i] - 2 * i;
+    size_t branch_start = subtree_offsets[i] - 2 * i;
+    size_t inner_start = subtree_offsets[i] - i;
+
+    std::vector<pll_unode_t *> new_order(leaves);
+    for (size_t j = 0; j < leaves; j++) {
+      new_order[j] = consensus_orders[i][succinct_permutations[subtree_offsets[i] + j]];
+      assert(new_order[j] != NULL);
+    }
+
+    subtrees[i] = createTreeSpecial(subtrees_succinct, succinct_start, succinct_start + 4 * leaves - 2,
+                    new_order, non_consensus_branches.empty() ? NULL : non_consensus_branches.data() + branch_start, leaves - 2,
+                    inner_nodes.data() + inner_start);
+  }
+}
 
-  // split subtrees_succinct
-  std::vector<std::vector<int>> subtrees_split;
+pll_unode_t * createInnerNode(std::vector<pll_unode_t *> &free_nodes) {
+  if (free_nodes.size() < 3) {
+    return pllmod_utree_create_node(0, 0, NULL, NULL);
+  }
 
-  if(!(subtrees_succinct.size() == 0)) {
-    assert(subtrees_succinct[0] == 0);
+  // link three recycled unodes into a new ring
+  pll_unode_t * unodes[3];
+  for (int j = 0; j < 3; j++) {
+    unodes[j] = free_nodes.back();
+    free_nodes.pop_back();
+    memset(unodes[j], 0, sizeof(pll_unode_t));
+  }
+  unodes[0]->next = unodes[1];
+  unodes[1]->next = unodes[2];
+  unodes[2]->next = unodes[0];
+  return unodes[0];
+}
 
-    size_t temp_start_index = 0;
-    unsigned int temp_ctr = 1;
-    size_t temp_size = 1;
+int checkRFSubtreeDirectory(const std::vector<uint64_t> &subtree_offsets, size_t subtrees_bits) {
+  if (subtree_offsets.empty() || subtree_offsets[0] != 0) {
+    return -1;
+  }
+  size_t subtree_count = subtree_offsets.size() - 1;
+  for (size_t i = 0; i < subtree_count; i++) {
+    if (subtree_offsets[i + 1] < subtree_offsets[i] + 3) {
+      // ERROR: a subtree replaces a node with at least three children
+      return -1;
+    }
+  }
+  if (subtree_offsets[subtree_count] > subtrees_bits
+        || subtrees_bits != 4 * subtree_offsets[subtree_count] - 2 * subtree_count) {
+    // ERROR: the directory does not fit the parantheses
+    return -1;
+  }
+  return 0;
+}
 
-    while(temp_start_index + temp_size < subtrees_succinct.size()) {
-      while(temp_ctr > 0) {
-        if(subtrees_succinct[temp_start_index + temp_size] == 0) {
-          temp_ctr++;
-        } else {
-          temp_ctr--;
+/*
+ * Checks that the parantheses of each subtree of an RF delta form a binary
+ * tree with the leaves given by the directory and that each permutation is
+ * one of the leaves of its subtree.
+ */
+int checkRFSubtrees(const sdsl::bit_vector &subtrees_succinct, const std::vector<uint64_t> &subtree_offsets,
+          const sdsl::int_vector<> &succinct_permutations) {
+  size_t subtree_count = subtree_offsets.size() - 1;
+  std::vector<uint8_t> children;
+  std::vector<size_t> seen(subtree_offsets[subtree_count], SIZE_MAX);
+  for (size_t i = 0; i < subtree_count; i++) {
+    size_t leaves = subtree_offsets[i + 1] - subtree_offsets[i];
+    size_t start = 4 * subtree_offsets[i] - 2 * i;
+    size_t end = start + 4 * leaves - 2;
+    size_t found = 0;
+    children.clear();
+    for (size_t j = start; j < end; j++) {
+      if (subtrees_succinct[j] == 0) {
+        if (j > start && children.empty()) {
+          // ERROR: more than one root
+          return -1;
         }
-        temp_size++;
-        assert(temp_ctr >= 0);
+        children.push_back(0);
+        continue;
       }
-      assert(temp_ctr == 0);
-      subtrees_split.push_back(std::vector<int> (subtrees_succinct.begin() + temp_start_index, subtrees_succinct.begin() + temp_start_index + temp_size));
+      if (children.empty() || (children.back() != 0 && children.back() != 2)) {
+        // ERROR: unbalanced or not binary
+        return -1;
+      }
+      found += children.back() == 0;
+      children.pop_back();
+      if (!children.empty() && ++children.back() > 2) {
+        return -1;
+      }
+    }
+    if (!children.empty() || found != leaves) {
+      return -1;
+    }
 
-      temp_start_index = temp_start_index + temp_size;
-      temp_size = 1;
-      assert(temp_start_index <= subtrees_succinct.size());
-      temp_ctr = 1;
+    for (size_t j = subtree_offsets[i]; j < subtree_offsets[i + 1]; j++) {
+      uint64_t value = succinct_permutations[j];
+      if (value >= leaves || seen[subtree_offsets[i] + value] == i) {
+        // ERROR: not a permutation of the leaves
+        return -1;
+      }
+      seen[subtree_offsets[i] + value] = i;
     }
-    assert(temp_ctr == 1);
   }
+  return 0;
+}
 
-  // split succinct_permutations
-  std::vector<std::vector<int>> permutations;
-  size_t start_idx_succinct = 0;
-  size_t end_idx_succinct;
-  for (size_t i = 0; i < subtrees_split.size(); i++) {
-      assert(subtrees_split[i].size() % 2 == 0);
-      assert((subtrees_split[i].size() + 2) % 4 == 0);
-      end_idx_succinct = start_idx_succinct + (subtrees_split[i].size() + 2) / 4;
-      assert(end_idx_succinct <= succinct_permutations.size());
-
-      permutations.push_back(std::vector<int> (succinct_permutations.begin() + start_idx_succinct,
-                      succinct_permutations.begin() + end_idx_succinct));
-      start_idx_succinct = end_idx_succinct;
+int applyRFDelta(pll_unode_t * tree, sdsl::int_vector<> &edges_to_contract,
+          sdsl::bit_vector &subtrees_succinct, const std::vector<uint64_t> &subtree_offsets,
+          sdsl::int_vector<> &succinct_permutations,
+          const std::vector<double> &consensus_branches, const std::vector<double> &non_consensus_branches,
+          std::vector<pll_unode_t *> &free_nodes) {
+
+  // the delta is checked as far as possible before the tree is changed
+  if (checkRFSubtreeDirectory(subtree_offsets, subtrees_succinct.size()) < 0) {
+    return -1;
   }
-  assert(start_idx_succinct == succinct_permutations.size());
-
-  // split non_consensus_branch_lengths
-  std::vector<std::vector<double>> branch_lengths;
-  start_idx_succinct = 0;
-  for (size_t i = 0; i < permutations.size(); i++) {
-      end_idx_succinct = start_idx_succinct + (permutations[i].size() - 2);
-      assert(end_idx_succinct <= succinct_permutations.size());
-
-      branch_lengths.push_back(std::vector<double> (non_consensus_branches.begin() + start_idx_succinct,
-                      non_consensus_branches.begin() + end_idx_succinct));
-      start_idx_succinct = end_idx_succinct;
+  size_t subtree_count = subtree_offsets.size() - 1;
+  if (succinct_permutations.size() != subtree_offsets[subtree_count]
+        || (!non_consensus_branches.empty()
+            && non_consensus_branches.size() != subtree_offsets[subtree_count] - 2 * subtree_count)
+        || checkRFSubtrees(subtrees_succinct, subtree_offsets, succinct_permutations) < 0) {
+    // ERROR: the subtrees are not binary trees with permuted leaves
+    return -1;
   }
-  assert(start_idx_succinct == non_consensus_branches.size());
-
-  // assert predecessor_tree ordered
-  pll_unode_t * tree = copyTree(predecessor_tree);
 
-  traverseAndDeleteEdges(tree, edges_to_contract);
+  std::vector<pll_unode_t *> removed_nodes;
+  if (traverseAndDeleteEdges(tree, edges_to_contract, removed_nodes) < 0) {
+    return -1;
+  }
+  // the contracted unodes are not part of the tree any more
+  free_nodes.insert(free_nodes.end(), removed_nodes.begin(), removed_nodes.end());
+  removed_nodes.clear();
 
   std::vector<pll_unode_t *> consensus_subtree_roots;
   std::vector<std::vector<pll_unode_t *>> consensus_orders;
   traverseConsensus(tree, consensus_subtree_roots, consensus_orders);
 
-  assert(consensus_orders.size() == permutations.size());
-  for (size_t i = 0; i < consensus_orders.size(); i++) {
-    assert(consensus_orders[i].size() == permutations[i].size());
+  if (consensus_orders.size() != subtree_count) {
+    // ERROR: the subtrees do not match the nodes of the contracted tree
+    return -1;
+  }
+  for (size_t i = 0; i < subtree_count; i++) {
+    if (consensus_orders[i].size() != subtree_offsets[i + 1] - subtree_offsets[i]) {
+      return -1;
+    }
   }
 
-  std::vector<std::vector<pll_unode_t *>> new_orders;
-  for (size_t i = 0; i < consensus_orders.size(); i++) {
-      std::vector<pll_unode_t *> new_order(consensus_orders[i].size());
-      for (size_t j = 0; j < consensus_orders[i].size(); j++) {
-        new_order[j] = consensus_orders[i][permutations[i][j]];
-      }
+  // allocate the inner nodes of all subtrees, reusing the unodes of the previous delta
+  std::vector<pll_unode_t *> inner_nodes(subtree_offsets[subtree_count] - subtree_count);
+  for (size_t i = 0; i < inner_nodes.size(); i++) {
+    inner_nodes[i] = createInnerNode(free_nodes);
+  }
 
-      for (size_t j = 0; j < consensus_orders[i].size(); j++) {
-        assert(new_order[j] != NULL);
+  // create the subtrees, on several threads for large deltas
+  std::vector<pll_unode_t *> subtrees(subtree_count, NULL);
+  size_t threads = std::min((size_t) std::max(std::thread::hardware_concurrency(), 1u),
+                  (size_t) (subtree_offsets[subtree_count] / PARALLEL_SUBTREES_MIN_LEAVES));
+  if (threads <= 1 || subtree_count <= 1) {
+    createSubtrees(0, subtree_count, subtrees_succinct, subtree_offsets, succinct_permutations,
+                  non_consensus_branches, consensus_orders, inner_nodes, subtrees);
+  } else {
+    // split the subtrees into ranges with about the same number of leaves
+    std::vector<std::thread> workers;
+    size_t first = 0;
+    for (size_t t = 1; t <= threads; t++) {
+      uint64_t target = subtree_offsets[subtree_count] * t / threads;
+      size_t last = std::lower_bound(subtree_offsets.begin() + first, subtree_offsets.end() - 1, target)
+                  - subtree_offsets.begin();
+      if (t == threads) {
+        last = subtree_count;
       }
-
-      new_orders.push_back(new_order);
+      if (last > first) {
+        workers.push_back(std::thread(createSubtrees, first, last, std::cref(subtrees_succinct),
+                  std::cref(subtree_offsets), std::cref(succinct_permutations), std::cref(non_consensus_branches),
+                  std::ref(consensus_orders), std::ref(inner_nodes), std::ref(subtrees)));
+      }
+      first = last;
+    }
+    for (auto &worker: workers) {
+      worker.join();
+    }
   }
 
-  assert(subtrees_split.size() == new_orders.size());
-  for (size_t i = 0; i < subtrees_split.size(); i++) {
-
-    pll_unode_t * subtree = createTreeSpecial(subtrees_split[i], new_orders[i], branch_lengths[i]);
+  // splice the subtrees into the consensus tree
+  for (size_t i = 0; i < subtree_count; i++) {
+    pll_unode_t * subtree = subtrees[i];
 
     assert(consensus_subtree_roots[i] != NULL);
     assert(consensus_subtree_roots[i]->back != NULL);
@@ -460,11 +691,59 @@ pll_unode_t * rf_distance_uncompression(const pll_unode_t * predecessor_tree, sd
     subtree->length = subtree->back->length;
     subtree->data = consensus_subtree_roots[i]->data;
 
-    // TODO: free consensus_subtree_roots
-    // TODO: free consensus_subtree_roots[i]
+    // the multifurcating node has been replaced by the subtree
+    removed_nodes.push_back(consensus_subtree_roots[i]);
+    for (auto child: consensus_orders[i]) {
+      removed_nodes.push_back(child);
+    }
+  }
+
+  free_nodes.insert(free_nodes.end(), removed_nodes.begin(), removed_nodes.end());
+
+  if (!consensus_branches.empty() && applyBranchLengthDiffs(tree, consensus_branches) < 0) {
+    // ERROR: not one diff per consensus branch
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Frees the unodes of the subtree behind node, but not the labels (a copied
+ * tree shares them with the original).
+ */
+void freeUnodes(pll_unode_t * node) {
+  if (node->next != NULL) {
+    pll_unode_t * current = node->next;
+    while (current != node) {
+      pll_unode_t * next = current->next;
+      freeUnodes(current->back);
+      free(current);
+      current = next;
+    }
   }
+  free(node);
+}
+
+pll_unode_t * rf_distance_uncompression(const pll_unode_t * predecessor_tree, sdsl::int_vector<> &edges_to_contract,
+          sdsl::bit_vector &subtrees_succinct, const std::vector<uint64_t> &subtree_offsets,
+          sdsl::int_vector<> &succinct_permutations,
+          std::vector<double> consensus_branches, std::vector<double> non_consensus_branches) {
+
+  // assert predecessor_tree ordered
+  pll_unode_t * tree = copyTree(predecessor_tree);
 
-  applyBranchLengthDiffs(tree, consensus_branches);
+  std::vector<pll_unode_t *> free_nodes;
+  int result = applyRFDelta(tree, edges_to_contract, subtrees_succinct, subtree_offsets, succinct_permutations,
+            consensus_branches, non_consensus_branches, free_nodes);
+  for (auto node: free_nodes) {
+    free(node);
+  }
+  if (result < 0) {
+    // ERROR: the delta does not fit the predecessor tree
+    freeUnodes(tree->back);
+    free(tree);
+    return NULL;
+  }
 
   return tree;
 }
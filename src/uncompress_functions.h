@@ -13,29 +13,101 @@ extern "C" {
 
 #include <sdsl/bit_vectors.hpp>
 #include <algorithm>
+#include <thread>
 
 #include "util.h"
 
+// RF deltas whose subtrees have at least this many leaves per thread are
+// decompressed on several threads
+#define PARALLEL_SUBTREES_MIN_LEAVES 4096
+
 /**
  * Decompresses a tree stored with simple compression.
  * @param  succinct_structure vector containing succint structure
  * @param  node_permutation   vector containing node permutation
- * @param  branch_lengths     vector containing branch lengths
+ * @param  branch_lengths     vector containing branch lengths (empty: topology only,
+ *                            all branch lengths are 0)
  * @return                    root of the decompressed tree
  */
 pll_unode_t * simple_uncompression(sdsl::bit_vector &succinct_structure, sdsl::int_vector<> &node_permutation, std::vector<double> branch_lengths);
 
+/**
+ * Transcodes a tree stored with simple compression directly to newick format,
+ * in one pass over the structures and without creating the tree. The output
+ * equals appendNewick of the tree returned by simple_uncompression.
+ * @param  succinct_structure vector containing succint structure
+ * @param  node_permutation   vector containing node permutation
+ * @param  branch_lengths     vector containing branch lengths (empty: all
+ *                            branch lengths are 0)
+ * @param  newick             the newick string is appended to it
+ */
+void simple_uncompression_newick(const sdsl::bit_vector &succinct_structure, const sdsl::int_vector<> &node_permutation,
+          const std::vector<double> &branch_lengths, std::string &newick);
+
 /**
  * Decompresses a tree stored with rf distance compression.
  * @param  predecessor_tree       the predecessor tree (compressed tree is stored
  *                                relative to this tree)
  * @param  edges_to_contract      vector containing the edges to contract
  * @param  subtrees_succinct      vector containing the succinct subtrees
+ * @param  subtree_offsets        subtree directory: element i is the number of
+ *                                leaves in the subtrees before subtree i
  * @param  succinct_permutations  vector containing the permutations
  * @param  consensus_branches     vector containing the consensus branch lengths (diffs)
  * @param  non_consensus_branches vector containing the non consensus branch lengths
- * @return                        root of the decompressed tree
+ * @return                        root of the decompressed tree, NULL if the delta
+ *                                does not fit the predecessor tree
  */
 pll_unode_t * rf_distance_uncompression(const pll_unode_t * predecessor_tree, sdsl::int_vector<> &edges_to_contract,
-          sdsl::bit_vector &subtrees_succinct, sdsl::int_vector<> &succinct_permutations,
+          sdsl::bit_vector &subtrees_succinct, const std::vector<uint64_t> &subtree_offsets,
+          sdsl::int_vector<> &succinct_permutations,
           std::vector<double> consensus_branches, std::vector<double> non_consensus_branches);
+
+/**
+ * Applies an RF delta in place: contracts the given edges of the tree, replaces
+ * the resulting multifurcating nodes by the given subtrees and applies the
+ * consensus branch length diffs.
+ * The unodes removed from the tree are appended to free_nodes; the inner nodes
+ * of the new subtrees are taken from free_nodes first.
+ * If both branch length vectors are empty, only the topology is decompressed
+ * (the branch lengths of the new subtrees are 0, the others are not changed).
+ * @param  tree                   root of the predecessor tree (ordered), is
+ *                                turned into the decompressed tree
+ * A delta that does not fit the tree (edges that are not increasing inner
+ * branches, subtrees that are not binary or do not match the contracted
+ * nodes, permutations that are not permutations) is an error; the tree may be
+ * contracted then and has to be released.
+ * @param  free_nodes             unodes that can be reused
+ * (other parameters as in rf_distance_uncompression)
+ * @return                        value < 0 in case of an error
+ */
+int applyRFDelta(pll_unode_t * tree, sdsl::int_vector<> &edges_to_contract,
+          sdsl::bit_vector &subtrees_succinct, const std::vector<uint64_t> &subtree_offsets,
+          sdsl::int_vector<> &succinct_permutations,
+          const std::vector<double> &consensus_branches, const std::vector<double> &non_consensus_branches,
+          std::vector<pll_unode_t *> &free_nodes);
+
+/**
+ * Checks the subtree directory of an RF delta: each subtree has at least three
+ * leaves and the directory fits the number of parantheses of the subtrees.
+ * @param  subtree_offsets subtree directory
+ * @param  subtrees_bits   number of parantheses of the subtrees
+ * @return                 value < 0 if the directory is corrupt
+ */
+int checkRFSubtreeDirectory(const std::vector<uint64_t> &subtree_offsets, size_t subtrees_bits);
+
+/**
+ * Adds branch length diffs to all branches of a tree, in depth-first order
+ * (the consensus branches of a branch length record).
+ * @param  tree  root of the tree (ordered)
+ * @param  diffs the diffs, element 0 is unused
+ */
+void addBranchLengthDiffs(pll_unode_t * tree, const std::vector<double> &diffs);
+
+/**
+ * Takes a binary tree and creates a copy of its topology. The copy shares the
+ * labels with the given tree.
+ * @param  tree the tree to copy
+ * @return      copy of the tree
+ */
+pll_unode_t * copyTree(const pll_unode_t * tree);
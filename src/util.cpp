@@ -1,6 +1,7 @@
 #include <assert.h>
 
 #include "util.h"
+#include "datastructure_compression_functions.h"
 
 std::string toNewickRec(pll_unode_t * tree) {
   assert(tree != NULL);
@@ -40,6 +41,51 @@ std::string toNewick(pll_unode_t * tree) {
   }
 }
 
+void appendBranchLength(std::string &newick, double length) {
+  // the decimals of the archive, so the length is compressed to the same
+  // value again
+  char buffer[64];
+  int n = snprintf(buffer, sizeof(buffer), ":%.*f", PRECISION, length);
+  while (buffer[n - 1] == '0') {
+    n--;
+  }
+  if (buffer[n - 1] == '.') {
+    n--;
+  }
+  newick.append(buffer, n);
+}
+
+/*
+ * Appends a subtree and the length of the branch above it.
+ */
+void appendNewickRec(pll_unode_t * tree, std::string &newick) {
+  if(tree->next == NULL) {
+    //leaf
+    newick += tree->label;
+  } else {
+    assert(tree->next->next->next == tree); // tree is binary
+    newick += '(';
+    appendNewickRec(tree->next->back, newick);
+    newick += ',';
+    appendNewickRec(tree->next->next->back, newick);
+    newick += ')';
+  }
+  appendBranchLength(newick, tree->length);
+}
+
+void appendNewick(pll_unode_t * tree, std::string &newick) {
+  assert(tree != NULL);
+
+  pll_unode_t * inner = tree->next == NULL ? tree->back : tree;
+  newick += '(';
+  appendNewickRec(tree->next == NULL ? tree : tree->back, newick);
+  newick += ',';
+  appendNewickRec(inner->next->back, newick);
+  newick += ',';
+  appendNewickRec(inner->next->next->back, newick);
+  newick += ");";
+}
+
 void printNode(pll_unode_t * node) {
   assert(node != NULL);
   printf("Node Index: %i, PMatrix Index: %i, Label: %s, Length: %f, Data: %i\n",
@@ -159,77 +205,6 @@ void orderTree(pll_unode_t * tree) {
   orderTreeRec(tree->back);
 }
 
-bool innerNodeCompare(pll_unode_t * node1, pll_unode_t * node2) {
-  return ((intptr_t) node1->data) < ((intptr_t) node2->data);
-}
-
-void assignBranchNumbersRec(pll_unode_t * tree, unsigned int * bp_idx, sdsl::bit_vector &bp,
-              unsigned int * iv_idx, sdsl::int_vector<> &iv, unsigned int * bl_idx, std::vector<double> &branch_lengths,
-              unsigned int * n, unsigned int* node_id_to_branch_id) {
-  assert(tree != NULL);
-  branch_lengths[*bl_idx] = tree->length;
-  (*bl_idx)++;
-  if(tree->next == NULL) {
-    // leaf
-
-    node_id_to_branch_id[tree->node_index] = *n;
-    node_id_to_branch_id[tree->back->node_index] = *n;
-    (*n)++;
-    iv[*iv_idx] = atoi(tree->label);
-    (*iv_idx)++;
-  } else {
-    // inner node
-
-    // assign inner nodes to an array
-    std::vector<pll_unode_t*> inner_nodes;
-    pll_unode_t * temp_node = tree->next;
-    while(temp_node->node_index != tree->node_index) {
-      inner_nodes.push_back(temp_node);
-      assert(temp_node->next != NULL);
-      temp_node = temp_node->next;
-    }
-    assert(temp_node->node_index == tree->node_index);
-
-    // sort the internal nodes
-    std::sort (inner_nodes.begin(), inner_nodes.end(), innerNodeCompare);
-
-    node_id_to_branch_id[tree->node_index] = *n;
-    node_id_to_branch_id[tree->back->node_index] = *n;
-    (*n)++;
-
-    for (size_t i = 0; i < inner_nodes.size(); i++) {
-      bp[*bp_idx] = 0;
-      (*bp_idx)++;
-      assignBranchNumbersRec(inner_nodes[i]->back, bp_idx, bp, iv_idx, iv, bl_idx, branch_lengths, n, node_id_to_branch_id);
-      bp[*bp_idx] = 1;
-      (*bp_idx)++;
-    }
-  }
-}
-
-void assignBranchNumbers(pll_unode_t * tree, sdsl::bit_vector &bp, sdsl::int_vector<> &iv,
-                std::vector<double> &branch_lengths, unsigned int* node_id_to_branch_id) {
-  assert(tree->next == NULL);
-  assert(atoi(tree->label) == 1);
-  bp[0] = 0;
-  bp[1] = 0;
-  bp[2] = 1;
-  iv[0] = 1; // first node is always the root
-  unsigned int n = 2;
-  bp[3] = 0;
-  unsigned int bp_idx = 4;
-  unsigned int iv_idx = 1;
-  unsigned int bl_idx = 1;
-  assignBranchNumbersRec(tree->back, &bp_idx, bp, &iv_idx, iv, &bl_idx, branch_lengths, &n, node_id_to_branch_id);
-  bp[bp_idx] = 1;
-  bp_idx++;
-  bp[bp_idx] = 1;
-  bp_idx++;
-  assert(bp_idx == bp.size());
-  assert(iv_idx == iv.size());
-  assert(bl_idx == branch_lengths.size());
-}
-
 /*
  * Searches the internal predecessor p of a node and returns a pointer to it.
  * The node p fulfills p->next = node.
@@ -12,6 +12,23 @@
  */
 std::string toNewick(pll_unode_t * tree);
 
+/**
+ * Appends the given tree in newick format (like toNewick, but with the branch
+ * lengths at the precision of the archive) to a string, without building a
+ * string per subtree.
+ * @param tree   tree
+ * @param newick the newick string is appended to it
+ */
+void appendNewick(pll_unode_t * tree, std::string &newick);
+
+/**
+ * Appends ":" and a branch length the way appendNewick prints it: with the
+ * PRECISION decimals it is stored with in an archive, without trailing zeros.
+ * @param newick the newick string is appended to it
+ * @param length the branch length
+ */
+void appendBranchLength(std::string &newick, double length);
+
 /**
  * Prints out a given pll_unode_t on the console.
  * @param node the node
@@ -56,20 +73,6 @@ void setTree(pll_unode_t * tree);
  */
  void orderTree(pll_unode_t * tree);
 
-/**
- * Traverses the given tree in depth-first order.
- * setTree had to be called on the tree before.
- *
- * Fills an array that maps node_id's to branch numbers (according to later
- * position in the succinct balanced parantheses representation)
- * @param tree                 root of the tree
- * @param bp                   vector to store succinct representation (balaced parantheses, ( = 0, ) = 1)
- * @param iv                   vector to store labels of leafs in depth-first order
- * @param branch_lengths       vector to store all branch_lengths in dfs
- * @param node_id_to_branch_id mapping of node_id to branch_id
- */
-void assignBranchNumbers(pll_unode_t * tree, sdsl::bit_vector &bp, sdsl::int_vector<> &iv, std::vector<double> &branch_lengths, unsigned int* node_id_to_branch_id);
-
 /**
  * Contracts the edge between node and node->back.
  * @param node node with incident edge